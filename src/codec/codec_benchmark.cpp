@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for the frame codecs and image encoders, against memcpy.
+// Bytes/s count raw frame bytes, and the "ratio" counter is how many times
+// smaller the encoded frame is.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "codec/image_encoder.h"
+#include "codec/tile_codec.h"
+
+namespace {
+
+// A frame with the things game frames have: a sky gradient, flat terrain,
+// tiled sprites and a noisy, detailed HUD strip.
+std::vector<uint8_t> make_game_frame(int32_t width, int32_t height) {
+  std::vector<uint8_t> pixels((size_t)width * height * 4);
+  srand(1);
+  for (int32_t y = 0; y < height; y++) {
+    for (int32_t x = 0; x < width; x++) {
+      uint8_t* px = &pixels[((size_t)y * width + x) * 4];
+      px[3] = 255;
+      if (y > height * 9 / 10) {
+        px[0] = rand() % 64, px[1] = rand() % 64, px[2] = rand() % 64;
+      } else if (y < height / 3) {
+        px[0] = 40, px[1] = 80 + y * 100 / height, px[2] = 200 - y / 16;
+      } else if ((x / 64 + y / 64) % 7 == 0) {
+        px[0] = (x * 7) % 256, px[1] = (y * 5) % 256, px[2] = 90;
+      } else {
+        px[0] = 60, px[1] = 120, px[2] = 30;
+      }
+    }
+  }
+  return pixels;
+}
+
+void add_codec_args(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "height", "threads"});
+  for (int threads : {1, 4, 8}) {
+    b->Args({1920, 1080, threads});
+    b->Args({3840, 2160, threads});
+  }
+}
+
+void BM_Memcpy(benchmark::State& state) {
+  std::vector<uint8_t> pixels = make_game_frame(state.range(0), state.range(1));
+  std::vector<uint8_t> dst(pixels.size());
+  for (auto _ : state) {
+    memcpy(dst.data(), pixels.data(), pixels.size());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+}
+BENCHMARK(BM_Memcpy)
+    ->ArgNames({"width", "height"})
+    ->Args({1920, 1080})
+    ->Args({3840, 2160});
+
+void BM_TileEncode(benchmark::State& state) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  TileCodec codec(state.range(2));
+  std::vector<uint8_t> pixels = make_game_frame(width, height);
+  std::vector<uint8_t> encoded(TileCodec::max_encoded_size(width, height));
+  size_t size = 0;
+  for (auto _ : state) {
+    size = codec.encode(pixels.data(), width, height, encoded.data(),
+                        encoded.size());
+    benchmark::DoNotOptimize(size);
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  state.counters["ratio"] = (double)pixels.size() / size;
+}
+BENCHMARK(BM_TileEncode)->Apply(add_codec_args)->UseRealTime();
+
+void BM_TileDecode(benchmark::State& state) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  TileCodec codec(state.range(2));
+  std::vector<uint8_t> pixels = make_game_frame(width, height);
+  std::vector<uint8_t> encoded(TileCodec::max_encoded_size(width, height));
+  size_t size = codec.encode(pixels.data(), width, height, encoded.data(),
+                             encoded.size());
+  std::vector<uint8_t> decoded(pixels.size());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        codec.decode(encoded.data(), size, decoded.data(), decoded.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  state.counters["ratio"] = (double)pixels.size() / size;
+}
+BENCHMARK(BM_TileDecode)->Apply(add_codec_args)->UseRealTime();
+
+// Encodes whole image files, as snapshot_vfb saves them. The format is the
+// last argument.
+void BM_ImageEncode(benchmark::State& state) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  const ImageFormat format = (ImageFormat)state.range(3);
+  ImageEncoder encoder(state.range(2));
+  std::vector<uint8_t> pixels = make_game_frame(width, height);
+  std::vector<uint8_t> file;
+  for (auto _ : state) {
+    encoder.encode(format, pixels.data(), width, height, &file);
+    benchmark::DoNotOptimize(file.data());
+  }
+  state.SetLabel(image_format_name(format));
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  state.counters["ratio"] = (double)pixels.size() / file.size();
+}
+BENCHMARK(BM_ImageEncode)
+    ->ArgNames({"width", "height", "threads", "format"})
+    ->ArgsProduct({{3840}, {2160}, {1, 4, 8},
+                   {(int)ImageFormat::QOI, (int)ImageFormat::PNG}})
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image_encoder.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "logger.h"
+#include "qoi.h"
+#include "trace/trace.h"
+#include "worker_pool.h"
+
+namespace {
+
+// Bands are about this many bytes of pixels, which is enough for deflate to
+// find its matches, and makes a few bands per thread on small frames.
+const size_t kBandBytes = 128 << 10;
+// How much of the previous band primes each band's deflate stream.
+const size_t kDeflateWindow = 32 << 10;
+const int kBytesPerPixel = 4;
+
+int32_t rows_per_band(int32_t width) {
+  size_t row_bytes = (size_t)width * kBytesPerPixel;
+  return std::max<size_t>(1, (kBandBytes + row_bytes - 1) / row_bytes);
+}
+
+void put_be32(uint8_t* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+void append_be32(std::vector<uint8_t>* out, uint32_t value) {
+  uint8_t bytes[4];
+  put_be32(bytes, value);
+  out->insert(out->end(), bytes, bytes + 4);
+}
+
+inline uint32_t as_word(QoiPixel px) {
+  uint32_t word;
+  memcpy(&word, &px, 4);
+  return word;
+}
+
+// Filters work on 8 bytes at a time, widened to 16 bits, with GCC vector
+// extensions, which lower to SSE on x86 and NEON on ARM. Every filter
+// predicts from the unfiltered rows, so bytes filter independently.
+typedef uint8_t Byte8 __attribute__((vector_size(8)));
+typedef int16_t Short8 __attribute__((vector_size(16)));
+typedef int32_t Int8 __attribute__((vector_size(32)));
+constexpr size_t kLanes = 8;
+
+inline Short8 load8(const uint8_t* p) {
+  Byte8 v;
+  memcpy(&v, p, sizeof(v));
+  return __builtin_convertvector(v, Short8);
+}
+
+inline void store8(uint8_t* p, Short8 v) {
+  Byte8 bytes = __builtin_convertvector(v, Byte8);
+  memcpy(p, &bytes, sizeof(bytes));
+}
+
+// Works on ints and Short8s alike.
+template <typename T>
+inline T absolute(T x) {
+  return x < 0 ? -x : x;
+}
+
+// PNG filter 'kType''s prediction of a byte from the bytes to its left, above
+// it, and above and to its left.
+template <int kType, typename T>
+inline T predict(T left, T up, T up_left) {
+  if (kType == 1) {
+    return left;
+  } else if (kType == 2) {
+    return up;
+  } else if (kType == 3) {
+    return (left + up) >> 1;
+  } else if (kType == 4) {
+    // Paeth, without branches.
+    T pa = absolute(up - up_left);
+    T pb = absolute(left - up_left);
+    T pc = absolute(left + up - 2 * up_left);
+    T up_or_up_left = pb <= pc ? up : up_left;
+    return (pa <= pb) & (pa <= pc) ? left : up_or_up_left;
+  }
+  return T();
+}
+
+// Applies PNG filter 'kType' to 'row', whose previous row is 'prior', writing
+// 'size' bytes to 'out'. Returns the sum of the filtered bytes as signed
+// values, which libpng uses to guess which filter compresses best.
+template <int kType>
+uint32_t apply_filter(const uint8_t* __restrict row,
+                      const uint8_t* __restrict prior, size_t size,
+                      uint8_t* __restrict out) {
+  const size_t bpp = kBytesPerPixel;
+  uint32_t sum = 0;
+  auto filter_byte = [&](size_t i) {
+    // The first pixel has no left neighbours, which count as zeros.
+    int left = i >= bpp ? row[i - bpp] : 0;
+    int up_left = i >= bpp ? prior[i - bpp] : 0;
+    out[i] = row[i] - predict<kType>(left, (int)prior[i], up_left);
+    sum += absolute((int)(int8_t)out[i]);
+  };
+  for (size_t i = 0; i < bpp; i++) {
+    filter_byte(i);
+  }
+  Int8 sums = {};
+  size_t i = bpp;
+  for (; i + kLanes <= size; i += kLanes) {
+    Short8 filtered =
+        load8(row + i) -
+        predict<kType>(load8(row + i - bpp), load8(prior + i),
+                       load8(prior + i - bpp));
+    store8(out + i, filtered);
+    // Wrap to the signed byte that's stored.
+    Short8 wrapped = ((filtered + 128) & 255) - 128;
+    sums += __builtin_convertvector(absolute(wrapped), Int8);
+  }
+  for (; i < size; i++) {
+    filter_byte(i);
+  }
+  for (size_t lane = 0; lane < kLanes; lane++) {
+    sum += sums[lane];
+  }
+  return sum;
+}
+
+// Writes row 'y' of 'pixels' to 'out' as a filter type byte and the row
+// filtered with whichever filter has the smallest sum. 'trial' holds a row.
+void filter_row(const uint8_t* pixels, int32_t y, size_t row_bytes,
+                const uint8_t* zero_row, uint8_t* trial, uint8_t* out) {
+  using Filter = uint32_t (*)(const uint8_t*, const uint8_t*, size_t,
+                              uint8_t*);
+  static const Filter kFilters[] = {apply_filter<0>, apply_filter<1>,
+                                    apply_filter<2>, apply_filter<3>,
+                                    apply_filter<4>};
+  const uint8_t* row = pixels + y * row_bytes;
+  const uint8_t* prior = y > 0 ? row - row_bytes : zero_row;
+  uint32_t best_sum = kFilters[0](row, prior, row_bytes, out + 1);
+  out[0] = 0;
+  for (int type = 1; type <= 4; type++) {
+    uint32_t sum = kFilters[type](row, prior, row_bytes, trial);
+    if (sum < best_sum) {
+      best_sum = sum;
+      out[0] = type;
+      memcpy(out + 1, trial, row_bytes);
+    }
+  }
+}
+
+void append_chunk(std::vector<uint8_t>* out, const char* type,
+                  const uint8_t* data, uint32_t size) {
+  append_be32(out, size);
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data, data + size);
+  uint32_t crc = crc32(0, (const uint8_t*)type, 4);
+  // crc32() restarts when given no data, rather than passing 'crc' through.
+  if (size > 0) {
+    crc = crc32(crc, data, size);
+  }
+  append_be32(out, crc);
+}
+
+}  // namespace
+
+const char* image_format_name(ImageFormat format) {
+  switch (format) {
+    case ImageFormat::RAW:
+      return "raw";
+    case ImageFormat::QOI:
+      return "qoi";
+    case ImageFormat::PNG:
+      return "png";
+  }
+  return "unknown";
+}
+
+bool parse_image_format(const std::string& name, ImageFormat* format) {
+  for (ImageFormat f : {ImageFormat::RAW, ImageFormat::QOI, ImageFormat::PNG}) {
+    if (name == image_format_name(f)) {
+      *format = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+ImageEncoder::ImageEncoder(int num_threads, int png_level)
+    : png_level_(std::clamp(png_level, 0, 9)) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  pool_ = std::make_unique<WorkerPool>(num_threads, "vkvfb_image_encoder");
+}
+
+ImageEncoder::~ImageEncoder() = default;
+ImageEncoder::ImageEncoder(ImageEncoder&& other) noexcept = default;
+ImageEncoder& ImageEncoder::operator=(ImageEncoder&& other) noexcept = default;
+
+uint8_t* ImageEncoder::scratch(size_t size) {
+  if (scratch_size_ < size) {
+    // Not value-initialized, so only the pages encoding touches are faulted
+    // in.
+    scratch_.reset(new uint8_t[size]);
+    scratch_size_ = size;
+  }
+  return scratch_.get();
+}
+
+bool ImageEncoder::encode(ImageFormat format, const uint8_t* pixels,
+                          int32_t width, int32_t height,
+                          std::vector<uint8_t>* out) {
+  if (width <= 0 || height <= 0) {
+    return false;
+  }
+  switch (format) {
+    case ImageFormat::RAW:
+      out->assign(pixels, pixels + (size_t)width * height * kBytesPerPixel);
+      return true;
+    case ImageFormat::QOI:
+      encode_qoi(pixels, width, height, out);
+      return true;
+    case ImageFormat::PNG:
+      return encode_png(pixels, width, height, out);
+  }
+  return false;
+}
+
+void ImageEncoder::encode_qoi(const uint8_t* pixels, int32_t width,
+                              int32_t height, std::vector<uint8_t>* out) {
+  TRACE_SCOPE("qoi_encode");
+  const int32_t rows = rows_per_band(width);
+  const size_t bands = (height + rows - 1) / rows;
+  const size_t band_pixels = (size_t)rows * width;
+  const size_t total_pixels = (size_t)height * width;
+  auto band_start = [&](size_t i) { return pixels + i * band_pixels * 4; };
+  auto band_count = [&](size_t i) {
+    return std::min(band_pixels, total_pixels - i * band_pixels);
+  };
+
+  // First, find what each band leaves in the index: the last pixel with each
+  // hash that differs from the pixel before it.
+  std::vector<QoiState> states(bands);
+  std::vector<uint64_t> seen(bands);
+  std::function<void(size_t)> scan = [&](size_t i) {
+    const uint8_t* begin = band_start(i);
+    QoiPixel prev = QoiState().prev;
+    if (i > 0) {
+      memcpy(&prev, begin - 4, 4);
+    }
+    QoiState& state = states[i];
+    uint64_t mask = 0;
+    for (size_t p = 0; p < band_count(i); p++) {
+      QoiPixel px;
+      memcpy(&px, begin + p * 4, 4);
+      if (as_word(px) != as_word(prev)) {
+        int hash = qoi_hash(px);
+        state.index[hash] = px;
+        mask |= 1ull << hash;
+        prev = px;
+      }
+    }
+    seen[i] = mask;
+  };
+  pool_->run(bands, scan);
+
+  // Each band starts from the index the bands before it leave behind.
+  QoiState running;
+  for (size_t i = 0; i < bands; i++) {
+    QoiState left_behind = states[i];
+    states[i] = running;
+    if (i > 0) {
+      memcpy(&states[i].prev, band_start(i) - 4, 4);
+    }
+    for (int hash = 0; hash < 64; hash++) {
+      if (seen[i] & (1ull << hash)) {
+        running.index[hash] = left_behind.index[hash];
+      }
+    }
+  }
+
+  const size_t slot_size = band_pixels * kQoiMaxBytesPerPixel;
+  uint8_t* slots = scratch(bands * slot_size);
+  std::vector<size_t> sizes(bands);
+  std::function<void(size_t)> encode_band = [&](size_t i) {
+    sizes[i] = qoi_encode_pixels(band_start(i), band_count(i), &states[i],
+                                 slots + i * slot_size);
+  };
+  pool_->run(bands, encode_band);
+
+  // The header is the magic, the size, 4 channels, and the sRGB colorspace,
+  // and the file ends with 7 zeros and a one.
+  out->clear();
+  out->insert(out->end(), {'q', 'o', 'i', 'f'});
+  append_be32(out, width);
+  append_be32(out, height);
+  out->insert(out->end(), {4, 0});
+  for (size_t i = 0; i < bands; i++) {
+    out->insert(out->end(), slots + i * slot_size,
+                slots + i * slot_size + sizes[i]);
+  }
+  out->insert(out->end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+bool ImageEncoder::encode_png(const uint8_t* pixels, int32_t width,
+                              int32_t height, std::vector<uint8_t>* out) {
+  TRACE_SCOPE("png_encode");
+  const int32_t rows = rows_per_band(width);
+  const size_t bands = (height + rows - 1) / rows;
+  const size_t row_bytes = (size_t)width * kBytesPerPixel;
+  const size_t filtered_row_bytes = row_bytes + 1;
+  const size_t filtered_size = filtered_row_bytes * height;
+  auto band_offset = [&](size_t i) { return i * rows * filtered_row_bytes; };
+  auto band_size = [&](size_t i) {
+    return std::min(band_offset(i + 1), filtered_size) - band_offset(i);
+  };
+  // A bound on deflate's output for a band, with room for the sync flush.
+  const size_t slot_size = band_size(0) + band_size(0) / 8 + 64;
+
+  uint8_t* filtered = scratch(filtered_size + bands * slot_size);
+  uint8_t* slots = filtered + filtered_size;
+  std::vector<uint8_t> zero_row(row_bytes);
+
+  std::function<void(size_t)> filter_band = [&](size_t i) {
+    std::vector<uint8_t> trial(row_bytes);
+    int32_t end = std::min<int32_t>(height, (i + 1) * rows);
+    for (int32_t y = i * rows; y < end; y++) {
+      filter_row(pixels, y, row_bytes, zero_row.data(), trial.data(),
+                 filtered + y * filtered_row_bytes);
+    }
+  };
+  pool_->run(bands, filter_band);
+
+  // Every band but the last ends with a sync flush, which ends it on a byte
+  // boundary, so the raw deflate streams concatenate into one.
+  std::vector<size_t> sizes(bands);
+  std::vector<uint32_t> adlers(bands);
+  std::vector<uint32_t> crcs(bands);
+  std::atomic<bool> ok{true};
+  std::function<void(size_t)> deflate_band = [&](size_t i) {
+    z_stream stream = {};
+    int strategy = png_level_ == 1 ? Z_RLE : Z_DEFAULT_STRATEGY;
+    if (deflateInit2(&stream, png_level_, Z_DEFLATED, -MAX_WBITS, 8,
+                     strategy) != Z_OK) {
+      ok.store(false, std::memory_order_relaxed);
+      return;
+    }
+    const uint8_t* begin = filtered + band_offset(i);
+    if (i > 0) {
+      size_t window = std::min(kDeflateWindow, band_offset(i));
+      deflateSetDictionary(&stream, begin - window, window);
+    }
+    stream.next_in = (uint8_t*)begin;
+    stream.avail_in = band_size(i);
+    stream.next_out = slots + i * slot_size;
+    stream.avail_out = slot_size;
+    bool last = i == bands - 1;
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (last ? result != Z_STREAM_END
+             : result != Z_OK || stream.avail_in > 0 ||
+                   stream.avail_out == 0) {
+      ok.store(false, std::memory_order_relaxed);
+    }
+    sizes[i] = slot_size - stream.avail_out;
+    deflateEnd(&stream);
+    adlers[i] = adler32(adler32(0, nullptr, 0), begin, band_size(i));
+    crcs[i] = crc32(0, slots + i * slot_size, sizes[i]);
+  };
+  pool_->run(bands, deflate_band);
+  if (!ok.load()) {
+    ERROR("Failed to deflate a %dx%d frame", width, height);
+    return false;
+  }
+
+  size_t idat_size = 2 + 4;
+  for (size_t size : sizes) {
+    idat_size += size;
+  }
+  if (idat_size > INT32_MAX) {
+    ERROR("A %dx%d frame is too big for a PNG", width, height);
+    return false;
+  }
+
+  out->clear();
+  out->reserve(idat_size + 64);
+  out->insert(out->end(), {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'});
+  // 8 bits a channel, RGBA, deflate, adaptive filters, not interlaced.
+  uint8_t ihdr[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, 6, 0, 0, 0};
+  put_be32(ihdr, width);
+  put_be32(ihdr + 4, height);
+  append_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+  // One IDAT holds the zlib stream: a header for a 32 KiB window, the bands,
+  // and the Adler-32 of everything they deflated.
+  append_be32(out, idat_size);
+  const uint8_t idat_start[] = {'I', 'D', 'A', 'T', 0x78, 0x01};
+  out->insert(out->end(), idat_start, idat_start + sizeof(idat_start));
+  uint32_t crc = crc32(0, idat_start, sizeof(idat_start));
+  uint32_t adler = adler32(0, nullptr, 0);
+  for (size_t i = 0; i < bands; i++) {
+    out->insert(out->end(), slots + i * slot_size,
+                slots + i * slot_size + sizes[i]);
+    crc = crc32_combine(crc, crcs[i], sizes[i]);
+    adler = adler32_combine(adler, adlers[i], band_size(i));
+  }
+  uint8_t adler_bytes[4];
+  put_be32(adler_bytes, adler);
+  out->insert(out->end(), adler_bytes, adler_bytes + 4);
+  append_be32(out, crc32(crc, adler_bytes, 4));
+
+  append_chunk(out, "IEND", nullptr, 0);
+  return true;
+}
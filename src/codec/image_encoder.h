@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_IMAGE_ENCODER_H_
+#define CODEC_IMAGE_ENCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class WorkerPool;
+
+// Image file formats a frame can be saved as.
+enum class ImageFormat {
+  // Tightly packed RGBA rows, with no header.
+  RAW,
+  // A standard .qoi file.
+  QOI,
+  // A standard RGBA .png file.
+  PNG,
+};
+
+// Returns "raw", "qoi" or "png", which is also the format's file extension.
+const char* image_format_name(ImageFormat format);
+
+// Parses a name image_format_name() returns. Returns false if 'name' isn't a
+// format.
+bool parse_image_format(const std::string& name, ImageFormat* format);
+
+// Encodes frames as image files on a pool of threads. The frame is cut into
+// bands of rows that are encoded in parallel and then joined into one file
+// that any decoder reads:
+//  - QOI bands pick up the encoder state the previous band leaves behind,
+//    which a quick parallel pass over the frame works out ahead of time, so
+//    the file is the one a sequential encoder would write, give or take
+//    where runs are split.
+//  - PNG bands are filtered and deflated in parallel, with each band's
+//    deflate stream primed with the end of the previous band, the way pigz
+//    splits gzip streams.
+// An ImageEncoder isn't thread-safe.
+class ImageEncoder {
+ public:
+  // 'num_threads' is the number of threads encoding, including the calling
+  // thread, and defaults to one per core. 'png_level' is zlib's compression
+  // level, from 0 to 9. Level 1, the default, uses zlib's run-length
+  // strategy, which on filtered frames is faster than zlib's own level 1 and
+  // compresses as well.
+  explicit ImageEncoder(int num_threads = 0, int png_level = 1);
+  ~ImageEncoder();
+
+  ImageEncoder(ImageEncoder&& other) noexcept;
+  ImageEncoder& operator=(ImageEncoder&& other) noexcept;
+
+  // Encodes a frame of tightly packed RGBA rows as a complete file in
+  // 'format', replacing the contents of 'out'. Returns false if the frame is
+  // empty or zlib fails.
+  bool encode(ImageFormat format, const uint8_t* pixels, int32_t width,
+              int32_t height, std::vector<uint8_t>* out);
+
+ private:
+  void encode_qoi(const uint8_t* pixels, int32_t width, int32_t height,
+                  std::vector<uint8_t>* out);
+  bool encode_png(const uint8_t* pixels, int32_t width, int32_t height,
+                  std::vector<uint8_t>* out);
+  // Returns at least 'size' bytes of scratch space, kept between frames so
+  // bursts don't fault it in again for every frame.
+  uint8_t* scratch(size_t size);
+
+  std::unique_ptr<WorkerPool> pool_;
+  int png_level_;
+  std::unique_ptr<uint8_t[]> scratch_;
+  size_t scratch_size_ = 0;
+};
+
+#endif  // CODEC_IMAGE_ENCODER_H_
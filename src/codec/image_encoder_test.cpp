@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image_encoder.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "qoi.h"
+#include "test_frames.h"
+
+namespace {
+
+uint32_t be32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Decodes a .qoi file the way a sequential decoder does, in one piece.
+std::vector<uint8_t> decode_qoi(const std::vector<uint8_t>& file) {
+  EXPECT_GE(file.size(), 22u);
+  EXPECT_EQ(memcmp(file.data(), "qoif", 4), 0);
+  uint32_t width = be32(&file[4]);
+  uint32_t height = be32(&file[8]);
+  EXPECT_EQ(file[12], 4);
+  const uint8_t end_marker[] = {0, 0, 0, 0, 0, 0, 0, 1};
+  EXPECT_EQ(memcmp(&file[file.size() - 8], end_marker, 8), 0);
+  std::vector<uint8_t> pixels((size_t)width * height * 4);
+  EXPECT_TRUE(qoi_decode_pixels(&file[14], file.size() - 22, pixels.data(),
+                                (size_t)width * height));
+  return pixels;
+}
+
+// Checks every chunk's CRC, inflates the IDATs with zlib, and undoes the
+// filters.
+std::vector<uint8_t> decode_png(const std::vector<uint8_t>& file,
+                                int32_t* width, int32_t* height) {
+  const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  EXPECT_EQ(memcmp(file.data(), signature, 8), 0);
+  std::vector<uint8_t> idat;
+  bool ended = false;
+  for (size_t pos = 8; pos + 12 <= file.size();) {
+    uint32_t size = be32(&file[pos]);
+    const uint8_t* type = &file[pos + 4];
+    const uint8_t* data = type + 4;
+    EXPECT_EQ(crc32(0, type, size + 4), be32(data + size));
+    if (memcmp(type, "IHDR", 4) == 0) {
+      *width = be32(data);
+      *height = be32(data + 4);
+      EXPECT_EQ(data[8], 8);
+      EXPECT_EQ(data[9], 6);
+    } else if (memcmp(type, "IDAT", 4) == 0) {
+      idat.insert(idat.end(), data, data + size);
+    } else if (memcmp(type, "IEND", 4) == 0) {
+      ended = pos + 12 == file.size();
+    }
+    pos += size + 12;
+  }
+  EXPECT_TRUE(ended);
+
+  const size_t row_bytes = (size_t)*width * 4;
+  std::vector<uint8_t> filtered((row_bytes + 1) * *height);
+  uLongf filtered_size = filtered.size();
+  EXPECT_EQ(uncompress(filtered.data(), &filtered_size, idat.data(),
+                       idat.size()),
+            Z_OK);
+  EXPECT_EQ(filtered_size, filtered.size());
+
+  std::vector<uint8_t> pixels(row_bytes * *height);
+  std::vector<uint8_t> zero_row(row_bytes);
+  for (int32_t y = 0; y < *height; y++) {
+    const uint8_t* in = &filtered[y * (row_bytes + 1)];
+    uint8_t* row = &pixels[y * row_bytes];
+    const uint8_t* prior = y > 0 ? row - row_bytes : zero_row.data();
+    for (size_t i = 0; i < row_bytes; i++) {
+      int a = i >= 4 ? row[i - 4] : 0;
+      int b = prior[i];
+      int c = i >= 4 ? prior[i - 4] : 0;
+      int p = a + b - c;
+      int paeth = abs(p - a) <= abs(p - b) && abs(p - a) <= abs(p - c) ? a
+                  : abs(p - b) <= abs(p - c)                          ? b
+                                                                      : c;
+      int predicted[] = {0, a, b, (a + b) / 2, paeth};
+      EXPECT_LE(in[0], 4);
+      row[i] = in[1 + i] + predicted[in[0] % 5];
+    }
+  }
+  return pixels;
+}
+
+}  // namespace
+
+TEST(ImageEncoder, QoiFilesDecodeSequentially) {
+  ImageEncoder encoder(3);
+  // Narrow frames make many bands, so runs and the index carry across band
+  // boundaries.
+  for (auto [width, height] : {std::pair{97, 1200}, std::pair{1, 1},
+                               std::pair{640, 480}}) {
+    std::vector<uint8_t> pixels = make_frame(width, height);
+    std::vector<uint8_t> file;
+    ASSERT_TRUE(encoder.encode(ImageFormat::QOI, pixels.data(), width, height,
+                               &file));
+    EXPECT_EQ(be32(&file[4]), (uint32_t)width);
+    EXPECT_EQ(be32(&file[8]), (uint32_t)height);
+    EXPECT_EQ(decode_qoi(file), pixels);
+  }
+}
+
+TEST(ImageEncoder, PngFilesDecodeWithZlib) {
+  ImageEncoder encoder(3);
+  for (int level : {0, 1, 9}) {
+    encoder = ImageEncoder(3, level);
+    for (auto [width, height] : {std::pair{97, 1200}, std::pair{1, 1},
+                                 std::pair{640, 480}}) {
+      std::vector<uint8_t> pixels = make_frame(width, height);
+      std::vector<uint8_t> file;
+      ASSERT_TRUE(encoder.encode(ImageFormat::PNG, pixels.data(), width,
+                                 height, &file));
+      int32_t decoded_width = 0;
+      int32_t decoded_height = 0;
+      EXPECT_EQ(decode_png(file, &decoded_width, &decoded_height), pixels);
+      EXPECT_EQ(decoded_width, width);
+      EXPECT_EQ(decoded_height, height);
+    }
+  }
+}
+
+TEST(ImageEncoder, CompressesFlatFrames) {
+  ImageEncoder encoder(2);
+  std::vector<uint8_t> pixels(1920 * 1080 * 4, 7);
+  for (ImageFormat format : {ImageFormat::QOI, ImageFormat::PNG}) {
+    std::vector<uint8_t> file;
+    ASSERT_TRUE(encoder.encode(format, pixels.data(), 1920, 1080, &file));
+    EXPECT_LT(file.size() * 100, pixels.size()) << image_format_name(format);
+  }
+  std::vector<uint8_t> raw;
+  ASSERT_TRUE(encoder.encode(ImageFormat::RAW, pixels.data(), 1920, 1080,
+                             &raw));
+  EXPECT_EQ(raw, pixels);
+  EXPECT_FALSE(encoder.encode(ImageFormat::PNG, pixels.data(), 0, 1080, &raw));
+}
+
+TEST(ImageEncoder, FormatsParseByName) {
+  ImageFormat format = ImageFormat::RAW;
+  EXPECT_TRUE(parse_image_format("png", &format));
+  EXPECT_EQ(format, ImageFormat::PNG);
+  EXPECT_TRUE(parse_image_format(image_format_name(ImageFormat::QOI),
+                                 &format));
+  EXPECT_EQ(format, ImageFormat::QOI);
+  EXPECT_FALSE(parse_image_format("jpg", &format));
+}
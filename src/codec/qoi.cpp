@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "qoi.h"
+
+#include <cstring>
+
+namespace {
+
+const uint8_t kOpIndex = 0x00;
+const uint8_t kOpDiff = 0x40;
+const uint8_t kOpLuma = 0x80;
+const uint8_t kOpRun = 0xc0;
+const uint8_t kOpRgb = 0xfe;
+const uint8_t kOpRgba = 0xff;
+const uint8_t kOpMask = 0xc0;
+// Runs of 63 and 64 would collide with kOpRgb and kOpRgba.
+const int kMaxRun = 62;
+
+inline uint32_t as_word(QoiPixel px) {
+  uint32_t word;
+  memcpy(&word, &px, 4);
+  return word;
+}
+
+}  // namespace
+
+size_t qoi_encode_pixels(const uint8_t* pixels, size_t count, QoiState* state,
+                         uint8_t* out) {
+  QoiPixel* index = state->index;
+  QoiPixel prev = state->prev;
+  uint8_t* p = out;
+  int run = 0;
+  for (size_t i = 0; i < count; i++) {
+    QoiPixel px;
+    memcpy(&px, pixels + i * 4, 4);
+    if (as_word(px) == as_word(prev)) {
+      run++;
+      if (run == kMaxRun) {
+        *p++ = kOpRun | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      *p++ = kOpRun | (run - 1);
+      run = 0;
+    }
+
+    int hash = qoi_hash(px);
+    if (as_word(index[hash]) == as_word(px)) {
+      *p++ = kOpIndex | hash;
+    } else {
+      index[hash] = px;
+      if (px.a == prev.a) {
+        int8_t dr = px.r - prev.r;
+        int8_t dg = px.g - prev.g;
+        int8_t db = px.b - prev.b;
+        int8_t dr_dg = dr - dg;
+        int8_t db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          *p++ = kOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          *p++ = kOpLuma | (dg + 32);
+          *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+        } else {
+          *p++ = kOpRgb;
+          *p++ = px.r;
+          *p++ = px.g;
+          *p++ = px.b;
+        }
+      } else {
+        *p++ = kOpRgba;
+        memcpy(p, &px, 4);
+        p += 4;
+      }
+    }
+    prev = px;
+  }
+  if (run > 0) {
+    *p++ = kOpRun | (run - 1);
+  }
+  state->prev = prev;
+  return p - out;
+}
+
+bool qoi_decode_pixels(const uint8_t* in, size_t size, uint8_t* pixels,
+                       size_t count) {
+  QoiPixel index[64] = {};
+  QoiPixel px = {0, 0, 0, 255};
+  const uint8_t* end = in + size;
+  uint8_t* out = pixels;
+  uint8_t* out_end = pixels + count * 4;
+  while (out < out_end) {
+    if (in >= end) {
+      return false;
+    }
+    uint8_t op = *in++;
+    if (op == kOpRgb) {
+      if (end - in < 3) {
+        return false;
+      }
+      px.r = in[0];
+      px.g = in[1];
+      px.b = in[2];
+      in += 3;
+    } else if (op == kOpRgba) {
+      if (end - in < 4) {
+        return false;
+      }
+      memcpy(&px, in, 4);
+      in += 4;
+    } else if ((op & kOpMask) == kOpIndex) {
+      px = index[op];
+    } else if ((op & kOpMask) == kOpDiff) {
+      px.r += ((op >> 4) & 3) - 2;
+      px.g += ((op >> 2) & 3) - 2;
+      px.b += (op & 3) - 2;
+    } else if ((op & kOpMask) == kOpLuma) {
+      if (in >= end) {
+        return false;
+      }
+      uint8_t next = *in++;
+      int dg = (op & 0x3f) - 32;
+      px.r += dg - 8 + (next >> 4);
+      px.g += dg;
+      px.b += dg - 8 + (next & 0xf);
+    } else {
+      size_t run = (op & 0x3f) + 1;
+      if (run > (size_t)(out_end - out) / 4) {
+        return false;
+      }
+      for (size_t i = 0; i < run; i++) {
+        memcpy(out, &px, 4);
+        out += 4;
+      }
+      continue;
+    }
+    index[qoi_hash(px)] = px;
+    memcpy(out, &px, 4);
+    out += 4;
+  }
+  return in == end;
+}
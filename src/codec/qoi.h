@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_QOI_H_
+#define CODEC_QOI_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// The operations of QOI (https://qoiformat.org), without its file header and
+// end marker. A run of pixels can be encoded from any state, so callers can
+// cut an image into pieces and encode them independently.
+
+struct QoiPixel {
+  uint8_t r, g, b, a;
+};
+
+// What the encoder and decoder remember between pixels.
+struct QoiState {
+  // The most recent pixel with each hash that differed from the pixel before
+  // it.
+  QoiPixel index[64] = {};
+  QoiPixel prev = {0, 0, 0, 255};
+};
+
+// Every pixel takes at most an RGBA op and its 4 bytes.
+inline const size_t kQoiMaxBytesPerPixel = 5;
+
+inline int qoi_hash(QoiPixel px) {
+  return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+// Encodes 'count' RGBA pixels to 'out', which holds at least
+// count * kQoiMaxBytesPerPixel bytes, starting from and updating 'state'.
+// Returns the encoded size. Runs end with the pixels, so encoding the next
+// pixels from the updated state continues the stream.
+size_t qoi_encode_pixels(const uint8_t* pixels, size_t count, QoiState* state,
+                         uint8_t* out);
+
+// Decodes exactly 'count' RGBA pixels from 'size' bytes, starting from QOI's
+// initial state. Returns false if the bytes are corrupt, or aren't exactly
+// 'count' pixels.
+bool qoi_decode_pixels(const uint8_t* in, size_t size, uint8_t* pixels,
+                       size_t count);
+
+#endif  // CODEC_QOI_H_
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_TEST_FRAMES_H_
+#define CODEC_TEST_FRAMES_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Returns a width x height RGBA frame with the things game frames have, for
+// codec tests: flat areas, gradients, a translucent region and some noise.
+// The noise is the same for every call.
+inline std::vector<uint8_t> make_frame(int32_t width, int32_t height) {
+  std::vector<uint8_t> pixels((size_t)width * height * 4);
+  srand(1);
+  for (int32_t y = 0; y < height; y++) {
+    for (int32_t x = 0; x < width; x++) {
+      uint8_t* px = &pixels[((size_t)y * width + x) * 4];
+      if (x < width / 4) {
+        px[0] = 20, px[1] = 40, px[2] = 60, px[3] = 255;
+      } else if (x < width / 2) {
+        px[0] = x, px[1] = y, px[2] = x + y, px[3] = 255;
+      } else if (y < height / 2) {
+        px[0] = rand(), px[1] = rand(), px[2] = rand(), px[3] = 255;
+      } else {
+        px[0] = 200, px[1] = 10, px[2] = x, px[3] = x * 3;
+      }
+    }
+  }
+  return pixels;
+}
+
+#endif  // CODEC_TEST_FRAMES_H_
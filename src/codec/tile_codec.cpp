@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tile_codec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "qoi.h"
+#include "trace/trace.h"
+#include "worker_pool.h"
+
+// Bands are encoded with the operations of QOI (see qoi.h), each starting
+// from QOI's initial state, so bands decode independently.
+
+namespace {
+
+uint32_t num_bands(int32_t height) {
+  return (height + TileCodec::kBandRows - 1) / TileCodec::kBandRows;
+}
+
+size_t band_table_size(uint32_t bands) {
+  return sizeof(TileStreamHeader) + bands * sizeof(uint32_t);
+}
+
+}  // namespace
+
+const char* codec_name(FrameCodec codec) {
+  switch (codec) {
+    case FrameCodec::RAW:
+      return "raw";
+    case FrameCodec::QOI_TILES:
+      return "qoi";
+  }
+  return "unknown";
+}
+
+bool parse_codec(const std::string& name, FrameCodec* codec) {
+  for (FrameCodec c : {FrameCodec::RAW, FrameCodec::QOI_TILES}) {
+    if (name == codec_name(c)) {
+      *codec = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+TileCodec::TileCodec(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  pool_ = std::make_unique<WorkerPool>(num_threads, "vkvfb_tile_codec");
+}
+
+TileCodec::~TileCodec() = default;
+TileCodec::TileCodec(TileCodec&& other) noexcept = default;
+TileCodec& TileCodec::operator=(TileCodec&& other) noexcept = default;
+
+size_t TileCodec::max_encoded_size(int32_t width, int32_t height) {
+  uint32_t bands = num_bands(height);
+  return band_table_size(bands) +
+         (size_t)bands * kBandRows * width * kQoiMaxBytesPerPixel;
+}
+
+size_t TileCodec::encode(const uint8_t* pixels, int32_t width, int32_t height,
+                         uint8_t* dst, size_t capacity) {
+  TRACE_SCOPE("tile_encode");
+  if (width <= 0 || height <= 0 ||
+      capacity < max_encoded_size(width, height)) {
+    return 0;
+  }
+  const uint32_t bands = num_bands(height);
+  // Frames shorter than a band are one band of their own height.
+  TileStreamHeader header = {TileStreamHeader::kMagic, width, height,
+                             std::min<uint32_t>(kBandRows, height), bands};
+  memcpy(dst, &header, sizeof(header));
+  uint32_t* sizes = (uint32_t*)(dst + sizeof(header));
+
+  // Each band is encoded into its own worst case sized slot, and the slots
+  // are then packed together.
+  uint8_t* slots = dst + band_table_size(bands);
+  const size_t band_pixels = (size_t)kBandRows * width;
+  const size_t slot_size = band_pixels * kQoiMaxBytesPerPixel;
+  std::function<void(size_t)> encode_one = [&](size_t i) {
+    size_t first_row = i * kBandRows;
+    size_t rows = std::min<size_t>(kBandRows, height - first_row);
+    QoiState state;
+    sizes[i] = qoi_encode_pixels(pixels + first_row * width * 4,
+                                 rows * width, &state, slots + i * slot_size);
+  };
+  pool_->run(bands, encode_one);
+
+  uint8_t* packed = slots;
+  for (uint32_t i = 0; i < bands; i++) {
+    memmove(packed, slots + i * slot_size, sizes[i]);
+    packed += sizes[i];
+  }
+  return packed - dst;
+}
+
+bool TileCodec::peek_size(const uint8_t* src, size_t size, int32_t* width,
+                          int32_t* height) {
+  TileStreamHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, src, sizeof(header));
+  if (header.magic != TileStreamHeader::kMagic || header.width <= 0 ||
+      header.height <= 0) {
+    return false;
+  }
+  *width = header.width;
+  *height = header.height;
+  return true;
+}
+
+bool TileCodec::decode(const uint8_t* src, size_t size, uint8_t* dst,
+                       size_t capacity) {
+  TRACE_SCOPE("tile_decode");
+  TileStreamHeader header;
+  if (!peek_size(src, size, &header.width, &header.height)) {
+    return false;
+  }
+  memcpy(&header, src, sizeof(header));
+  // Bands taller than the frame would also make the band count wrap.
+  if (header.band_rows == 0 || header.band_rows > (uint32_t)header.height ||
+      header.num_bands !=
+          (header.height + header.band_rows - 1) / header.band_rows ||
+      size < band_table_size(header.num_bands) ||
+      capacity < (size_t)header.width * header.height * 4) {
+    return false;
+  }
+
+  // Find where each band starts.
+  std::vector<size_t> offsets(header.num_bands + 1);
+  offsets[0] = band_table_size(header.num_bands);
+  for (uint32_t i = 0; i < header.num_bands; i++) {
+    uint32_t band_size;
+    memcpy(&band_size, src + sizeof(header) + i * sizeof(uint32_t),
+           sizeof(band_size));
+    offsets[i + 1] = offsets[i] + band_size;
+  }
+  if (offsets.back() != size) {
+    return false;
+  }
+
+  std::atomic<bool> ok{true};
+  std::function<void(size_t)> decode_one = [&](size_t i) {
+    size_t first_row = i * header.band_rows;
+    size_t rows = std::min<size_t>(header.band_rows, header.height - first_row);
+    if (!qoi_decode_pixels(src + offsets[i], offsets[i + 1] - offsets[i],
+                           dst + first_row * header.width * 4,
+                           rows * header.width)) {
+      ok.store(false, std::memory_order_relaxed);
+    }
+  };
+  pool_->run(header.num_bands, decode_one);
+  return ok.load();
+}
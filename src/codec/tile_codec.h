@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_TILE_CODEC_H_
+#define CODEC_TILE_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class WorkerPool;
+
+// How a stored or transported frame's pixels are encoded.
+enum class FrameCodec : uint32_t {
+  // Tightly packed RGBA rows.
+  RAW = 0,
+  // Lossless. The frame is cut into bands of rows, and each band is
+  // compressed independently with QOI's operations, so bands are encoded and
+  // decoded in parallel. See TileCodec.
+  QOI_TILES = 1,
+};
+
+// Returns "raw" or "qoi".
+const char* codec_name(FrameCodec codec);
+
+// Parses a name codec_name() returns. Returns false if 'name' isn't a codec.
+bool parse_codec(const std::string& name, FrameCodec* codec);
+
+// The header of a QOI_TILES frame. It's followed by each band's encoded size,
+// as num_bands uint32_ts, and then the bands themselves, in order.
+struct TileStreamHeader {
+  static const uint32_t kMagic = 0x76666271;
+
+  uint32_t magic;
+  int32_t width;
+  int32_t height;
+  // Every band but the last is 'band_rows' rows, and none is taller than the
+  // frame.
+  uint32_t band_rows;
+  uint32_t num_bands;
+};
+
+// Encodes and decodes QOI_TILES frames on a pool of threads. QOI compresses
+// flat areas and smooth gradients to a byte or two a pixel or less, which is
+// most of a game frame, at several hundred MB/s a core. A TileCodec isn't
+// thread-safe.
+class TileCodec {
+ public:
+  static const uint32_t kBandRows = 32;
+
+  // 'num_threads' is the number of threads coding, including the calling
+  // thread, and defaults to one per core.
+  explicit TileCodec(int num_threads = 0);
+  ~TileCodec();
+
+  TileCodec(TileCodec&& other) noexcept;
+  TileCodec& operator=(TileCodec&& other) noexcept;
+
+  // The most bytes a width x height frame can encode to.
+  static size_t max_encoded_size(int32_t width, int32_t height);
+
+  // Encodes a frame of tightly packed RGBA rows into 'dst', which must hold at
+  // least max_encoded_size() bytes. Returns the encoded size, or 0 if 'dst' is
+  // too small.
+  size_t encode(const uint8_t* pixels, int32_t width, int32_t height,
+                uint8_t* dst, size_t capacity);
+
+  // Reads an encoded frame's size. Returns false if 'src' isn't an encoded
+  // frame.
+  static bool peek_size(const uint8_t* src, size_t size, int32_t* width,
+                        int32_t* height);
+
+  // Decodes a frame into 'dst' as tightly packed RGBA rows. Returns false if
+  // the frame is corrupt or doesn't fit in 'capacity' bytes.
+  bool decode(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+ private:
+  std::unique_ptr<WorkerPool> pool_;
+};
+
+#endif  // CODEC_TILE_CODEC_H_
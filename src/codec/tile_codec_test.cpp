@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tile_codec.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "test_frames.h"
+
+namespace {
+
+std::vector<uint8_t> round_trip(TileCodec& codec,
+                                const std::vector<uint8_t>& pixels,
+                                int32_t width, int32_t height) {
+  std::vector<uint8_t> encoded(TileCodec::max_encoded_size(width, height));
+  size_t size = codec.encode(pixels.data(), width, height, encoded.data(),
+                             encoded.size());
+  EXPECT_GT(size, 0u);
+  int32_t decoded_width = 0;
+  int32_t decoded_height = 0;
+  EXPECT_TRUE(TileCodec::peek_size(encoded.data(), size, &decoded_width,
+                                   &decoded_height));
+  EXPECT_EQ(decoded_width, width);
+  EXPECT_EQ(decoded_height, height);
+  std::vector<uint8_t> decoded(pixels.size());
+  EXPECT_TRUE(
+      codec.decode(encoded.data(), size, decoded.data(), decoded.size()));
+  return decoded;
+}
+
+}  // namespace
+
+TEST(TileCodec, RoundTripsLosslessly) {
+  for (int threads : {1, 4}) {
+    TileCodec codec(threads);
+    // Heights that are and aren't whole bands, and single pixel rows.
+    for (auto [width, height] : {std::pair<int32_t, int32_t>{256, 128},
+                                 {97, 45},
+                                 {1, 70},
+                                 {300, 1}}) {
+      std::vector<uint8_t> pixels = make_frame(width, height);
+      EXPECT_EQ(round_trip(codec, pixels, width, height), pixels)
+          << width << "x" << height << " with " << threads << " threads";
+    }
+  }
+}
+
+TEST(TileCodec, CompressesFlatFrames) {
+  TileCodec codec;
+  const int32_t width = 1920;
+  const int32_t height = 1080;
+  std::vector<uint8_t> pixels((size_t)width * height * 4, 128);
+  std::vector<uint8_t> encoded(TileCodec::max_encoded_size(width, height));
+  size_t size = codec.encode(pixels.data(), width, height, encoded.data(),
+                             encoded.size());
+  EXPECT_GT(size, 0u);
+  EXPECT_LT(size * 100, pixels.size());
+}
+
+TEST(TileCodec, RejectsCorruptFrames) {
+  TileCodec codec(2);
+  const int32_t width = 64;
+  const int32_t height = 80;
+  std::vector<uint8_t> pixels = make_frame(width, height);
+  std::vector<uint8_t> encoded(TileCodec::max_encoded_size(width, height));
+  size_t size = codec.encode(pixels.data(), width, height, encoded.data(),
+                             encoded.size());
+  std::vector<uint8_t> decoded(pixels.size());
+
+  EXPECT_FALSE(
+      codec.decode(encoded.data(), size - 1, decoded.data(), decoded.size()));
+  EXPECT_FALSE(codec.decode(encoded.data(), size, decoded.data(),
+                            decoded.size() - 1));
+  // A band's size that doesn't match its contents.
+  std::vector<uint8_t> corrupt(encoded.begin(), encoded.begin() + size);
+  uint32_t* band_sizes = (uint32_t*)(corrupt.data() + sizeof(TileStreamHeader));
+  band_sizes[0]--;
+  band_sizes[1]++;
+  EXPECT_FALSE(
+      codec.decode(corrupt.data(), size, decoded.data(), decoded.size()));
+  // Bands taller than the frame, whose band count wraps around to none.
+  TileStreamHeader no_bands = {TileStreamHeader::kMagic, width, height,
+                               UINT32_MAX, 0};
+  EXPECT_FALSE(codec.decode((const uint8_t*)&no_bands, sizeof(no_bands),
+                            decoded.data(), decoded.size()));
+  EXPECT_EQ(codec.encode(pixels.data(), width, height, encoded.data(),
+                         encoded.size() - 1),
+            0u);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fd_server.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include "logger.h"
+#include "utility.h"
+
+namespace {
+
+// Fills in the address of the abstract socket 'name', returning its length,
+// or 0 if the name is too long.
+socklen_t abstract_address(const std::string& name, sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  // Abstract socket names start with a NUL byte.
+  if (name.size() + 1 > sizeof(addr->sun_path)) {
+    return 0;
+  }
+  memcpy(addr->sun_path + 1, name.data(), name.size());
+  return offsetof(sockaddr_un, sun_path) + 1 + name.size();
+}
+
+// Abstract sockets have no file permissions, so servers check who connected.
+bool peer_allowed(int fd) {
+  ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    return false;
+  }
+  return cred.uid == geteuid() || cred.uid == 0;
+}
+
+void close_all(const std::vector<int>& fds) {
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+}  // namespace
+
+StatusOr<std::unique_ptr<FdServer>> FdServer::Create(const std::string& name,
+                                                     std::vector<int> fds) {
+  sockaddr_un addr;
+  socklen_t addr_len = abstract_address(name, &addr);
+  int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fds.size() > kMaxFds || addr_len == 0 || listen_fd == -1) {
+    ERROR("Failed to create fd server %s", name.c_str());
+    if (listen_fd != -1) {
+      close(listen_fd);
+    }
+    close_all(fds);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  if (bind(listen_fd, (sockaddr*)&addr, addr_len) == -1 ||
+      listen(listen_fd, 16) == -1) {
+    ERROR("Failed to bind fd server %s: %s", name.c_str(),
+          errno_to_string(errno).c_str());
+    close(listen_fd);
+    close_all(fds);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  return std::unique_ptr<FdServer>(new FdServer(listen_fd, std::move(fds)));
+}
+
+FdServer::FdServer(int listen_fd, std::vector<int> fds)
+    : listen_fd_(listen_fd), fds_(std::move(fds)) {
+  thread_ = std::thread([this] { serve(); });
+}
+
+FdServer::~FdServer() {
+  // Shutting the socket down wakes the thread from accept().
+  shutdown(listen_fd_, SHUT_RDWR);
+  thread_.join();
+  close(listen_fd_);
+  close_all(fds_);
+}
+
+void FdServer::serve() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    if (!peer_allowed(fd)) {
+      close(fd);
+      continue;
+    }
+
+    char payload = 0;
+    iovec iov = {&payload, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(kMaxFds * sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fds_.size() * sizeof(int));
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fds_.size() * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds_.data(), fds_.size() * sizeof(int));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) == -1) {
+      ERROR("Failed to send fds: %s", errno_to_string(errno).c_str());
+    }
+    close(fd);
+  }
+}
+
+StatusOr<std::vector<int>> receive_fds(const std::string& name) {
+  sockaddr_un addr;
+  socklen_t addr_len = abstract_address(name, &addr);
+  if (addr_len == 0) {
+    return StatusVal(ErrorCode::NOT_FOUND);
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  if (connect(fd, (sockaddr*)&addr, addr_len) == -1) {
+    close(fd);
+    return StatusVal(ErrorCode::NOT_FOUND);
+  }
+  timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  char payload;
+  iovec iov = {&payload, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(FdServer::kMaxFds * sizeof(int))];
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  close(fd);
+  if (r != 1) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
+  std::vector<int> fds;
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int* received = (const int*)CMSG_DATA(cmsg);
+    fds.insert(fds.end(), received, received + count);
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    close_all(fds);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  return fds;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IPC_FD_SERVER_H_
+#define IPC_FD_SERVER_H_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "status_or.h"
+
+// Passes fds between processes over abstract unix sockets, which need no
+// shared filesystem, only a shared network namespace, and vanish with the
+// process that bound them.
+
+// Serves a fixed set of fds to every process of the same user that connects
+// to the abstract socket 'name', from a background thread.
+class FdServer {
+ public:
+  static const size_t kMaxFds = 8;
+
+  // Starts serving 'fds', taking ownership of them. Returns GENERAL if
+  // another server is bound to 'name'.
+  static StatusOr<std::unique_ptr<FdServer>> Create(const std::string& name,
+                                                    std::vector<int> fds);
+
+  // Stops serving and closes the fds.
+  ~FdServer();
+
+  // The serving thread points at the server, so it can't move.
+  FdServer(const FdServer&) = delete;
+  FdServer& operator=(const FdServer&) = delete;
+
+ private:
+  // Private constructor, use Create() instead.
+  FdServer(int listen_fd, std::vector<int> fds);
+
+  void serve();
+
+  int listen_fd_;
+  std::vector<int> fds_;
+  std::thread thread_;
+};
+
+// Connects to the FdServer at 'name' and returns the fds it sends, which the
+// caller owns. Returns NOT_FOUND if no server is bound to 'name', and GENERAL
+// if the server refused or didn't answer within a second.
+StatusOr<std::vector<int>> receive_fds(const std::string& name);
+
+#endif  // IPC_FD_SERVER_H_
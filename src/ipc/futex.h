@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IPC_FUTEX_H_
+#define IPC_FUTEX_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdint>
+
+// Futexes on words in shared memory, which wake waiters in other processes.
+// Waiters only need the word mapped readable, so readers with read-only
+// mappings can wait too.
+
+// Waits up to 'timeout_nanos' while '*word' is 'expected'. Returns early if
+// woken, interrupted, or '*word' isn't 'expected', so callers re-check their
+// condition.
+inline void futex_wait(const uint32_t* word, uint32_t expected,
+                       uint64_t timeout_nanos) {
+  timespec timeout = {(time_t)(timeout_nanos / 1'000'000'000),
+                      (long)(timeout_nanos % 1'000'000'000)};
+  syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+// Wakes every waiter on 'word'.
+inline void futex_wake_all(uint32_t* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#endif  // IPC_FUTEX_H_
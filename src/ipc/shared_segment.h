@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IPC_SHARED_SEGMENT_H_
+#define IPC_SHARED_SEGMENT_H_
+
+#include <string>
+
+#include "constants.h"
+#include "ipc/shm.h"
+#include "ipc/shm_mutex.h"
+#include "logger.h"
+#include "status_or.h"
+
+// A writer's shm segment and the ShmMutex next to it, named '<name>_mu',
+// that protects it.
+struct SharedSegment {
+  ShmMutex mu;
+  Shm shm;
+};
+
+// Opens the segment 'name' for writing, creating it with at least 'size'
+// bytes if it doesn't exist, along with its mutex.
+//
+// A window's successive swapchains share its segments, so one left by an
+// earlier writer is taken over rather than started afresh. 'in_use(header)'
+// says whether the segment's header was set up by such a writer. If so, its
+// mutex is kept, since readers may be holding it, and otherwise it's
+// initialized. Then, with the mutex locked, 'init(shm, owner_died)' sets up
+// or takes over the header, and may grow 'shm'. 'owner_died' is set if the
+// lock's last owner died holding it, after which the lock is reset.
+//
+// Returns GENERAL if the lock can't be taken within a second.
+template <typename InUse, typename Init>
+StatusOr<SharedSegment> open_shared_segment(const std::string& name,
+                                            size_t size, HugePages huge_pages,
+                                            InUse in_use, Init init) {
+  StatusOr<Shm> shm_result = Shm::Create(name, 'w', size, huge_pages);
+  RETURN_IF_ERROR(shm_result);
+
+  StatusOr<ShmMutex> mu_result = StatusVal(ErrorCode::NOT_FOUND);
+  if (in_use((const void*)shm_result->map())) {
+    mu_result = ShmMutex::Create(name + "_mu", /*create=*/false);
+  }
+  if (!mu_result.ok()) {
+    mu_result = ShmMutex::Create(name + "_mu", /*create=*/true);
+  }
+  RETURN_IF_ERROR(mu_result);
+
+  {
+    LockResult lock = mu_result->mu().lock(kOneSecNanos);
+    if (lock.state == LockState::TIMEOUT) {
+      ERROR("Timed out locking %s", name.c_str());
+      return StatusVal(ErrorCode::GENERAL);
+    }
+    const bool owner_died = lock.state == LockState::OWNERDEAD;
+    init(*shm_result, owner_died);
+    if (owner_died) {
+      mu_result->mu().reset();
+    }
+  }
+  return SharedSegment{std::move(*mu_result), std::move(*shm_result)};
+}
+
+#endif  // IPC_SHARED_SEGMENT_H_
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared_segment.h"
+
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "test_util.h"
+#include "utility.h"
+
+namespace {
+
+const char kName[] = "test_segment";
+
+// A header that's in use once 'magic' is set.
+struct Header {
+  uint32_t magic;
+  uint32_t opens;
+};
+
+// Opens the test segment, counting opens in its header. Sets 'owner_died' if
+// the lock's last owner died.
+StatusOr<SharedSegment> open_segment(bool* owner_died = nullptr) {
+  return open_shared_segment(
+      kName, 4096, HugePages::OFF,
+      [](const void* header) { return ((const Header*)header)->magic != 0; },
+      [&](Shm& shm, bool died) {
+        Header* header = (Header*)shm.map();
+        header->magic = 1;
+        header->opens++;
+        if (owner_died) {
+          *owner_died = died;
+        }
+      });
+}
+
+}  // namespace
+
+TEST(SharedSegment, NewWriterTakesOverLiveSegment) {
+  remove_shared_segment(kName);
+  StatusOr<SharedSegment> first = open_segment();
+  ASSERT_TRUE(first.ok());
+
+  // The next writer takes the segment over while a reader holds its lock,
+  // and waits for them rather than resetting the lock under them.
+  std::atomic<bool> locked = false;
+  std::thread holder([&] {
+    LockResult lock = first->mu.mu().lock(kOneSecNanos);
+    locked = true;
+    usleep(50'000);
+  });
+  while (!locked) {
+    std::this_thread::yield();
+  }
+  const uint64_t start = now_nanos();
+  StatusOr<SharedSegment> second = open_segment();
+  EXPECT_GE(now_nanos() - start, 40'000'000u);
+  holder.join();
+  ASSERT_TRUE(second.ok());
+
+  // Both writers share the header and the lock.
+  EXPECT_EQ(((Header*)second->shm.map())->opens, 2u);
+  LockResult lock = second->mu.mu().lock(kOneSecNanos);
+  ASSERT_EQ(lock.state, LockState::LOCKED);
+  std::thread([&] {
+    EXPECT_EQ(first->mu.mu().lock(1'000'000).state, LockState::TIMEOUT);
+  }).join();
+  remove_shared_segment(kName);
+}
+
+TEST(SharedSegment, ResetsLocksWhoseOwnerDied) {
+  remove_shared_segment(kName);
+  StatusOr<SharedSegment> first = open_segment();
+  ASSERT_TRUE(first.ok());
+
+  // A child dies holding the lock.
+  pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    LockResult lock = first->mu.mu().lock(kOneSecNanos);
+    _exit(lock.state == LockState::LOCKED ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  bool owner_died = false;
+  StatusOr<SharedSegment> second = open_segment(&owner_died);
+  ASSERT_TRUE(second.ok());
+  EXPECT_TRUE(owner_died);
+  EXPECT_EQ(second->mu.mu().lock(kOneSecNanos).state, LockState::LOCKED);
+  remove_shared_segment(kName);
+}
@@ -17,19 +17,87 @@
 #include "shm.h"
 
 #include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/memfd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "logger.h"
 #include "status_or.h"
 #include "utility.h"
 
+namespace {
+
+// Maps 'size' bytes of 'fd', advising transparent huge pages if asked to.
+void* map_fd(int fd, size_t size, int prot, HugePages huge_pages) {
+  void* map = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+  if (map != MAP_FAILED && huge_pages == HugePages::THP) {
+    // Best effort: fails harmlessly on kernels without THP.
+    madvise(map, size, MADV_HUGEPAGE);
+  }
+  return map;
+}
+
+// Returns the protection to map 'fd' with, which is read-only for read-only
+// fds.
+int fd_prot(int fd) {
+  int prot = PROT_READ;
+  if ((fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR) {
+    prot |= PROT_WRITE;
+  }
+  return prot;
+}
+
+}  // namespace
+
+HugePages huge_pages_from_env() {
+  const char* huge_pages_env = std::getenv("VKVFB_HUGE_PAGES");
+  if (!huge_pages_env || !*huge_pages_env ||
+      strcmp(huge_pages_env, "off") == 0) {
+    return HugePages::OFF;
+  } else if (strcmp(huge_pages_env, "thp") == 0) {
+    return HugePages::THP;
+  } else if (strcmp(huge_pages_env, "hugetlb") == 0) {
+    return HugePages::HUGETLB;
+  }
+  ERROR("Ignoring invalid VKVFB_HUGE_PAGES '%s'", huge_pages_env);
+  return HugePages::OFF;
+}
+
+void prefault(void* addr, size_t length, bool writable) {
+  const size_t page_size = getpagesize();
+  uint8_t* start = (uint8_t*)((uintptr_t)addr & ~(page_size - 1));
+  uint8_t* end = (uint8_t*)addr + length;
+  if (start >= end) {
+    return;
+  }
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(start, end - start,
+              writable ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) {
+    return;
+  }
+#endif
+  // Older kernels, and mappings madvise can't populate. Adding 0 atomically
+  // faults a page in writable without racing the mapping's other writers.
+  for (uint8_t* page = start; page < end; page += page_size) {
+    if (writable) {
+      __atomic_fetch_add(page, 0, __ATOMIC_RELAXED);
+    } else {
+      (void)*(volatile uint8_t*)page;
+    }
+  }
+}
+
 StatusOr<Shm> Shm::Create(const std::string& path, char mode,
-                          size_t alloc_size) {
+                          size_t alloc_size, HugePages huge_pages) {
   int flags = O_RDWR;
   if (mode == 'w') {
     flags |= O_CREAT;
@@ -40,8 +108,26 @@ StatusOr<Shm> Shm::Create(const std::string& path, char mode,
     return StatusVal(ErrorCode::NOT_FOUND);
   }
 
-  size_t size = round_to_page(alloc_size);
-  if (mode == 'w') {
+  // tmpfs can't hold hugetlbfs pages.
+  if (huge_pages == HugePages::HUGETLB) {
+    huge_pages = HugePages::THP;
+  }
+  const size_t page_size = mode == 'w' && huge_pages == HugePages::THP
+                               ? kHugePageSize
+                               : getpagesize();
+  size_t size = round_to_page(alloc_size, page_size);
+  if (mode == 'w' && huge_pages == HugePages::THP) {
+    // Pages allocated up front ignore the mapping's advice, so they're left
+    // to fault in as huge pages.
+    struct stat st;
+    if (fstat(shm_fd, &st) == 0 && (size_t)st.st_size < size &&
+        ftruncate(shm_fd, size) != 0) {
+      ERROR("Failed to size shared memory: %s",
+            errno_to_string(errno).c_str());
+      close(shm_fd);
+      return StatusVal(ErrorCode::GENERAL);
+    }
+  } else if (mode == 'w') {
     int r = posix_fallocate(shm_fd, 0, size);
     if (r != 0) {
       ERROR("Failed to allocate shared memory: %s", errno_to_string(r).c_str());
@@ -50,8 +136,7 @@ StatusOr<Shm> Shm::Create(const std::string& path, char mode,
     }
   }
 
-  void* map =
-      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  void* map = map_fd(shm_fd, size, PROT_READ | PROT_WRITE, huge_pages);
   if (map == MAP_FAILED) {
     ERROR("Failed to map shared memory: %s", errno_to_string(errno).c_str());
     close(shm_fd);
@@ -59,7 +144,102 @@ StatusOr<Shm> Shm::Create(const std::string& path, char mode,
   }
   LOG(kLogSync, "Mapped shm to %p", map);
 
-  return Shm(shm_fd, mode, size, map);
+  Shm shm(shm_fd, mode, size, map);
+  shm.huge_pages_ = huge_pages;
+  shm.page_size_ = page_size;
+  return shm;
+}
+
+StatusOr<Shm> Shm::CreateMemfd(const std::string& name, size_t alloc_size,
+                               HugePages huge_pages) {
+  int fd = -1;
+  size_t size = 0;
+  if (huge_pages == HugePages::HUGETLB) {
+    fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING |
+                                        MFD_HUGETLB | MFD_HUGE_2MB);
+    size = round_to_page(alloc_size, kHugePageSize);
+    if (fd != -1 && posix_fallocate(fd, 0, size) != 0) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd == -1) {
+      ERROR("No hugetlbfs pages for memfd %s, falling back to THP",
+            name.c_str());
+      huge_pages = HugePages::THP;
+    }
+  }
+  if (fd == -1) {
+    fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+      ERROR("Failed to create memfd: %s", errno_to_string(errno).c_str());
+      return StatusVal(ErrorCode::GENERAL);
+    }
+    // As in Create(), THP pages are left to fault in.
+    size = round_to_page(alloc_size, huge_pages == HugePages::THP
+                                         ? kHugePageSize
+                                         : getpagesize());
+    int r = huge_pages == HugePages::THP ? (ftruncate(fd, size) ? errno : 0)
+                                         : posix_fallocate(fd, 0, size);
+    if (r != 0) {
+      ERROR("Failed to allocate memfd: %s", errno_to_string(r).c_str());
+      close(fd);
+      return StatusVal(ErrorCode::GENERAL);
+    }
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) == -1) {
+    ERROR("Failed to seal memfd: %s", errno_to_string(errno).c_str());
+    close(fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
+  void* map = map_fd(fd, size, PROT_READ | PROT_WRITE, huge_pages);
+  if (map == MAP_FAILED) {
+    ERROR("Failed to map memfd: %s", errno_to_string(errno).c_str());
+    close(fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  LOG(kLogSync, "Mapped memfd to %p", map);
+
+  Shm shm(fd, 'w', size, map);
+  shm.grow_only_ = true;
+  shm.huge_pages_ = huge_pages;
+  shm.page_size_ =
+      huge_pages == HugePages::OFF ? getpagesize() : kHugePageSize;
+  return shm;
+}
+
+StatusOr<Shm> Shm::FromFd(int fd, char mode, HugePages huge_pages) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  int prot = fd_prot(fd);
+  // hugetlbfs mappings must be sized in whole huge pages.
+  size_t page_size = getpagesize();
+  struct statfs fs;
+  if (fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC) {
+    huge_pages = HugePages::HUGETLB;
+    page_size = fs.f_bsize;
+  } else if (huge_pages == HugePages::HUGETLB) {
+    huge_pages = HugePages::THP;
+  }
+
+  size_t size = st.st_size;
+  void* map = map_fd(fd, size, prot, huge_pages);
+  if (map == MAP_FAILED) {
+    ERROR("Failed to map fd: %s", errno_to_string(errno).c_str());
+    close(fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  LOG(kLogSync, "Mapped fd %d to %p", fd, map);
+
+  Shm shm(fd, mode, size, map);
+  // Sealed memfds only grow, so their mappings never lose pages.
+  shm.grow_only_ = fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK;
+  shm.huge_pages_ = huge_pages;
+  shm.page_size_ = page_size;
+  return shm;
 }
 
 Shm::Shm(int shm_fd, char mode, size_t size, void* map)
@@ -67,16 +247,102 @@ Shm::Shm(int shm_fd, char mode, size_t size, void* map)
 
 Shm::~Shm() {
   if (map_ != nullptr) {
-    munmap(map_, size_);
+    munmap(map_, std::max(size_, reserved_));
   }
   if (shm_fd_ != 0) {
     close(shm_fd_);
   }
 }
 
+Shm::Shm(Shm&& other) noexcept
+    : shm_fd_(other.shm_fd_),
+      mode_(other.mode_),
+      grow_only_(other.grow_only_),
+      huge_pages_(other.huge_pages_),
+      page_size_(other.page_size_),
+      size_(other.size_),
+      reserved_(other.reserved_),
+      locked_(other.locked_),
+      map_(other.map_) {
+  other.shm_fd_ = 0;
+  other.size_ = 0;
+  other.reserved_ = 0;
+  other.map_ = nullptr;
+}
+
+Shm& Shm::operator=(Shm&& other) noexcept {
+  if (this != &other) {
+    if (map_ != nullptr) {
+      munmap(map_, std::max(size_, reserved_));
+    }
+    if (shm_fd_ != 0) {
+      close(shm_fd_);
+    }
+    shm_fd_ = other.shm_fd_;
+    mode_ = other.mode_;
+    grow_only_ = other.grow_only_;
+    huge_pages_ = other.huge_pages_;
+    page_size_ = other.page_size_;
+    size_ = other.size_;
+    reserved_ = other.reserved_;
+    locked_ = other.locked_;
+    map_ = other.map_;
+    other.shm_fd_ = 0;
+    other.size_ = 0;
+    other.reserved_ = 0;
+    other.map_ = nullptr;
+  }
+  return *this;
+}
+
+StatusVal Shm::reserve(size_t max_size) {
+  max_size = round_to_page(max_size, page_size_);
+  if (map_ == nullptr || max_size <= std::max(size_, reserved_)) {
+    return StatusVal(ErrorCode::OK);
+  }
+
+  // Reserves an extra page to align the mapping to, as hugetlbfs needs.
+  const size_t span = max_size + page_size_;
+  uint8_t* base = (uint8_t*)mmap(nullptr, span, PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                 -1, 0);
+  if (base == MAP_FAILED) {
+    ERROR("Failed to reserve address space: %s",
+          errno_to_string(errno).c_str());
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  uint8_t* start = (uint8_t*)round_to_page((uintptr_t)base, page_size_);
+  if (start != base) {
+    munmap(base, start - base);
+  }
+  if (start + max_size != base + span) {
+    munmap(start + max_size, base + span - (start + max_size));
+  }
+
+  void* map = mmap(start, size_, fd_prot(shm_fd_), MAP_SHARED | MAP_FIXED,
+                   shm_fd_, 0);
+  if (map == MAP_FAILED) {
+    ERROR("Failed to map shared memory: %s", errno_to_string(errno).c_str());
+    munmap(start, max_size);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  if (huge_pages_ == HugePages::THP) {
+    madvise(start, size_, MADV_HUGEPAGE);
+  }
+  if (locked_) {
+    mlock(start, size_);
+  }
+  LOG(kLogSync, "Reserved %zu bytes for shm at %p", max_size, map);
+
+  munmap(map_, std::max(size_, reserved_));
+  map_ = map;
+  reserved_ = max_size;
+  return StatusVal(ErrorCode::OK);
+}
+
 void Shm::resize(size_t new_size) {
-  new_size = round_to_page(new_size);
-  if (new_size == size_) {
+  new_size = round_to_page(new_size, page_size_);
+  if (new_size == size_ || (grow_only_ && new_size < size_)) {
     return;
   }
   
@@ -85,10 +351,59 @@ void Shm::resize(size_t new_size) {
     CCHECK(r == 0, "Failed to allocate shared memory", errno);
   }
   
-  void* map_val = mremap(map_, size_, new_size, MREMAP_MAYMOVE);
+  if (new_size <= reserved_) {
+    // Maps or unmaps just the tail, so the mapping stays put and keeps its
+    // pages.
+    uint8_t* map = (uint8_t*)map_;
+    void* tail;
+    if (new_size > size_) {
+      tail = mmap(map + size_, new_size - size_, fd_prot(shm_fd_),
+                  MAP_SHARED | MAP_FIXED, shm_fd_, size_);
+      if (tail != MAP_FAILED && huge_pages_ == HugePages::THP) {
+        madvise(tail, new_size - size_, MADV_HUGEPAGE);
+      }
+      if (tail != MAP_FAILED && locked_) {
+        mlock(tail, new_size - size_);
+      }
+    } else {
+      tail = mmap(map + new_size, size_ - new_size, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                  -1, 0);
+    }
+    CCHECK(tail != MAP_FAILED, "Failed to remap shared memory", errno);
+    size_ = new_size;
+    return;
+  } else if (reserved_ != 0) {
+    // Outgrew the reservation, so drop what's left of it and move.
+    munmap((uint8_t*)map_ + size_, reserved_ - size_);
+    reserved_ = 0;
+  }
+
+  void* map_val;
+  if (huge_pages_ == HugePages::HUGETLB) {
+    // Older kernels can't mremap hugetlbfs mappings.
+    munmap(map_, size_);
+    map_val =
+        mmap(nullptr, new_size, fd_prot(shm_fd_), MAP_SHARED, shm_fd_, 0);
+    if (map_val != MAP_FAILED && locked_) {
+      mlock(map_val, new_size);
+    }
+  } else {
+    // mremap keeps the mapping locked.
+    map_val = mremap(map_, size_, new_size, MREMAP_MAYMOVE);
+  }
   CCHECK(map_val != MAP_FAILED, "Failed to remap shared memory", errno);
-  LOG(kLogSync, "Remapped shm to %p", map_val);
+  LOG_HOT(kLogSync, "Remapped shm to %p", map_val);
   
   map_ = map_val;
   size_ = new_size;
 }
+
+StatusVal Shm::lock() {
+  if (mlock(map_, size_) != 0) {
+    ERROR("Failed to lock shared memory: %s", errno_to_string(errno).c_str());
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  locked_ = true;
+  return StatusVal(ErrorCode::OK);
+}
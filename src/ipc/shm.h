@@ -17,10 +17,38 @@
 #ifndef IPC_SHM_H_
 #define IPC_SHM_H_
 
+#include <cstddef>
 #include <string>
 
 #include "status_or.h"
 
+// Which pages back a segment. Huge pages cut the TLB misses of copying large
+// frames, at the cost of rounding segments up to 2 MiB.
+enum class HugePages {
+  // Regular pages.
+  OFF,
+  // Transparent huge pages, advised with MADV_HUGEPAGE. Takes effect when the
+  // kernel allows it: for named shm, /dev/shm must be mounted with huge=advise
+  // or huge=within_size, and for memfds,
+  // /sys/kernel/mm/transparent_hugepage/shmem_enabled must allow it.
+  THP,
+  // hugetlbfs pages, for memfds. Needs pages reserved in
+  // /proc/sys/vm/nr_hugepages. Named shm can't use them, so falls back to THP.
+  HUGETLB,
+};
+
+// The size of the huge pages segments are rounded to.
+inline const size_t kHugePageSize = 2 << 20;
+
+// Reads VKVFB_HUGE_PAGES ("off", "thp" or "hugetlb").
+HugePages huge_pages_from_env();
+
+// Faults in the pages of [addr, addr + length), so the first copies through a
+// new mapping don't stall on thousands of page faults. Uses
+// MADV_POPULATE_WRITE, or MADV_POPULATE_READ for read-only mappings, where the
+// kernel has them, and touches every page otherwise.
+void prefault(void* addr, size_t length, bool writable);
+
 class Shm {
  public:
   // Constructs an empty default shared memory object.
@@ -32,13 +60,54 @@ class Shm {
   // In 'r' mode, it's required that a shm already exists at path and it's
   // opened for reading. Note: Calls to Shm(...) don't shrink existing shm
   // allocations. Returns StatusOr<Shm> with NOT_FOUND status if shared memory
-  // creation/opening fails.
+  // creation/opening fails. With huge pages, writers round sizes up to whole
+  // huge pages, and readers only advise them.
   static StatusOr<Shm> Create(const std::string& path, char mode,
-                              size_t alloc_size);
+                              size_t alloc_size,
+                              HugePages huge_pages = HugePages::OFF);
+
+  // Creates an anonymous memfd of 'alloc_size' bytes, sealed so it can grow
+  // but never shrink, for passing to readers by fd. Resizes to a smaller size
+  // keep the larger mapping, so readers' mappings never lose pages. 'name'
+  // only shows up in /proc/<pid>/fd. Returns GENERAL if memfds aren't
+  // supported. If there are no hugetlbfs pages to spare, HUGETLB falls back to
+  // THP.
+  static StatusOr<Shm> CreateMemfd(const std::string& name, size_t alloc_size,
+                                   HugePages huge_pages = HugePages::OFF);
+
+  // Maps the whole of 'fd', taking ownership of it. Read-only fds are mapped
+  // read-only. Mode must be either 'r' or 'w', as in Create(). hugetlbfs fds
+  // are detected, and THP is advised if 'huge_pages' asks for it. Returns
+  // GENERAL if the fd can't be mapped.
+  static StatusOr<Shm> FromFd(int fd, char mode,
+                              HugePages huge_pages = HugePages::OFF);
+
   ~Shm();
+
+  // Shm is moveable, but not copyable. A moved-from Shm owns nothing.
+  Shm(const Shm&) = delete;
+  Shm& operator=(const Shm&) = delete;
+  Shm(Shm&& other) noexcept;
+  Shm& operator=(Shm&& other) noexcept;
+
+  // Reserves address space for the mapping to grow to 'max_size' bytes in
+  // place. Resizes within the reservation keep the mapping's address and the
+  // pages already faulted in, where other resizes mremap and may move it.
+  // Returns GENERAL if the address space can't be reserved.
+  StatusVal reserve(size_t max_size);
+
   void resize(size_t new_size);
+
+  // Locks the mapping's pages in memory, including those it grows to, so they
+  // can't be paged out. Returns GENERAL if RLIMIT_MEMLOCK is too low.
+  StatusVal lock();
+
   void* map() { return map_; }
   size_t size() { return size_; }
+  size_t reserved() const { return reserved_; }
+  int fd() const { return shm_fd_; }
+  // The unit mappings of the segment must be sized in.
+  size_t page_size() const { return page_size_; }
 
  private:
   // Private constructor, use Create() instead.
@@ -46,7 +115,15 @@ class Shm {
 
   int shm_fd_ = 0;
   char mode_ = 'r';
+  // Set for sealed memfds, whose size can't shrink.
+  bool grow_only_ = false;
+  HugePages huge_pages_ = HugePages::OFF;
+  size_t page_size_ = 0;
   size_t size_ = 0;
+  // The size of the address space reserved at map_, or 0 if there's none.
+  size_t reserved_ = 0;
+  // Set once lock() succeeds.
+  bool locked_ = false;
   void* map_ = nullptr;
 };
 
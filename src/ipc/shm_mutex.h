@@ -56,9 +56,40 @@ class ShmMutex {
     return ShmMutex(std::move(*shm_result), mu);
   }
 
+  // Creates a ShmMutex in 'shm', such as a memfd passed between processes,
+  // which only its creator should 'create'.
+  static StatusOr<ShmMutex> FromShm(Shm&& shm, bool create) {
+    if (shm.size() < sizeof(PMutex)) {
+      return StatusVal(ErrorCode::GENERAL);
+    }
+    PMutex* mu = new (shm.map()) PMutex(create);
+    return ShmMutex(std::move(shm), mu);
+  }
+
   // We manually call mu_'s destructor, since it was placement-new'd into shared
   // memory.
-  ~ShmMutex() { mu_->~PMutex(); }
+  ~ShmMutex() {
+    if (mu_) {
+      mu_->~PMutex();
+    }
+  }
+
+  ShmMutex(ShmMutex&& other) noexcept
+      : shm_(std::move(other.shm_)), mu_(other.mu_) {
+    other.mu_ = nullptr;
+  }
+  ShmMutex& operator=(ShmMutex&& other) noexcept {
+    if (this != &other) {
+      if (mu_) {
+        mu_->~PMutex();
+      }
+      shm_ = std::move(other.shm_);
+      mu_ = other.mu_;
+      other.mu_ = nullptr;
+    }
+    return *this;
+  }
+
   PMutex& mu() { return *mu_; }
 
  private:
@@ -20,6 +20,8 @@
 
 #include "callback_swapchain.h"
 
+#include <sys/mman.h>
+
 #include <cassert>
 #include <chrono>
 #include <fstream>
@@ -30,6 +32,10 @@
 #include <stdio.h>
 #include <string>
 
+#include "ipc/shm.h"
+#include "logger.h"
+#include "trace/trace.h"
+#include "utility.h"
 
 namespace {
 
@@ -64,11 +70,12 @@ CallbackSwapchain::CallbackSwapchain(
     const VkSwapchainCreateInfoKHR* _swapchain_info,
     const VkAllocationCallbacks* pAllocator,
     uint32_t pending_image_timeout_in_milliseconds,
-    bool always_get_acquired_image)
+    bool always_get_acquired_image, const ReadbackOptions& readback_options)
     : swapchain_info_(*_swapchain_info),
       num_images_(_swapchain_info->minImageCount == 0
                       ? 1
                       : _swapchain_info->minImageCount),
+      num_initial_images_(num_images_),
       image_data_(num_images_),
       should_close_(false),
       device_(device),
@@ -76,8 +83,10 @@ CallbackSwapchain::CallbackSwapchain(
       functions_(functions),
       pending_image_timeout_in_milliseconds_(
           pending_image_timeout_in_milliseconds),
-      always_get_acquired_image_(always_get_acquired_image) {
+      always_get_acquired_image_(always_get_acquired_image),
+      readback_options_(readback_options) {
   callback_ = null_callback;
+  stats_ = nullptr;
   width_ = _swapchain_info->imageExtent.width;
   height_ = _swapchain_info->imageExtent.height;
   VkPhysicalDeviceMemoryProperties properties = *memory_properties;
@@ -113,11 +122,7 @@ CallbackSwapchain::CallbackSwapchain(
     // Handle more formats later if we have other swapchain formats we care
     // about.
 
-    // maximum non-coherent-atom-size is 128 bytes
-    // This means we can write subsequent layers on 128-byte
-    // boundaries
-    size_t buffer_memory_size =
-        ((ImageByteSize() + 127) & ~127) * swapchain_info_.imageArrayLayers;
+    size_t buffer_memory_size = BufferByteSize();
 
     const VkBufferCreateInfo buffer_create_info{
         VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,  // sType
@@ -180,16 +185,16 @@ CallbackSwapchain::CallbackSwapchain(
                                     &image_data.buffer_memory_);
       functions_->vkBindBufferMemory(device_, image_data.buffer_,
                                       image_data.buffer_memory_, 0);
+      // Mapped once, rather than per frame, so its pages stay faulted in.
+      functions_->vkMapMemory(device_, image_data.buffer_memory_, 0,
+                              VK_WHOLE_SIZE, 0, &image_data.buffer_map_);
     }
 
     // Create the image
     {
       functions_->vkCreateImage(device_, &image_create_info, pAllocator,
                                 &image_data.image_);
-      {
-        auto swp_images = GetGlobalContext().SwapchainImages(device_);
-        swp_images->push_back(image_data.image_);
-      }
+      GetGlobalContext().AddSwapchainImage(device_, image_data.image_);
 
       VkMemoryRequirements reqs;
       functions_->vkGetImageMemoryRequirements(device_, image_data.image_,
@@ -289,6 +294,10 @@ void CallbackSwapchain::Destroy(const VkAllocationCallbacks* pAllocator) {
   for (size_t i = 0; i < num_images_; ++i) {
     functions_->vkFreeMemory(device_, image_data_[i].image_memory_, pAllocator);
     functions_->vkDestroyImage(device_, image_data_[i].image_, pAllocator);
+    if (readback_options_.lock) {
+      munlock(image_data_[i].buffer_map_, BufferByteSize());
+    }
+    functions_->vkUnmapMemory(device_, image_data_[i].buffer_memory_);
     functions_->vkFreeMemory(device_, image_data_[i].buffer_memory_,
                              pAllocator);
     functions_->vkDestroyBuffer(device_, image_data_[i].buffer_, pAllocator);
@@ -301,6 +310,12 @@ void CallbackSwapchain::Destroy(const VkAllocationCallbacks* pAllocator) {
 }
 
 void CallbackSwapchain::CopyThreadFunc() {
+  trace::set_thread_name("vkvfb_copy");
+  // Fault the readback memory in now, rather than in the first frames after
+  // the swapchain is created, which is when the app changes resolution.
+  for (uint32_t i = 0; i < num_initial_images_; ++i) {
+    PrepareReadbackMemory(image_data_[i]);
+  }
   while (true) {
     uint32_t pending_image = 0;
     // We have to wait until there is a pending image.
@@ -324,13 +339,16 @@ void CallbackSwapchain::CopyThreadFunc() {
       pending_images_.pop_front();
     }
 
-    functions_->vkWaitForFences(
-        device_, 1, &image_data_[pending_image].fence_, false, UINT64_MAX);
+    const uint64_t frame_id = image_data_[pending_image].frame_id_;
+    {
+      TRACE_SCOPE("fence_wait", "frame", frame_id);
+      functions_->vkWaitForFences(
+          device_, 1, &image_data_[pending_image].fence_, false, UINT64_MAX);
+    }
     functions_->vkResetFences(device_, 1, &image_data_[pending_image].fence_);
 
-    void* mapped_value;
-    functions_->vkMapMemory(device_, image_data_[pending_image].buffer_memory_,
-                            0, VK_WHOLE_SIZE, 0, &mapped_value);
+    trace::Scope map_scope("invalidate", "frame", frame_id);
+    void* mapped_value = image_data_[pending_image].buffer_map_;
     VkMappedMemoryRange range{
         VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,      // sType
         nullptr,                                    // pNext
@@ -339,17 +357,24 @@ void CallbackSwapchain::CopyThreadFunc() {
         VK_WHOLE_SIZE,                              // size
     };
     functions_->vkInvalidateMappedMemoryRanges(device_, 1, &range);
+    map_scope.end();
+    CountFrame(FrameCounter::COPIED);
+    if (stats_) {
+      stats_->record_latency(
+          FrameLatency::PRESENT_TO_COPY,
+          now_nanos() - image_data_[pending_image].present_nanos_);
+    }
 
     uint32_t length = ImageByteSize();
     {
+      TRACE_SCOPE("publish", "frame", frame_id);
       std::lock_guard<std::mutex> retire_lock = GetRetireLock();
       if (callback_) {
         callback_(user_data_.get(), (uint8_t*)mapped_value, length);
+      } else {
+        CountFrame(FrameCounter::SKIPPED);
       }
     }
-    functions_->vkUnmapMemory(device_,
-                              image_data_[pending_image].buffer_memory_);
-
     FreeImage(pending_image);
     free_images_condition_.notify_all();
   }
@@ -403,9 +428,34 @@ void CallbackSwapchain::SetCallback(void callback(void*, uint8_t*, size_t),
   user_data_ = std::move(user_data);
 }
 
+void CallbackSwapchain::PrepareReadbackMemory(
+    const SwapchainImageData& image_data) {
+  if (!image_data.buffer_map_) {
+    return;
+  }
+  const size_t size = BufferByteSize();
+  if (readback_options_.lock &&
+      mlock(image_data.buffer_map_, size) != 0) {
+    ERROR("Failed to lock readback memory: %s",
+          errno_to_string(errno).c_str());
+  }
+  if (readback_options_.prefault) {
+    TRACE_SCOPE("prefault_readback", "bytes", size);
+    // The GPU writes the memory and the copy thread only reads it.
+    prefault(image_data.buffer_map_, size, /*writable=*/false);
+  }
+}
+
 uint32_t CallbackSwapchain::ImageByteSize() const {
   // TODO(awoloszyn): Once we support more than RGBA8, have this be
   // more dynamic.
   return width_ * height_ * 4;
 }
+
+size_t CallbackSwapchain::BufferByteSize() const {
+  // maximum non-coherent-atom-size is 128 bytes
+  // This means we can write subsequent layers on 128-byte
+  // boundaries
+  return ((ImageByteSize() + 127) & ~127) * swapchain_info_.imageArrayLayers;
+}
 }  // namespace swapchain
@@ -19,6 +19,7 @@
  *  - Store user data in a unique_ptr
  *  - Track swapchain images
  *  - Fix missin dispatch table in internal allocated cmd buffer
+ *  - Keep readback memory mapped, and prefault and lock it
  */
 
 #ifndef LAYER_CALLBACK_SWAPCHAIN_H_
@@ -33,10 +34,20 @@
 
 #include "generic_unique_ptr.h"
 #include "layer.h"
+#include "stats/frame_stats.h"
+#include "utility.h"
 
 
 namespace swapchain {
 
+// How a swapchain treats the host memory that frames are read back into.
+struct ReadbackOptions {
+  // Faults the memory in on the copy thread before the first frame needs it.
+  bool prefault = true;
+  // Locks the memory, so it can't be paged out.
+  bool lock = false;
+};
+
 // The CallbackSwapchain is the bulk of the data for handling
 // all of the images/synchronization/buffers for our swapchain.
 class CallbackSwapchain {
@@ -54,7 +65,8 @@ class CallbackSwapchain {
                     const VkSwapchainCreateInfoKHR* _swapchain_info,
                     const VkAllocationCallbacks* pAllocator,
                     uint32_t pending_image_timeout_in_milliseconds = 10,
-                    bool always_get_acquired_image = false);
+                    bool always_get_acquired_image = false,
+                    const ReadbackOptions& readback_options = ReadbackOptions());
   // Call this to release all of the resources associated with this object.
   void Destroy(const VkAllocationCallbacks* pAllocator);
 
@@ -62,6 +74,16 @@ class CallbackSwapchain {
   // user-data to be passed.
   void SetCallback(void callback(void*, uint8_t*, size_t), generic_unique_ptr&& user_data);
 
+  // Sets the stats that this swapchain's frames are counted in, or nullptr
+  // for none. The stats must outlive the swapchain.
+  void SetStats(FrameStats* stats) { stats_ = stats; }
+  // Counts a frame event in the window's stats, if it has any.
+  void CountFrame(FrameCounter counter) {
+    if (stats_) {
+      stats_->count(counter);
+    }
+  }
+
   // Returns in *image the index of the next free image. Returns false
   // if timeout nanoseconds have passed and no image could be returned.
   // If timeout is UINT64_MAX, then this function will wait forever.
@@ -75,6 +97,7 @@ class CallbackSwapchain {
     std::unique_lock<threading::mutex> sl(free_images_lock_);
     while (num_images > num_images_ && create_new_images) {
       image_data_.push_back(build_swapchain_image_data_());
+      PrepareReadbackMemory(image_data_.back());
       free_images_.push_back(num_images_);
       free_images_condition_.notify_all();
       num_images_++;
@@ -106,13 +129,20 @@ class CallbackSwapchain {
   }
   // When the commands associated with an image have been submitted to
   // a VkQueue, NotifySubmitted must be called to inform the swapchain
-  // that the image in question is no longer needed.
-  void NotifySubmitted(size_t i) {
+  // that the image in question is no longer needed. Returns the frame's id,
+  // which counts up from 0 with each present.
+  uint64_t NotifySubmitted(size_t i) {
+    CountFrame(FrameCounter::PRESENTED);
+    uint64_t frame_id;
     {
       std::lock_guard<threading::mutex> lock(pending_images_lock_);
+      image_data_[i].present_nanos_ = now_nanos();
+      frame_id = next_frame_id_++;
+      image_data_[i].frame_id_ = frame_id;
       pending_images_.push_back(static_cast<uint32_t>(i));
     }
     pending_images_condition_.notify_one();
+    return frame_id;
   }
 
   // Sets the flag to control the behavior of GetImage(). When true, the
@@ -142,6 +172,8 @@ class CallbackSwapchain {
   void CopyThreadFunc();
   // Returns the size of the image in bytes.
   uint32_t ImageByteSize() const;
+  // Returns the size of the buffer the image is copied into, in bytes.
+  size_t BufferByteSize() const;
   // All of the data associated with a single swapchain VkImage.
   struct SwapchainImageData {
     VkImage image_;                // The image itself.
@@ -149,15 +181,25 @@ class CallbackSwapchain {
 
     VkBuffer buffer_;  // The buffer to copy the image contents into.
     VkDeviceMemory buffer_memory_;  // The memory for the buffer.
+    void* buffer_map_;  // buffer_memory_, mapped for the image's lifetime.
 
     VkFence fence_;  // The fence to signal when the copy is complete.
     VkCommandBuffer
         command_buffer_;  // The command_buffer that contains the copy commands.
+
+    uint64_t present_nanos_ = 0;  // When the image was last presented.
+    uint64_t frame_id_ = 0;       // The id of the image's last present.
   };
+  // Faults in and locks an image's readback memory, as the readback options
+  // ask.
+  void PrepareReadbackMemory(const SwapchainImageData& image_data);
 
   // In our constructor we rely on num_images_ being
   // initialized first, so don't move anything above it.
   uint32_t num_images_;
+  // The number of images built by the constructor, which the copy thread
+  // prepares the readback memory of.
+  const uint32_t num_initial_images_;
   uint32_t width_;
   uint32_t height_;
   // All of the data for each requested swapchain image.
@@ -165,6 +207,8 @@ class CallbackSwapchain {
   // Indices into image_data_ for all images that have been submitted but not processed
   // yet.
   std::deque<uint32_t> pending_images_;
+  // The id of the next presented frame. Protected by pending_images_lock_.
+  uint64_t next_frame_id_ = 0;
   // Indices into image_data_ for all images that are not currently in use.
   std::deque<uint32_t> free_images_;
 
@@ -191,6 +235,7 @@ class CallbackSwapchain {
 
   void (*callback_)(void*, uint8_t*, size_t);
   generic_unique_ptr user_data_;
+  FrameStats* stats_;
 
   const uint32_t queue_;
   const DeviceData* functions_;
@@ -204,6 +249,7 @@ class CallbackSwapchain {
   // false, GetImage() will write the index of a randomly free image to the
   // given index pointer.
   bool always_get_acquired_image_;
+  const ReadbackOptions readback_options_;
   std::function<SwapchainImageData()> build_swapchain_image_data_;
 };
 }  // namespace swapchain
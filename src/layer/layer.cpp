@@ -302,11 +302,6 @@ vkCreateDevice(VkPhysicalDevice gpu, const VkDeviceCreateInfo* pCreateInfo,
     }
   }
 
-  {
-    auto swp_map = GetGlobalContext().GetSwapchainImageMap();
-    (*swp_map)[*pDevice] = {};
-  }
-
   LOG(kLogLayer, "Created device: %p\n", *pDevice);
   return result;
 }
@@ -319,6 +314,7 @@ VKAPI_ATTR void vkDestroyDevice(VkDevice device,
   auto device_map = GetGlobalContext().GetDeviceMap();
   auto it = device_map->find(device);
 
+  GetGlobalContext().RemoveSwapchainImageDevice(device);
   it->second.vkDestroyDevice(device, pAllocator);
   device_map->erase(it);
 }
@@ -452,9 +448,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateImageView(VkDevice device,
   // passing in baseMipLevel = 1 for some swapchain image views.
   VkImageViewCreateInfo info = *pCreateInfo;
 
-  VkImage image = pCreateInfo->image;
-  const std::vector<VkImage>& swp_images = *GetGlobalContext().SwapchainImages(device);
-  if (std::find(swp_images.begin(), swp_images.end(), image) != swp_images.end()) {
+  if (GetGlobalContext().IsSwapchainImage(device, pCreateInfo->image)) {
     uint32_t& base_mip_level = info.subresourceRange.baseMipLevel;
     if (base_mip_level == 1) {
       LOG(kLogLayer, "Overriding image basemiplevel to 0.\n");
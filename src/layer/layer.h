@@ -22,7 +22,9 @@
 #ifndef LAYER_LAYER_H_
 #define LAYER_LAYER_H_
 
+#include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "vulkan/vulkan.h"
 
@@ -69,6 +71,17 @@ struct PhysicalDeviceData {
   VkInstance instance_;
   VkPhysicalDeviceMemoryProperties memory_properties_;
   VkPhysicalDeviceProperties physical_device_properties_;
+
+  // Queue family data is queried once in RegisterInstance, since surface
+  // support queries and swapchain (re)creation both need it.
+  std::vector<VkQueueFamilyProperties> queue_family_properties_;
+  // The first queue family with graphics support, or UINT32_MAX if there's
+  // none. This is the only family we report as able to present, so it's also
+  // the family our swapchain copy commands are recorded and submitted on.
+  uint32_t graphics_queue_family_ = UINT32_MAX;
+  // Indexed by queue family. Surface support doesn't depend on the surface,
+  // since we never present to a real one.
+  std::vector<VkBool32> surface_support_;
 };
 
 // All of the device data we need for book-keeping.
@@ -167,7 +180,8 @@ struct Context {
       std::unordered_map<VkPhysicalDevice, PhysicalDeviceData>;
   using QueueMap = std::unordered_map<VkQueue, QueueData>;
   using DeviceMap = std::unordered_map<VkDevice, DeviceData>;
-  using SwapchainImageMap = std::unordered_map<VkDevice, std::vector<VkImage>>;
+  using SwapchainImageMap =
+      std::unordered_map<VkDevice, std::unordered_set<VkImage>>;
 
   ContextToken<InstanceMap> GetInstanceMap() {
     return ContextToken<InstanceMap>(instance_data_map_, instance_lock_);
@@ -222,16 +236,35 @@ struct Context {
                                     std::move(locker));
   }
 
-  ContextToken<SwapchainImageMap> GetSwapchainImageMap() {
-    std::unique_lock<threading::mutex> locker(device_swapchain_images_lock_);
-    return ContextToken<SwapchainImageMap>(device_swapchain_images_,
-                                           std::move(locker));
+  // Swapchain image membership is queried on every vkCreateImageView, so it
+  // takes a shared lock and concurrent lookups don't serialize against each
+  // other. Only swapchain creation and destruction take the lock exclusively.
+  bool IsSwapchainImage(VkDevice device, VkImage image) {
+    std::shared_lock<std::shared_mutex> locker(device_swapchain_images_lock_);
+    auto it = device_swapchain_images_.find(device);
+    return it != device_swapchain_images_.end() && it->second.count(image) > 0;
+  }
+
+  void AddSwapchainImage(VkDevice device, VkImage image) {
+    std::unique_lock<std::shared_mutex> locker(device_swapchain_images_lock_);
+    device_swapchain_images_[device].insert(image);
+  }
+
+  void RemoveSwapchainImages(VkDevice device,
+                             const std::vector<VkImage>& images) {
+    std::unique_lock<std::shared_mutex> locker(device_swapchain_images_lock_);
+    auto it = device_swapchain_images_.find(device);
+    if (it == device_swapchain_images_.end()) {
+      return;
+    }
+    for (VkImage image : images) {
+      it->second.erase(image);
+    }
   }
 
-  ContextToken<std::vector<VkImage>> SwapchainImages(VkDevice device) {
-    std::unique_lock<threading::mutex> locker(device_swapchain_images_lock_);
-    return ContextToken<std::vector<VkImage>>(device_swapchain_images_.at(device),
-                                              std::move(locker));
+  void RemoveSwapchainImageDevice(VkDevice device) {
+    std::unique_lock<std::shared_mutex> locker(device_swapchain_images_lock_);
+    device_swapchain_images_.erase(device);
   }
 
  private:
@@ -265,8 +298,9 @@ struct Context {
   DeviceMap device_data_map_;
   threading::mutex device_lock_;
 
+  // The set of swapchain images created on each device.
   SwapchainImageMap device_swapchain_images_;
-  threading::mutex device_swapchain_images_lock_;
+  std::shared_mutex device_swapchain_images_lock_;
 };
 
 Context& GetGlobalContext();
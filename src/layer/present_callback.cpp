@@ -19,13 +19,24 @@
 #include <cstdlib>
 
 #include "logger.h"
+#include "utility.h"
 
 SwapchainData::SwapchainData(int32_t w, int32_t h, PixbufWriter&& writer_param,
-                             VkCompositeAlphaFlagBitsKHR mode)
+                             std::unique_ptr<FrameRingWriter> ring_param,
+                             std::unique_ptr<JpegStreamWriter> jpeg_param,
+                             VkCompositeAlphaFlagBitsKHR mode,
+                             FrameStats* stats_param,
+                             WindowTitleWatcher* title_param,
+                             uint64_t title_generation_param)
     : width(w),
       height(h),
       writer(std::move(writer_param)),
-      composite_mode(mode) {}
+      ring(std::move(ring_param)),
+      jpeg(std::move(jpeg_param)),
+      composite_mode(mode),
+      stats(stats_param),
+      title(title_param),
+      title_generation(title_generation_param) {}
 
 void present_callback(void* user_data, uint8_t* pixels, size_t pixels_size) {
   SwapchainData& swapchain_data = *(SwapchainData*)user_data;
@@ -34,7 +45,51 @@ void present_callback(void* user_data, uint8_t* pixels, size_t pixels_size) {
     force_opaque = true;
   }
 
-  swapchain_data.writer.write_pixels(pixels, swapchain_data.width, swapchain_data.height, force_opaque);
+  FrameStats& stats = *swapchain_data.stats;
+  uint64_t copy_nanos = now_nanos();
+  WriteResult result = swapchain_data.writer.write_pixels(
+      pixels, swapchain_data.width, swapchain_data.height, force_opaque);
+  switch (result) {
+    case WriteResult::PUBLISHED:
+      stats.count(FrameCounter::PUBLISHED);
+      stats.record_latency(FrameLatency::COPY_TO_PUBLISH,
+                           now_nanos() - copy_nanos);
+      break;
+    case WriteResult::EMPTY:
+      stats.count(FrameCounter::SKIPPED);
+      break;
+    case WriteResult::LOCK_TIMEOUT:
+      stats.count(FrameCounter::LOCK_TIMEOUTS);
+      break;
+    case WriteResult::OWNER_DEAD:
+      stats.count(FrameCounter::OWNER_DEAD);
+      break;
+    case WriteResult::RING_FULL:
+      break;
+  }
+
+  if (swapchain_data.ring) {
+    WriteResult ring_result = swapchain_data.ring->write_pixels(
+        pixels, swapchain_data.width, swapchain_data.height, force_opaque);
+    if (ring_result != WriteResult::PUBLISHED &&
+        ring_result != WriteResult::EMPTY) {
+      stats.count(FrameCounter::RING_DROPS);
+    }
+  }
+
+  // Only copies the frame when one is due; the encoding happens on the
+  // stream's own thread.
+  if (swapchain_data.jpeg) {
+    swapchain_data.jpeg->submit(pixels, swapchain_data.width,
+                                swapchain_data.height);
+  }
+
+  // Picks up the window's title here rather than on the app's thread, since
+  // it comes from the X server.
+  std::string title;
+  if (swapchain_data.title->poll(&swapchain_data.title_generation, &title)) {
+    swapchain_data.writer.set_title(title);
+  }
 }
 
 void cleanup_callback(void* user_data) {
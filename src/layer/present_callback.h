@@ -21,19 +21,37 @@
 #include <stdint.h>
 #include <vulkan/vulkan.h>
 
+#include <memory>
 #include <string>
 
+#include "pixbuf/frame_ring.h"
+#include "pixbuf/jpeg_stream.h"
 #include "pixbuf/pixbuf_writer.h"
+#include "stats/frame_stats.h"
+#include "window_title.h"
 
 // Struct to store and pass to present callback.
 struct SwapchainData {
   int32_t width;
   int32_t height;
   PixbufWriter writer;
+  // The window's frame ring, if VKVFB_RING_FRAMES enabled one.
+  std::unique_ptr<FrameRingWriter> ring;
+  // The window's JPEG stream, if VKVFB_JPEG_QUALITY enabled one.
+  std::unique_ptr<JpegStreamWriter> jpeg;
   VkCompositeAlphaFlagBitsKHR composite_mode;
+  // Owned by the swapchain's surface.
+  FrameStats* stats;
+  // Owned by the swapchain's surface, which may have several swapchains.
+  WindowTitleWatcher* title;
+  // The title generation the writer's registry entry has.
+  uint64_t title_generation;
 
   SwapchainData(int32_t w, int32_t h, PixbufWriter&& writer,
-                VkCompositeAlphaFlagBitsKHR mode);
+                std::unique_ptr<FrameRingWriter> ring,
+                std::unique_ptr<JpegStreamWriter> jpeg,
+                VkCompositeAlphaFlagBitsKHR mode, FrameStats* stats,
+                WindowTitleWatcher* title, uint64_t title_generation);
 };
 
 void present_callback(void* user_data, uint8_t* pixels, size_t pixels_size);
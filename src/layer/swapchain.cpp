@@ -22,19 +22,19 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <string>
 #include <vector>
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
 #include <xcb/xcb.h>
-#include <unordered_set>
-#include <algorithm>
 
 #include "callback_swapchain.h"
 #include "logger.h"
+#include "pixbuf/naming.h"
 #include "present_callback.h"
+#include "trace/trace.h"
 
 
 namespace swapchain {
@@ -55,6 +55,29 @@ void RegisterInstance(VkInstance instance, InstanceData& data) {
                                              &dat.memory_properties_);
     data.vkGetPhysicalDeviceProperties(physical_device,
                                        &dat.physical_device_properties_);
+
+    uint32_t property_count = 0;
+    data.vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                                  &property_count, nullptr);
+    dat.queue_family_properties_.resize(property_count);
+    data.vkGetPhysicalDeviceQueueFamilyProperties(
+        physical_device, &property_count, dat.queue_family_properties_.data());
+
+    // For now only support the FIRST graphics queue. It looks like all of
+    // the commands we will have to run are transfer commands, so
+    // we can probably get away with ANY queue (other than
+    // SPARSE_BINDING).
+    for (uint32_t i = 0; i < property_count; ++i) {
+      if (dat.queue_family_properties_[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        dat.graphics_queue_family_ = i;
+        break;
+      }
+    }
+    dat.surface_support_.resize(property_count, VK_FALSE);
+    if (dat.graphics_queue_family_ != UINT32_MAX) {
+      dat.surface_support_[dat.graphics_queue_family_] = VK_TRUE;
+    }
+
     (*physical_device_map)[physical_device] = dat;
   }
 }
@@ -84,7 +107,7 @@ VKAPI_ATTR VkResult VKAPI_CALL CreateSurface(
     const VkAllocationCallbacks* pAllocator, VkSurfaceKHR* pSurface) {
   const auto instance_dat = *GetGlobalContext().GetInstanceData(instance);
 
-  std::string window_name;
+  std::string display;
   xcb_window_t window;
   xcb_connection_t* connection;
   VkSurfaceKHR backing_surface;
@@ -93,55 +116,52 @@ VKAPI_ATTR VkResult VKAPI_CALL CreateSurface(
     const VkXlibSurfaceCreateInfoKHR& info = *(VkXlibSurfaceCreateInfoKHR*)pCreateInfo;
     window = (xcb_window_t)info.window;
     connection = XGetXCBConnection(info.dpy);
+    display = DisplayString(info.dpy);
     instance_dat.vkCreateXlibSurfaceKHR(instance, (VkXlibSurfaceCreateInfoKHR*)pCreateInfo, pAllocator, &backing_surface);
   }
   if (createType == VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR) {
     const VkXcbSurfaceCreateInfoKHR& info = *(VkXcbSurfaceCreateInfoKHR*)pCreateInfo;
     window = info.window;
     connection = info.connection;
+    // XCB connections don't keep the name they were opened with, so assume
+    // the default display.
+    const char* env_display = std::getenv("DISPLAY");
+    display = env_display ? env_display : "";
     instance_dat.vkCreateXcbSurfaceKHR(instance, (VkXcbSurfaceCreateInfoKHR*)pCreateInfo, pAllocator, &backing_surface);
   }
 
-  std::ostringstream oss;
-  oss << "0x" << std::hex << std::setw(8) << std::setfill('0') << static_cast<std::uint32_t>(window);
-  window_name = oss.str();
-
+  const std::string window_name = pixbuf_name(display, window);
 
-  *pSurface = reinterpret_cast<VkSurfaceKHR>(
+  CallbackSurface* surface =
           new CallbackSurface{.window_name=window_name,
+                              .display=display,
                               .window=window,
                               .connection=connection,
-                              .backing_surface=backing_surface});
+                              .backing_surface=backing_surface};
+  // Only sends requests; their replies are picked up off the app's thread.
+  surface->title = std::make_unique<WindowTitleWatcher>(connection, window);
+  if (FrameStats::enabled_by_env()) {
+    StatusOr<FrameStats> stats = FrameStats::Create(window_name);
+    if (stats.ok()) {
+      surface->stats = std::move(*stats);
+    } else {
+      ERROR("Failed to create frame stats for window: %s", window_name.c_str());
+    }
+  }
+  *pSurface = reinterpret_cast<VkSurfaceKHR>(surface);
   return VK_SUCCESS;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfaceSupportKHR(
     VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex,
     VkSurfaceKHR surface, VkBool32* pSupported) {
-  const auto instance_dat = *GetGlobalContext().GetInstanceData(
-      GetGlobalContext().GetPhysicalDeviceData(physicalDevice)->instance_);
+  const std::vector<VkBool32>& surface_support =
+      GetGlobalContext().GetPhysicalDeviceData(physicalDevice)->surface_support_;
+  assert(queueFamilyIndex < surface_support.size());
 
-  for (uint32_t i = 0; i <= queueFamilyIndex; ++i) {
-    uint32_t property_count = 0;
-    instance_dat.vkGetPhysicalDeviceQueueFamilyProperties(
-        physicalDevice, &property_count, nullptr);
-    assert(property_count > queueFamilyIndex);
-
-    std::vector<VkQueueFamilyProperties> properties(property_count);
-    instance_dat.vkGetPhysicalDeviceQueueFamilyProperties(
-        physicalDevice, &property_count, properties.data());
-
-    if (properties[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      *pSupported = (i == queueFamilyIndex);
-      return VK_SUCCESS;
-    }
-  }
-
-  // For now only support the FIRST graphics queue. It looks like all of
-  // the commands we will have to run are transfer commands, so
-  // we can probably get away with ANY queue (other than
-  // SPARSE_BINDING).
-  *pSupported = false;
+  *pSupported = queueFamilyIndex < surface_support.size()
+                    ? surface_support[queueFamilyIndex]
+                    : VK_FALSE;
   return VK_SUCCESS;
 }
 
@@ -263,37 +283,72 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateSwapchainKHR(
   DeviceData& dev_dat = *GetGlobalContext().GetDeviceData(device);
   PhysicalDeviceData& pdd =
       *GetGlobalContext().GetPhysicalDeviceData(dev_dat.physicalDevice);
-  InstanceData& inst_dat = *GetGlobalContext().GetInstanceData(pdd.instance_);
 
-  uint32_t property_count = 0;
-  inst_dat.vkGetPhysicalDeviceQueueFamilyProperties(dev_dat.physicalDevice,
-                                                    &property_count, nullptr);
-
-  std::vector<VkQueueFamilyProperties> queue_properties(property_count);
-  inst_dat.vkGetPhysicalDeviceQueueFamilyProperties(
-      dev_dat.physicalDevice, &property_count, queue_properties.data());
-
-  uint32_t queue = 0;
-  for (; queue < static_cast<uint32_t>(queue_properties.size()); ++queue) {
-    if (queue_properties[queue].queueFlags & VK_QUEUE_GRAPHICS_BIT) break;
-  }
-
-  assert(queue < queue_properties.size());
+  uint32_t queue = pdd.graphics_queue_family_;
+  assert(queue < pdd.queue_family_properties_.size());
 
+  const PixbufOptions pixbuf_options = PixbufOptions::from_env();
+  ReadbackOptions readback_options;
+  readback_options.prefault = pixbuf_options.prefault;
+  readback_options.lock = pixbuf_options.lock_memory;
   CallbackSwapchain* swapchain = new CallbackSwapchain(
       device, queue, &pdd.physical_device_properties_, &pdd.memory_properties_,
-      &dev_dat, pCreateInfo, pAllocator);
+      &dev_dat, pCreateInfo, pAllocator,
+      /*pending_image_timeout_in_milliseconds=*/10,
+      /*always_get_acquired_image=*/false, readback_options);
   *pSwapchain = reinterpret_cast<VkSwapchainKHR>(swapchain);
 
   VkSurfaceKHR vk_surface = pCreateInfo->surface;
   CallbackSurface& surface = *reinterpret_cast<CallbackSurface*>(vk_surface);
+  swapchain->SetStats(&surface.stats);
   const uint32_t w = pCreateInfo->imageExtent.width;
   const uint32_t h = pCreateInfo->imageExtent.height;
   const VkCompositeAlphaFlagBitsKHR composite_mode = pCreateInfo->compositeAlpha;
 
-  generic_unique_ptr present_data = make_generic_unique(new SwapchainData(
-      w, h, std::move(PixbufWriter::Create(surface.window_name).value_or_die()),
-      composite_mode));
+  std::unique_ptr<FrameRingWriter> ring;
+  RingOptions ring_options = RingOptions::from_env();
+  if (ring_options.frames > 0) {
+    StatusOr<FrameRingWriter> ring_result =
+        FrameRingWriter::Create(surface.window_name, ring_options);
+    if (ring_result.ok()) {
+      ring = std::make_unique<FrameRingWriter>(std::move(*ring_result));
+    } else {
+      ERROR("Failed to create frame ring for window: %s",
+            surface.window_name.c_str());
+    }
+  }
+
+  std::unique_ptr<JpegStreamWriter> jpeg;
+  JpegOptions jpeg_options = JpegOptions::from_env();
+  if (jpeg_options.quality > 0) {
+    StatusOr<JpegStreamWriter> jpeg_result =
+        JpegStreamWriter::Create(surface.window_name, jpeg_options);
+    if (jpeg_result.ok()) {
+      jpeg = std::make_unique<JpegStreamWriter>(std::move(*jpeg_result));
+    } else {
+      ERROR("Failed to create JPEG stream for window: %s",
+            surface.window_name.c_str());
+    }
+  }
+
+  WindowInfo window_info;
+  window_info.display = surface.display;
+  window_info.window_id = surface.window;
+  // The title is empty until the X server's replies arrive, and kept up to
+  // date by the copy thread after that.
+  uint64_t title_generation = 0;
+  surface.title->poll(&title_generation, &window_info.title);
+
+  PixbufWriter writer = std::move(
+      PixbufWriter::Create(surface.window_name, window_info, pixbuf_options)
+          .value_or_die());
+  // Readers keep the old frame while the pixbuf grows and faults in for the
+  // new size.
+  writer.reserve(w, h);
+  generic_unique_ptr present_data = make_generic_unique(
+      new SwapchainData(w, h, std::move(writer), std::move(ring),
+                        std::move(jpeg), composite_mode, &surface.stats,
+                        surface.title.get(), title_generation));
   swapchain->SetCallback(present_callback, std::move(present_data));
 
   return VK_SUCCESS;
@@ -304,13 +359,7 @@ vkDestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
                       const VkAllocationCallbacks* pAllocator) {
   CallbackSwapchain* swp = reinterpret_cast<CallbackSwapchain*>(swapchain);
 
-  std::vector<VkImage> swp_images = swp->AllImages();
-  std::vector<VkImage>& all_swp_images = *GetGlobalContext().SwapchainImages(device);
-  std::unordered_set<VkImage> to_remove(swp_images.begin(), swp_images.end());
-  all_swp_images.erase(
-    std::remove_if(all_swp_images.begin(), all_swp_images.end(), [&](VkImage img) {
-      return to_remove.count(img) > 0;
-    }), all_swp_images.end());
+  GetGlobalContext().RemoveSwapchainImages(device, swp->AllImages());
 
   swp->Destroy(pAllocator);
   delete swp;
@@ -355,6 +404,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkGetSwapchainImagesKHR(
 VKAPI_ATTR VkResult VKAPI_CALL vkAcquireNextImageKHR(
     VkDevice device, VkSwapchainKHR swapchain, uint64_t timeout,
     VkSemaphore semaphore, VkFence fence, uint32_t* pImageIndex) {
+  TRACE_SCOPE("acquire");
   CallbackSwapchain* swp = reinterpret_cast<CallbackSwapchain*>(swapchain);
   if (!swp->GetImage(timeout, pImageIndex)) {
     return timeout == 0 ? VK_NOT_READY : VK_TIMEOUT;
@@ -392,6 +442,7 @@ vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
   // We submit to the queue the commands set up by the callback swapchain.
   // This will start a copy operation from the image to the swapchain
   // buffers.
+  TRACE_SCOPE("present");
   uint32_t res = VK_SUCCESS;
   std::vector<VkPipelineStageFlags> pipeline_stages(
       pPresentInfo->waitSemaphoreCount, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
@@ -400,6 +451,7 @@ vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
     CallbackSwapchain* swp =
         reinterpret_cast<CallbackSwapchain*>(pPresentInfo->pSwapchains[i]);
 
+    trace::Scope copy_submit("copy_submit");
     VkSubmitInfo submitInfo{
         VK_STRUCTURE_TYPE_SUBMIT_INFO,                     // sType
         nullptr,                                           // nullptr
@@ -412,9 +464,13 @@ vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
         nullptr                                            // pSemaphores
     };
 
-    res |= GetGlobalContext().GetQueueData(queue)->vkQueueSubmit(
+    VkResult submit_res = GetGlobalContext().GetQueueData(queue)->vkQueueSubmit(
         queue, 1, &submitInfo, swp->GetFence(image_index));
-    swp->NotifySubmitted(image_index);
+    if (submit_res != VK_SUCCESS) {
+      swp->CountFrame(FrameCounter::SUBMIT_FAILED);
+    }
+    res |= submit_res;
+    copy_submit.set_arg("frame", swp->NotifySubmitted(image_index));
   }
 
   return VkResult(res);
@@ -424,6 +480,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(VkQueue queue,
                                              uint32_t submitCount,
                                              const VkSubmitInfo* pSubmits,
                                              VkFence fence) {
+  TRACE_SCOPE("queue_submit");
   // We actually DO have to lock here, we may share this queue with
   // vkAcquireNextImageKHR, which is not externally synchronized on Queue.
   return GetGlobalContext().GetQueueData(queue)->vkQueueSubmit(
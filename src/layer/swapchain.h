@@ -24,6 +24,7 @@
 #ifndef LAYER_SWAPCHAIN_H_
 #define LAYER_SWAPCHAIN_H_
 
+#include <memory>
 #include <string>
 #include <vulkan/vulkan.h>
 #include <vulkan/vk_layer.h>
@@ -34,15 +35,23 @@
 #include <vulkan/vulkan_xcb.h>
 
 #include "layer.h"
+#include "stats/frame_stats.h"
+#include "window_title.h"
 
 
 namespace swapchain {
 
 struct CallbackSurface {
   std::string window_name;
+  // The X display the window is on, as DisplayString() names it.
+  std::string display;
   xcb_window_t window;
   xcb_connection_t* connection;
   VkSurfaceKHR backing_surface;
+  // Follows the window's title for the registry.
+  std::unique_ptr<WindowTitleWatcher> title;
+  // Stats outlive the surface's swapchains, so that they're per window.
+  FrameStats stats;
 };
 
 // RegisterInstance set up all of the swapchain related physical
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "window_title.h"
+
+#include <xcb/xcbext.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "utility.h"
+
+namespace {
+
+const uint64_t kRefreshNanos = 1'000'000'000;
+// The registry keeps 63 bytes of a title, so there's no use asking for more
+// than 64. Property lengths are in 32 bit words.
+const uint32_t kTitleWords = 16;
+
+xcb_intern_atom_cookie_t intern_atom(xcb_connection_t* connection,
+                                     const char* name) {
+  return xcb_intern_atom(connection, /*only_if_exists=*/0, strlen(name), name);
+}
+
+}  // namespace
+
+WindowTitleWatcher::WindowTitleWatcher(xcb_connection_t* connection,
+                                       xcb_window_t window)
+    : connection_(connection), window_(window) {
+  net_wm_name_atom_request_ = {
+      true, intern_atom(connection_, "_NET_WM_NAME").sequence};
+  utf8_string_atom_request_ = {
+      true, intern_atom(connection_, "UTF8_STRING").sequence};
+  xcb_flush(connection_);
+}
+
+WindowTitleWatcher::~WindowTitleWatcher() {
+  for (Request* request :
+       {&net_wm_name_atom_request_, &utf8_string_atom_request_,
+        &net_wm_name_request_, &wm_name_request_}) {
+    if (request->sent) {
+      xcb_discard_reply(connection_, request->sequence);
+    }
+  }
+}
+
+bool WindowTitleWatcher::poll(uint64_t* generation, std::string* title) {
+  std::lock_guard<std::mutex> lock(mu_);
+  update();
+  if (*generation == generation_) {
+    return false;
+  }
+  *generation = generation_;
+  *title = title_;
+  return true;
+}
+
+bool WindowTitleWatcher::take_reply(Request& request, void** reply) {
+  *reply = nullptr;
+  if (!request.sent) {
+    return true;
+  }
+  // Reads whatever the connection has buffered, without blocking.
+  xcb_generic_error_t* error = nullptr;
+  if (!xcb_poll_for_reply(connection_, request.sequence, reply, &error)) {
+    return false;
+  }
+  free(error);
+  request.sent = false;
+  return true;
+}
+
+bool WindowTitleWatcher::take_atom(Request& request, xcb_atom_t* atom) {
+  void* reply;
+  if (!take_reply(request, &reply)) {
+    return false;
+  }
+  if (reply) {
+    *atom = ((xcb_intern_atom_reply_t*)reply)->atom;
+    free(reply);
+  }
+  return true;
+}
+
+bool WindowTitleWatcher::take_property(Request& request, std::string* value) {
+  const bool sent = request.sent;
+  void* reply;
+  if (!take_reply(request, &reply)) {
+    return false;
+  }
+  if (sent) {
+    value->clear();
+  }
+  if (reply) {
+    xcb_get_property_reply_t* property = (xcb_get_property_reply_t*)reply;
+    value->assign((const char*)xcb_get_property_value(property),
+                  xcb_get_property_value_length(property));
+    free(reply);
+  }
+  return true;
+}
+
+void WindowTitleWatcher::request_title() {
+  if (net_wm_name_atom_ != XCB_ATOM_NONE) {
+    // Titles set in any other encoding are left to WM_NAME.
+    xcb_atom_t type = utf8_string_atom_ != XCB_ATOM_NONE
+                          ? utf8_string_atom_
+                          : (xcb_atom_t)XCB_GET_PROPERTY_TYPE_ANY;
+    net_wm_name_request_ = {
+        true, xcb_get_property(connection_, 0, window_, net_wm_name_atom_,
+                               type, 0, kTitleWords)
+                  .sequence};
+  }
+  wm_name_request_ = {
+      true, xcb_get_property(connection_, 0, window_, XCB_ATOM_WM_NAME,
+                             XCB_GET_PROPERTY_TYPE_ANY, 0, kTitleWords)
+                .sequence};
+  xcb_flush(connection_);
+}
+
+void WindowTitleWatcher::update() {
+  if (!take_atom(net_wm_name_atom_request_, &net_wm_name_atom_) ||
+      !take_atom(utf8_string_atom_request_, &utf8_string_atom_)) {
+    return;
+  }
+  if (!net_wm_name_request_.sent && !wm_name_request_.sent) {
+    if (now_nanos() >= refresh_nanos_) {
+      request_title();
+    }
+    return;
+  }
+  if (!take_property(net_wm_name_request_, &net_wm_name_) ||
+      !take_property(wm_name_request_, &wm_name_)) {
+    return;
+  }
+  const std::string& title = net_wm_name_.empty() ? wm_name_ : net_wm_name_;
+  if (title != title_) {
+    title_ = title;
+    generation_++;
+  }
+  refresh_nanos_ = now_nanos() + kRefreshNanos;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LAYER_WINDOW_TITLE_H_
+#define LAYER_WINDOW_TITLE_H_
+
+#include <xcb/xcb.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Follows an X window's title without ever waiting on the X server: requests
+// go out on the app's connection, and their replies are picked up by later
+// calls to poll(), from the swapchains' copy threads, once they've arrived.
+// Prefers the window's UTF-8 _NET_WM_NAME to its legacy WM_NAME, and asks
+// again every second, so retitled windows are followed.
+class WindowTitleWatcher {
+ public:
+  // Sends the first requests. 'connection' must outlive the watcher.
+  WindowTitleWatcher(xcb_connection_t* connection, xcb_window_t window);
+  // Discards the replies that haven't been picked up.
+  ~WindowTitleWatcher();
+
+  WindowTitleWatcher(const WindowTitleWatcher&) = delete;
+  WindowTitleWatcher& operator=(const WindowTitleWatcher&) = delete;
+
+  // Picks up the replies that have arrived, and asks for the title again if
+  // it's due. If the title changed since '*generation', which starts at 0,
+  // sets 'title' and '*generation' to the latest and returns true. Safe to
+  // call from several threads.
+  bool poll(uint64_t* generation, std::string* title);
+
+ private:
+  // A request whose reply hasn't been picked up.
+  struct Request {
+    bool sent = false;
+    unsigned int sequence = 0;
+  };
+
+  // Takes 'request's reply, or nullptr if it failed, into 'reply'. Returns
+  // false while the reply hasn't arrived.
+  bool take_reply(Request& request, void** reply);
+  bool take_atom(Request& request, xcb_atom_t* atom);
+  bool take_property(Request& request, std::string* value);
+  void request_title();
+  // Call with mu_ held.
+  void update();
+
+  xcb_connection_t* connection_;
+  const xcb_window_t window_;
+
+  std::mutex mu_;
+  Request net_wm_name_atom_request_;
+  Request utf8_string_atom_request_;
+  xcb_atom_t net_wm_name_atom_ = XCB_ATOM_NONE;
+  xcb_atom_t utf8_string_atom_ = XCB_ATOM_NONE;
+  Request net_wm_name_request_;
+  Request wm_name_request_;
+  std::string net_wm_name_;
+  std::string wm_name_;
+  // CLOCK_MONOTONIC nanoseconds when the title is next asked for.
+  uint64_t refresh_nanos_ = 0;
+  std::string title_;
+  // Bumped whenever title_ changes.
+  uint64_t generation_ = 0;
+};
+
+#endif  // LAYER_WINDOW_TITLE_H_
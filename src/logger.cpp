@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "logger.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ipc/futex.h"
+
+namespace logger {
+namespace {
+
+// TODO: Consider making out file controllable.
+const int kFd = STDOUT_FILENO;
+
+// How long the flush thread lets a batch of messages build up once one is
+// logged, and how long it sleeps without any, in case a wakeup was missed.
+const uint64_t kFlushIntervalNanos = 5'000'000;
+const uint64_t kIdleTimeoutNanos = 1'000'000'000;
+
+// Records are fixed size so that a thread's ring is a single allocation.
+// Longer messages are truncated.
+const size_t kRecordSize = 512;
+// Must be a power of two.
+const size_t kRingRecords = 256;
+
+struct Record {
+  timespec time;
+  pid_t tid;
+  uint32_t length;
+  char message[kRecordSize - sizeof(timespec) - sizeof(pid_t) -
+               sizeof(uint32_t)];
+};
+static_assert(sizeof(Record) == kRecordSize, "Unexpected Record padding");
+
+// A single producer, single consumer ring of log records. The owning thread
+// writes at head and the flush thread reads at tail.
+struct Ring {
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  // Set when the owning thread exits. The flush thread frees retired rings
+  // once they're drained.
+  std::atomic<bool> retired{false};
+  std::atomic<uint64_t> dropped{0};
+  Record records[kRingRecords];
+};
+
+struct State {
+  // Protects rings.
+  std::mutex rings_mu;
+  std::vector<Ring*> rings;
+  // Serializes draining between the flush thread and flush().
+  std::mutex drain_mu;
+  std::atomic<bool> started{false};
+  // Futex words the flush thread sleeps on. 'idle' is 1 while it waits for
+  // the first message of a batch, and 'urgent' is set by a thread whose ring
+  // is filling up before the batch is due. Producers only make a syscall to
+  // wake the flush thread when they clear one of them.
+  uint32_t idle = 0;
+  uint32_t urgent = 0;
+};
+
+// To avoid bad cleanup, we never free the logger state. Log calls can come
+// from any thread during static initialization and destruction, so it's
+// created on first use rather than by a global initializer.
+State*& state() {
+  static State* state = new State();
+  return state;
+}
+
+struct RingHolder {
+  Ring* ring = nullptr;
+  ~RingHolder() {
+    if (ring) {
+      ring->retired.store(true, std::memory_order_release);
+      // The main thread's thread locals are destroyed before atexit handlers
+      // run, and those may still log. They'll get a fresh ring.
+      ring = nullptr;
+    }
+  }
+};
+
+thread_local RingHolder ring_holder;
+thread_local pid_t thread_id = 0;
+
+// Returns the local date and time of the given second. Formatting the date is
+// slow, so we cache it for the current second. Must be called with drain_mu
+// held.
+const char* format_date(time_t sec) {
+  static time_t cached_sec = -1;
+  static char cached_date[32];
+  if (sec != cached_sec) {
+    tm local_time;
+    localtime_r(&sec, &local_time);
+    strftime(cached_date, sizeof(cached_date), "%Y/%m/%d %H:%M:%S",
+             &local_time);
+    cached_sec = sec;
+  }
+  return cached_date;
+}
+
+// Formats the given record's "<date> [tid: <tid>] " prefix into 'prefix'.
+// Must be called with drain_mu held.
+size_t format_prefix(const Record& record, char* prefix, size_t size) {
+  int len = snprintf(prefix, size, "%s.%06ld [tid: %d] ",
+                     format_date(record.time.tv_sec),
+                     record.time.tv_nsec / 1000, record.tid);
+  if (len < 0) {
+    return 0;
+  }
+  return std::min((size_t)len, size - 1);
+}
+
+// Writes out every record that's been published to the given ring. Must be
+// called with drain_mu held.
+void drain_ring(Ring& ring) {
+  const size_t kBatch = 32;
+  static char prefixes[kBatch][64];
+  static char dropped_s[64];
+  iovec writes[kBatch * 3 + 1];
+
+  uint64_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped) {
+    int len = snprintf(dropped_s, sizeof(dropped_s),
+                       "[logger: dropped %lu messages]\n", (unsigned long)dropped);
+    if (len > 0) {
+      (void)!write(kFd, dropped_s, len);
+    }
+  }
+
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  uint64_t head = ring.head.load(std::memory_order_acquire);
+  while (tail != head) {
+    size_t n_writes = 0;
+    uint64_t batch_end = tail;
+    for (size_t i = 0; i < kBatch && batch_end != head; ++i, ++batch_end) {
+      const Record& record = ring.records[batch_end & (kRingRecords - 1)];
+      size_t prefix_len =
+          format_prefix(record, prefixes[i], sizeof(prefixes[i]));
+      writes[n_writes++] = {prefixes[i], prefix_len};
+      writes[n_writes++] = {const_cast<char*>(record.message), record.length};
+      writes[n_writes++] = {const_cast<char*>("\n"), 1};
+    }
+    (void)!writev(kFd, writes, n_writes);
+    tail = batch_end;
+    ring.tail.store(tail, std::memory_order_release);
+  }
+}
+
+// Must be called with drain_mu held.
+void drain_all_locked() {
+  std::lock_guard<std::mutex> rings_lock(state()->rings_mu);
+  for (auto it = state()->rings.begin(); it != state()->rings.end();) {
+    Ring* ring = *it;
+    // Check retired before draining, so that we never free a ring with
+    // records published after the drain.
+    bool retired = ring->retired.load(std::memory_order_acquire);
+    drain_ring(*ring);
+    if (retired) {
+      delete ring;
+      it = state()->rings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void drain_all() {
+  std::lock_guard<std::mutex> drain_lock(state()->drain_mu);
+  drain_all_locked();
+}
+
+// Writes out the given record straight away, after everything buffered
+// before it.
+void write_now(const Record& record) {
+  char prefix[64];
+  std::lock_guard<std::mutex> drain_lock(state()->drain_mu);
+  drain_all_locked();
+  iovec writes[3] = {
+      {prefix, format_prefix(record, prefix, sizeof(prefix))},
+      {const_cast<char*>(record.message), record.length},
+      {const_cast<char*>("\n"), 1},
+  };
+  (void)!writev(kFd, writes, 3);
+}
+
+// Whether any ring has records left to drain.
+bool pending() {
+  std::lock_guard<std::mutex> rings_lock(state()->rings_mu);
+  for (Ring* ring : state()->rings) {
+    if (ring->head.load(std::memory_order_relaxed) !=
+        ring->tail.load(std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void flush_thread_func() {
+  while (true) {
+    // Sleeps until a message is logged. Setting 'idle' before checking the
+    // rings pairs with log() publishing before checking 'idle', so either
+    // we see the message or its thread sees us idle and wakes us.
+    __atomic_store_n(&state()->idle, 1, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pending()) {
+      futex_wait(&state()->idle, 1, kIdleTimeoutNanos);
+    }
+    __atomic_store_n(&state()->idle, 0, __ATOMIC_RELAXED);
+
+    // Lets the rest of the batch arrive, unless a ring is filling up.
+    futex_wait(&state()->urgent, 0, kFlushIntervalNanos);
+    __atomic_store_n(&state()->urgent, 0, __ATOMIC_RELAXED);
+    drain_all();
+  }
+}
+
+void start_flush_thread();
+
+// After a fork only the forking thread exists in the child. Its ring and the
+// other threads' rings belong to the parent's logger, so the child starts a
+// fresh one.
+void reset_after_fork() {
+  state() = new State();
+  ring_holder.ring = nullptr;
+  thread_id = 0;
+}
+
+void start_flush_thread() {
+  bool expected = false;
+  if (!state()->started.compare_exchange_strong(expected, true)) {
+    return;
+  }
+  static std::once_flag once;
+  std::call_once(once, []() {
+    atexit(flush);
+    pthread_atfork(nullptr, nullptr, reset_after_fork);
+  });
+  std::thread(flush_thread_func).detach();
+}
+
+Ring& thread_ring() {
+  if (!ring_holder.ring) {
+    start_flush_thread();
+    Ring* ring = new Ring();
+    {
+      std::lock_guard<std::mutex> lock(state()->rings_mu);
+      state()->rings.push_back(ring);
+    }
+    ring_holder.ring = ring;
+  }
+  return *ring_holder.ring;
+}
+
+bool channel_listed(const char* list, const char* name) {
+  size_t name_len = strlen(name);
+  const char* p = list;
+  while (*p) {
+    const char* end = strchr(p, ',');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len == name_len && strncmp(p, name, len) == 0) {
+      return true;
+    }
+    if (!end) {
+      break;
+    }
+    p = end + 1;
+  }
+  return false;
+}
+
+// Fills in the given record, truncating the message if needed.
+void format_record(Record& record, const char* fmt, va_list args) {
+  if (!thread_id) {
+    thread_id = gettid();
+  }
+  clock_gettime(CLOCK_REALTIME, &record.time);
+  record.tid = thread_id;
+  int len = vsnprintf(record.message, sizeof(record.message), fmt, args);
+  if (len < 0) {
+    len = 0;
+  } else if ((size_t)len >= sizeof(record.message)) {
+    len = sizeof(record.message) - 1;
+  }
+  record.length = len;
+}
+
+}  // namespace
+
+bool resolve_channel(Channel& channel) {
+  const char* channels_env = std::getenv("VKVFB_LOG_CHANNELS");
+  bool enabled = !channels_env || &channel == &kLogError ||
+                 channel_listed(channels_env, channel.name);
+  channel.enabled.store(enabled, std::memory_order_relaxed);
+  return enabled;
+}
+
+void log(Channel& channel, const char* fmt, ...) {
+  if (!channel_enabled(channel)) {
+    return;
+  }
+
+  // Errors are rare, and are often the last thing a process logs before it
+  // dies, so they don't wait for the flush thread.
+  if (&channel == &kLogError) {
+    Record record;
+    va_list args;
+    va_start(args, fmt);
+    format_record(record, fmt, args);
+    va_end(args);
+    write_now(record);
+    return;
+  }
+
+  Ring& ring = thread_ring();
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  uint64_t tail = ring.tail.load(std::memory_order_acquire);
+  if (head - tail >= kRingRecords) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Record& record = ring.records[head & (kRingRecords - 1)];
+  va_list args;
+  va_start(args, fmt);
+  format_record(record, fmt, args);
+  va_end(args);
+
+  ring.head.store(head + 1, std::memory_order_release);
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (__atomic_load_n(&state()->idle, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&state()->idle, 0, __ATOMIC_RELAXED)) {
+    futex_wake_all(&state()->idle);
+  } else if (head + 1 - tail >= kRingRecords / 2 &&
+             !__atomic_load_n(&state()->urgent, __ATOMIC_RELAXED) &&
+             !__atomic_exchange_n(&state()->urgent, 1, __ATOMIC_RELAXED)) {
+    futex_wake_all(&state()->urgent);
+  }
+}
+
+void flush() { drain_all(); }
+
+}  // namespace logger
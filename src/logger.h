@@ -17,83 +17,65 @@
 #ifndef LOGGER_H_
 #define LOGGER_H_
 
-#include <cstdarg>
-#include <cstdio>
-#include <ctime>
-#include <mutex>
-#include <sys/uio.h>
-#include <unistd.h>
-#include <sys/types.h>
-
-inline const char* kLogLayer = "LAYER";
-inline const char* kLogSync = "SYNC";
-inline const char* kLogError = "ERROR";
+#include <atomic>
 
 namespace logger {
 
-// TODO: Consider making out file controllable.
-
-inline std::mutex mu;
-inline int fd = STDOUT_FILENO;
-
-inline void log(const char* channel, const char* fmt, ...) {
-  va_list args;
-  va_start(args, fmt);
-
-  // TODO: Consider implementing channel filtering.
-
-  timespec time;
-  clock_gettime(CLOCK_REALTIME, &time);
-
-  tm local_time;
-  localtime_r(&time.tv_sec, &local_time);
-
-  char time_s[64];
-  int time_slen = snprintf(
-    time_s,
-    64,
-    "%d/%02d/%02d %02d:%02d:%02d.%06ld",
-    local_time.tm_year + 1900,
-    local_time.tm_mon + 1,
-    local_time.tm_mday,
-    local_time.tm_hour,
-    local_time.tm_min,
-    local_time.tm_sec,
-    time.tv_nsec / 1000
-  );
-  if (time_slen < 0) {
-    perror("snprintf for time string.");
-    time_slen = 0;
+// A named log channel. Whether a channel is enabled is resolved from the
+// VKVFB_LOG_CHANNELS environment variable the first time it's logged to.
+//
+// VKVFB_LOG_CHANNELS is a comma separated list of channel names, e.g.
+// "LAYER,SYNC". If it's unset, all channels are enabled. ERROR is always
+// enabled.
+struct Channel {
+  const char* name;
+  // -1 until resolved, then 0 (disabled) or 1 (enabled).
+  std::atomic<int> enabled{-1};
+};
+
+bool resolve_channel(Channel& channel);
+
+inline bool channel_enabled(Channel& channel) {
+  int enabled = channel.enabled.load(std::memory_order_relaxed);
+  if (enabled >= 0) {
+    return enabled;
   }
+  return resolve_channel(channel);
+}
 
-  char process_s[32];
-  int process_slen = snprintf(process_s, 32, " [tid: %d] ", gettid());
-  if (process_slen < 0) {
-    perror("snprintf for process string.");
-    process_slen = 0;
-  }
+// Logs a printf style message to the given channel.
+//
+// The message is formatted into a per-thread ring buffer and written out later
+// by a background thread, so logging never takes a lock, and only makes a
+// syscall beyond clock_gettime to wake that thread, at most once per batch of
+// messages. If a thread's ring buffer is full, its messages are dropped and the
+// drop is reported once there's space.
+//
+// ERROR messages are the exception: they're written synchronously, after any
+// buffered messages, so they're never dropped or lost if the process dies.
+void log(Channel& channel, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
 
-  char log_s[2048];
-  int log_slen = vsnprintf(log_s, 2048, fmt, args);
-  if (log_slen < 0) {
-    perror("snprintf for log string.");
-    log_slen = 0;
-  }
+// Synchronously writes out all buffered log messages. Called at exit.
+void flush();
 
-  std::lock_guard<std::mutex> lock(mu);
-  iovec writes[4] = {
-    {time_s, (size_t)time_slen},
-    {process_s, (size_t)process_slen},
-    {log_s, (size_t)log_slen},
-    {const_cast<char*>("\n"), (size_t)1},
-  };
-  writev(fd, writes, 4);
+}  // namespace logger
 
-  va_end(args);
-}
-}
+inline logger::Channel kLogLayer{"LAYER"};
+inline logger::Channel kLogSync{"SYNC"};
+inline logger::Channel kLogError{"ERROR"};
 
 #define LOG(...) ::logger::log(__VA_ARGS__)
 #define ERROR(...) ::logger::log(kLogError, __VA_ARGS__)
 
+// Use LOG_HOT for call sites on per-frame or per-resize paths. They compile
+// out entirely unless the build defines VKVFB_HOT_LOGS (meson -Dhot_logs=true).
+#ifdef VKVFB_HOT_LOGS
+#define LOG_HOT(...) ::logger::log(__VA_ARGS__)
+#else
+#define LOG_HOT(...) \
+  do {               \
+  } while (0)
+#endif
+
 #endif // LOGGER_H_
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_ring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ipc/futex.h"
+#include "ipc/shared_segment.h"
+#include "logger.h"
+#include "naming.h"
+#include "pixbuf_data.h"
+#include "trace/trace.h"
+#include "utility.h"
+
+namespace {
+
+// How often a blocked writer rechecks its readers even if none has read a
+// frame, to free the cursors of readers that died.
+const uint64_t kDeadReaderCheckNanos = 100'000'000;
+
+}  // namespace
+
+RingOptions RingOptions::from_env() {
+  RingOptions options;
+  const char* frames_env = std::getenv("VKVFB_RING_FRAMES");
+  if (frames_env && *frames_env) {
+    char* end;
+    long frames = strtol(frames_env, &end, 10);
+    if (*end || frames < 0 || frames > UINT32_MAX) {
+      ERROR("Ignoring invalid VKVFB_RING_FRAMES '%s'", frames_env);
+    } else {
+      options.frames = frames;
+    }
+  }
+  const char* policy_env = std::getenv("VKVFB_RING_POLICY");
+  if (policy_env && *policy_env) {
+    if (strcmp(policy_env, "block") == 0) {
+      options.policy = RingPolicy::BLOCK;
+    } else if (strcmp(policy_env, "drop_oldest") != 0) {
+      ERROR("Ignoring unknown VKVFB_RING_POLICY '%s'", policy_env);
+    }
+  }
+  options.huge_pages = huge_pages_from_env();
+  return options;
+}
+
+// --- FrameRingWriter ---
+
+StatusOr<FrameRingWriter> FrameRingWriter::Create(const std::string& path,
+                                                  const RingOptions& options) {
+  if (options.frames == 0) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  // A ring left by an earlier swapchain keeps its frame numbers and readers.
+  // Every update to the header leaves it consistent, so a writer that died
+  // holding the lock only lost the frame it was writing.
+  StatusOr<SharedSegment> segment = open_shared_segment(
+      path + "_ring", FrameRingData::kSlotsOffset, options.huge_pages,
+      [](const void* header) {
+        return ((const FrameRingData*)header)->capacity != 0;
+      },
+      [&](Shm& shm, bool) {
+        FrameRingData* data = (FrameRingData*)shm.map();
+        if (data->capacity == 0) {
+          data = new (shm.map()) FrameRingData();
+        } else if (data->capacity != options.frames) {
+          data->oldest = data->next;
+        }
+        data->capacity = options.frames;
+        data->policy = options.policy;
+        shm.resize(std::max(data->shm_size(), shm.size()));
+      });
+  RETURN_IF_ERROR(segment);
+  return FrameRingWriter(std::move(segment->mu), std::move(segment->shm),
+                         options);
+}
+
+FrameRingWriter::FrameRingWriter(ShmMutex&& mu, Shm&& shm,
+                                 const RingOptions& options)
+    : mu_(std::move(mu)),
+      shm_(std::move(shm)),
+      data_((FrameRingData*)shm_.map()),
+      options_(options) {}
+
+uint64_t FrameRingWriter::slowest_reader() {
+  uint64_t slowest = data_->next;
+  for (FrameRingData::Cursor& cursor : data_->cursors) {
+    if (cursor.pid == 0) {
+      continue;
+    }
+    if (!pid_alive(cursor.pid)) {
+      LOG(kLogSync, "Freeing ring cursor of dead reader %d", cursor.pid);
+      cursor.pid = 0;
+      continue;
+    }
+    slowest = std::min(slowest, cursor.next);
+  }
+  return slowest;
+}
+
+WriteResult FrameRingWriter::write_pixels(const uint8_t* pixels, int32_t width,
+                                          int32_t height, bool force_opaque) {
+  if (width <= 0 || height <= 0) {
+    return WriteResult::EMPTY;
+  }
+  TRACE_SCOPE("ring_write");
+
+  const uint64_t deadline = now_nanos() + options_.block_timeout_nanos;
+  while (true) {
+    uint32_t reads;
+    {
+      trace::Scope lock_wait("writer_lock_wait");
+      LockResult res = mu_.mu().lock(2 * kOneSecNanos);
+      lock_wait.end();
+      if (res.state == LockState::OWNERDEAD) {
+        mu_.mu().reset();
+        return WriteResult::OWNER_DEAD;
+      } else if (res.state == LockState::TIMEOUT) {
+        return WriteResult::LOCK_TIMEOUT;
+      }
+
+      bool resized = width != data_->width || height != data_->height;
+      bool full = false;
+      if (data_->policy == RingPolicy::BLOCK) {
+        // Resizing drops every held frame, so it waits for readers to drain
+        // them all, while a plain write only needs the oldest slot free.
+        uint64_t slowest = slowest_reader();
+        full = resized ? slowest < data_->next
+                       : data_->next - slowest >= data_->capacity;
+      }
+
+      if (full) {
+        // Readers wake us once they've read a frame, with the ring locked,
+        // so none can be missed between here and the wait below.
+        reads = data_->reads;
+        data_->writer_blocked = 1;
+      } else {
+        data_->writer_blocked = 0;
+        if (resized) {
+          size_t slot_size =
+              round_to_page(PixbufData::pixbuf_size(width, height));
+          data_->width = width;
+          data_->height = height;
+          data_->slot_size = std::max(data_->slot_size, slot_size);
+          data_->oldest = data_->next;
+          if (data_->shm_size() > shm_.size()) {
+            shm_.resize(data_->shm_size());
+            data_ = (FrameRingData*)shm_.map();
+          }
+        }
+        uint64_t frame = data_->next;
+        {
+          TRACE_SCOPE("writer_memcpy", "frame", frame);
+          PixbufData::copy_pixels(data_->slot(frame), pixels,
+                                  PixbufData::pixbuf_size(width, height),
+                                  force_opaque);
+        }
+        if (frame + 1 - data_->oldest > data_->capacity) {
+          data_->oldest = frame + 1 - data_->capacity;
+        }
+        __atomic_store_n(&data_->next, frame + 1, __ATOMIC_RELEASE);
+        futex_wake_all(data_->next_futex());
+        return WriteResult::PUBLISHED;
+      }
+    }
+
+    uint64_t now = now_nanos();
+    if (now >= deadline) {
+      return WriteResult::RING_FULL;
+    }
+    TRACE_SCOPE("ring_blocked");
+    futex_wait(&data_->reads, reads,
+               std::min(deadline - now, kDeadReaderCheckNanos));
+  }
+}
+
+// --- FrameRingReader ---
+
+StatusOr<FrameRingReader> FrameRingReader::Create(const std::string& path,
+                                                  bool drain) {
+  const std::string name = resolve_pixbuf_name(path);
+  StatusOr<ShmMutex> mu_result =
+      ShmMutex::Create(name + "_ring_mu", /*create=*/false);
+  RETURN_IF_ERROR(mu_result);
+
+  StatusOr<Shm> shm_result =
+      Shm::Create(name + "_ring", 'r', FrameRingData::kSlotsOffset,
+                  huge_pages_from_env());
+  RETURN_IF_ERROR(shm_result);
+
+  int32_t cursor = -1;
+  if (drain) {
+    LockResult lock = mu_result->mu().lock(kOneSecNanos);
+    if (lock.state != LockState::LOCKED) {
+      return StatusVal(ErrorCode::GENERAL);
+    }
+    FrameRingData* data = (FrameRingData*)shm_result->map();
+    for (uint32_t i = 0; i < FrameRingData::kMaxReaders; ++i) {
+      FrameRingData::Cursor& c = data->cursors[i];
+      if (c.pid == 0 || !pid_alive(c.pid)) {
+        c.pid = getpid();
+        c.next = data->oldest;
+        cursor = i;
+        break;
+      }
+    }
+    if (cursor == -1) {
+      ERROR("All %u of %s's ring cursors are taken",
+            FrameRingData::kMaxReaders, path.c_str());
+      return StatusVal(ErrorCode::GENERAL);
+    }
+  }
+  return FrameRingReader(std::move(*mu_result), std::move(*shm_result),
+                         cursor);
+}
+
+FrameRingReader::FrameRingReader(ShmMutex&& mu, Shm&& shm, int32_t cursor)
+    : mu_(std::move(mu)), shm_(std::move(shm)), cursor_(cursor) {
+  data_ = (FrameRingData*)shm_.map();
+}
+
+FrameRingReader::~FrameRingReader() { release_cursor(); }
+
+void FrameRingReader::release_cursor() {
+  if (cursor_ == -1) {
+    return;
+  }
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  if (lock.state == LockState::LOCKED) {
+    data_->cursors[cursor_].pid = 0;
+    data_->notify_read();
+  }
+  cursor_ = -1;
+}
+
+FrameRingReader::FrameRingReader(FrameRingReader&& other) noexcept
+    : mu_(std::move(other.mu_)),
+      shm_(std::move(other.shm_)),
+      data_(other.data_),
+      cursor_(other.cursor_),
+      missed_(other.missed_) {
+  other.data_ = nullptr;
+  other.cursor_ = -1;
+}
+
+FrameRingReader& FrameRingReader::operator=(FrameRingReader&& other) noexcept {
+  if (this != &other) {
+    release_cursor();
+    mu_ = std::move(other.mu_);
+    shm_ = std::move(other.shm_);
+    data_ = other.data_;
+    cursor_ = other.cursor_;
+    missed_ = other.missed_;
+    other.data_ = nullptr;
+    other.cursor_ = -1;
+  }
+  return *this;
+}
+
+void FrameRingReader::remap() {
+  if (data_->shm_size() != shm_.size()) {
+    shm_.resize(data_->shm_size());
+    data_ = (FrameRingData*)shm_.map();
+  }
+}
+
+FrameInfo FrameRingReader::read_next(uint8_t* dst, size_t capacity) {
+  TRACE_SCOPE("ring_read_next");
+  FrameInfo info;
+  if (cursor_ == -1) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  trace::Scope lock_wait("reader_lock_wait");
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  lock_wait.end();
+  if (lock.state != LockState::LOCKED) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  remap();
+
+  FrameRingData::Cursor& cursor = data_->cursors[cursor_];
+  if (cursor.next < data_->oldest) {
+    missed_ += data_->oldest - cursor.next;
+    cursor.next = data_->oldest;
+  }
+  if (cursor.next == data_->next) {
+    info.code = ErrorCode::NOT_FOUND;
+    return info;
+  }
+
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = cursor.next;
+  info.stride = PixbufData::pixbuf_size(info.width, 1);
+  size_t size = PixbufData::pixbuf_size(info.width, info.height);
+  if (size > capacity) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  {
+    TRACE_SCOPE("reader_copy", "frame", info.sequence);
+    memcpy(dst, data_->slot(cursor.next), size);
+  }
+  cursor.next++;
+  data_->notify_read();
+  return info;
+}
+
+FrameInfo FrameRingReader::read_latest(int32_t count, uint8_t* dst,
+                                       size_t capacity, int32_t* copied) {
+  TRACE_SCOPE("ring_read_latest");
+  FrameInfo info;
+  *copied = 0;
+  trace::Scope lock_wait("reader_lock_wait");
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  lock_wait.end();
+  if (lock.state != LockState::LOCKED) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  remap();
+
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = data_->next - 1;
+  info.stride = PixbufData::pixbuf_size(info.width, 1);
+  uint64_t held = data_->next - data_->oldest;
+  int32_t n = (int32_t)std::min<uint64_t>(std::max(count, 0), held);
+  size_t size = PixbufData::pixbuf_size(info.width, info.height);
+  if (size * n > capacity) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  TRACE_SCOPE("reader_copy", "frame", info.sequence);
+  for (int32_t i = 0; i < n; ++i) {
+    memcpy(dst + i * size, data_->slot(data_->next - n + i), size);
+  }
+  *copied = n;
+  return info;
+}
+
+bool FrameRingReader::wait_for_frame(uint64_t timeout_nanos) {
+  TRACE_SCOPE("ring_wait_for_frame");
+  if (cursor_ == -1) {
+    return false;
+  }
+  uint64_t after;
+  {
+    LockResult lock = mu_.mu().lock(kOneSecNanos);
+    if (lock.state != LockState::LOCKED) {
+      return false;
+    }
+    after = data_->cursors[cursor_].next;
+  }
+  // Only this reader remaps data_, so we can wait on 'next' without the lock.
+  // Writers wake its futex after every frame.
+  const uint64_t start = now_nanos();
+  while (true) {
+    uint64_t next = __atomic_load_n(&data_->next, __ATOMIC_ACQUIRE);
+    if (next != after) {
+      return true;
+    }
+    uint64_t elapsed = now_nanos() - start;
+    if (elapsed >= timeout_nanos) {
+      return false;
+    }
+    futex_wait(data_->next_futex(), (uint32_t)next, timeout_nanos - elapsed);
+  }
+}
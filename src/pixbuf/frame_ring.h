@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_FRAME_RING_H_
+#define PIXBUF_FRAME_RING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "constants.h"
+#include "ipc/futex.h"
+#include "ipc/shm.h"
+#include "ipc/shm_mutex.h"
+#include "pixbuf/pixbuf_reader.h"
+#include "pixbuf/pixbuf_writer.h"
+#include "status_or.h"
+
+// A frame ring is an opt-in queue of a window's last few frames, published
+// next to its pixbuf in a shm named '<window>_ring'. Where the pixbuf only
+// holds the latest frame, the ring holds up to 'capacity' of them, and every
+// draining reader has its own cursor, so recorders can read every frame in
+// order.
+
+// What the writer does when the next frame would overwrite one a draining
+// reader hasn't read yet.
+enum class RingPolicy : uint32_t {
+  // Overwrites the oldest frame. The reader notices and counts it as missed.
+  DROP_OLDEST = 0,
+  // Waits for every draining reader to read the oldest frame, up to the
+  // options' block timeout, then drops the new frame instead.
+  BLOCK,
+};
+
+struct RingOptions {
+  // The number of frames the ring holds, or 0 for no ring.
+  uint32_t frames = 0;
+  RingPolicy policy = RingPolicy::DROP_OLDEST;
+  // How long a BLOCK ring waits for readers before dropping a frame. Long
+  // stalls freeze the app, so this is bounded even when blocking.
+  uint64_t block_timeout_nanos = 2 * kOneSecNanos;
+  HugePages huge_pages = HugePages::OFF;
+
+  // Reads VKVFB_RING_FRAMES, VKVFB_RING_POLICY ("drop_oldest" or "block") and
+  // VKVFB_HUGE_PAGES.
+  static RingOptions from_env();
+};
+
+// The layout of a ring's shm. The header is followed, at kSlotsOffset, by
+// 'capacity' slots of 'slot_size' bytes. Frames are numbered from 1, and frame
+// n lives in slot (n - 1) % capacity. All fields are protected by the ring's
+// mutex, though 'next' is also read atomically by waiting readers.
+struct FrameRingData {
+  static const uint32_t kMaxReaders = 8;
+  static const size_t kSlotsOffset = 4096;
+
+  uint32_t capacity = 0;
+  RingPolicy policy = RingPolicy::DROP_OLDEST;
+  // The size of every frame in the ring. Frames of another size reset it.
+  int32_t width = 0;
+  int32_t height = 0;
+  uint64_t slot_size = 0;
+  // The ring holds frames [oldest, next).
+  uint64_t oldest = 1;
+  uint64_t next = 1;
+
+  // A draining reader's position: the next frame it'll read. Entries with a
+  // pid of 0 are free.
+  struct Cursor {
+    int32_t pid;
+    uint64_t next;
+  };
+  Cursor cursors[kMaxReaders] = {};
+
+  // Counts frames read by draining readers, and cursors they release. It's
+  // the futex word a writer blocked by a full BLOCK ring sleeps on, and
+  // 'writer_blocked' is set while it does, so readers only make a syscall to
+  // wake it when it's waiting.
+  uint32_t reads = 0;
+  uint32_t writer_blocked = 0;
+
+  // The futex word writers wake after every frame: the low half of 'next'.
+  uint32_t* next_futex() { return (uint32_t*)&next; }
+
+  // Called with the ring's mutex held, after a draining reader advances or
+  // releases its cursor.
+  void notify_read() {
+    __atomic_store_n(&reads, reads + 1, __ATOMIC_RELEASE);
+    if (writer_blocked) {
+      writer_blocked = 0;
+      futex_wake_all(&reads);
+    }
+  }
+
+  uint8_t* slot(uint64_t frame) {
+    return (uint8_t*)this + kSlotsOffset + ((frame - 1) % capacity) * slot_size;
+  }
+  size_t shm_size() const { return kSlotsOffset + capacity * slot_size; }
+};
+static_assert(sizeof(FrameRingData) <= FrameRingData::kSlotsOffset,
+              "FrameRingData's header must fit before its slots");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "FrameRingData::next_futex() assumes little endian");
+
+class FrameRingWriter {
+ public:
+  // Creates the ring for the window at 'path', or takes over the one an
+  // earlier swapchain of the window left, keeping its readers.
+  // Returns GENERAL if 'options' has no frames.
+  static StatusOr<FrameRingWriter> Create(const std::string& path,
+                                          const RingOptions& options);
+
+  // Appends a frame to the ring. A frame of a new size first drops the ring's
+  // frames, after waiting for readers to drain them if the policy is BLOCK.
+  // Returns RING_FULL if a BLOCK ring timed out waiting for readers.
+  WriteResult write_pixels(const uint8_t* pixels, int32_t width,
+                           int32_t height, bool force_opaque = false);
+
+ private:
+  // Private constructor, use Create() instead.
+  FrameRingWriter(ShmMutex&& mu, Shm&& shm, const RingOptions& options);
+
+  // Returns the next frame of the slowest live draining reader, or 'next' if
+  // there are none. Frees cursors whose process has died.
+  uint64_t slowest_reader();
+
+  // Protects shm_ and data_.
+  ShmMutex mu_;
+  Shm shm_;
+  FrameRingData* data_;
+  RingOptions options_;
+};
+
+class FrameRingReader {
+ public:
+  // Opens the ring for the window at 'path'. A draining reader takes a cursor
+  // starting at the ring's oldest frame, and with the BLOCK policy the writer
+  // waits for it. A non-draining reader only supports read_latest(). Returns
+  // NOT_FOUND if there's no ring, or GENERAL if every cursor is taken.
+  static StatusOr<FrameRingReader> Create(const std::string& path,
+                                          bool drain = true);
+
+  // Releases the reader's cursor.
+  ~FrameRingReader();
+
+  // FrameRingReader is moveable, but not copyable.
+  FrameRingReader(const FrameRingReader&) = delete;
+  FrameRingReader& operator=(const FrameRingReader&) = delete;
+  FrameRingReader(FrameRingReader&& other) noexcept;
+  FrameRingReader& operator=(FrameRingReader&& other) noexcept;
+
+  // Copies the oldest frame this reader hasn't read into 'dst' as tightly
+  // packed RGBA rows, and advances past it. The returned sequence is the
+  // frame's number in the ring. Returns NOT_FOUND if there's no unread frame,
+  // and GENERAL if the lock timed out, the reader isn't draining, or the frame
+  // doesn't fit in 'capacity' bytes, in which case its size is filled in and
+  // the reader doesn't advance.
+  FrameInfo read_next(uint8_t* dst, size_t capacity);
+
+  // Copies up to 'count' of the newest frames into 'dst', oldest first, one
+  // every width*height*4 bytes, for frame stacking. Sets 'copied' to the
+  // number of frames copied and returns the newest one's info. Doesn't move
+  // the reader's cursor. Returns GENERAL if the frames don't fit.
+  FrameInfo read_latest(int32_t count, uint8_t* dst, size_t capacity,
+                        int32_t* copied);
+
+  // Waits up to 'timeout_nanos' for a frame this reader hasn't read. Returns
+  // whether there is one.
+  bool wait_for_frame(uint64_t timeout_nanos);
+
+  // The number of frames that were dropped before this reader read them.
+  uint64_t missed() const { return missed_; }
+
+ private:
+  // Private constructor, use Create() instead.
+  FrameRingReader(ShmMutex&& mu, Shm&& shm, int32_t cursor);
+
+  // Maps the whole ring, which grows when the frame size does. Call with mu_
+  // held.
+  void remap();
+  // Frees the reader's cursor, if it has one.
+  void release_cursor();
+
+  // Protects shm_ and data_.
+  ShmMutex mu_;
+  Shm shm_;
+  FrameRingData* data_;
+  // The index of this reader's cursor, or -1 if it isn't draining.
+  int32_t cursor_;
+  uint64_t missed_ = 0;
+};
+
+#endif  // PIXBUF_FRAME_RING_H_
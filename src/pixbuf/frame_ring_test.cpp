@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+#include "utility.h"
+
+namespace {
+
+const int32_t kWidth = 16;
+const int32_t kHeight = 8;
+const size_t kFrameSize = kWidth * kHeight * 4;
+
+// Creates a fresh ring, dropping any left by an earlier run.
+FrameRingWriter make_writer(uint32_t frames, RingPolicy policy,
+                            uint64_t block_timeout_nanos = kOneSecNanos) {
+  remove_shared_segment("test_ring_ring");
+  RingOptions options;
+  options.frames = frames;
+  options.policy = policy;
+  options.block_timeout_nanos = block_timeout_nanos;
+  return created_or_die(FrameRingWriter::Create("test_ring", options));
+}
+
+FrameRingReader make_reader(bool drain = true) {
+  return created_or_die(FrameRingReader::Create("test_ring", drain));
+}
+
+// Writes a frame filled with 'value'.
+WriteResult write_frame(FrameRingWriter& writer, uint8_t value) {
+  std::vector<uint8_t> frame(kFrameSize, value);
+  return writer.write_pixels(frame.data(), kWidth, kHeight);
+}
+
+}  // namespace
+
+TEST(FrameRing, DrainsEveryFrameInOrder) {
+  FrameRingWriter writer = make_writer(4, RingPolicy::DROP_OLDEST);
+  FrameRingReader reader = make_reader();
+
+  std::vector<uint8_t> frame(kFrameSize);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).code,
+            ErrorCode::NOT_FOUND);
+  for (uint8_t i = 1; i <= 3; ++i) {
+    EXPECT_EQ(write_frame(writer, i), WriteResult::PUBLISHED);
+  }
+  for (uint8_t i = 1; i <= 3; ++i) {
+    FrameInfo info = reader.read_next(frame.data(), frame.size());
+    ASSERT_EQ(info.code, ErrorCode::OK);
+    EXPECT_EQ(info.sequence, i);
+    EXPECT_EQ(info.width, kWidth);
+    EXPECT_EQ(info.height, kHeight);
+    EXPECT_EQ(frame[0], i);
+    EXPECT_EQ(frame[kFrameSize - 1], i);
+  }
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).code,
+            ErrorCode::NOT_FOUND);
+  EXPECT_FALSE(reader.wait_for_frame(0));
+  write_frame(writer, 4);
+  EXPECT_TRUE(reader.wait_for_frame(0));
+  EXPECT_EQ(reader.missed(), 0u);
+
+  // Frames that don't fit aren't consumed.
+  FrameInfo info = reader.read_next(frame.data(), 16);
+  EXPECT_EQ(info.code, ErrorCode::GENERAL);
+  EXPECT_EQ(info.width, kWidth);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).sequence, 4u);
+}
+
+TEST(FrameRing, DropOldestCountsMissedFrames) {
+  FrameRingWriter writer = make_writer(2, RingPolicy::DROP_OLDEST);
+  FrameRingReader reader = make_reader();
+
+  for (uint8_t i = 1; i <= 5; ++i) {
+    EXPECT_EQ(write_frame(writer, i), WriteResult::PUBLISHED);
+  }
+  std::vector<uint8_t> frame(kFrameSize);
+  FrameInfo info = reader.read_next(frame.data(), frame.size());
+  ASSERT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.sequence, 4u);
+  EXPECT_EQ(frame[0], 4);
+  EXPECT_EQ(reader.missed(), 3u);
+}
+
+TEST(FrameRing, BlockDropsNewFramesAfterTimeout) {
+  FrameRingWriter writer =
+      make_writer(2, RingPolicy::BLOCK, /*block_timeout_nanos=*/1'000'000);
+  FrameRingReader reader = make_reader();
+
+  EXPECT_EQ(write_frame(writer, 1), WriteResult::PUBLISHED);
+  EXPECT_EQ(write_frame(writer, 2), WriteResult::PUBLISHED);
+  EXPECT_EQ(write_frame(writer, 3), WriteResult::RING_FULL);
+
+  std::vector<uint8_t> frame(kFrameSize);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).sequence, 1u);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).sequence, 2u);
+  EXPECT_EQ(reader.missed(), 0u);
+}
+
+TEST(FrameRing, BlockedWriterResumesWhenReaderDrains) {
+  FrameRingWriter writer = make_writer(2, RingPolicy::BLOCK);
+  FrameRingReader reader = make_reader();
+  EXPECT_EQ(write_frame(writer, 1), WriteResult::PUBLISHED);
+  EXPECT_EQ(write_frame(writer, 2), WriteResult::PUBLISHED);
+
+  std::vector<uint8_t> frame(kFrameSize);
+  std::thread drain([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reader.read_next(frame.data(), frame.size());
+  });
+  EXPECT_EQ(write_frame(writer, 3), WriteResult::PUBLISHED);
+  drain.join();
+  EXPECT_EQ(frame[0], 1);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).sequence, 2u);
+  EXPECT_EQ(reader.read_next(frame.data(), frame.size()).sequence, 3u);
+  EXPECT_EQ(reader.missed(), 0u);
+}
+
+TEST(FrameRing, BlockedWriterResumesWhenReaderLeaves) {
+  FrameRingWriter writer =
+      make_writer(2, RingPolicy::BLOCK, 10 * kOneSecNanos);
+  std::optional<FrameRingReader> reader(make_reader());
+  EXPECT_EQ(write_frame(writer, 1), WriteResult::PUBLISHED);
+  EXPECT_EQ(write_frame(writer, 2), WriteResult::PUBLISHED);
+
+  std::thread leave([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reader.reset();
+  });
+  // The writer wakes when the reader releases its cursor, long before it
+  // would give up on it.
+  uint64_t start = now_nanos();
+  EXPECT_EQ(write_frame(writer, 3), WriteResult::PUBLISHED);
+  EXPECT_LT(now_nanos() - start, kOneSecNanos);
+  leave.join();
+}
+
+TEST(FrameRing, ReadLatestStacksNewestFrames) {
+  FrameRingWriter writer = make_writer(4, RingPolicy::BLOCK);
+  // Non-draining readers don't hold the writer back.
+  FrameRingReader stacker = make_reader(/*drain=*/false);
+  for (uint8_t i = 1; i <= 6; ++i) {
+    EXPECT_EQ(write_frame(writer, i), WriteResult::PUBLISHED);
+  }
+
+  std::vector<uint8_t> stack(3 * kFrameSize);
+  int32_t copied;
+  FrameInfo info = stacker.read_latest(3, stack.data(), stack.size(), &copied);
+  ASSERT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(copied, 3);
+  EXPECT_EQ(info.sequence, 6u);
+  EXPECT_EQ(stack[0], 4);
+  EXPECT_EQ(stack[kFrameSize], 5);
+  EXPECT_EQ(stack[2 * kFrameSize], 6);
+
+  EXPECT_EQ(stacker.read_latest(3, stack.data(), kFrameSize, &copied).code,
+            ErrorCode::GENERAL);
+  EXPECT_EQ(stacker.read_next(stack.data(), stack.size()).code,
+            ErrorCode::GENERAL);
+}
+
+TEST(FrameRing, ResizeDropsOlderFrames) {
+  FrameRingWriter writer = make_writer(4, RingPolicy::DROP_OLDEST);
+  FrameRingReader reader = make_reader();
+  write_frame(writer, 1);
+  std::vector<uint8_t> big(4 * kFrameSize, 7);
+  EXPECT_EQ(writer.write_pixels(big.data(), 2 * kWidth, 2 * kHeight),
+            WriteResult::PUBLISHED);
+
+  std::vector<uint8_t> frame(big.size());
+  FrameInfo info = reader.read_next(frame.data(), frame.size());
+  ASSERT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.width, 2 * kWidth);
+  EXPECT_EQ(frame, big);
+  EXPECT_EQ(reader.missed(), 1u);
+}
+
+TEST(FrameRing, NewWriterTakesOverLiveRing) {
+  FrameRingWriter writer = make_writer(4, RingPolicy::DROP_OLDEST);
+  FrameRingReader reader = make_reader();
+  EXPECT_EQ(write_frame(writer, 1), WriteResult::PUBLISHED);
+
+  // Another swapchain of the window takes the ring over.
+  RingOptions options;
+  options.frames = 4;
+  StatusOr<FrameRingWriter> second =
+      FrameRingWriter::Create("test_ring", options);
+  ASSERT_TRUE(second.ok());
+
+  // The reader keeps its place, and frame numbers carry on.
+  EXPECT_EQ(write_frame(*second, 2), WriteResult::PUBLISHED);
+  std::vector<uint8_t> frame(kFrameSize);
+  for (uint8_t i = 1; i <= 2; ++i) {
+    FrameInfo info = reader.read_next(frame.data(), frame.size());
+    ASSERT_EQ(info.code, ErrorCode::OK);
+    EXPECT_EQ(info.sequence, i);
+    EXPECT_EQ(frame[0], i);
+  }
+}
+
+TEST(FrameRing, WaitForFrameWakesOnWrite) {
+  FrameRingWriter writer = make_writer(4, RingPolicy::DROP_OLDEST);
+  FrameRingReader reader = make_reader();
+  EXPECT_FALSE(reader.wait_for_frame(1'000'000));
+
+  // The writer wakes the waiting reader well before its timeout.
+  std::thread write_thread([&] {
+    usleep(20'000);
+    write_frame(writer, 1);
+  });
+  const uint64_t start = now_nanos();
+  EXPECT_TRUE(reader.wait_for_frame(10 * kOneSecNanos));
+  EXPECT_LT(now_nanos() - start, 5 * kOneSecNanos);
+  write_thread.join();
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "jpeg_stream.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifdef VKVFB_HAS_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif
+
+#include "constants.h"
+#include "ipc/futex.h"
+#include "ipc/shared_segment.h"
+#include "logger.h"
+#include "naming.h"
+#include "trace/trace.h"
+#include "utility.h"
+
+namespace {
+
+#ifdef VKVFB_HAS_LIBJPEG
+// libjpeg's default error handler exits the process, so errors jump back to
+// encode_jpeg() instead.
+struct JpegErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+void on_jpeg_error(j_common_ptr cinfo) {
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  ERROR("libjpeg failed: %s", message);
+  longjmp(((JpegErrorManager*)cinfo->err)->jump, 1);
+}
+#endif
+
+// Encodes a frame of tightly packed RGBA rows as a JPEG into '*jpeg', which
+// libjpeg mallocs and the caller frees. Returns false if encoding failed.
+bool encode_jpeg(const uint8_t* pixels, int32_t width, int32_t height,
+                 int quality, unsigned char** jpeg, unsigned long* size) {
+  *jpeg = nullptr;
+  *size = 0;
+#ifdef VKVFB_HAS_LIBJPEG
+  TRACE_SCOPE("jpeg_encode");
+  jpeg_compress_struct cinfo;
+  JpegErrorManager error;
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = on_jpeg_error;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    free(*jpeg);
+    *jpeg = nullptr;
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, jpeg, size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  // libjpeg-turbo reads RGBA directly, and drops the alpha.
+  cinfo.input_components = 4;
+  cinfo.in_color_space = JCS_EXT_RGBA;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row =
+        (JSAMPROW)(pixels + (size_t)cinfo.next_scanline * width * 4);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+JpegOptions JpegOptions::from_env() {
+  JpegOptions options;
+  const char* quality_env = std::getenv("VKVFB_JPEG_QUALITY");
+  if (quality_env && *quality_env) {
+    char* end;
+    long quality = strtol(quality_env, &end, 10);
+    if (*end || quality < 0 || quality > 100) {
+      ERROR("Ignoring invalid VKVFB_JPEG_QUALITY '%s'", quality_env);
+    } else {
+      options.quality = quality;
+    }
+  }
+  const char* fps_env = std::getenv("VKVFB_JPEG_FPS");
+  if (fps_env && *fps_env) {
+    char* end;
+    double fps = strtod(fps_env, &end);
+    if (*end || fps < 0) {
+      ERROR("Ignoring invalid VKVFB_JPEG_FPS '%s'", fps_env);
+    } else {
+      options.fps = fps;
+    }
+  }
+  return options;
+}
+
+// --- JpegStreamWriter ---
+
+struct JpegStreamWriter::Encoder {
+  Encoder(ShmMutex&& mu_param, Shm&& shm_param, const JpegOptions& options)
+      : mu(std::move(mu_param)), shm(std::move(shm_param)), options(options) {}
+
+  // Encodes submitted frames until stopped.
+  void run();
+  // Publishes a JPEG to the stream.
+  void publish(const uint8_t* jpeg, size_t size);
+
+  // Protects shm and data.
+  ShmMutex mu;
+  Shm shm;
+  JpegStreamData* data = nullptr;
+  const JpegOptions options;
+
+  // Protects the fields below, which hand frames to the encoder thread.
+  std::mutex lock;
+  std::condition_variable cv;
+  // Set while the encoder thread owns 'pixels'.
+  bool busy = false;
+  bool stopping = false;
+  std::vector<uint8_t> pixels;
+  int32_t width = 0;
+  int32_t height = 0;
+  uint64_t timestamp_nanos = 0;
+  // When the next frame is due. Only submit() uses it.
+  uint64_t next_due_nanos = 0;
+
+  std::thread thread;
+};
+
+StatusOr<JpegStreamWriter> JpegStreamWriter::Create(
+    const std::string& path, const JpegOptions& options) {
+  if (options.quality <= 0) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+#ifndef VKVFB_HAS_LIBJPEG
+  ERROR("vkvfb was built without libjpeg, so there's no JPEG stream");
+  return StatusVal(ErrorCode::GENERAL);
+#endif
+  // A stream left by an earlier swapchain keeps its sequence numbers, and
+  // readers waiting on them.
+  StatusOr<SharedSegment> segment = open_shared_segment(
+      path + "_jpeg", JpegStreamData::kDataOffset, HugePages::OFF,
+      [](const void* header) {
+        return ((const JpegStreamData*)header)->capacity != 0;
+      },
+      [&](Shm& shm, bool owner_died) {
+        JpegStreamData* data = (JpegStreamData*)shm.map();
+        if (data->capacity == 0) {
+          data = new (shm.map()) JpegStreamData();
+        }
+        data->quality = options.quality;
+        shm.resize(std::max(data->shm_size(), shm.size()));
+        if (owner_died) {
+          // A writer died part way through publishing, so its JPEG may be
+          // torn.
+          ((JpegStreamData*)shm.map())->size = 0;
+        }
+      });
+  RETURN_IF_ERROR(segment);
+
+  auto encoder = std::make_unique<Encoder>(
+      std::move(segment->mu), std::move(segment->shm), options);
+  encoder->data = (JpegStreamData*)encoder->shm.map();
+  Encoder* raw = encoder.get();
+  encoder->thread = std::thread([raw] { raw->run(); });
+  return JpegStreamWriter(std::move(encoder));
+}
+
+JpegStreamWriter::JpegStreamWriter(std::unique_ptr<Encoder> encoder)
+    : encoder_(std::move(encoder)) {}
+
+JpegStreamWriter::~JpegStreamWriter() { stop(); }
+
+void JpegStreamWriter::stop() {
+  if (!encoder_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(encoder_->lock);
+    encoder_->stopping = true;
+  }
+  encoder_->cv.notify_all();
+  encoder_->thread.join();
+  encoder_.reset();
+}
+
+JpegStreamWriter::JpegStreamWriter(JpegStreamWriter&& other) noexcept =
+    default;
+
+JpegStreamWriter& JpegStreamWriter::operator=(
+    JpegStreamWriter&& other) noexcept {
+  if (this != &other) {
+    stop();
+    encoder_ = std::move(other.encoder_);
+  }
+  return *this;
+}
+
+bool JpegStreamWriter::submit(const uint8_t* pixels, int32_t width,
+                              int32_t height) {
+  if (width <= 0 || height <= 0) {
+    return false;
+  }
+  Encoder& encoder = *encoder_;
+  const uint64_t now = now_nanos();
+  std::unique_lock<std::mutex> lock(encoder.lock, std::try_to_lock);
+  if (!lock.owns_lock() || encoder.busy || now < encoder.next_due_nanos) {
+    return false;
+  }
+  TRACE_SCOPE("jpeg_submit");
+  size_t size = (size_t)width * height * 4;
+  encoder.pixels.resize(size);
+  memcpy(encoder.pixels.data(), pixels, size);
+  encoder.width = width;
+  encoder.height = height;
+  encoder.timestamp_nanos = now;
+  encoder.busy = true;
+  if (encoder.options.fps > 0) {
+    encoder.next_due_nanos = now + (uint64_t)(1e9 / encoder.options.fps);
+  }
+  lock.unlock();
+  encoder.cv.notify_one();
+  return true;
+}
+
+void JpegStreamWriter::Encoder::run() {
+  trace::set_thread_name("vkvfb_jpeg");
+  while (true) {
+    {
+      std::unique_lock<std::mutex> l(lock);
+      cv.wait(l, [this] { return busy || stopping; });
+      if (stopping) {
+        return;
+      }
+    }
+
+    // submit() leaves 'pixels' alone while busy.
+    unsigned char* jpeg;
+    unsigned long size;
+    if (encode_jpeg(pixels.data(), width, height, options.quality, &jpeg,
+                    &size)) {
+      publish(jpeg, size);
+      free(jpeg);
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    busy = false;
+  }
+}
+
+void JpegStreamWriter::Encoder::publish(const uint8_t* jpeg, size_t size) {
+  TRACE_SCOPE("jpeg_publish");
+  LockResult res = mu.mu().lock(kOneSecNanos);
+  if (res.state == LockState::OWNERDEAD) {
+    mu.mu().reset();
+    return;
+  } else if (res.state != LockState::LOCKED) {
+    return;
+  }
+  if (size > data->capacity) {
+    // Leave room for busier frames, so the stream rarely grows.
+    data->capacity = round_to_page(size + size / 2);
+    shm.resize(data->shm_size());
+    data = (JpegStreamData*)shm.map();
+  }
+  memcpy(data->jpeg(), jpeg, size);
+  data->size = size;
+  data->width = width;
+  data->height = height;
+  data->timestamp_nanos = timestamp_nanos;
+  __atomic_store_n(&data->sequence, data->sequence + 1, __ATOMIC_RELEASE);
+  futex_wake_all(data->sequence_futex());
+}
+
+// --- JpegStreamReader ---
+
+StatusOr<JpegStreamReader> JpegStreamReader::Create(const std::string& path) {
+  const std::string name = resolve_pixbuf_name(path);
+  StatusOr<ShmMutex> mu_result =
+      ShmMutex::Create(name + "_jpeg_mu", /*create=*/false);
+  RETURN_IF_ERROR(mu_result);
+
+  StatusOr<Shm> shm_result =
+      Shm::Create(name + "_jpeg", 'r', JpegStreamData::kDataOffset);
+  RETURN_IF_ERROR(shm_result);
+
+  return JpegStreamReader(std::move(*mu_result), std::move(*shm_result));
+}
+
+JpegStreamReader::JpegStreamReader(ShmMutex&& mu, Shm&& shm)
+    : mu_(std::move(mu)), shm_(std::move(shm)) {
+  data_ = (JpegStreamData*)shm_.map();
+}
+
+void JpegStreamReader::remap() {
+  if (data_->shm_size() != shm_.size()) {
+    shm_.resize(data_->shm_size());
+    data_ = (JpegStreamData*)shm_.map();
+  }
+}
+
+FrameInfo JpegStreamReader::read(std::vector<uint8_t>* jpeg) {
+  TRACE_SCOPE("jpeg_read");
+  FrameInfo info;
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  if (lock.state != LockState::LOCKED) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  remap();
+  if (data_->sequence == 0 || data_->size == 0) {
+    info.code = ErrorCode::NOT_FOUND;
+    return info;
+  }
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = data_->sequence;
+  jpeg->assign(data_->jpeg(), data_->jpeg() + data_->size);
+  return info;
+}
+
+bool JpegStreamReader::wait_for_frame(uint64_t after_sequence,
+                                      uint64_t timeout_nanos) {
+  TRACE_SCOPE("jpeg_wait_for_frame");
+  // Only this reader remaps data_, so 'sequence' can be read without the
+  // lock.
+  const uint64_t start = now_nanos();
+  while (true) {
+    uint64_t sequence = __atomic_load_n(&data_->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != after_sequence) {
+      return true;
+    }
+    uint64_t elapsed = now_nanos() - start;
+    if (elapsed >= timeout_nanos) {
+      return false;
+    }
+    futex_wait(data_->sequence_futex(), (uint32_t)sequence,
+               timeout_nanos - elapsed);
+  }
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_JPEG_STREAM_H_
+#define PIXBUF_JPEG_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ipc/shm.h"
+#include "ipc/shm_mutex.h"
+#include "pixbuf/pixbuf_reader.h"
+#include "status_or.h"
+
+// A JPEG stream is an opt-in, low-bandwidth copy of a window's frames,
+// published next to its pixbuf in a shm named '<window>_jpeg'. The writer
+// encodes at most a few frames a second on its own thread, and only holds the
+// latest JPEG, so dashboards and review tools can poll a window without
+// mapping its full-size pixbuf.
+
+struct JpegOptions {
+  // JPEG quality, from 1 to 100, or 0 for no stream.
+  int quality = 0;
+  // The most frames a second to encode, or 0 to encode as many as the
+  // encoder keeps up with.
+  double fps = 5;
+
+  // Reads VKVFB_JPEG_QUALITY and VKVFB_JPEG_FPS.
+  static JpegOptions from_env();
+};
+
+// The layout of a JPEG stream's shm. The header is followed, at kDataOffset,
+// by room for 'capacity' bytes of JPEG. All fields are protected by the
+// stream's mutex, though 'sequence' is also read atomically by waiting
+// readers.
+struct JpegStreamData {
+  static const size_t kDataOffset = 4096;
+
+  // Bumped after every frame. 0 until the first frame is published.
+  uint64_t sequence = 0;
+  int32_t width = 0;
+  int32_t height = 0;
+  int32_t quality = 0;
+  uint32_t reserved = 0;
+  // CLOCK_MONOTONIC nanoseconds when the frame was presented.
+  uint64_t timestamp_nanos = 0;
+  // The size of the latest JPEG.
+  uint64_t size = 0;
+  uint64_t capacity = 0;
+
+  // The futex word the writer wakes after every frame: the low half of
+  // 'sequence'.
+  uint32_t* sequence_futex() { return (uint32_t*)&sequence; }
+  uint8_t* jpeg() { return (uint8_t*)this + kDataOffset; }
+  size_t shm_size() const { return kDataOffset + capacity; }
+};
+static_assert(sizeof(JpegStreamData) <= JpegStreamData::kDataOffset,
+              "JpegStreamData's header must fit before its JPEG");
+
+class JpegStreamWriter {
+ public:
+  // Creates the stream for the window at 'path', or takes over the one an
+  // earlier swapchain of the window left, keeping its sequence numbers, and
+  // starts the encoder thread. Returns GENERAL if 'options' has no quality,
+  // or vkvfb was built without libjpeg.
+  static StatusOr<JpegStreamWriter> Create(const std::string& path,
+                                           const JpegOptions& options);
+
+  // Stops the encoder thread, after it finishes the frame it's encoding.
+  ~JpegStreamWriter();
+
+  // JpegStreamWriter is moveable, but not copyable.
+  JpegStreamWriter(const JpegStreamWriter&) = delete;
+  JpegStreamWriter& operator=(const JpegStreamWriter&) = delete;
+  JpegStreamWriter(JpegStreamWriter&& other) noexcept;
+  JpegStreamWriter& operator=(JpegStreamWriter&& other) noexcept;
+
+  // Copies a frame of tightly packed RGBA rows for the encoder thread, if the
+  // next frame is due and the encoder is idle. Otherwise skips it. Never
+  // waits for the encoder, so the app never does. Returns whether the frame
+  // was taken.
+  bool submit(const uint8_t* pixels, int32_t width, int32_t height);
+
+ private:
+  struct Encoder;
+
+  // Private constructor, use Create() instead.
+  explicit JpegStreamWriter(std::unique_ptr<Encoder> encoder);
+
+  // Stops and joins the encoder thread, after it finishes the frame it's
+  // encoding, and frees the encoder.
+  void stop();
+
+  // Shared with the encoder thread.
+  std::unique_ptr<Encoder> encoder_;
+};
+
+class JpegStreamReader {
+ public:
+  // Opens the JPEG stream of the window at 'path'. Returns NOT_FOUND if the
+  // window has no stream.
+  static StatusOr<JpegStreamReader> Create(const std::string& path);
+
+  // Copies the latest JPEG into 'jpeg'. The returned sequence is the stream's,
+  // not the pixbuf's. Returns NOT_FOUND if there's no JPEG, e.g. because
+  // nothing has been published yet, and GENERAL if the lock timed out.
+  FrameInfo read(std::vector<uint8_t>* jpeg);
+
+  // Waits up to 'timeout_nanos' for a JPEG with a sequence number other than
+  // 'after_sequence'. Returns whether one arrived.
+  bool wait_for_frame(uint64_t after_sequence, uint64_t timeout_nanos);
+
+ private:
+  // Private constructor, use Create() instead.
+  JpegStreamReader(ShmMutex&& mu, Shm&& shm);
+
+  // Maps the whole stream, which grows with its JPEGs. Call with mu_ held.
+  void remap();
+
+  // Protects shm_ and data_.
+  ShmMutex mu_;
+  Shm shm_;
+  JpegStreamData* data_;
+};
+
+#endif  // PIXBUF_JPEG_STREAM_H_
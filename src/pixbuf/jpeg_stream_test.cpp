@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "jpeg_stream.h"
+
+#include <gtest/gtest.h>
+#include <jpeglib.h>
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+#include "utility.h"
+
+namespace {
+
+const int32_t kWidth = 64;
+const int32_t kHeight = 32;
+const uint64_t kWaitNanos = 2 * kOneSecNanos;
+
+// Creates a fresh stream, dropping any left by an earlier run.
+JpegStreamWriter make_writer(double fps, int quality = 90) {
+  remove_shared_segment("test_jpeg_jpeg");
+  JpegOptions options;
+  options.quality = quality;
+  options.fps = fps;
+  return created_or_die(JpegStreamWriter::Create("test_jpeg", options));
+}
+
+JpegStreamReader make_reader() {
+  return created_or_die(JpegStreamReader::Create("test_jpeg"));
+}
+
+// A frame with a horizontal gradient in red and a flat green.
+std::vector<uint8_t> gradient_frame() {
+  std::vector<uint8_t> frame(kWidth * kHeight * 4);
+  for (int32_t y = 0; y < kHeight; ++y) {
+    for (int32_t x = 0; x < kWidth; ++x) {
+      uint8_t* pixel = &frame[(y * kWidth + x) * 4];
+      pixel[0] = x * 4;
+      pixel[1] = 128;
+      pixel[2] = 0;
+      pixel[3] = 255;
+    }
+  }
+  return frame;
+}
+
+// A square frame of noise, which barely compresses.
+std::vector<uint8_t> noise_frame(int32_t size) {
+  std::vector<uint8_t> frame((size_t)size * size * 4);
+  srand(1);
+  for (uint8_t& byte : frame) {
+    byte = rand();
+  }
+  return frame;
+}
+
+// Submits 'frame', waiting for the encoder to finish the previous one.
+void submit_when_idle(JpegStreamWriter& writer,
+                      const std::vector<uint8_t>& frame, int32_t width,
+                      int32_t height) {
+  while (!writer.submit(frame.data(), width, height)) {
+    std::this_thread::yield();
+  }
+}
+
+// Decodes 'jpeg' to RGB with libjpeg.
+std::vector<uint8_t> decode(const std::vector<uint8_t>& jpeg, int32_t* width,
+                            int32_t* height) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+  std::vector<uint8_t> rgb((size_t)*width * *height * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &rgb[(size_t)cinfo.output_scanline * *width * 3];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return rgb;
+}
+
+// The mean absolute difference between an RGBA frame and its decoded JPEG.
+double mean_error(const std::vector<uint8_t>& frame,
+                  const std::vector<uint8_t>& jpeg) {
+  int32_t width;
+  int32_t height;
+  std::vector<uint8_t> rgb = decode(jpeg, &width, &height);
+  uint64_t error = 0;
+  for (size_t i = 0; i < (size_t)width * height; ++i) {
+    for (size_t c = 0; c < 3; ++c) {
+      error += abs(frame[i * 4 + c] - rgb[i * 3 + c]);
+    }
+  }
+  return (double)error / ((size_t)width * height * 3);
+}
+
+// The stream's JPEG capacity, read from its header.
+uint64_t stream_capacity() {
+  StatusOr<Shm> shm =
+      Shm::Create("test_jpeg_jpeg", 'r', JpegStreamData::kDataOffset);
+  return ((const JpegStreamData*)shm.value_or_die().map())->capacity;
+}
+
+}  // namespace
+
+TEST(JpegStream, PublishesDecodableFrames) {
+  JpegStreamWriter writer = make_writer(/*fps=*/0);
+  JpegStreamReader reader = make_reader();
+
+  std::vector<uint8_t> jpeg;
+  EXPECT_EQ(reader.read(&jpeg).code, ErrorCode::NOT_FOUND);
+
+  std::vector<uint8_t> frame = gradient_frame();
+  ASSERT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+  ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+  FrameInfo info = reader.read(&jpeg);
+  ASSERT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.sequence, 1u);
+  EXPECT_EQ(info.width, kWidth);
+  EXPECT_EQ(info.height, kHeight);
+  EXPECT_LT(jpeg.size(), frame.size());
+
+  int32_t width;
+  int32_t height;
+  std::vector<uint8_t> rgb = decode(jpeg, &width, &height);
+  ASSERT_EQ(width, kWidth);
+  ASSERT_EQ(height, kHeight);
+  for (int32_t y = 0; y < kHeight; ++y) {
+    for (int32_t x = 0; x < kWidth; ++x) {
+      const uint8_t* pixel = &rgb[(y * kWidth + x) * 3];
+      EXPECT_NEAR(pixel[0], x * 4, 12);
+      EXPECT_NEAR(pixel[1], 128, 12);
+      EXPECT_NEAR(pixel[2], 0, 12);
+    }
+  }
+}
+
+TEST(JpegStream, ThrottlesToFps) {
+  JpegStreamWriter writer = make_writer(/*fps=*/10);
+  JpegStreamReader reader = make_reader();
+
+  std::vector<uint8_t> frame = gradient_frame();
+  const uint64_t start = now_nanos();
+  EXPECT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+  ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+
+  // Frames are skipped until 1/fps after the last one taken, even though
+  // the encoder is idle.
+  while (!writer.submit(frame.data(), kWidth, kHeight)) {
+    std::this_thread::yield();
+  }
+  EXPECT_GE(now_nanos() - start, kOneSecNanos / 10);
+  ASSERT_TRUE(reader.wait_for_frame(1, kWaitNanos));
+  std::vector<uint8_t> jpeg;
+  EXPECT_EQ(reader.read(&jpeg).sequence, 2u);
+}
+
+TEST(JpegStream, DropsFramesWhileEncoding) {
+  JpegStreamWriter writer = make_writer(/*fps=*/0);
+  JpegStreamReader reader = make_reader();
+
+  // A large frame keeps the encoder busy for a while, and submit() skips
+  // frames rather than waiting for it.
+  const int32_t kLarge = 1024;
+  std::vector<uint8_t> noise = noise_frame(kLarge);
+  ASSERT_TRUE(writer.submit(noise.data(), kLarge, kLarge));
+  const uint64_t start = now_nanos();
+  EXPECT_FALSE(writer.submit(noise.data(), kLarge, kLarge));
+  EXPECT_LT(now_nanos() - start, kOneSecNanos / 100);
+
+  // Only the first frame is published.
+  ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+  EXPECT_FALSE(reader.wait_for_frame(1, kOneSecNanos / 10));
+
+  // Once the encoder is idle, frames are taken again.
+  std::vector<uint8_t> frame = gradient_frame();
+  submit_when_idle(writer, frame, kWidth, kHeight);
+  ASSERT_TRUE(reader.wait_for_frame(1, kWaitNanos));
+  std::vector<uint8_t> jpeg;
+  FrameInfo info = reader.read(&jpeg);
+  EXPECT_EQ(info.sequence, 2u);
+  EXPECT_EQ(info.width, kWidth);
+}
+
+TEST(JpegStream, EncodesAtItsQuality) {
+  std::vector<uint8_t> frame = gradient_frame();
+  std::vector<uint8_t> jpegs[2];
+  const int qualities[2] = {10, 95};
+  for (int i = 0; i < 2; ++i) {
+    JpegStreamWriter writer = make_writer(/*fps=*/0, qualities[i]);
+    JpegStreamReader reader = make_reader();
+    ASSERT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+    ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+    ASSERT_EQ(reader.read(&jpegs[i]).code, ErrorCode::OK);
+  }
+
+  // Higher quality costs bytes, and buys fidelity.
+  EXPECT_LT(jpegs[0].size(), jpegs[1].size());
+  EXPECT_GT(mean_error(frame, jpegs[0]), 2 * mean_error(frame, jpegs[1]));
+  EXPECT_LT(mean_error(frame, jpegs[1]), 2);
+}
+
+TEST(JpegStream, GrowsForLargerFrames) {
+  JpegStreamWriter writer = make_writer(/*fps=*/0);
+  JpegStreamReader reader = make_reader();
+  EXPECT_EQ(stream_capacity(), 0u);
+
+  // The first JPEG sizes the stream, with room to spare.
+  std::vector<uint8_t> frame = gradient_frame();
+  ASSERT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+  ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+  std::vector<uint8_t> jpeg;
+  ASSERT_EQ(reader.read(&jpeg).code, ErrorCode::OK);
+  const uint64_t first_capacity = stream_capacity();
+  EXPECT_GE(first_capacity, jpeg.size() + jpeg.size() / 2);
+
+  // Noise outgrows it, and the reader follows the stream as it grows.
+  const int32_t kLarge = 256;
+  std::vector<uint8_t> noise = noise_frame(kLarge);
+  submit_when_idle(writer, noise, kLarge, kLarge);
+  ASSERT_TRUE(reader.wait_for_frame(1, kWaitNanos));
+  FrameInfo info = reader.read(&jpeg);
+  ASSERT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.sequence, 2u);
+  int32_t width;
+  int32_t height;
+  decode(jpeg, &width, &height);
+  EXPECT_EQ(width, kLarge);
+  EXPECT_EQ(height, kLarge);
+  const uint64_t large_capacity = stream_capacity();
+  EXPECT_GT(large_capacity, first_capacity);
+  EXPECT_GE(large_capacity, jpeg.size());
+
+  // Smaller frames don't shrink it again.
+  submit_when_idle(writer, frame, kWidth, kHeight);
+  ASSERT_TRUE(reader.wait_for_frame(2, kWaitNanos));
+  info = reader.read(&jpeg);
+  EXPECT_EQ(info.width, kWidth);
+  EXPECT_EQ(stream_capacity(), large_capacity);
+}
+
+TEST(JpegStream, NewWriterKeepsSequenceNumbers) {
+  JpegStreamWriter writer = make_writer(/*fps=*/0);
+  JpegStreamReader reader = make_reader();
+  std::vector<uint8_t> frame = gradient_frame();
+  ASSERT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+  ASSERT_TRUE(reader.wait_for_frame(0, kWaitNanos));
+
+  // Another swapchain of the window takes the stream over, and move-assigning
+  // it stops the first writer's encoder.
+  JpegOptions options;
+  options.quality = 90;
+  writer = created_or_die(JpegStreamWriter::Create("test_jpeg", options));
+
+  // The reader keeps its stream, whose sequence numbers carry on.
+  ASSERT_TRUE(writer.submit(frame.data(), kWidth, kHeight));
+  ASSERT_TRUE(reader.wait_for_frame(1, kWaitNanos));
+  std::vector<uint8_t> jpeg;
+  EXPECT_EQ(reader.read(&jpeg).sequence, 2u);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "naming.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "ipc/fd_server.h"
+
+namespace {
+
+std::string window_id_name(uint32_t window_id) {
+  char name[16];
+  snprintf(name, sizeof(name), "0x%08x", window_id);
+  return name;
+}
+
+// Reduces a DISPLAY value to the part that identifies its X server, in
+// characters that are safe in shm and /tmp file names. The screen number is
+// dropped, since window ids are shared by a server's screens.
+std::string display_tag(const std::string& display) {
+  std::string server = display;
+  size_t colon = server.rfind(':');
+  if (colon != std::string::npos) {
+    size_t dot = server.find('.', colon);
+    if (dot != std::string::npos) {
+      server.resize(dot);
+    }
+  }
+  // ":1" is the common case, so it's tagged "1" rather than "_1".
+  if (!server.empty() && server[0] == ':') {
+    server.erase(0, 1);
+  }
+  std::string tag;
+  for (char c : server) {
+    bool safe = isalnum((unsigned char)c) || c == '-' || c == '.';
+    tag += safe ? c : '_';
+  }
+  return tag;
+}
+
+// Parses a bare window id like "0x400001", or returns false.
+bool parse_window_id(const std::string& name, uint32_t* window_id) {
+  if (name.size() < 3 || name.size() > 10 || name[0] != '0' ||
+      (name[1] != 'x' && name[1] != 'X')) {
+    return false;
+  }
+  for (size_t i = 2; i < name.size(); ++i) {
+    if (!isxdigit((unsigned char)name[i])) {
+      return false;
+    }
+  }
+  *window_id = strtoul(name.c_str() + 2, nullptr, 16);
+  return true;
+}
+
+// Returns whether a writer publishes the pixbuf 'name' over either transport.
+bool pixbuf_exists(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd != -1) {
+    close(fd);
+    return true;
+  }
+  StatusOr<std::vector<int>> fds = receive_fds(pixbuf_socket_name(name));
+  if (!fds.ok()) {
+    return false;
+  }
+  for (int received : *fds) {
+    close(received);
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string pixbuf_name(const std::string& display, uint32_t window_id) {
+  const char* prefix = std::getenv("VKVFB_SHM_PREFIX");
+  if (prefix && *prefix) {
+    return prefix + window_id_name(window_id);
+  }
+  std::string tag = display_tag(display);
+  return "vkvfb_" + (tag.empty() ? "" : tag + "_") + window_id_name(window_id);
+}
+
+std::string pixbuf_socket_name(const std::string& pixbuf_name) {
+  return "vkvfb/" + pixbuf_name;
+}
+
+std::string resolve_pixbuf_name(const std::string& name) {
+  uint32_t window_id;
+  if (!parse_window_id(name, &window_id)) {
+    return name;
+  }
+  const char* display = std::getenv("DISPLAY");
+  std::string qualified = pixbuf_name(display ? display : "", window_id);
+  if (pixbuf_exists(qualified)) {
+    return qualified;
+  }
+  return name;
+}
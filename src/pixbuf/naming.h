@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_NAMING_H_
+#define PIXBUF_NAMING_H_
+
+#include <cstdint>
+#include <string>
+
+// X11 window ids are only unique within an X server, so pixbuf names are
+// namespaced by display, letting apps on many Xvfb servers share a host. The
+// name also names the pixbuf's '<name>_mu' lock file, ring and stats.
+
+// Returns the name of the pixbuf of X11 window 'window_id' on 'display', e.g.
+// "vkvfb_1_0x00400001" for ":1" or ":1.0". If VKVFB_SHM_PREFIX is set, returns
+// the prefix followed by the window id instead, e.g. "game3_0x00400001".
+std::string pixbuf_name(const std::string& display, uint32_t window_id);
+
+// Returns the name of the abstract unix socket that serves the memfds of the
+// pixbuf 'pixbuf_name', when the writer uses PixbufTransport::MEMFD.
+std::string pixbuf_socket_name(const std::string& pixbuf_name);
+
+// Resolves the name a reader was given to a pixbuf name. A bare window id,
+// like "0x00400001" or xwininfo's "0x400001", is qualified with this
+// process's VKVFB_SHM_PREFIX or DISPLAY, the way the app's layer named it.
+// If there's no such pixbuf, returns the window id as is, for writers that
+// predate namespacing. Other names are returned unchanged.
+std::string resolve_pixbuf_name(const std::string& name);
+
+#endif  // PIXBUF_NAMING_H_
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "naming.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "pixbuf_reader.h"
+#include "pixbuf_writer.h"
+
+TEST(Naming, NamesAreNamespacedByDisplay) {
+  unsetenv("VKVFB_SHM_PREFIX");
+  EXPECT_EQ(pixbuf_name(":1", 0x400001), "vkvfb_1_0x00400001");
+  EXPECT_EQ(pixbuf_name(":1.0", 0x400001), "vkvfb_1_0x00400001");
+  EXPECT_EQ(pixbuf_name(":12", 0x400001), "vkvfb_12_0x00400001");
+  EXPECT_EQ(pixbuf_name("localhost:10.0", 0x400001),
+            "vkvfb_localhost_10_0x00400001");
+  EXPECT_EQ(pixbuf_name("/tmp/launch/org.x:0", 0x400001),
+            "vkvfb__tmp_launch_org.x_0_0x00400001");
+  EXPECT_EQ(pixbuf_name("", 0x400001), "vkvfb_0x00400001");
+
+  setenv("VKVFB_SHM_PREFIX", "game3_", 1);
+  EXPECT_EQ(pixbuf_name(":1", 0x400001), "game3_0x00400001");
+  unsetenv("VKVFB_SHM_PREFIX");
+}
+
+TEST(Naming, ReadersResolveWindowIdsOnTheirDisplay) {
+  unsetenv("VKVFB_SHM_PREFIX");
+  setenv("DISPLAY", ":7041", 1);
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(4, 4));
+
+  // Two displays' windows with the same id don't collide.
+  StatusOr<PixbufWriter> ours =
+      PixbufWriter::Create(pixbuf_name(":7041", 0x2a));
+  StatusOr<PixbufWriter> theirs =
+      PixbufWriter::Create(pixbuf_name(":7042", 0x2a));
+  ASSERT_TRUE(ours.ok());
+  ASSERT_TRUE(theirs.ok());
+  ours->write_pixels(pixels.data(), 4, 4);
+  theirs->write_pixels(pixels.data(), 4, 4);
+  theirs->write_pixels(pixels.data(), 4, 4);
+
+  EXPECT_EQ(resolve_pixbuf_name("0x2a"), "vkvfb_7041_0x0000002a");
+  EXPECT_EQ(resolve_pixbuf_name("0x0000002a"), "vkvfb_7041_0x0000002a");
+  EXPECT_EQ(resolve_pixbuf_name("vkvfb_7042_0x0000002a"),
+            "vkvfb_7042_0x0000002a");
+  StatusOr<PixbufReader> reader = PixbufReader::Create("0x2a");
+  ASSERT_TRUE(reader.ok());
+  EXPECT_EQ(reader->read_pixels().sequence, 1u);
+
+  // Windows without a namespaced pixbuf keep their bare names.
+  EXPECT_EQ(resolve_pixbuf_name("0x2b"), "0x2b");
+  EXPECT_EQ(resolve_pixbuf_name("test_buf"), "test_buf");
+}
@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for the pixbuf IPC path: writer and reader throughput,
+// shm resizing, cross-process lock handoff and reader contention.
+//
+// Run with `meson test -C build --benchmark` or the pixbuf_benchmark binary
+// directly. Besides the usual time and bytes/s, benchmarks report per-op
+// latency percentiles as p50_us, p99_us and max_us counters.
+
+#include <benchmark/benchmark.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/shm.h"
+#include "ipc/shm_mutex.h"
+#include "pixbuf/pixbuf_reader.h"
+#include "pixbuf/pixbuf_reader_group.h"
+#include "pixbuf/pixbuf_writer.h"
+#include "pixbuf/preprocess.h"
+#include "utility.h"
+
+namespace {
+
+// Records per-op latencies and reports their percentiles as counters.
+class LatencyRecorder {
+ public:
+  void start() { start_nanos_ = now_nanos(); }
+  void stop() { latencies_.push_back(now_nanos() - start_nanos_); }
+
+  void report(benchmark::State& state) {
+    if (latencies_.empty()) {
+      return;
+    }
+    std::sort(latencies_.begin(), latencies_.end());
+    auto percentile_us = [&](double p) {
+      size_t i = std::min(latencies_.size() - 1,
+                          (size_t)(p * latencies_.size()));
+      return latencies_[i] / 1000.0;
+    };
+    state.counters["p50_us"] = percentile_us(0.50);
+    state.counters["p99_us"] = percentile_us(0.99);
+    state.counters["max_us"] = latencies_.back() / 1000.0;
+  }
+
+ private:
+  uint64_t start_nanos_ = 0;
+  std::vector<uint64_t> latencies_;
+};
+
+// Returns a pixbuf path that's unique to this process and benchmark.
+std::string bench_path(const char* name) {
+  return "vkvfb_bench_" + std::to_string(getpid()) + "_" + name;
+}
+
+// Removes everything a PixbufWriter at 'path' leaves behind.
+void unlink_pixbuf(const std::string& path) {
+  shm_unlink(path.c_str());
+  shm_unlink((path + "_mu").c_str());
+  unlink(("/tmp/" + path + "_mu").c_str());
+}
+
+std::vector<uint8_t> make_pixels(int32_t width, int32_t height) {
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(width, height));
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (uint8_t)i;
+  }
+  return pixels;
+}
+
+void add_resolutions(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "height"});
+  b->Args({1280, 720});
+  b->Args({1920, 1080});
+  b->Args({2560, 1440});
+  b->Args({3840, 2160});
+  b->Args({7680, 4320});
+}
+
+void BM_WritePixels(benchmark::State& state, bool force_opaque) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  const std::string path = bench_path("write");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(width, height);
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    writer.write_pixels(pixels.data(), width, height, force_opaque);
+    latency.stop();
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+  unlink_pixbuf(path);
+}
+BENCHMARK_CAPTURE(BM_WritePixels, copy, false)->Apply(add_resolutions);
+BENCHMARK_CAPTURE(BM_WritePixels, force_opaque, true)->Apply(add_resolutions);
+
+void BM_ReadPixels(benchmark::State& state) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  const std::string path = bench_path("read");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(width, height);
+  writer.write_pixels(pixels.data(), width, height);
+  PixbufReader reader = std::move(PixbufReader::Create(path).value_or_die());
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    const ReadPixbuf& read = reader.read_pixels();
+    latency.stop();
+    benchmark::DoNotOptimize(read.pixels);
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+  unlink_pixbuf(path);
+}
+BENCHMARK(BM_ReadPixels)->Apply(add_resolutions);
+
+void BM_ReadInto(benchmark::State& state) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  const std::string path = bench_path("read_into");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(width, height);
+  writer.write_pixels(pixels.data(), width, height);
+  PixbufReader reader = std::move(PixbufReader::Create(path).value_or_die());
+  std::vector<uint8_t> dst(pixels.size());
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    FrameInfo info = reader.read_into(dst.data(), dst.size());
+    latency.stop();
+    benchmark::DoNotOptimize(info);
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+  unlink_pixbuf(path);
+}
+BENCHMARK(BM_ReadInto)->Apply(add_resolutions);
+
+// Writes and reads memfd pixbufs backed by each kind of page, to measure what
+// the TLB misses of 4KiB pages cost at high resolutions. THP only applies where
+// the kernel allows it, and hugetlb falls back to THP without reserved pages.
+PixbufOptions huge_page_options(HugePages huge_pages) {
+  PixbufOptions options;
+  options.transport = PixbufTransport::MEMFD;
+  options.huge_pages = huge_pages;
+  return options;
+}
+
+void add_large_resolutions(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "height"});
+  b->Args({3840, 2160});
+  b->Args({7680, 4320});
+}
+
+void BM_WriteHugePages(benchmark::State& state, HugePages huge_pages) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  PixbufWriter writer = std::move(
+      PixbufWriter::Create(bench_path("write_huge"), WindowInfo(),
+                           huge_page_options(huge_pages))
+          .value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(width, height);
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    writer.write_pixels(pixels.data(), width, height);
+    latency.stop();
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+}
+BENCHMARK_CAPTURE(BM_WriteHugePages, off, HugePages::OFF)
+    ->Apply(add_large_resolutions);
+BENCHMARK_CAPTURE(BM_WriteHugePages, thp, HugePages::THP)
+    ->Apply(add_large_resolutions);
+BENCHMARK_CAPTURE(BM_WriteHugePages, hugetlb, HugePages::HUGETLB)
+    ->Apply(add_large_resolutions);
+
+void BM_ReadIntoHugePages(benchmark::State& state, HugePages huge_pages) {
+  const int32_t width = state.range(0);
+  const int32_t height = state.range(1);
+  const std::string path = bench_path("read_huge");
+  PixbufWriter writer = std::move(
+      PixbufWriter::Create(path, WindowInfo(), huge_page_options(huge_pages))
+          .value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(width, height);
+  writer.write_pixels(pixels.data(), width, height);
+  PixbufReader reader =
+      std::move(PixbufReader::Create(path, huge_pages).value_or_die());
+  std::vector<uint8_t> dst(pixels.size());
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    FrameInfo info = reader.read_into(dst.data(), dst.size());
+    latency.stop();
+    benchmark::DoNotOptimize(info);
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+}
+BENCHMARK_CAPTURE(BM_ReadIntoHugePages, off, HugePages::OFF)
+    ->Apply(add_large_resolutions);
+BENCHMARK_CAPTURE(BM_ReadIntoHugePages, thp, HugePages::THP)
+    ->Apply(add_large_resolutions);
+BENCHMARK_CAPTURE(BM_ReadIntoHugePages, hugetlb, HugePages::HUGETLB)
+    ->Apply(add_large_resolutions);
+
+// Preprocesses 1080p frames straight from shm into common observation
+// layouts.
+void BM_ReadPreprocessed(benchmark::State& state, PreprocessSpec spec) {
+  const std::string path = bench_path("preprocess");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(1920, 1080);
+  writer.write_pixels(pixels.data(), 1920, 1080);
+  PixbufReader reader = std::move(PixbufReader::Create(path).value_or_die());
+  Preprocessor preprocessor =
+      std::move(Preprocessor::Create(spec).value_or_die());
+  std::vector<uint8_t> dst(preprocessor.output_size(1920, 1080));
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    FrameInfo info =
+        reader.read_preprocessed(preprocessor, dst.data(), dst.size());
+    latency.stop();
+    benchmark::DoNotOptimize(info);
+  }
+  latency.report(state);
+  unlink_pixbuf(path);
+}
+
+PreprocessSpec gray_84_spec() {
+  PreprocessSpec spec;
+  spec.out_width = 84;
+  spec.out_height = 84;
+  spec.channels = PreprocessSpec::Channels::GRAY;
+  return spec;
+}
+
+PreprocessSpec rgb_224_chw_spec() {
+  PreprocessSpec spec;
+  spec.crop_y = 60;
+  spec.crop_height = 960;
+  spec.out_width = 224;
+  spec.out_height = 224;
+  spec.layout = PreprocessSpec::Layout::CHW;
+  spec.mean[0] = 0.485f;
+  spec.mean[1] = 0.456f;
+  spec.mean[2] = 0.406f;
+  spec.std[0] = 0.229f;
+  spec.std[1] = 0.224f;
+  spec.std[2] = 0.225f;
+  return spec;
+}
+
+PreprocessSpec rgb_540_uint8_spec() {
+  PreprocessSpec spec;
+  spec.out_width = 960;
+  spec.out_height = 540;
+  spec.dtype = PreprocessSpec::DataType::UINT8;
+  return spec;
+}
+
+BENCHMARK_CAPTURE(BM_ReadPreprocessed, gray_84_float, gray_84_spec());
+BENCHMARK_CAPTURE(BM_ReadPreprocessed, rgb_224_chw_float, rgb_224_chw_spec());
+BENCHMARK_CAPTURE(BM_ReadPreprocessed, rgb_540_uint8, rgb_540_uint8_spec());
+
+// Reads a batch of 64 720p windows, as a trainer collecting from 64
+// environments would, with a varying number of threads.
+void BM_GroupReadInto(benchmark::State& state) {
+  const int kWindows = 64;
+  const int threads = state.range(0);
+  std::vector<uint8_t> pixels = make_pixels(1280, 720);
+  std::vector<std::string> paths;
+  std::vector<PixbufWriter> writers;
+  for (int i = 0; i < kWindows; ++i) {
+    paths.push_back(bench_path(("group_" + std::to_string(i)).c_str()));
+    writers.push_back(
+        std::move(PixbufWriter::Create(paths.back()).value_or_die()));
+    writers.back().write_pixels(pixels.data(), 1280, 720);
+  }
+  PixbufReaderGroup group =
+      std::move(PixbufReaderGroup::Create(paths, threads).value_or_die());
+  std::vector<uint8_t> batch(kWindows * pixels.size());
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    latency.start();
+    benchmark::DoNotOptimize(group.read_into(batch.data(), pixels.size()));
+    latency.stop();
+  }
+  state.SetBytesProcessed(state.iterations() * batch.size());
+  latency.report(state);
+  for (const std::string& path : paths) {
+    unlink_pixbuf(path);
+  }
+}
+BENCHMARK(BM_GroupReadInto)
+    ->ArgName("threads")
+    ->RangeMultiplier(2)
+    ->Range(1, 16)
+    ->UseRealTime();
+
+// Alternates the writer between two sizes. The pixbuf keeps the larger size's
+// capacity, so only the first write grows the shm.
+void BM_WriteResizeChurn(benchmark::State& state) {
+  const std::string path = bench_path("churn");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> small = make_pixels(1280, 720);
+  std::vector<uint8_t> large = make_pixels(1920, 1080);
+
+  LatencyRecorder latency;
+  bool use_large = false;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    latency.start();
+    if (use_large) {
+      writer.write_pixels(large.data(), 1920, 1080);
+    } else {
+      writer.write_pixels(small.data(), 1280, 720);
+    }
+    latency.stop();
+    bytes += use_large ? large.size() : small.size();
+    use_large = !use_large;
+  }
+  state.SetBytesProcessed(bytes);
+  latency.report(state);
+  unlink_pixbuf(path);
+}
+BENCHMARK(BM_WriteResizeChurn);
+
+// Times the first 4K frame into a fresh pixbuf, as after a swapchain is
+// recreated at a new size, with and without reserve() faulting it in first.
+void BM_FirstFrame(benchmark::State& state, bool reserve) {
+  const std::string path = bench_path("first_frame");
+  std::vector<uint8_t> pixels = make_pixels(3840, 2160);
+  std::optional<PixbufWriter> writer;
+
+  LatencyRecorder latency;
+  for (auto _ : state) {
+    state.PauseTiming();
+    writer.reset();
+    unlink_pixbuf(path);
+    writer.emplace(std::move(PixbufWriter::Create(path).value_or_die()));
+    if (reserve) {
+      writer->reserve(3840, 2160);
+      // Apps take a few frames' time to present after recreating a swapchain.
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    state.ResumeTiming();
+
+    latency.start();
+    writer->write_pixels(pixels.data(), 3840, 2160);
+    latency.stop();
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  latency.report(state);
+  writer.reset();
+  unlink_pixbuf(path);
+}
+BENCHMARK_CAPTURE(BM_FirstFrame, faulting, false)->UseRealTime();
+BENCHMARK_CAPTURE(BM_FirstFrame, reserved, true)->UseRealTime();
+
+// Resizes a shm back and forth, with mremap or, if 'reserve' is set, in place
+// within a reservation.
+void BM_ShmResize(benchmark::State& state, bool reserve) {
+  const std::string path = bench_path("resize");
+  const size_t small_size = PixbufData::pixbuf_struct_size(1280, 720);
+  const size_t large_size = PixbufData::pixbuf_struct_size(3840, 2160);
+  Shm shm = std::move(Shm::Create(path, 'w', small_size).value_or_die());
+  if (reserve) {
+    shm.reserve(large_size);
+  }
+
+  LatencyRecorder latency;
+  bool use_large = false;
+  for (auto _ : state) {
+    latency.start();
+    shm.resize(use_large ? large_size : small_size);
+    latency.stop();
+    use_large = !use_large;
+  }
+  latency.report(state);
+  shm_unlink(path.c_str());
+}
+BENCHMARK_CAPTURE(BM_ShmResize, mremap, false);
+BENCHMARK_CAPTURE(BM_ShmResize, reserved, true);
+
+// Shared state for the cross-process benchmarks.
+struct SharedControl {
+  std::atomic<uint64_t> turn;
+  std::atomic<bool> stop;
+  std::atomic<uint64_t> reads;
+};
+
+// Two processes take turns holding a shared PMutex. Each iteration is one
+// round trip, so the reported latency covers two handoffs.
+void BM_LockHandoff(benchmark::State& state) {
+  const std::string mu_path = bench_path("handoff_mu");
+  const std::string control_path = bench_path("handoff_control");
+  ShmMutex mu = std::move(ShmMutex::Create(mu_path, true).value_or_die());
+  Shm control_shm = std::move(
+      Shm::Create(control_path, 'w', sizeof(SharedControl)).value_or_die());
+  SharedControl* control = new (control_shm.map()) SharedControl();
+
+  pid_t child = fork();
+  if (child == 0) {
+    ShmMutex child_mu =
+        std::move(ShmMutex::Create(mu_path, false).value_or_die());
+    uint64_t turn = 1;
+    while (!control->stop.load(std::memory_order_acquire)) {
+      if (control->turn.load(std::memory_order_acquire) != turn) {
+        continue;
+      }
+      LockResult lock = child_mu.mu().lock();
+      control->turn.store(turn + 1, std::memory_order_release);
+      turn += 2;
+    }
+    _exit(0);
+  }
+
+  LatencyRecorder latency;
+  uint64_t turn = 0;
+  for (auto _ : state) {
+    latency.start();
+    {
+      LockResult lock = mu.mu().lock();
+      control->turn.store(turn + 1, std::memory_order_release);
+    }
+    turn += 2;
+    while (control->turn.load(std::memory_order_acquire) != turn) {
+    }
+    latency.stop();
+  }
+  control->stop.store(true, std::memory_order_release);
+  waitpid(child, nullptr, 0);
+  latency.report(state);
+
+  shm_unlink(mu_path.c_str());
+  unlink(("/tmp/" + mu_path).c_str());
+  shm_unlink(control_path.c_str());
+}
+BENCHMARK(BM_LockHandoff)->UseRealTime();
+
+// Writes 1080p frames while N reader processes read as fast as they can.
+void BM_WriteWithReaders(benchmark::State& state) {
+  const int readers = state.range(0);
+  const std::string path = bench_path("contention");
+  const std::string control_path = bench_path("contention_control");
+  PixbufWriter writer = std::move(PixbufWriter::Create(path).value_or_die());
+  std::vector<uint8_t> pixels = make_pixels(1920, 1080);
+  writer.write_pixels(pixels.data(), 1920, 1080);
+  Shm control_shm = std::move(
+      Shm::Create(control_path, 'w', sizeof(SharedControl)).value_or_die());
+  SharedControl* control = new (control_shm.map()) SharedControl();
+
+  std::vector<pid_t> children;
+  for (int i = 0; i < readers; ++i) {
+    pid_t child = fork();
+    if (child == 0) {
+      PixbufReader reader =
+          std::move(PixbufReader::Create(path).value_or_die());
+      while (!control->stop.load(std::memory_order_acquire)) {
+        benchmark::DoNotOptimize(reader.read_pixels().pixels);
+        control->reads.fetch_add(1, std::memory_order_relaxed);
+      }
+      _exit(0);
+    }
+    children.push_back(child);
+  }
+
+  LatencyRecorder latency;
+  uint64_t lock_timeouts = 0;
+  uint64_t start_reads = control->reads.load();
+  uint64_t start_nanos = now_nanos();
+  for (auto _ : state) {
+    latency.start();
+    if (writer.write_pixels(pixels.data(), 1920, 1080) !=
+        WriteResult::PUBLISHED) {
+      lock_timeouts++;
+    }
+    latency.stop();
+  }
+  double seconds = (now_nanos() - start_nanos) / 1e9;
+  uint64_t reads = control->reads.load() - start_reads;
+
+  control->stop.store(true, std::memory_order_release);
+  for (pid_t child : children) {
+    waitpid(child, nullptr, 0);
+  }
+  state.SetBytesProcessed(state.iterations() * pixels.size());
+  state.counters["reads/s"] = reads / seconds;
+  state.counters["unpublished"] = lock_timeouts;
+  latency.report(state);
+
+  unlink_pixbuf(path);
+  shm_unlink(control_path.c_str());
+}
+BENCHMARK(BM_WriteWithReaders)
+    ->ArgName("readers")
+    ->RangeMultiplier(2)
+    ->Range(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
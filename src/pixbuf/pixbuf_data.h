@@ -21,22 +21,43 @@
 #include <semaphore.h>
 
 #include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <mutex>
 #include <string>
 
 #include "ipc/pmutex.h"
+#include "logger.h"
 
 struct PixbufData {
   // Field accesses must be externally synchronized.
+  // Incremented on every write, so readers can tell frames apart.
+  uint64_t sequence = 0;
   int32_t width = 0;
   int32_t height = 0;
+  // The size of the segment, including this header. Writers grow it
+  // geometrically and never shrink it, so frames that get smaller or grow
+  // back don't resize it, and readers' mappings never lose pages.
+  uint64_t capacity = 0;
+  // Incremented whenever the width, height or capacity change, so readers
+  // only check their mapping when the layout does.
+  uint32_t generation = 0;
   // A width*height*4 sized block of pixels, that starts here.
-  uint8_t first_pixel;
+  alignas(16) uint8_t first_pixel;
 
   PixbufData(char mode) {}
 
+  // The futex word writers wake after every frame: the low half of
+  // 'sequence', which changes with every frame.
+  uint32_t* sequence_futex() { return (uint32_t*)&sequence; }
+
+  // The frame size mappings reserve address space for by default: 8K.
+  static const int32_t kDefaultMaxWidth = 7680;
+  static const int32_t kDefaultMaxHeight = 4320;
+
   static size_t pixbuf_size(int32_t width, int32_t height) {
     // Casting to size_t before multiplication protects against possible
     // overflows at very high resolutions.
@@ -45,6 +66,50 @@ struct PixbufData {
   static size_t pixbuf_struct_size(int32_t width, int32_t height) {
     return pixbuf_size(width, height) + offsetof(PixbufData, first_pixel);
   }
+
+  // Returns the segment size to reserve address space for, from
+  // VKVFB_MAX_FRAME=<width>x<height>. Larger frames still work, but move the
+  // mappings when they first arrive.
+  static size_t reserve_size_from_env() {
+    int32_t width = kDefaultMaxWidth;
+    int32_t height = kDefaultMaxHeight;
+    const char* max_frame_env = std::getenv("VKVFB_MAX_FRAME");
+    if (max_frame_env && *max_frame_env &&
+        (sscanf(max_frame_env, "%dx%d", &width, &height) != 2 || width <= 0 ||
+         height <= 0)) {
+      ERROR("Ignoring invalid VKVFB_MAX_FRAME '%s'", max_frame_env);
+      width = kDefaultMaxWidth;
+      height = kDefaultMaxHeight;
+    }
+    return pixbuf_struct_size(width, height);
+  }
+
+  // Copies 'size' bytes of RGBA8 pixels. If force_opaque is true, sets every
+  // copied pixel's alpha to 255.
+  static void copy_pixels(void* dst, const void* src, size_t size,
+                          bool force_opaque) {
+    if (!force_opaque) {
+      memcpy(dst, src, size);
+      return;
+    }
+
+    // Check alignment for uint32_t operations
+    assert(((uintptr_t)src & 3) == 0 && "src must be 4-byte aligned");
+    assert(((uintptr_t)dst & 3) == 0 && "dst must be 4-byte aligned");
+
+    // Memcpy clamping every 4th byte to 255.
+    const uint32_t* from = (const uint32_t*)(src);
+    uint32_t* to = (uint32_t*)(dst);
+    const uint32_t* end = (const uint32_t*)(src) + size / 4;
+    while (from != end) {
+      *to = *from | 0xff000000u;
+      from++;
+      to++;
+    }
+  }
 };
 
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "PixbufData::sequence_futex() assumes little endian");
+
 #endif  // PIXBUF_PIXBUF_DATA_H_
@@ -16,18 +16,54 @@
 
 #include "pixbuf_reader.h"
 
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
+#include "ipc/fd_server.h"
+#include "ipc/futex.h"
+#include "naming.h"
 #include "pixbuf_data.h"
+#include "preprocess.h"
+#include "registry.h"
 #include "status_or.h"
+#include "trace/trace.h"
+#include "utility.h"
+
+namespace {
+
+// Opens the most recently published registered pixbuf that 'matches'.
+template <typename Predicate>
+StatusOr<PixbufReader> open_registered(Predicate matches) {
+  StatusOr<std::vector<WindowRecord>> windows = list_registered_windows();
+  RETURN_IF_ERROR(windows);
+  const WindowRecord* best = nullptr;
+  for (const WindowRecord& window : *windows) {
+    if (matches(window) &&
+        (!best || window.last_frame_nanos > best->last_frame_nanos)) {
+      best = &window;
+    }
+  }
+  if (!best) {
+    return StatusVal(ErrorCode::NOT_FOUND);
+  }
+  return PixbufReader::Create(best->pixbuf_name);
+}
+
+}  // namespace
 
 ReadPixbuf::ReadPixbuf(ReadPixbuf&& other) noexcept
     : code(other.code),
       width(other.width),
       height(other.height),
-      pixels(other.pixels) {
+      sequence(other.sequence),
+      pixels(other.pixels),
+      capacity(other.capacity) {
   other.pixels = nullptr;
+  other.capacity = 0;
 }
 
 ReadPixbuf& ReadPixbuf::operator=(ReadPixbuf&& other) noexcept {
@@ -36,54 +72,206 @@ ReadPixbuf& ReadPixbuf::operator=(ReadPixbuf&& other) noexcept {
     code = other.code;
     width = other.width;
     height = other.height;
+    sequence = other.sequence;
     pixels = other.pixels;
+    capacity = other.capacity;
     other.pixels = nullptr;
+    other.capacity = 0;
   }
   return *this;
 }
 
 void ReadPixbuf::update(int32_t new_w, int32_t new_h, const uint8_t* data) {
   size_t data_size = PixbufData::pixbuf_size(new_w, new_h);
-  if (new_w != width || new_h != height) {
+  if (data_size > capacity) {
     free(pixels);
-    width = new_w;
-    height = new_h;
     pixels = (uint8_t*)malloc(data_size);
+    capacity = data_size;
   }
+  width = new_w;
+  height = new_h;
   memcpy(pixels, data, data_size);
 }
 
-StatusOr<PixbufReader> PixbufReader::Create(const std::string& path) {
+StatusOr<PixbufReader> PixbufReader::Create(const std::string& path,
+                                            HugePages huge_pages) {
+  const std::string name = resolve_pixbuf_name(path);
+
+  // Writers using the MEMFD transport serve their segments by fd.
+  StatusOr<std::vector<int>> fds = receive_fds(pixbuf_socket_name(name));
+  if (fds.ok() && fds->size() == 2) {
+    StatusOr<Shm> shm = Shm::FromFd((*fds)[0], 'r', huge_pages);
+    StatusOr<Shm> mu_shm = Shm::FromFd((*fds)[1], 'r');
+    RETURN_IF_ERROR(shm);
+    RETURN_IF_ERROR(mu_shm);
+    StatusOr<ShmMutex> mu_result =
+        ShmMutex::FromShm(std::move(*mu_shm), /*create=*/false);
+    RETURN_IF_ERROR(mu_result);
+    return PixbufReader(std::move(*mu_result), std::move(*shm));
+  } else if (fds.ok()) {
+    for (int fd : *fds) {
+      close(fd);
+    }
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
   StatusOr<ShmMutex> mu_result =
-      ShmMutex::Create(path + "_mu", /*create=*/false);
+      ShmMutex::Create(name + "_mu", /*create=*/false);
   RETURN_IF_ERROR(mu_result);
 
   StatusOr<Shm> shm =
-      Shm::Create(path, 'r', PixbufData::pixbuf_struct_size(0, 0));
+      Shm::Create(name, 'r', PixbufData::pixbuf_struct_size(0, 0), huge_pages);
   RETURN_IF_ERROR(shm);
 
   return PixbufReader(std::move(*mu_result), std::move(*shm));
 }
 
+StatusOr<PixbufReader> PixbufReader::Open(int32_t pid) {
+  return open_registered(
+      [pid](const WindowRecord& window) { return window.pid == pid; });
+}
+
+StatusOr<PixbufReader> PixbufReader::Open(const std::string& name) {
+  return open_registered([&name](const WindowRecord& window) {
+    return window.title == name || window.process_name == name;
+  });
+}
+
 PixbufReader::PixbufReader(ShmMutex&& mu, Shm&& shm)
     : mu_(std::move(mu)), shm_(std::move(shm)) {
+  // Readers still work without the reservation, but move their mapping as
+  // the window grows.
+  shm_.reserve(PixbufData::reserve_size_from_env());
   data_ = (PixbufData*)shm_.map();
 }
 
+void PixbufReader::follow_layout() {
+  if (data_->generation == generation_) {
+    return;
+  }
+  generation_ = data_->generation;
+  // Mappings only grow, so they keep covering what the writer may write.
+  size_t size = std::max<size_t>(
+      data_->capacity,
+      PixbufData::pixbuf_struct_size(data_->width, data_->height));
+  if (size > shm_.size()) {
+    shm_.resize(size);
+    data_ = (PixbufData*)shm_.map();
+  }
+}
+
 const ReadPixbuf& PixbufReader::read_pixels() {
+  TRACE_SCOPE("read_pixels");
+  trace::Scope lock_wait("reader_lock_wait");
   LockResult lock = mu_.mu().lock(kOneSecNanos);
+  lock_wait.end();
   if (lock.state == LockState::OWNERDEAD || lock.state == LockState::TIMEOUT) {
     read_pixbuf_.code = ErrorCode::GENERAL;
     return read_pixbuf_;
   }
 
+  follow_layout();
   int32_t w = data_->width;
   int32_t h = data_->height;
-  size_t pixbuf_struct_size = PixbufData::pixbuf_struct_size(w, h);
-  shm_.resize(pixbuf_struct_size);
-  data_ = (PixbufData*)shm_.map();
-  read_pixbuf_.update(w, h, &data_->first_pixel);
+  {
+    TRACE_SCOPE("reader_copy", "sequence", data_->sequence);
+    read_pixbuf_.update(w, h, &data_->first_pixel);
+  }
+  read_pixbuf_.sequence = data_->sequence;
   read_pixbuf_.code = ErrorCode::OK;
 
   return read_pixbuf_;
 }
+
+FrameInfo PixbufReader::read_into(uint8_t* dst, size_t dst_stride,
+                                  size_t capacity) {
+  TRACE_SCOPE("read_into");
+  FrameInfo info;
+  trace::Scope lock_wait("reader_lock_wait");
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  lock_wait.end();
+  if (lock.state == LockState::OWNERDEAD || lock.state == LockState::TIMEOUT) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+
+  follow_layout();
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = data_->sequence;
+
+  const size_t row_size = PixbufData::pixbuf_size(info.width, 1);
+  info.stride = dst_stride ? dst_stride : row_size;
+  size_t dst_size =
+      info.height ? info.stride * (info.height - 1) + row_size : 0;
+  if (info.stride < row_size || dst_size > capacity) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  TRACE_SCOPE("reader_copy", "sequence", info.sequence);
+  const uint8_t* src = &data_->first_pixel;
+  if (info.stride == row_size) {
+    memcpy(dst, src, PixbufData::pixbuf_size(info.width, info.height));
+  } else {
+    for (int32_t y = 0; y < info.height; ++y) {
+      memcpy(dst + y * info.stride, src + y * row_size, row_size);
+    }
+  }
+  return info;
+}
+
+FrameInfo PixbufReader::read_preprocessed(Preprocessor& preprocessor,
+                                          void* dst, size_t capacity) {
+  TRACE_SCOPE("read_preprocessed");
+  FrameInfo info;
+  trace::Scope lock_wait("reader_lock_wait");
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  lock_wait.end();
+  if (lock.state == LockState::OWNERDEAD || lock.state == LockState::TIMEOUT) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+
+  follow_layout();
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = data_->sequence;
+  info.stride = PixbufData::pixbuf_size(info.width, 1);
+  info.code = preprocessor.run(&data_->first_pixel, info.width, info.height,
+                               info.stride, dst, capacity);
+  return info;
+}
+
+FrameInfo PixbufReader::peek() {
+  FrameInfo info;
+  LockResult lock = mu_.mu().lock(kOneSecNanos);
+  if (lock.state == LockState::OWNERDEAD || lock.state == LockState::TIMEOUT) {
+    info.code = ErrorCode::GENERAL;
+    return info;
+  }
+  info.width = data_->width;
+  info.height = data_->height;
+  info.sequence = data_->sequence;
+  return info;
+}
+
+bool PixbufReader::wait_for_frame(uint64_t after_sequence,
+                                  uint64_t timeout_nanos) {
+  TRACE_SCOPE("wait_for_frame");
+  // The header sits at the start of the mapping, which only this reader moves,
+  // so we can wait on the sequence number without taking the lock. Writers
+  // wake its futex after every frame.
+  const uint64_t start_nanos = now_nanos();
+  while (true) {
+    uint64_t sequence = __atomic_load_n(&data_->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != after_sequence) {
+      return true;
+    }
+    uint64_t elapsed = now_nanos() - start_nanos;
+    if (elapsed >= timeout_nanos) {
+      return false;
+    }
+    futex_wait(data_->sequence_futex(), (uint32_t)sequence,
+               timeout_nanos - elapsed);
+  }
+}
@@ -31,7 +31,12 @@ struct ReadPixbuf {
   ErrorCode code = ErrorCode::OK;
   int32_t width = 0;
   int32_t height = 0;
+  // The writer's sequence number for this frame.
+  uint64_t sequence = 0;
   uint8_t* pixels = nullptr;
+  // The allocated size of 'pixels', which only grows, so resizing back and
+  // forth doesn't reallocate.
+  size_t capacity = 0;
 
   ReadPixbuf() = default;
   ~ReadPixbuf() { free(pixels); }
@@ -45,17 +50,68 @@ struct ReadPixbuf {
   void update(int32_t new_w, int32_t new_h, const uint8_t* data);
 };
 
+// Describes a frame copied into a caller-provided buffer.
+struct FrameInfo {
+  ErrorCode code = ErrorCode::OK;
+  int32_t width = 0;
+  int32_t height = 0;
+  // The writer's sequence number for this frame.
+  uint64_t sequence = 0;
+  // The distance in bytes between the starts of rows in the destination.
+  size_t stride = 0;
+};
+
+class Preprocessor;
+
 class PixbufReader {
  public:
   // Factory function to create a PixbufReader.
   // 'path' should be the name of the window you're trying to connect to.
-  // You can get it from xwininfo, or from the bottom of `ls -1tr /dev/shm`.
+  // You can get it from the registry, or pass the X11 window id from xwininfo,
+  // which is resolved on this process's DISPLAY (see resolve_pixbuf_name()).
+  // Pass HugePages::THP to read THP pixbufs through huge page mappings.
   // Returns StatusOr<PixbufReader> with a NOT_FOUND status if the shared-memory
   // at 'path' cannot be opened.
-  static StatusOr<PixbufReader> Create(const std::string& path);
+  static StatusOr<PixbufReader> Create(
+      const std::string& path, HugePages huge_pages = huge_pages_from_env());
+
+  // Opens the registered pixbuf of process 'pid', or of the window whose
+  // title or process name is 'name'. If several match, opens the one that
+  // published most recently. Returns NOT_FOUND if none match.
+  static StatusOr<PixbufReader> Open(int32_t pid);
+  static StatusOr<PixbufReader> Open(const std::string& name);
 
   const ReadPixbuf& read_pixels();
 
+  // Copies the latest frame's pixels straight into 'dst', skipping
+  // read_pixels()'s intermediate buffer, so frames can land directly in
+  // pinned, huge page or tensor-backed memory. Rows start every 'dst_stride'
+  // bytes, leaving any padding past a row's width*4 bytes untouched. A
+  // 'dst_stride' of 0 packs rows tightly.
+  //
+  // If the stride is shorter than a row, or the frame doesn't fit in
+  // 'capacity' bytes, nothing is copied and the returned code is GENERAL,
+  // with the frame's size filled in so the caller can grow 'dst'.
+  FrameInfo read_into(uint8_t* dst, size_t dst_stride, size_t capacity);
+  FrameInfo read_into(uint8_t* dst, size_t capacity) {
+    return read_into(dst, 0, capacity);
+  }
+
+  // Runs 'preprocessor' over the latest frame directly in shared memory,
+  // writing the observation to 'dst'. The writer is locked out while it runs.
+  // Returns GENERAL if the output doesn't fit in 'capacity' bytes, with the
+  // source frame's size filled in.
+  FrameInfo read_preprocessed(Preprocessor& preprocessor, void* dst,
+                              size_t capacity);
+
+  // Returns the latest frame's size and sequence number without copying it.
+  FrameInfo peek();
+
+  // Waits up to 'timeout_nanos' for a frame with a sequence number other than
+  // 'after_sequence'. Returns whether one arrived. Sleeps on a futex the
+  // writer wakes on every frame, rather than polling.
+  bool wait_for_frame(uint64_t after_sequence, uint64_t timeout_nanos);
+
   // Exposed for testing.
   PixbufData& get_data() { return *data_; };
   Shm& get_shm() { return shm_; };
@@ -64,10 +120,16 @@ class PixbufReader {
   // Private constructor, use Create() instead.
   PixbufReader(ShmMutex&& mu, Shm&& shm);
 
-  // shm_ and data_ are protected by mu_.
+  // Grows the mapping to the writer's capacity if the layout changed since
+  // the last read. Call with mu_ held.
+  void follow_layout();
+
+  // shm_, data_ and generation_ are protected by mu_.
   ShmMutex mu_;
   Shm shm_;
   PixbufData* data_;
+  // The writer's layout generation the mapping was last checked at.
+  uint32_t generation_ = 0;
 
   ReadPixbuf read_pixbuf_;
 };
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pixbuf_reader_group.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "trace/trace.h"
+#include "worker_pool.h"
+
+StatusOr<PixbufReaderGroup> PixbufReaderGroup::Create(
+    const std::vector<std::string>& paths, int num_threads) {
+  std::vector<PixbufReader> readers;
+  readers.reserve(paths.size());
+  for (const std::string& path : paths) {
+    StatusOr<PixbufReader> reader = PixbufReader::Create(path);
+    RETURN_IF_ERROR(reader);
+    readers.push_back(std::move(*reader));
+  }
+
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, std::max(1, (int)paths.size()));
+  return PixbufReaderGroup(std::move(readers), num_threads);
+}
+
+PixbufReaderGroup::PixbufReaderGroup(std::vector<PixbufReader>&& readers,
+                                     int num_threads)
+    : readers_(std::move(readers)),
+      statuses_(readers_.size()),
+      pool_(std::make_unique<WorkerPool>(num_threads,
+                                         "vkvfb_reader_group")) {}
+
+PixbufReaderGroup::PixbufReaderGroup(PixbufReaderGroup&& other) noexcept =
+    default;
+PixbufReaderGroup& PixbufReaderGroup::operator=(
+    PixbufReaderGroup&& other) noexcept = default;
+PixbufReaderGroup::~PixbufReaderGroup() = default;
+
+const std::vector<GroupFrameStatus>& PixbufReaderGroup::read_into(
+    uint8_t* batch, size_t slot_size) {
+  TRACE_SCOPE("group_read_into", "windows", readers_.size());
+  std::function<void(size_t)> read_one = [&](size_t i) {
+    FrameInfo info = readers_[i].read_into(batch + i * slot_size, slot_size);
+    GroupFrameStatus& status = statuses_[i];
+    // Published frames have nonzero sequence numbers, so this is a failure to
+    // lock the window, and what we knew about its last frame still holds.
+    if (info.code != ErrorCode::OK && info.sequence == 0) {
+      status.code = info.code;
+      status.updated = false;
+      status.resized = false;
+      return;
+    }
+    status.updated = info.sequence != status.sequence;
+    status.resized = info.width != status.width || info.height != status.height;
+    status.code = info.code;
+    status.width = info.width;
+    status.height = info.height;
+    status.sequence = info.sequence;
+  };
+  pool_->run(readers_.size(), read_one);
+  return statuses_;
+}
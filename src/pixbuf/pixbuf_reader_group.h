@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_PIXBUF_READER_GROUP_H_
+#define PIXBUF_PIXBUF_READER_GROUP_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pixbuf/pixbuf_reader.h"
+#include "status_or.h"
+
+class WorkerPool;
+
+// The status of one window after a batch read.
+struct GroupFrameStatus {
+  // OK if the window's frame was copied into its slot. GENERAL if the window
+  // couldn't be read or its frame didn't fit in the slot, in which case the
+  // slot is left as it was.
+  ErrorCode code = ErrorCode::OK;
+  int32_t width = 0;
+  int32_t height = 0;
+  uint64_t sequence = 0;
+  // True if the frame's sequence number differs from the last batch's.
+  bool updated = false;
+  // True if the frame's size differs from the last batch's, including on the
+  // first batch.
+  bool resized = false;
+};
+
+// Reads the latest frames of many windows into one contiguous batch buffer,
+// such as an NHWC array, copying each window's frame directly into its slot.
+// Windows are read in parallel on a pool of threads that lives as long as the
+// group.
+class PixbufReaderGroup {
+ public:
+  // Opens a reader for each of 'paths'. 'num_threads' is the number of threads
+  // reading, including the calling thread, and defaults to one per core, up to
+  // one per window. Returns NOT_FOUND if any window can't be opened.
+  static StatusOr<PixbufReaderGroup> Create(
+      const std::vector<std::string>& paths, int num_threads = 0);
+
+  PixbufReaderGroup(PixbufReaderGroup&& other) noexcept;
+  PixbufReaderGroup& operator=(PixbufReaderGroup&& other) noexcept;
+  ~PixbufReaderGroup();
+
+  // Copies window i's latest frame to 'batch' + i * 'slot_size', for every
+  // window, and returns each window's status. Frames are tightly packed RGBA
+  // rows. The returned statuses stay valid until the next read_into().
+  const std::vector<GroupFrameStatus>& read_into(uint8_t* batch,
+                                                 size_t slot_size);
+
+  size_t size() const { return readers_.size(); }
+
+ private:
+  // Private constructor, use Create() instead.
+  PixbufReaderGroup(std::vector<PixbufReader>&& readers, int num_threads);
+
+  std::vector<PixbufReader> readers_;
+  std::vector<GroupFrameStatus> statuses_;
+  std::unique_ptr<WorkerPool> pool_;
+};
+
+#endif  // PIXBUF_PIXBUF_READER_GROUP_H_
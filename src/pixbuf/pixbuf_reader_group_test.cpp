@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pixbuf_reader_group.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pixbuf_writer.h"
+
+TEST(PixbufReaderGroup, ReadIntoBatch) {
+  const int kWindows = 5;
+  const int32_t kWidth = 64;
+  const int32_t kHeight = 32;
+  const size_t kSlotSize = PixbufData::pixbuf_size(kWidth, kHeight);
+
+  std::vector<std::string> paths;
+  std::vector<PixbufWriter> writers;
+  for (int i = 0; i < kWindows; ++i) {
+    paths.push_back("test_group_buf_" + std::to_string(i));
+    StatusOr<PixbufWriter> writer = PixbufWriter::Create(paths.back());
+    ASSERT_TRUE(writer.ok());
+    writers.push_back(std::move(writer.value()));
+  }
+
+  // Window i is filled with the value i.
+  std::vector<uint8_t> pixels(kSlotSize);
+  for (int i = 0; i < kWindows; ++i) {
+    memset(pixels.data(), i, pixels.size());
+    writers[i].write_pixels(pixels.data(), kWidth, kHeight);
+  }
+
+  StatusOr<PixbufReaderGroup> group_result =
+      PixbufReaderGroup::Create(paths, /*num_threads=*/3);
+  ASSERT_TRUE(group_result.ok());
+  PixbufReaderGroup group = std::move(group_result.value());
+  ASSERT_EQ(group.size(), (size_t)kWindows);
+
+  std::vector<uint8_t> batch(kWindows * kSlotSize);
+  const std::vector<GroupFrameStatus>& first =
+      group.read_into(batch.data(), kSlotSize);
+  for (int i = 0; i < kWindows; ++i) {
+    EXPECT_EQ(first[i].code, ErrorCode::OK);
+    EXPECT_EQ(first[i].width, kWidth);
+    EXPECT_EQ(first[i].height, kHeight);
+    EXPECT_TRUE(first[i].updated);
+    EXPECT_TRUE(first[i].resized);
+    std::vector<uint8_t> expected(kSlotSize, (uint8_t)i);
+    EXPECT_EQ(memcmp(batch.data() + i * kSlotSize, expected.data(), kSlotSize),
+              0);
+  }
+
+  // Update window 1 and grow window 3 past the slot size.
+  memset(pixels.data(), 42, pixels.size());
+  writers[1].write_pixels(pixels.data(), kWidth, kHeight);
+  std::vector<uint8_t> large_pixels(PixbufData::pixbuf_size(kWidth * 2, kHeight));
+  writers[3].write_pixels(large_pixels.data(), kWidth * 2, kHeight);
+
+  const std::vector<GroupFrameStatus>& second =
+      group.read_into(batch.data(), kSlotSize);
+  EXPECT_FALSE(second[0].updated);
+  EXPECT_FALSE(second[0].resized);
+  EXPECT_TRUE(second[1].updated);
+  EXPECT_FALSE(second[1].resized);
+  EXPECT_EQ(batch[1 * kSlotSize], 42);
+  EXPECT_EQ(second[3].code, ErrorCode::GENERAL);
+  EXPECT_TRUE(second[3].resized);
+  EXPECT_EQ(second[3].width, kWidth * 2);
+  // Window 3's slot is untouched.
+  EXPECT_EQ(batch[3 * kSlotSize], 3);
+}
+
+TEST(PixbufReaderGroup, MissingWindow) {
+  StatusOr<PixbufReaderGroup> group =
+      PixbufReaderGroup::Create({"test_group_buf_missing"});
+  EXPECT_FALSE(group.ok());
+}
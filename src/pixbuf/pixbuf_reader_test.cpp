@@ -16,11 +16,17 @@
 
 #include "pixbuf_reader.h"
 
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "pixbuf_writer.h"
 #include "utility.h"
@@ -35,6 +41,8 @@ void EXPECT_PIXBUF_EQ(const ReadPixbuf& pixbuf, uint8_t* other_data,
 }
 
 TEST(Pixbuf, ReadWriteTest) {
+  // Writers keep the size of an existing segment, so start from a new one.
+  shm_unlink("test_buf");
   StatusOr<PixbufWriter> writer_result = PixbufWriter::Create("test_buf");
   ASSERT_TRUE(writer_result.ok());
   PixbufWriter writer = std::move(writer_result.value());
@@ -58,22 +66,237 @@ TEST(Pixbuf, ReadWriteTest) {
   EXPECT_EQ(reader.get_shm().size(),
             round_to_page(PixbufData::pixbuf_struct_size(320, 240)));
 
-  // Read and write buffer 1, expecting the correct data and shm size.
+  // Read and write buffer 1, expecting the correct data and shm size. The
+  // mapping grows in place, within its reservation.
+  void* map = reader.get_shm().map();
   writer.write_pixels(pixels_1, 640, 480);
   const ReadPixbuf& result_1 = reader.read_pixels();
   EXPECT_PIXBUF_EQ(result_1, pixels_1, 640, 480);
   EXPECT_EQ(reader.get_shm().size(),
             round_to_page(PixbufData::pixbuf_struct_size(640, 480)));
+  EXPECT_EQ(reader.get_shm().map(), map);
 
-  // Read and write buffer 0, expecting the correct data and shm size.
-  // We check buffer 0 again after buffer 1 to ensure the reader both grows and
-  // shrinks its mapped shm as necessary.
+  // Read and write buffer 0, expecting the correct data. We check buffer 0
+  // again after buffer 1 to ensure the pixbuf never shrinks, so the reader
+  // keeps its larger mapping.
   writer.write_pixels(pixels_0, 320, 240);
   const ReadPixbuf& result_0_again = reader.read_pixels();
   EXPECT_PIXBUF_EQ(result_0_again, pixels_0, 320, 240);
   EXPECT_EQ(reader.get_shm().size(),
-            round_to_page(PixbufData::pixbuf_struct_size(320, 240)));
+            round_to_page(PixbufData::pixbuf_struct_size(640, 480)));
+  EXPECT_EQ(reader.get_data().capacity, reader.get_shm().size());
 
   free(pixels_0);
   free(pixels_1);
 }
+
+TEST(Pixbuf, ReserveGrowsAheadOfFrames) {
+  PixbufOptions options;
+  options.lock_memory = true;
+  StatusOr<PixbufWriter> writer_result =
+      PixbufWriter::Create("test_buf", WindowInfo(), options);
+  ASSERT_TRUE(writer_result.ok());
+  PixbufWriter writer = std::move(writer_result.value());
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create("test_buf");
+  ASSERT_TRUE(reader_result.ok());
+  PixbufReader reader = std::move(reader_result.value());
+
+  std::vector<uint8_t> small(PixbufData::pixbuf_size(32, 16), 1);
+  std::vector<uint8_t> big(PixbufData::pixbuf_size(640, 480), 2);
+  writer.write_pixels(small.data(), 32, 16);
+  writer.reserve(640, 480);
+  // Readers see the old frame until the next one lands, and see the pixbuf
+  // grow once its pages are faulted in.
+  const size_t big_size = PixbufData::pixbuf_struct_size(640, 480);
+  const uint64_t deadline = now_nanos() + kOneSecNanos;
+  do {
+    EXPECT_PIXBUF_EQ(reader.read_pixels(), small.data(), 32, 16);
+  } while (reader.get_shm().size() < big_size && now_nanos() < deadline);
+  EXPECT_GE(reader.get_shm().size(), big_size);
+
+  void* map = reader.get_shm().map();
+  writer.write_pixels(big.data(), 640, 480);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), big.data(), 640, 480);
+  EXPECT_EQ(reader.get_shm().map(), map);
+}
+
+TEST(Pixbuf, FramesLandDuringPrefaults) {
+  PixbufOptions options;
+  options.reserve_size = PixbufData::pixbuf_struct_size(64, 64);
+  StatusOr<PixbufWriter> writer_result =
+      PixbufWriter::Create("test_buf", WindowInfo(), options);
+  ASSERT_TRUE(writer_result.ok());
+  PixbufWriter writer = std::move(writer_result.value());
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create("test_buf");
+  ASSERT_TRUE(reader_result.ok());
+  PixbufReader reader = std::move(reader_result.value());
+
+  // Each frame lands while the last reservation's pages are being faulted
+  // in. The first fits the grown segment, and the second moves the mapping.
+  std::vector<uint8_t> big(PixbufData::pixbuf_size(1024, 768), 3);
+  std::vector<uint8_t> bigger(PixbufData::pixbuf_size(1920, 1080), 4);
+  writer.reserve(1024, 768);
+  writer.write_pixels(big.data(), 1024, 768);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), big.data(), 1024, 768);
+  writer.reserve(1280, 800);
+  writer.write_pixels(bigger.data(), 1920, 1080);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), bigger.data(), 1920, 1080);
+}
+
+TEST(Pixbuf, ReadIntoStrided) {
+  StatusOr<PixbufWriter> writer_result = PixbufWriter::Create("test_buf");
+  ASSERT_TRUE(writer_result.ok());
+  PixbufWriter writer = std::move(writer_result.value());
+
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create("test_buf");
+  ASSERT_TRUE(reader_result.ok());
+  PixbufReader reader = std::move(reader_result.value());
+
+  const int32_t w = 30;
+  const int32_t h = 20;
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(w, h));
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (uint8_t)i;
+  }
+  writer.write_pixels(pixels.data(), w, h);
+
+  // Rows padded out to 128 bytes keep their padding.
+  const size_t stride = 128;
+  std::vector<uint8_t> dst(stride * h, 0xAB);
+  FrameInfo info = reader.read_into(dst.data(), stride, dst.size());
+  EXPECT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.width, w);
+  EXPECT_EQ(info.height, h);
+  EXPECT_EQ(info.stride, stride);
+  for (int32_t y = 0; y < h; ++y) {
+    EXPECT_EQ(memcmp(dst.data() + y * stride, pixels.data() + y * w * 4, w * 4),
+              0);
+    EXPECT_EQ(dst[y * stride + w * 4], 0xAB);
+  }
+
+  // The last row doesn't need padding.
+  info = reader.read_into(dst.data(), stride, stride * (h - 1) + w * 4);
+  EXPECT_EQ(info.code, ErrorCode::OK);
+
+  // Strides shorter than a row and buffers that are too small are rejected.
+  info = reader.read_into(dst.data(), w * 4 - 4, dst.size());
+  EXPECT_EQ(info.code, ErrorCode::GENERAL);
+  info = reader.read_into(dst.data(), 0, pixels.size() - 1);
+  EXPECT_EQ(info.code, ErrorCode::GENERAL);
+  EXPECT_EQ(info.width, w);
+  EXPECT_EQ(info.height, h);
+}
+
+TEST(Pixbuf, MemfdTransport) {
+  std::optional<PixbufWriter> writer;
+  PixbufOptions options;
+  options.transport = PixbufTransport::MEMFD;
+  {
+    StatusOr<PixbufWriter> writer_result =
+        PixbufWriter::Create("test_memfd_buf", WindowInfo(), options);
+    ASSERT_TRUE(writer_result.ok());
+    writer.emplace(std::move(writer_result.value()));
+  }
+  // Nothing is published in /dev/shm.
+  EXPECT_NE(access("/dev/shm/test_memfd_buf", F_OK), 0);
+
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create("test_memfd_buf");
+  ASSERT_TRUE(reader_result.ok());
+  PixbufReader reader = std::move(reader_result.value());
+  // Readers can't write the pixels.
+  EXPECT_EQ(fcntl(reader.get_shm().fd(), F_GETFL) & O_ACCMODE, O_RDONLY);
+
+  std::vector<uint8_t> big(PixbufData::pixbuf_size(64, 64), 1);
+  std::vector<uint8_t> small(PixbufData::pixbuf_size(16, 16), 2);
+  writer->write_pixels(big.data(), 64, 64);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), big.data(), 64, 64);
+
+  // The memfd never shrinks, so neither does the reader's mapping.
+  writer->write_pixels(small.data(), 16, 16);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), small.data(), 16, 16);
+  EXPECT_EQ(reader.get_shm().size(),
+            round_to_page(PixbufData::pixbuf_struct_size(64, 64)));
+
+  // A new writer of the pixbuf, like a recreated swapchain's, keeps serving
+  // the same memfds to existing readers.
+  StatusOr<PixbufWriter> next_writer =
+      PixbufWriter::Create("test_memfd_buf", WindowInfo(), options);
+  ASSERT_TRUE(next_writer.ok());
+  writer.reset();
+  next_writer->write_pixels(big.data(), 64, 64);
+  EXPECT_PIXBUF_EQ(reader.read_pixels(), big.data(), 64, 64);
+}
+
+TEST(Pixbuf, HugePages) {
+  // Each mode falls back when the host has no huge pages to give, so only the
+  // sizing and the pixels are checked.
+  for (HugePages huge_pages :
+       {HugePages::OFF, HugePages::THP, HugePages::HUGETLB}) {
+    for (PixbufTransport transport :
+         {PixbufTransport::SHM, PixbufTransport::MEMFD}) {
+      PixbufOptions options;
+      options.transport = transport;
+      options.huge_pages = huge_pages;
+      StatusOr<PixbufWriter> writer =
+          PixbufWriter::Create("test_huge_buf", WindowInfo(), options);
+      ASSERT_TRUE(writer.ok());
+      StatusOr<PixbufReader> reader =
+          PixbufReader::Create("test_huge_buf", huge_pages);
+      ASSERT_TRUE(reader.ok());
+
+      std::vector<uint8_t> pixels(PixbufData::pixbuf_size(640, 480), 3);
+      writer->write_pixels(pixels.data(), 640, 480);
+      EXPECT_PIXBUF_EQ(reader->read_pixels(), pixels.data(), 640, 480);
+      EXPECT_EQ(reader->get_shm().size() % reader->get_shm().page_size(), 0u);
+    }
+    shm_unlink("test_huge_buf");
+    shm_unlink("test_huge_buf_mu");
+  }
+}
+
+TEST(Pixbuf, WaitForFrameWakesOnWrite) {
+  StatusOr<PixbufWriter> writer = PixbufWriter::Create("test_wait_buf");
+  ASSERT_TRUE(writer.ok());
+  StatusOr<PixbufReader> reader = PixbufReader::Create("test_wait_buf");
+  ASSERT_TRUE(reader.ok());
+
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(16, 16), 5);
+  writer->write_pixels(pixels.data(), 16, 16);
+  uint64_t sequence = reader->read_pixels().sequence;
+  EXPECT_FALSE(reader->wait_for_frame(sequence, 1'000'000));
+
+  // The writer wakes the waiting reader well before its timeout.
+  std::thread write_thread([&] {
+    usleep(20'000);
+    writer->write_pixels(pixels.data(), 16, 16);
+  });
+  const uint64_t ten_secs = 10'000'000'000;
+  EXPECT_TRUE(reader->wait_for_frame(sequence, ten_secs));
+  write_thread.join();
+  EXPECT_EQ(reader->read_pixels().sequence, sequence + 1);
+}
+
+TEST(Pixbuf, RecreatedWriterKeepsSequence) {
+  shm_unlink("test_recreate_buf");
+  StatusOr<PixbufWriter> writer = PixbufWriter::Create("test_recreate_buf");
+  ASSERT_TRUE(writer.ok());
+  StatusOr<PixbufReader> reader = PixbufReader::Create("test_recreate_buf");
+  ASSERT_TRUE(reader.ok());
+
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(16, 16), 5);
+  writer->write_pixels(pixels.data(), 16, 16);
+  writer->write_pixels(pixels.data(), 16, 16);
+  uint64_t sequence = reader->read_pixels().sequence;
+  EXPECT_EQ(sequence, 2u);
+
+  // A new writer for the same window, as on swapchain recreation, carries on
+  // from the last frame, so readers waiting on it see the next one.
+  writer = PixbufWriter::Create("test_recreate_buf");
+  ASSERT_TRUE(writer.ok());
+  EXPECT_FALSE(reader->wait_for_frame(sequence, 1'000'000));
+  writer->write_pixels(pixels.data(), 16, 16);
+  EXPECT_TRUE(reader->wait_for_frame(sequence, 1'000'000));
+  EXPECT_EQ(reader->read_pixels().sequence, sequence + 1);
+  shm_unlink("test_recreate_buf");
+  shm_unlink("test_recreate_buf_mu");
+}
@@ -16,73 +16,317 @@
 
 #include "pixbuf_writer.h"
 
-#include <cassert>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <mutex>
 
 #include "constants.h"
+#include "ipc/fd_server.h"
+#include "ipc/futex.h"
+#include "logger.h"
+#include "naming.h"
 #include "pixbuf_data.h"
+#include "trace/trace.h"
+
+// A pixbuf's memfds, shared by the pixbuf's writers in this process.
+struct MemfdPixbuf {
+  ~MemfdPixbuf() {
+    close(data_fd);
+    close(mu_fd);
+  }
+
+  int data_fd = -1;
+  int mu_fd = -1;
+  std::unique_ptr<FdServer> server;
+};
 
 namespace {
 
-void memcpy_pixels(void* dst, const void* src, size_t size, bool force_opaque) {
-  if (!force_opaque) {
-    memcpy(dst, src, size);
-    return;
+// How often reserve()'s prefault thread tries for the lock to publish the
+// grown capacity, and so how long a writer cancelling it waits.
+const uint64_t kPrefaultLockPollNanos = 1'000'000;
+
+std::mutex memfd_pixbufs_mu;
+std::map<std::string, std::weak_ptr<MemfdPixbuf>> memfd_pixbufs;
+
+// Returns this process's memfds for the pixbuf 'path', creating them and
+// serving them to readers if no live writer has.
+StatusOr<std::shared_ptr<MemfdPixbuf>> open_memfd_pixbuf(
+    const std::string& path, HugePages huge_pages) {
+  std::lock_guard<std::mutex> lock(memfd_pixbufs_mu);
+  std::shared_ptr<MemfdPixbuf> memfd = memfd_pixbufs[path].lock();
+  if (memfd) {
+    return memfd;
   }
 
-  // Check alignment for uint32_t operations
-  assert(((uintptr_t)src & 3) == 0 && "src must be 4-byte aligned");
-  assert(((uintptr_t)dst & 3) == 0 && "dst must be 4-byte aligned");
+  StatusOr<Shm> mu_shm = Shm::CreateMemfd(path + "_mu", sizeof(PMutex));
+  RETURN_IF_ERROR(mu_shm);
+  // Only the memfd's creator initializes the mutex.
+  new (mu_shm->map()) PMutex(/*create=*/true);
+  StatusOr<Shm> shm = Shm::CreateMemfd(
+      path, PixbufData::pixbuf_struct_size(0, 0), huge_pages);
+  RETURN_IF_ERROR(shm);
 
-  // Memcpy clamping every 4th byte to 255.
-  uint32_t* from = (uint32_t*)(src);
-  uint32_t* to = (uint32_t*)(dst);
-  uint32_t* end = (uint32_t*)(src) + size / 4;
-  while (from != end) {
-    *to = *from | 0xff000000u;
-    from++;
-    to++;
+  memfd = std::make_shared<MemfdPixbuf>();
+  memfd->data_fd = dup(shm->fd());
+  memfd->mu_fd = dup(mu_shm->fd());
+  // Readers get a read-only fd to the pixels, so they can't stomp on them.
+  const std::string fd_path = "/proc/self/fd/" + std::to_string(shm->fd());
+  int reader_data_fd = open(fd_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (reader_data_fd == -1) {
+    return StatusVal(ErrorCode::GENERAL);
   }
+  StatusOr<std::unique_ptr<FdServer>> server = FdServer::Create(
+      pixbuf_socket_name(path), {reader_data_fd, dup(memfd->mu_fd)});
+  RETURN_IF_ERROR(server);
+  memfd->server = std::move(*server);
+  memfd_pixbufs[path] = memfd;
+  return memfd;
 }
 
 }  // namespace
 
-StatusOr<PixbufWriter> PixbufWriter::Create(const std::string& path) {
-  StatusOr<ShmMutex> mu_result =
-      ShmMutex::Create(path + "_mu", /*create=*/true);
-  RETURN_IF_ERROR(mu_result);
+PixbufOptions PixbufOptions::from_env() {
+  PixbufOptions options;
+  const char* transport_env = std::getenv("VKVFB_TRANSPORT");
+  if (transport_env && strcmp(transport_env, "memfd") == 0) {
+    options.transport = PixbufTransport::MEMFD;
+  } else if (transport_env && *transport_env &&
+             strcmp(transport_env, "shm") != 0) {
+    ERROR("Ignoring invalid VKVFB_TRANSPORT '%s'", transport_env);
+  }
+  options.huge_pages = huge_pages_from_env();
+  options.reserve_size = PixbufData::reserve_size_from_env();
+  const char* prefault_env = std::getenv("VKVFB_PREFAULT");
+  options.prefault = !prefault_env || strcmp(prefault_env, "0") != 0;
+  const char* mlock_env = std::getenv("VKVFB_MLOCK");
+  options.lock_memory = mlock_env && strcmp(mlock_env, "1") == 0;
+  return options;
+}
 
-  StatusOr<Shm> shm_result =
-      Shm::Create(path, 'w', PixbufData::pixbuf_struct_size(0, 0));
+StatusOr<PixbufWriter> PixbufWriter::Create(const std::string& path,
+                                            const WindowInfo& window,
+                                            const PixbufOptions& options) {
+  StatusOr<ShmMutex> mu_result = StatusVal(ErrorCode::UNKNOWN);
+  StatusOr<Shm> shm_result = StatusVal(ErrorCode::UNKNOWN);
+  std::shared_ptr<MemfdPixbuf> memfd;
+  if (options.transport == PixbufTransport::MEMFD) {
+    StatusOr<std::shared_ptr<MemfdPixbuf>> memfd_result =
+        open_memfd_pixbuf(path, options.huge_pages);
+    if (memfd_result.ok()) {
+      memfd = std::move(*memfd_result);
+      StatusOr<Shm> mu_shm = Shm::FromFd(dup(memfd->mu_fd), 'w');
+      RETURN_IF_ERROR(mu_shm);
+      mu_result = ShmMutex::FromShm(std::move(*mu_shm), /*create=*/false);
+      shm_result =
+          Shm::FromFd(dup(memfd->data_fd), 'w', options.huge_pages);
+    } else {
+      ERROR("Failed to serve pixbuf %s over memfds, falling back to shm",
+            path.c_str());
+    }
+  }
+  if (!memfd) {
+    mu_result = ShmMutex::Create(path + "_mu", /*create=*/true);
+    RETURN_IF_ERROR(mu_result);
+    shm_result = Shm::Create(path, 'w', PixbufData::pixbuf_struct_size(0, 0),
+                             options.huge_pages);
+  }
+  RETURN_IF_ERROR(mu_result);
   RETURN_IF_ERROR(shm_result);
 
+  // Adopts the whole of a segment an earlier writer grew, since readers may
+  // still map all of it.
+  struct stat st;
+  if (fstat(shm_result->fd(), &st) == 0) {
+    shm_result->resize(std::max((size_t)st.st_size, shm_result->size()));
+  }
+  if (!shm_result->reserve(options.reserve_size).ok()) {
+    ERROR("Pixbuf %s will move its mapping as it grows", path.c_str());
+  }
+  if (options.lock_memory && !shm_result->lock().ok()) {
+    ERROR("Pixbuf %s isn't locked in memory, raise RLIMIT_MEMLOCK",
+          path.c_str());
+  }
+  // Readers of an earlier writer's segment wait for the sequence to move on
+  // from the last frame they read, so it carries on from there rather than
+  // starting over.
+  const PixbufData* old_data = (const PixbufData*)shm_result->map();
+  const uint64_t sequence = old_data->sequence;
+  const uint32_t generation = old_data->generation;
   PixbufData* data = new (shm_result->map()) PixbufData('w');
-  return PixbufWriter(std::move(*mu_result), std::move(*shm_result), data);
+  data->sequence = sequence;
+  data->capacity = shm_result->size();
+  data->generation = generation + 1;
+
+  // Readers can still open the pixbuf by name, so it works unregistered.
+  WindowRegistration registration;
+  StatusOr<WindowRegistration> registration_result =
+      WindowRegistration::Create(path, window);
+  if (registration_result.ok()) {
+    registration = std::move(*registration_result);
+  } else {
+    ERROR("Failed to register pixbuf %s", path.c_str());
+  }
+  return PixbufWriter(std::move(*mu_result), std::move(*shm_result), data,
+                      std::move(registration), std::move(memfd), options);
 }
 
-PixbufWriter::PixbufWriter(ShmMutex&& mu, Shm&& shm, PixbufData* data)
-    : mu_(std::move(mu)), shm_(std::move(shm)), data_(data) {}
+PixbufWriter::PixbufWriter(ShmMutex&& mu, Shm&& shm, PixbufData* data,
+                           WindowRegistration&& registration,
+                           std::shared_ptr<MemfdPixbuf> memfd,
+                           const PixbufOptions& options)
+    : mu_(std::move(mu)),
+      shm_(std::move(shm)),
+      data_(data),
+      registration_(std::move(registration)),
+      memfd_(std::move(memfd)),
+      prefault_(options.prefault) {}
 
-void PixbufWriter::write_pixels(const uint8_t* pixels, int32_t width,
+WriteResult PixbufWriter::write_pixels(const uint8_t* pixels, int32_t width,
                                 int32_t height, bool force_opaque) {
   if (!pixels) {
     fprintf(stderr, "PixbufWriter::write_pixels: pixels cannot be null\n");
     exit(1);
   }
   if (width <= 0 || height <= 0) {
-    return;
+    return WriteResult::EMPTY;
   }
+  TRACE_SCOPE("write_pixels");
 
+  trace::Scope lock_wait("writer_lock_wait");
   LockResult res = mu_.mu().lock(2 * kOneSecNanos);
+  lock_wait.end();
   if (res.state == LockState::LOCKED) {
-    size_t new_shm_size = PixbufData::pixbuf_struct_size(width, height);
     size_t pixbuf_size = PixbufData::pixbuf_size(width, height);
-    shm_.resize(new_shm_size);
-    data_ = (PixbufData*)shm_.map();
-    data_->width = width;
-    data_->height = height;
-    memcpy_pixels(&data_->first_pixel, pixels, pixbuf_size, force_opaque);
+    if (width != data_->width || height != data_->height) {
+      grow(PixbufData::pixbuf_struct_size(width, height));
+      data_->width = width;
+      data_->height = height;
+      data_->generation++;
+    }
+    {
+      TRACE_SCOPE("writer_memcpy", "sequence", data_->sequence + 1);
+      PixbufData::copy_pixels(&data_->first_pixel, pixels, pixbuf_size,
+                              force_opaque);
+    }
+    data_->sequence++;
+    futex_wake_all(data_->sequence_futex());
+    registration_.record_frame(width, height);
+    return WriteResult::PUBLISHED;
   } else if (res.state == LockState::OWNERDEAD) {
     mu_.mu().reset();
+    return WriteResult::OWNER_DEAD;
+  }
+  return WriteResult::LOCK_TIMEOUT;
+}
+
+PixbufWriter& PixbufWriter::operator=(PixbufWriter&& other) noexcept {
+  if (this != &other) {
+    // Stops our prefault before the mapping and mutex it uses are replaced.
+    prefault_thread_ = std::move(other.prefault_thread_);
+    mu_ = std::move(other.mu_);
+    shm_ = std::move(other.shm_);
+    data_ = other.data_;
+    registration_ = std::move(other.registration_);
+    memfd_ = std::move(other.memfd_);
+    prefault_ = other.prefault_;
+    other.data_ = nullptr;
   }
+  return *this;
+}
+
+void PixbufWriter::grow(size_t size) {
+  if (size <= data_->capacity) {
+    return;
+  }
+  // A frame that lands before reserve()'s prefault is done publishes the
+  // capacity itself, and the prefault skips it.
+  extend(size);
+  data_->capacity = shm_.size();
+  data_->generation++;
+}
+
+void PixbufWriter::extend(size_t size) {
+  if (size <= shm_.size()) {
+    return;
+  }
+  // Grows by at least half again, so windows that are dragged larger don't
+  // resize on every frame, but stays within the reservation when the frame
+  // does, so the mapping doesn't move.
+  size_t capacity = std::max(size, shm_.size() + shm_.size() / 2);
+  if (size <= shm_.reserved()) {
+    capacity = std::min(capacity, shm_.reserved());
+  } else {
+    // The mapping moves out from under a prefault, so it stops first.
+    prefault_thread_.reset();
+  }
+  TRACE_SCOPE("writer_grow", "capacity", capacity);
+  shm_.resize(capacity);
+  data_ = (PixbufData*)shm_.map();
+}
+
+void PixbufWriter::reserve(int32_t width, int32_t height) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  const size_t size = PixbufData::pixbuf_struct_size(width, height);
+  LockResult res = mu_.mu().lock(2 * kOneSecNanos);
+  if (res.state == LockState::OWNERDEAD) {
+    mu_.mu().reset();
+    return;
+  } else if (res.state != LockState::LOCKED) {
+    return;
+  }
+  if (!prefault_) {
+    grow(size);
+    return;
+  }
+
+  // An earlier reservation's prefault is superseded. Its thread gives up
+  // waiting for the lock we hold once it's cancelled.
+  prefault_thread_.reset();
+  if (size <= data_->capacity) {
+    return;
+  }
+  extend(size);
+
+  // Only this writer moves its mapping, and extend() stops the prefault
+  // before it does, so the pages can be faulted in while frames are written.
+  // Pages below the published capacity were already faulted in or written.
+  uint8_t* map = (uint8_t*)shm_.map();
+  const size_t start = data_->capacity;
+  const size_t end = shm_.size();
+  PMutex* mu = &mu_.mu();
+  PixbufData* data = data_;
+  Prefault* prefault = new Prefault();
+  prefault->thread = std::thread([=] {
+    trace::set_thread_name("vkvfb_prefault");
+    {
+      TRACE_SCOPE("prefault", "bytes", end - start);
+      ::prefault(map + start, end - start, /*writable=*/true);
+    }
+    // Polls for the lock, so that a writer holding it can cancel us.
+    while (!prefault->cancelled.load(std::memory_order_relaxed)) {
+      LockResult res = mu->lock(kPrefaultLockPollNanos);
+      if (res.state == LockState::TIMEOUT) {
+        continue;
+      }
+      if (res.state == LockState::OWNERDEAD) {
+        // The next frame publishes the capacity instead.
+        mu->reset();
+      } else if (!prefault->cancelled.load(std::memory_order_relaxed) &&
+                 data->capacity < end) {
+        data->capacity = end;
+        data->generation++;
+      }
+      return;
+    }
+  });
+  prefault_thread_.reset(prefault);
 }
@@ -17,34 +17,134 @@
 #ifndef PIXBUF_PIXBUF_WRITER_H_
 #define PIXBUF_PIXBUF_WRITER_H_
 
+#include <atomic>
 #include <cstddef>
+#include <memory>
 #include <string>
+#include <thread>
 
 #include "ipc/shm.h"
 #include "ipc/shm_mutex.h"
 #include "pixbuf/pixbuf_data.h"
+#include "pixbuf/registry.h"
 #include "status_or.h"
 
+enum class WriteResult {
+  PUBLISHED,
+  // The frame had no pixels, so there was nothing to publish.
+  EMPTY,
+  // The frame was dropped because a reader held the lock for too long.
+  LOCK_TIMEOUT,
+  // The frame was dropped because the lock's owner died. The lock is reset, so
+  // the next write can succeed.
+  OWNER_DEAD,
+  // The frame was dropped because a blocking frame ring stayed full of frames
+  // a reader hadn't read.
+  RING_FULL,
+};
+
+// How a pixbuf's segments reach its readers.
+enum class PixbufTransport {
+  // Named POSIX shm, which readers open by name from a shared /dev/shm.
+  SHM,
+  // Sealed memfds, which the writer passes to readers of the same user over
+  // the abstract unix socket pixbuf_socket_name(path). Readers need no shared
+  // /dev/shm or /tmp, only a shared network namespace, get a read-only fd to
+  // the pixels, and since the memfds only grow, never see their mappings
+  // shrink. The segments live as long as the writers of the pixbuf in this
+  // process, so readers keep them across swapchain recreation.
+  MEMFD,
+};
+
+struct PixbufOptions {
+  PixbufTransport transport = PixbufTransport::SHM;
+  HugePages huge_pages = HugePages::OFF;
+  // The address space to reserve for the pixbuf, so it can grow to frames up
+  // to this size without moving.
+  size_t reserve_size = PixbufData::pixbuf_struct_size(
+      PixbufData::kDefaultMaxWidth, PixbufData::kDefaultMaxHeight);
+  // Whether reserve() faults in the pixbuf's pages ahead of its frames.
+  bool prefault = true;
+  // Whether to lock the pixbuf's pages in memory, within RLIMIT_MEMLOCK.
+  bool lock_memory = false;
+
+  // Reads VKVFB_TRANSPORT ("shm" or "memfd"), VKVFB_HUGE_PAGES,
+  // VKVFB_MAX_FRAME, VKVFB_PREFAULT ("0" to disable) and VKVFB_MLOCK ("1" to
+  // enable).
+  static PixbufOptions from_env();
+};
+
+struct MemfdPixbuf;
+
 class PixbufWriter {
  public:
   // Factory function to create a PixbufWriter.
   // Returns StatusOr<PixbufWriter> with appropriate error status if creation
-  // fails.
-  static StatusOr<PixbufWriter> Create(const std::string& path);
+  // fails. The pixbuf is listed in the registry under 'window' until the
+  // writer is destroyed. If the MEMFD transport fails, falls back to SHM.
+  static StatusOr<PixbufWriter> Create(
+      const std::string& path, const WindowInfo& window = WindowInfo(),
+      const PixbufOptions& options = PixbufOptions());
 
   // Writes the given pixel data to the shared pixbuf. If force_opaque is true,
   // overrides the copied data's alpha channel (assuming RGBA8) to be 255.
-  void write_pixels(const uint8_t* pixels, int32_t width, int32_t height,
+  // The pixbuf grows to fit larger frames, but never shrinks.
+  // Returns whether the frame was published.
+  WriteResult write_pixels(const uint8_t* pixels, int32_t width, int32_t height,
                     bool force_opaque = false);
 
+  // Grows the pixbuf to fit width x height frames ahead of the first one.
+  // Unless the options disable it, its new pages are faulted in on a
+  // background thread first, and readers only see it grow once they're in,
+  // so neither the first frames after a resize nor readers following the new
+  // layout stall on page faults. Readers keep seeing the current frame
+  // meanwhile.
+  void reserve(int32_t width, int32_t height);
+
+  PixbufWriter(PixbufWriter&& other) noexcept = default;
+  PixbufWriter& operator=(PixbufWriter&& other) noexcept;
+
+  // Updates the window's title in the registry.
+  void set_title(const std::string& title) { registration_.set_title(title); }
+
  private:
+  // A background prefault started by reserve(), which publishes the grown
+  // capacity once the pages are in. Destroying it cancels the publish, if it
+  // hasn't happened yet, and waits for the thread.
+  struct Prefault {
+    std::atomic<bool> cancelled{false};
+    std::thread thread;
+    ~Prefault() {
+      cancelled.store(true, std::memory_order_relaxed);
+      thread.join();
+    }
+  };
+
   // Private constructor, use Create() instead.
-  PixbufWriter(ShmMutex&& mu, Shm&& shm, PixbufData* data);
+  PixbufWriter(ShmMutex&& mu, Shm&& shm, PixbufData* data,
+               WindowRegistration&& registration,
+               std::shared_ptr<MemfdPixbuf> memfd,
+               const PixbufOptions& options);
+
+  // Grows the pixbuf's capacity to at least 'size' bytes and publishes it.
+  // Call with mu_ held.
+  void grow(size_t size);
+
+  // Grows the segment to at least 'size' bytes without publishing the new
+  // capacity. If that moves the mapping, first waits for any prefault of it.
+  // Call with mu_ held.
+  void extend(size_t size);
 
   // Protects shm_ and data_.
   ShmMutex mu_;
   Shm shm_;
   PixbufData* data_;
+  WindowRegistration registration_;
+  // Set when using the MEMFD transport.
+  std::shared_ptr<MemfdPixbuf> memfd_;
+  bool prefault_;
+  // Declared last, so it's joined before the mapping and mutex go away.
+  std::unique_ptr<Prefault> prefault_thread_;
 };
 
 #endif  // PIXBUF_PIXBUF_WRITER_H_
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "preprocess.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "trace/trace.h"
+
+namespace {
+
+// Rec. 601 luma weights, which sum to 1 so gray values stay in [0, 255].
+constexpr float kRedWeight = 0.299f;
+constexpr float kGreenWeight = 0.587f;
+constexpr float kBlueWeight = 0.114f;
+
+// Maps output coordinate 'o' of 'out_size' to a source coordinate of
+// 'src_size', returning the first source pixel and the second's weight. The
+// second pixel is the first plus one, clamped to the source.
+void map_coordinate(int32_t o, int32_t out_size, int32_t src_size,
+                    PreprocessSpec::Filter filter, int32_t* first,
+                    float* weight) {
+  double scale = (double)src_size / out_size;
+  if (filter == PreprocessSpec::Filter::NEAREST) {
+    *first = std::min((int32_t)((o + 0.5) * scale), src_size - 1);
+    *weight = 0;
+    return;
+  }
+  // Sample at pixel centers.
+  double s = std::clamp((o + 0.5) * scale - 0.5, 0.0, (double)(src_size - 1));
+  *first = (int32_t)s;
+  *weight = (float)(s - *first);
+}
+
+// Row loops work on 4 floats at a time with GCC vector extensions, which
+// lower to SSE on x86 and NEON on ARM, and finish with a scalar tail.
+typedef float Float4 __attribute__((vector_size(16)));
+constexpr int32_t kLanes = 4;
+
+inline Float4 load4(const float* p) {
+  Float4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline void store4(float* p, Float4 v) { memcpy(p, &v, sizeof(v)); }
+
+// Sets out[i] = a[i] + w * (b[i] - a[i]).
+void lerp_row(const float* __restrict a, const float* __restrict b, float w,
+              int32_t n, float* __restrict out) {
+  int32_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    Float4 va = load4(a + i);
+    store4(out + i, va + w * (load4(b + i) - va));
+  }
+  for (; i < n; ++i) {
+    out[i] = a[i] + w * (b[i] - a[i]);
+  }
+}
+
+template <typename T>
+void store_row(const float* __restrict values, const float* __restrict scale,
+               const float* __restrict bias, int32_t n, T* __restrict out);
+
+template <>
+void store_row(const float* __restrict values, const float* __restrict scale,
+               const float* __restrict bias, int32_t n,
+               float* __restrict out) {
+  int32_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    store4(out + i, load4(values + i) * load4(scale + i) + load4(bias + i));
+  }
+  for (; i < n; ++i) {
+    out[i] = values[i] * scale[i] + bias[i];
+  }
+}
+
+template <>
+void store_row(const float* __restrict values, const float*, const float*,
+               int32_t n, uint8_t* __restrict out) {
+  // Values are blends of bytes, so they're already in [0, 255].
+  for (int32_t i = 0; i < n; ++i) {
+    out[i] = (uint8_t)(values[i] + 0.5f);
+  }
+}
+
+// Stores a blended row, laid out as the output is, to output row 'y'.
+template <typename T>
+void store_output_row(const float* values, const float* scale,
+                      const float* bias, int32_t width, int32_t height,
+                      int32_t channels, PreprocessSpec::Layout layout,
+                      int32_t y, T* out) {
+  if (layout == PreprocessSpec::Layout::HWC) {
+    int32_t n = width * channels;
+    store_row(values, scale, bias, n, out + (size_t)y * n);
+    return;
+  }
+  for (int32_t c = 0; c < channels; ++c) {
+    T* plane = out + (size_t)c * width * height;
+    store_row(values + c * width, scale + c * width, bias + c * width, width,
+              plane + (size_t)y * width);
+  }
+}
+
+}  // namespace
+
+StatusOr<Preprocessor> Preprocessor::Create(const PreprocessSpec& spec) {
+  if (spec.crop_x < 0 || spec.crop_y < 0 || spec.crop_width < 0 ||
+      spec.crop_height < 0 || spec.out_width < 0 || spec.out_height < 0) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  for (float std : spec.std) {
+    if (std == 0) {
+      return StatusVal(ErrorCode::GENERAL);
+    }
+  }
+  return Preprocessor(spec);
+}
+
+bool Preprocessor::resolve_crop(int32_t src_width, int32_t src_height,
+                                Crop* crop) const {
+  crop->x = spec_.crop_x;
+  crop->y = spec_.crop_y;
+  int32_t max_width = src_width - crop->x;
+  int32_t max_height = src_height - crop->y;
+  crop->width =
+      spec_.crop_width ? std::min(spec_.crop_width, max_width) : max_width;
+  crop->height =
+      spec_.crop_height ? std::min(spec_.crop_height, max_height) : max_height;
+  return crop->width > 0 && crop->height > 0;
+}
+
+bool Preprocessor::output_shape(int32_t src_width, int32_t src_height,
+                                int32_t* width, int32_t* height,
+                                int32_t* channels) const {
+  Crop crop;
+  if (!resolve_crop(src_width, src_height, &crop)) {
+    return false;
+  }
+  *width = spec_.out_width ? spec_.out_width : crop.width;
+  *height = spec_.out_height ? spec_.out_height : crop.height;
+  *channels = spec_.channels == PreprocessSpec::Channels::RGB ? 3 : 1;
+  return true;
+}
+
+size_t Preprocessor::output_size(int32_t src_width, int32_t src_height) const {
+  int32_t width, height, channels;
+  if (!output_shape(src_width, src_height, &width, &height, &channels)) {
+    return 0;
+  }
+  size_t element_size =
+      spec_.dtype == PreprocessSpec::DataType::FLOAT32 ? sizeof(float) : 1;
+  return (size_t)width * height * channels * element_size;
+}
+
+void Preprocessor::build_tables(int32_t src_width, int32_t src_height) {
+  resolve_crop(src_width, src_height, &crop_);
+  output_shape(src_width, src_height, &out_width_, &out_height_, &channels_);
+  table_src_width_ = src_width;
+  table_src_height_ = src_height;
+
+  x_offsets_.resize(out_width_);
+  x_steps_.resize(out_width_);
+  x_weights_.resize(out_width_);
+  for (int32_t ox = 0; ox < out_width_; ++ox) {
+    int32_t x;
+    map_coordinate(ox, out_width_, crop_.width, spec_.filter, &x,
+                   &x_weights_[ox]);
+    x_offsets_[ox] = (crop_.x + x) * 4;
+    x_steps_[ox] = x + 1 < crop_.width ? 4 : 0;
+  }
+
+  y_rows_.resize(out_height_);
+  y_weights_.resize(out_height_);
+  for (int32_t oy = 0; oy < out_height_; ++oy) {
+    map_coordinate(oy, out_height_, crop_.height, spec_.filter, &y_rows_[oy],
+                   &y_weights_[oy]);
+  }
+
+  const size_t row_size = (size_t)out_width_ * channels_;
+  row_scale_.resize(row_size);
+  row_bias_.resize(row_size);
+  for (int32_t c = 0; c < channels_; ++c) {
+    float scale = 1.0f / (255.0f * spec_.std[c]);
+    float bias = -spec_.mean[c] / spec_.std[c];
+    for (int32_t ox = 0; ox < out_width_; ++ox) {
+      size_t i = spec_.layout == PreprocessSpec::Layout::HWC
+                     ? (size_t)ox * channels_ + c
+                     : (size_t)c * out_width_ + ox;
+      row_scale_[i] = scale;
+      row_bias_[i] = bias;
+    }
+  }
+  rows_[0].resize(row_size);
+  rows_[1].resize(row_size);
+  blended_.resize(row_size);
+}
+
+namespace {
+
+enum class RowMode { GRAY, RGB_HWC, RGB_CHW };
+
+// Horizontally resamples one source row into 'row', in the output's layout.
+template <RowMode kMode>
+void resample_row_as(const uint8_t* __restrict src_row,
+                     const int32_t* __restrict offsets,
+                     const int32_t* __restrict steps,
+                     const float* __restrict weights, int32_t width,
+                     float* __restrict row) {
+  for (int32_t x = 0; x < width; ++x) {
+    const uint8_t* a = src_row + offsets[x];
+    const uint8_t* b = a + steps[x];
+    float w = weights[x];
+    float r = a[0] + w * (b[0] - a[0]);
+    float g = a[1] + w * (b[1] - a[1]);
+    float bl = a[2] + w * (b[2] - a[2]);
+    if constexpr (kMode == RowMode::GRAY) {
+      row[x] = kRedWeight * r + kGreenWeight * g + kBlueWeight * bl;
+    } else if constexpr (kMode == RowMode::RGB_HWC) {
+      row[x * 3 + 0] = r;
+      row[x * 3 + 1] = g;
+      row[x * 3 + 2] = bl;
+    } else {
+      row[x] = r;
+      row[width + x] = g;
+      row[2 * width + x] = bl;
+    }
+  }
+}
+
+}  // namespace
+
+void Preprocessor::resample_row(const uint8_t* src, size_t src_stride,
+                                int32_t sy, float* row) {
+  const uint8_t* src_row = src + (size_t)(crop_.y + sy) * src_stride;
+  if (channels_ == 1) {
+    resample_row_as<RowMode::GRAY>(src_row, x_offsets_.data(),
+                                   x_steps_.data(), x_weights_.data(),
+                                   out_width_, row);
+  } else if (spec_.layout == PreprocessSpec::Layout::HWC) {
+    resample_row_as<RowMode::RGB_HWC>(src_row, x_offsets_.data(),
+                                      x_steps_.data(), x_weights_.data(),
+                                      out_width_, row);
+  } else {
+    resample_row_as<RowMode::RGB_CHW>(src_row, x_offsets_.data(),
+                                      x_steps_.data(), x_weights_.data(),
+                                      out_width_, row);
+  }
+}
+
+ErrorCode Preprocessor::run(const uint8_t* src, int32_t src_width,
+                            int32_t src_height, size_t src_stride, void* dst,
+                            size_t capacity) {
+  TRACE_SCOPE("preprocess");
+  size_t size = output_size(src_width, src_height);
+  if (size == 0 || size > capacity) {
+    return ErrorCode::GENERAL;
+  }
+  if (src_width != table_src_width_ || src_height != table_src_height_) {
+    build_tables(src_width, src_height);
+  }
+
+  // Returns source row 'sy' resampled, loading it over whichever cached row
+  // isn't 'keep'.
+  row_sources_[0] = row_sources_[1] = -1;
+  auto fetch = [&](int32_t sy, int32_t keep) {
+    for (int i = 0; i < 2; ++i) {
+      if (row_sources_[i] == sy) {
+        return rows_[i].data();
+      }
+    }
+    int slot = row_sources_[0] == keep ? 1 : 0;
+    resample_row(src, src_stride, sy, rows_[slot].data());
+    row_sources_[slot] = sy;
+    return rows_[slot].data();
+  };
+
+  const int32_t n = out_width_ * channels_;
+  for (int32_t oy = 0; oy < out_height_; ++oy) {
+    int32_t y0 = y_rows_[oy];
+    int32_t y1 = std::min(y0 + 1, crop_.height - 1);
+    float w = y_weights_[oy];
+    const float* values = fetch(y0, y1);
+    if (w > 0 && y1 != y0) {
+      lerp_row(values, fetch(y1, y0), w, n, blended_.data());
+      values = blended_.data();
+    }
+
+    if (spec_.dtype == PreprocessSpec::DataType::FLOAT32) {
+      store_output_row(values, row_scale_.data(), row_bias_.data(), out_width_,
+                       out_height_, channels_, spec_.layout, oy, (float*)dst);
+    } else {
+      store_output_row(values, row_scale_.data(), row_bias_.data(), out_width_,
+                       out_height_, channels_, spec_.layout, oy,
+                       (uint8_t*)dst);
+    }
+  }
+  return ErrorCode::OK;
+}
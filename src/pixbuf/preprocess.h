@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_PREPROCESS_H_
+#define PIXBUF_PREPROCESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "status_or.h"
+
+// Describes how to turn an RGBA frame into an observation.
+struct PreprocessSpec {
+  enum class Channels { RGB, GRAY };
+  enum class DataType { UINT8, FLOAT32 };
+  enum class Layout { HWC, CHW };
+  enum class Filter { NEAREST, BILINEAR };
+
+  // The source rectangle to keep. A zero width or height extends the crop to
+  // the frame's edge, and crops are clamped to the frame.
+  int32_t crop_x = 0;
+  int32_t crop_y = 0;
+  int32_t crop_width = 0;
+  int32_t crop_height = 0;
+
+  // The output size. Zero keeps the crop's size.
+  int32_t out_width = 0;
+  int32_t out_height = 0;
+
+  Channels channels = Channels::RGB;
+  DataType dtype = DataType::FLOAT32;
+  Layout layout = Layout::HWC;
+  Filter filter = Filter::BILINEAR;
+
+  // FLOAT32 outputs are (value / 255 - mean[c]) / std[c]. GRAY outputs use
+  // mean[0] and std[0]. UINT8 outputs aren't normalized.
+  float mean[3] = {0, 0, 0};
+  float std[3] = {1, 1, 1};
+};
+
+// Crops, resizes, converts and normalizes frames in a single pass.
+//
+// Each output row blends two horizontally resampled source rows, which are
+// cached in the output's channel layout, so every source row is read at most
+// once and the per-element work runs over contiguous arrays that the compiler
+// vectorizes. Lookup tables are rebuilt only when the source size changes.
+class Preprocessor {
+ public:
+  // Returns GENERAL if 'spec' has negative sizes or a zero std.
+  static StatusOr<Preprocessor> Create(const PreprocessSpec& spec);
+
+  const PreprocessSpec& spec() const { return spec_; }
+
+  // The output's width, height and channel count for a source frame of the
+  // given size. Returns false if the crop doesn't overlap the frame.
+  bool output_shape(int32_t src_width, int32_t src_height, int32_t* width,
+                    int32_t* height, int32_t* channels) const;
+
+  // The output's size in bytes, or 0 if the crop doesn't overlap the frame.
+  size_t output_size(int32_t src_width, int32_t src_height) const;
+
+  // Processes the RGBA frame at 'src', whose rows start every 'src_stride'
+  // bytes, into 'dst'. Returns GENERAL without writing anything if the crop
+  // doesn't overlap the frame or the output doesn't fit in 'capacity' bytes.
+  ErrorCode run(const uint8_t* src, int32_t src_width, int32_t src_height,
+                size_t src_stride, void* dst, size_t capacity);
+
+ private:
+  explicit Preprocessor(const PreprocessSpec& spec) : spec_(spec) {}
+
+  struct Crop {
+    int32_t x, y, width, height;
+  };
+  bool resolve_crop(int32_t src_width, int32_t src_height, Crop* crop) const;
+
+  // Rebuilds the lookup tables for a new source size.
+  void build_tables(int32_t src_width, int32_t src_height);
+
+  // Resamples source row 'sy' of the crop into 'row', in output layout.
+  void resample_row(const uint8_t* src, size_t src_stride, int32_t sy,
+                    float* row);
+
+  PreprocessSpec spec_;
+
+  // State for the source size the tables were built for.
+  int32_t table_src_width_ = -1;
+  int32_t table_src_height_ = -1;
+  Crop crop_ = {};
+  int32_t out_width_ = 0;
+  int32_t out_height_ = 0;
+  int32_t channels_ = 0;
+  // Per output column, the left source pixel's byte offset within a row, the
+  // right pixel's offset relative to the left, and the right pixel's weight.
+  std::vector<int32_t> x_offsets_;
+  std::vector<int32_t> x_steps_;
+  std::vector<float> x_weights_;
+  // Per output row, the top source row and the bottom row's weight.
+  std::vector<int32_t> y_rows_;
+  std::vector<float> y_weights_;
+  // Per element of an output row, the normalization scale and bias.
+  std::vector<float> row_scale_;
+  std::vector<float> row_bias_;
+  // Two resampled source rows, with the source row each one holds.
+  std::vector<float> rows_[2];
+  int32_t row_sources_[2] = {-1, -1};
+  // The blended output row, before conversion.
+  std::vector<float> blended_;
+};
+
+#endif  // PIXBUF_PREPROCESS_H_
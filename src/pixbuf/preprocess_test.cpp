@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "preprocess.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "pixbuf_reader.h"
+#include "pixbuf_writer.h"
+
+namespace {
+
+// A width x height RGBA frame where pixel (x, y) is (x, y, x + y, 255).
+std::vector<uint8_t> make_frame(int32_t width, int32_t height) {
+  std::vector<uint8_t> frame(PixbufData::pixbuf_size(width, height));
+  for (int32_t y = 0; y < height; ++y) {
+    for (int32_t x = 0; x < width; ++x) {
+      uint8_t* p = &frame[((size_t)y * width + x) * 4];
+      p[0] = x;
+      p[1] = y;
+      p[2] = x + y;
+      p[3] = 255;
+    }
+  }
+  return frame;
+}
+
+Preprocessor make_preprocessor(const PreprocessSpec& spec) {
+  StatusOr<Preprocessor> preprocessor = Preprocessor::Create(spec);
+  EXPECT_TRUE(preprocessor.ok());
+  return std::move(preprocessor.value());
+}
+
+}  // namespace
+
+TEST(Preprocess, CropKeepsRgb) {
+  PreprocessSpec spec;
+  spec.crop_x = 2;
+  spec.crop_y = 1;
+  spec.crop_width = 3;
+  spec.crop_height = 2;
+  spec.dtype = PreprocessSpec::DataType::UINT8;
+  Preprocessor preprocessor = make_preprocessor(spec);
+
+  std::vector<uint8_t> frame = make_frame(8, 4);
+  ASSERT_EQ(preprocessor.output_size(8, 4), 3u * 2 * 3);
+  std::vector<uint8_t> out(preprocessor.output_size(8, 4));
+  ASSERT_EQ(preprocessor.run(frame.data(), 8, 4, 8 * 4, out.data(), out.size()),
+            ErrorCode::OK);
+  for (int32_t y = 0; y < 2; ++y) {
+    for (int32_t x = 0; x < 3; ++x) {
+      const uint8_t* p = &out[(y * 3 + x) * 3];
+      EXPECT_EQ(p[0], x + 2);
+      EXPECT_EQ(p[1], y + 1);
+      EXPECT_EQ(p[2], x + y + 3);
+    }
+  }
+}
+
+TEST(Preprocess, BilinearResize) {
+  PreprocessSpec spec;
+  spec.out_width = 4;
+  spec.out_height = 1;
+  spec.channels = PreprocessSpec::Channels::GRAY;
+  Preprocessor preprocessor = make_preprocessor(spec);
+
+  // A black pixel and a white pixel, upscaled 2x.
+  std::vector<uint8_t> frame = {0, 0, 0, 255, 255, 255, 255, 255};
+  std::vector<float> out(4);
+  ASSERT_EQ(preprocessor.run(frame.data(), 2, 1, 8, out.data(),
+                             out.size() * sizeof(float)),
+            ErrorCode::OK);
+  EXPECT_NEAR(out[0], 0.0f, 1e-4);
+  EXPECT_NEAR(out[1], 0.25f, 1e-4);
+  EXPECT_NEAR(out[2], 0.75f, 1e-4);
+  EXPECT_NEAR(out[3], 1.0f, 1e-4);
+}
+
+TEST(Preprocess, NormalizedChw) {
+  PreprocessSpec spec;
+  spec.out_width = 4;
+  spec.out_height = 2;
+  spec.filter = PreprocessSpec::Filter::NEAREST;
+  spec.layout = PreprocessSpec::Layout::CHW;
+  spec.mean[1] = 0.5f;
+  spec.std[1] = 0.5f;
+  Preprocessor preprocessor = make_preprocessor(spec);
+
+  // Nearest neighbor 2x downscale picks odd source pixels.
+  std::vector<uint8_t> frame = make_frame(8, 4);
+  std::vector<float> out(3 * 2 * 4);
+  ASSERT_EQ(preprocessor.run(frame.data(), 8, 4, 8 * 4, out.data(),
+                             out.size() * sizeof(float)),
+            ErrorCode::OK);
+  for (int32_t y = 0; y < 2; ++y) {
+    for (int32_t x = 0; x < 4; ++x) {
+      int32_t sx = 2 * x + 1;
+      int32_t sy = 2 * y + 1;
+      EXPECT_FLOAT_EQ(out[0 * 8 + y * 4 + x], sx / 255.0f);
+      EXPECT_FLOAT_EQ(out[1 * 8 + y * 4 + x], (sy / 255.0f - 0.5f) / 0.5f);
+      EXPECT_FLOAT_EQ(out[2 * 8 + y * 4 + x], (sx + sy) / 255.0f);
+    }
+  }
+}
+
+TEST(Preprocess, RejectsBadSpecsAndSmallBuffers) {
+  PreprocessSpec spec;
+  spec.std[0] = 0;
+  EXPECT_FALSE(Preprocessor::Create(spec).ok());
+
+  spec = PreprocessSpec();
+  spec.crop_x = 10;
+  Preprocessor preprocessor = make_preprocessor(spec);
+  std::vector<uint8_t> frame = make_frame(8, 4);
+  std::vector<float> out(1024);
+  // The crop is off the frame.
+  EXPECT_EQ(preprocessor.output_size(8, 4), 0u);
+  EXPECT_EQ(preprocessor.run(frame.data(), 8, 4, 8 * 4, out.data(),
+                             out.size() * sizeof(float)),
+            ErrorCode::GENERAL);
+
+  preprocessor = make_preprocessor(PreprocessSpec());
+  EXPECT_EQ(preprocessor.run(frame.data(), 8, 4, 8 * 4, out.data(), 16),
+            ErrorCode::GENERAL);
+}
+
+TEST(Preprocess, ReadPreprocessed) {
+  StatusOr<PixbufWriter> writer_result = PixbufWriter::Create("test_buf");
+  ASSERT_TRUE(writer_result.ok());
+  PixbufWriter writer = std::move(writer_result.value());
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create("test_buf");
+  ASSERT_TRUE(reader_result.ok());
+  PixbufReader reader = std::move(reader_result.value());
+
+  std::vector<uint8_t> frame = make_frame(64, 32);
+  writer.write_pixels(frame.data(), 64, 32);
+
+  PreprocessSpec spec;
+  spec.out_width = 16;
+  spec.out_height = 8;
+  spec.channels = PreprocessSpec::Channels::GRAY;
+  spec.dtype = PreprocessSpec::DataType::UINT8;
+  Preprocessor preprocessor = make_preprocessor(spec);
+  std::vector<uint8_t> out(16 * 8);
+  FrameInfo info = reader.read_preprocessed(preprocessor, out.data(), out.size());
+  EXPECT_EQ(info.code, ErrorCode::OK);
+  EXPECT_EQ(info.width, 64);
+  EXPECT_EQ(info.height, 32);
+  // Brightness grows down and to the right.
+  EXPECT_LT(out[0], out[15]);
+  EXPECT_LT(out[15], out[16 * 7 + 15]);
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "registry.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "logger.h"
+#include "utility.h"
+
+// An entry's pid is 0 while it's free, the owner's pid while it's claimed, and
+// -1 while a process frees a dead owner's entry. Its version is odd while the
+// entry is readable, so the zeroed entries of a new registry start out free
+// and unreadable:
+//
+//   claim:   CAS pid 0 -> self, version to even, fill in fields, version++
+//            (odd)
+//   retitle: version++ (even), write title, version++ (odd)
+//   release: version++ (even), pid = 0
+//   reap:    CAS pid dead -> -1, version++ (even), pid = 0
+//
+// Readers copy an entry between two loads of its pid and version, and keep
+// the copy only if neither changed and the version was odd. Copies torn by a
+// retitle are tried again, so the entry doesn't drop out of listings. A
+// process that dies part way through a retitle leaves its entry's version
+// odd once it's reaped, which is why claims even it out first.
+
+namespace {
+
+// Tries to copy a live entry this many times before giving up on it.
+const int kCopyAttempts = 4;
+
+void copy_string(char* dst, size_t dst_size, const std::string& src) {
+  snprintf(dst, dst_size, "%s", src.c_str());
+}
+
+// Like copy_string(), but doesn't truncate part way through a UTF-8 character.
+void copy_utf8(char* dst, size_t dst_size, const std::string& src) {
+  size_t size = src.size();
+  if (size >= dst_size) {
+    size = dst_size - 1;
+    // Back up over the continuation bytes of the cut character.
+    while (size > 0 && ((unsigned char)src[size] & 0xc0) == 0x80) {
+      size--;
+    }
+  }
+  memcpy(dst, src.data(), size);
+  dst[size] = '\0';
+}
+
+std::string process_name() {
+  char name[16] = {};
+  FILE* comm = fopen("/proc/self/comm", "r");
+  if (comm) {
+    if (fgets(name, sizeof(name), comm)) {
+      name[strcspn(name, "\n")] = '\0';
+    }
+    fclose(comm);
+  }
+  return name;
+}
+
+// Opens the registry, creating it if 'create' is set and it doesn't exist.
+StatusOr<Shm> open_registry(bool create) {
+  StatusOr<Shm> shm_result =
+      Shm::Create(kRegistryName, create ? 'w' : 'r', sizeof(RegistryData));
+  if (!shm_result.ok()) {
+    if (errno == EACCES) {
+      ERROR("Can't open %s: it belongs to another user and isn't writable "
+            "by others",
+            kRegistryName);
+    }
+    return shm_result.status();
+  }
+
+  // Processes of every user share the registry, so its creator opens it up
+  // past its umask. Only the owner can, so everyone else's chmod fails
+  // harmlessly.
+  struct stat st;
+  if (fstat(shm_result->fd(), &st) == 0 && st.st_uid == geteuid() &&
+      (st.st_mode & 0777) != 0666 && fchmod(shm_result->fd(), 0666) != 0) {
+    ERROR("Failed to make %s writable by other users: %s", kRegistryName,
+          errno_to_string(errno).c_str());
+  }
+
+  // A new segment is zero filled, and every process that opens it writes the
+  // same header, so racing creators agree.
+  RegistryData* data = (RegistryData*)shm_result->map();
+  if (data->magic.load(std::memory_order_acquire) == 0) {
+    data->version = RegistryData::kVersion;
+    uint32_t expected = 0;
+    data->magic.compare_exchange_strong(expected, RegistryData::kMagic,
+                                        std::memory_order_release);
+  }
+  if (data->magic.load(std::memory_order_acquire) != RegistryData::kMagic ||
+      data->version != RegistryData::kVersion) {
+    ERROR("%s has an unknown layout", kRegistryName);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  return shm_result;
+}
+
+// Frees 'entry' if its owner 'pid' has died.
+void reap_if_dead(RegistryData::Entry& entry, int32_t pid) {
+  if (pid <= 0 || pid_alive(pid)) {
+    return;
+  }
+  if (entry.pid.compare_exchange_strong(pid, -1)) {
+    entry.version.fetch_add(1, std::memory_order_release);
+    entry.pid.store(0, std::memory_order_release);
+  }
+}
+
+}  // namespace
+
+StatusOr<WindowRegistration> WindowRegistration::Create(
+    const std::string& pixbuf_name, const WindowInfo& window) {
+  StatusOr<Shm> shm_result = open_registry(/*create=*/true);
+  RETURN_IF_ERROR(shm_result);
+
+  RegistryData* data = (RegistryData*)shm_result->map();
+  const int32_t self = getpid();
+  for (RegistryData::Entry& entry : data->entries) {
+    int32_t pid = entry.pid.load(std::memory_order_acquire);
+    reap_if_dead(entry, pid);
+    pid = 0;
+    if (!entry.pid.compare_exchange_strong(pid, self)) {
+      continue;
+    }
+    if (entry.version.load(std::memory_order_relaxed) % 2) {
+      entry.version.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    copy_string(entry.process_name, sizeof(entry.process_name),
+                process_name());
+    copy_string(entry.display, sizeof(entry.display), window.display);
+    entry.window_id = window.window_id;
+    copy_utf8(entry.title, sizeof(entry.title), window.title);
+    copy_string(entry.pixbuf_name, sizeof(entry.pixbuf_name), pixbuf_name);
+    copy_string(entry.format, sizeof(entry.format), "RGBA8");
+    entry.width.store(0, std::memory_order_relaxed);
+    entry.height.store(0, std::memory_order_relaxed);
+    entry.last_frame_nanos.store(0, std::memory_order_relaxed);
+    entry.version.fetch_add(1, std::memory_order_release);
+    return WindowRegistration(std::move(*shm_result), &entry);
+  }
+  ERROR("%s is full", kRegistryName);
+  return StatusVal(ErrorCode::GENERAL);
+}
+
+WindowRegistration::WindowRegistration(Shm&& shm, RegistryData::Entry* entry)
+    : shm_(std::move(shm)), entry_(entry) {}
+
+WindowRegistration::~WindowRegistration() { release(); }
+
+void WindowRegistration::release() {
+  if (entry_) {
+    entry_->version.fetch_add(1, std::memory_order_release);
+    entry_->pid.store(0, std::memory_order_release);
+    entry_ = nullptr;
+  }
+}
+
+WindowRegistration::WindowRegistration(WindowRegistration&& other) noexcept
+    : shm_(std::move(other.shm_)), entry_(other.entry_) {
+  other.entry_ = nullptr;
+}
+
+WindowRegistration& WindowRegistration::operator=(
+    WindowRegistration&& other) noexcept {
+  if (this != &other) {
+    release();
+    shm_ = std::move(other.shm_);
+    entry_ = other.entry_;
+    other.entry_ = nullptr;
+  }
+  return *this;
+}
+
+void WindowRegistration::record_frame(int32_t width, int32_t height) {
+  if (entry_) {
+    entry_->width.store(width, std::memory_order_relaxed);
+    entry_->height.store(height, std::memory_order_relaxed);
+    entry_->last_frame_nanos.store(now_nanos(), std::memory_order_relaxed);
+  }
+}
+
+void WindowRegistration::set_title(const std::string& title) {
+  if (entry_) {
+    // Readers mustn't see the title change before the version does.
+    entry_->version.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    copy_utf8(entry_->title, sizeof(entry_->title), title);
+    entry_->version.fetch_add(1, std::memory_order_release);
+  }
+}
+
+StatusOr<std::vector<WindowRecord>> list_registered_windows() {
+  StatusOr<Shm> shm_result = open_registry(/*create=*/false);
+  RETURN_IF_ERROR(shm_result);
+
+  RegistryData* data = (RegistryData*)shm_result->map();
+  std::vector<WindowRecord> records;
+  for (RegistryData::Entry& entry : data->entries) {
+    for (int attempt = 0; attempt < kCopyAttempts; attempt++) {
+      int32_t pid = entry.pid.load(std::memory_order_acquire);
+      uint32_t version = entry.version.load(std::memory_order_acquire);
+      if (pid <= 0) {
+        break;
+      }
+      if (attempt == 0 && !pid_alive(pid)) {
+        reap_if_dead(entry, pid);
+        break;
+      }
+      if (version % 2 == 0) {
+        // Being claimed or retitled.
+        continue;
+      }
+
+      WindowRecord record;
+      record.pid = pid;
+      record.process_name.assign(
+          entry.process_name, strnlen(entry.process_name,
+                                      sizeof(entry.process_name)));
+      record.display.assign(entry.display,
+                            strnlen(entry.display, sizeof(entry.display)));
+      record.window_id = entry.window_id;
+      record.title.assign(entry.title,
+                          strnlen(entry.title, sizeof(entry.title)));
+      record.pixbuf_name.assign(
+          entry.pixbuf_name,
+          strnlen(entry.pixbuf_name, sizeof(entry.pixbuf_name)));
+      record.format.assign(entry.format,
+                           strnlen(entry.format, sizeof(entry.format)));
+      record.width = entry.width.load(std::memory_order_relaxed);
+      record.height = entry.height.load(std::memory_order_relaxed);
+      record.last_frame_nanos =
+          entry.last_frame_nanos.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (entry.version.load(std::memory_order_relaxed) == version &&
+          entry.pid.load(std::memory_order_relaxed) == pid) {
+        records.push_back(std::move(record));
+        break;
+      }
+    }
+  }
+  return records;
+}
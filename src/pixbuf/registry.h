@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXBUF_REGISTRY_H_
+#define PIXBUF_REGISTRY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ipc/shm.h"
+#include "status_or.h"
+
+// The registry is one shm segment, shared by every vkvfb process on the host,
+// that lists the live pixbufs, so readers can find a window by its process or
+// title instead of guessing at /dev/shm names. Processes of any user register
+// in it, so it's writable by everyone.
+
+inline const char kRegistryName[] = "vkvfb_registry";
+
+// The layout of the registry segment. Entries are claimed and released with
+// atomics rather than a lock, so a process dying at any point can't wedge the
+// registry; a claimed entry whose pid is gone is stale, and is freed by the
+// next process that notices.
+struct RegistryData {
+  static const uint32_t kMagic = 0x76666272;
+  static const uint32_t kVersion = 1;
+  static const size_t kMaxEntries = 1024;
+
+  struct Entry {
+    // The owning process, or 0 if the entry is free. Claimed by CAS.
+    std::atomic<int32_t> pid;
+    // Even while the entry's fields are being written, so readers can detect
+    // and skip torn copies.
+    std::atomic<uint32_t> version;
+
+    // Fixed while the entry is claimed.
+    char process_name[16];
+    char display[32];
+    uint32_t window_id;
+    // Written by the owner alone, under the version, as the window is
+    // retitled.
+    char title[64];
+    char pixbuf_name[64];
+    char format[8];
+
+    // Updated on every published frame.
+    std::atomic<int32_t> width;
+    std::atomic<int32_t> height;
+    // CLOCK_MONOTONIC nanoseconds.
+    std::atomic<uint64_t> last_frame_nanos;
+  };
+
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  Entry entries[kMaxEntries];
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "RegistryData's atomics must be lock free to live in shm");
+
+// Identifies the window a pixbuf belongs to.
+struct WindowInfo {
+  std::string display;
+  uint32_t window_id = 0;
+  std::string title;
+};
+
+// A copy of a live registry entry.
+struct WindowRecord {
+  int32_t pid = 0;
+  std::string process_name;
+  std::string display;
+  uint32_t window_id = 0;
+  std::string title;
+  std::string pixbuf_name;
+  std::string format;
+  int32_t width = 0;
+  int32_t height = 0;
+  uint64_t last_frame_nanos = 0;
+};
+
+// A pixbuf's entry in the registry, which is released when the registration
+// is destroyed. A default constructed registration holds no entry, and its
+// updates are no-ops.
+class WindowRegistration {
+ public:
+  WindowRegistration() = default;
+
+  // Claims a registry entry for the pixbuf 'pixbuf_name' of 'window', owned by
+  // this process. Returns GENERAL if the registry is full.
+  static StatusOr<WindowRegistration> Create(const std::string& pixbuf_name,
+                                             const WindowInfo& window);
+
+  ~WindowRegistration();
+  WindowRegistration(WindowRegistration&& other) noexcept;
+  WindowRegistration& operator=(WindowRegistration&& other) noexcept;
+
+  // Records a published frame's size and time.
+  void record_frame(int32_t width, int32_t height);
+
+  // Replaces the window's title, e.g. once it's known or after the window is
+  // retitled. Titles are truncated to 63 bytes, at a UTF-8 character
+  // boundary.
+  void set_title(const std::string& title);
+
+ private:
+  WindowRegistration(Shm&& shm, RegistryData::Entry* entry);
+
+  // Frees the entry, if the registration holds one.
+  void release();
+
+  Shm shm_;
+  RegistryData::Entry* entry_ = nullptr;
+};
+
+// Returns every live registered pixbuf, freeing the entries of processes that
+// have died. Returns NOT_FOUND if no vkvfb process has created the registry.
+StatusOr<std::vector<WindowRecord>> list_registered_windows();
+
+#endif  // PIXBUF_REGISTRY_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "registry.h"
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "pixbuf_reader.h"
+#include "pixbuf_writer.h"
+#include "utility.h"
+
+namespace {
+
+// Returns the registry's record of 'pixbuf_name', or nullptr.
+const WindowRecord* find_record(const std::vector<WindowRecord>& records,
+                                const std::string& pixbuf_name) {
+  for (const WindowRecord& record : records) {
+    if (record.pixbuf_name == pixbuf_name) {
+      return &record;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(Registry, WritersRegisterUntilDestroyed) {
+  WindowInfo window;
+  window.display = ":42";
+  window.window_id = 0x00400001;
+  window.title = "registry test window";
+  {
+    StatusOr<PixbufWriter> writer_result =
+        PixbufWriter::Create("test_registry_buf", window);
+    ASSERT_TRUE(writer_result.ok());
+    PixbufWriter writer = std::move(writer_result.value());
+    std::vector<uint8_t> pixels(PixbufData::pixbuf_size(8, 4));
+    writer.write_pixels(pixels.data(), 8, 4);
+
+    StatusOr<std::vector<WindowRecord>> records = list_registered_windows();
+    ASSERT_TRUE(records.ok());
+    const WindowRecord* record = find_record(*records, "test_registry_buf");
+    ASSERT_NE(record, nullptr);
+    EXPECT_EQ(record->pid, getpid());
+    EXPECT_EQ(record->display, ":42");
+    EXPECT_EQ(record->window_id, 0x00400001u);
+    EXPECT_EQ(record->title, "registry test window");
+    EXPECT_EQ(record->format, "RGBA8");
+    EXPECT_EQ(record->width, 8);
+    EXPECT_EQ(record->height, 4);
+    EXPECT_GT(record->last_frame_nanos, 0u);
+
+    StatusOr<PixbufReader> by_title =
+        PixbufReader::Open(std::string("registry test window"));
+    ASSERT_TRUE(by_title.ok());
+    EXPECT_EQ(by_title->read_pixels().width, 8);
+    EXPECT_TRUE(PixbufReader::Open(getpid()).ok());
+  }
+
+  StatusOr<std::vector<WindowRecord>> records = list_registered_windows();
+  ASSERT_TRUE(records.ok());
+  EXPECT_EQ(find_record(*records, "test_registry_buf"), nullptr);
+  EXPECT_EQ(PixbufReader::Open(std::string("registry test window"))
+                .status()
+                .code(),
+            ErrorCode::NOT_FOUND);
+}
+
+TEST(Registry, RetitledWindowsStayListed) {
+  WindowInfo window;
+  window.window_id = 0x00400002;
+  StatusOr<PixbufWriter> writer_result =
+      PixbufWriter::Create("test_registry_retitled", window);
+  ASSERT_TRUE(writer_result.ok());
+  PixbufWriter writer = std::move(writer_result.value());
+
+  // Titles too long for the entry are cut before the 2 byte character that
+  // would straddle its end.
+  std::string long_title(61, 'a');
+  writer.set_title(long_title + "\u00e9\u00e9");
+  StatusOr<std::vector<WindowRecord>> records = list_registered_windows();
+  ASSERT_TRUE(records.ok());
+  const WindowRecord* record = find_record(*records, "test_registry_retitled");
+  ASSERT_NE(record, nullptr);
+  EXPECT_EQ(record->title, long_title + "\u00e9");
+
+  // Readers listing while the window is retitled never miss the entry.
+  std::atomic<bool> done{false};
+  std::thread retitler([&] {
+    for (int i = 0; !done.load(); i++) {
+      writer.set_title(i % 2 ? "registry retitle a" : "registry retitle b");
+      sleep_nanos(1000);
+    }
+  });
+  int missed = 0;
+  for (int i = 0; i < 1000; i++) {
+    records = list_registered_windows();
+    ASSERT_TRUE(records.ok());
+    if (!find_record(*records, "test_registry_retitled")) {
+      missed++;
+    }
+  }
+  done = true;
+  retitler.join();
+  EXPECT_EQ(missed, 0);
+}
+
+TEST(Registry, IsWritableByEveryUser) {
+  StatusOr<PixbufWriter> writer =
+      PixbufWriter::Create("test_registry_buf", WindowInfo());
+  ASSERT_TRUE(writer.ok());
+  struct stat st;
+  ASSERT_EQ(stat((std::string("/dev/shm/") + kRegistryName).c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, 0666u);
+}
@@ -0,0 +1,1069 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Python bindings for PixbufReader, FrameRingReader and JpegStreamReader.
+//
+//   import numpy as np
+//   import vkvfb
+//
+//   reader = vkvfb.Reader("0x00400001")  # Or pid=..., or name="vkcube".
+//   frame = np.empty((720, 1280, 4), np.uint8)
+//   width, height, sequence = reader.read_into(frame)
+//   reader.wait(sequence, timeout=1.0)
+//   view = np.asarray(reader.view())  # Zero-copy, read-only, (h, w, 4).
+//
+//   preprocessor = vkvfb.Preprocessor(size=(84, 84), channels="gray")
+//   obs = np.empty(preprocessor.output_shape(1280, 720), np.float32)
+//   reader.read_preprocessed(obs, preprocessor)
+//
+//   ring = vkvfb.Ring("0x00400001")  # Needs VKVFB_RING_FRAMES in the app.
+//   while ring.wait(timeout=1.0):
+//     width, height, frame_number = ring.read_next(frame)
+//
+//   stream = vkvfb.JpegStream("0x00400001")  # Needs VKVFB_JPEG_QUALITY.
+//   jpeg, width, height, sequence = stream.read()
+//
+// Frames are exposed through the buffer protocol, so they work with NumPy
+// without the module depending on it. Waiting, locking and copying all happen
+// with the GIL released.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+#include "pixbuf/frame_ring.h"
+#include "pixbuf/jpeg_stream.h"
+#include "pixbuf/pixbuf_data.h"
+#include "pixbuf/pixbuf_reader.h"
+#include "pixbuf/preprocess.h"
+#include "pixbuf/registry.h"
+#include "utility.h"
+
+namespace {
+
+// A read-only mapping of a window's frame, exported through the buffer
+// protocol as a (height, width, 4) array of bytes.
+//
+// A view is live: it maps the window's shm directly, so it shows whatever the
+// writer has most recently published, and may show a frame mid-write. Use
+// Reader.read_into() when you need a consistent copy. A view keeps its own
+// mapping, so it stays valid as the reader follows resizes, and since pixbufs
+// never shrink its pages stay backed. But it keeps the shape it was taken at,
+// so take a new view after the window resizes.
+struct FrameViewObject {
+  PyObject_HEAD
+  void* map;
+  size_t map_size;
+  int width;
+  int height;
+  unsigned long long sequence;
+  Py_ssize_t shape[3];
+  Py_ssize_t strides[3];
+};
+
+struct ReaderObject {
+  PyObject_HEAD
+  PixbufReader* reader;
+  // PixbufReader isn't thread-safe, and calls drop the GIL.
+  std::mutex* mu;
+};
+
+struct PreprocessorObject {
+  PyObject_HEAD
+  Preprocessor* preprocessor;
+  // Preprocessor caches per-size tables, so runs are serialized.
+  std::mutex* mu;
+};
+
+struct RingObject {
+  PyObject_HEAD
+  FrameRingReader* reader;
+  // FrameRingReader isn't thread-safe, and calls drop the GIL.
+  std::mutex* mu;
+};
+
+struct JpegStreamObject {
+  PyObject_HEAD
+  JpegStreamReader* reader;
+  // JpegStreamReader isn't thread-safe, and calls drop the GIL.
+  std::mutex* mu;
+};
+
+PyTypeObject FrameViewType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+PyTypeObject ReaderType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+PyTypeObject PreprocessorType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+PyTypeObject RingType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+PyTypeObject JpegStreamType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+PyObject* frame_info_tuple(const FrameInfo& info) {
+  return Py_BuildValue("(iiK)", info.width, info.height,
+                       (unsigned long long)info.sequence);
+}
+
+// --- FrameView ---
+
+void FrameView_dealloc(FrameViewObject* self) {
+  if (self->map) {
+    munmap(self->map, self->map_size);
+  }
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+int FrameView_getbuffer(FrameViewObject* self, Py_buffer* view, int flags) {
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "Frame views are read-only");
+    view->obj = nullptr;
+    return -1;
+  }
+  view->obj = (PyObject*)self;
+  Py_INCREF(self);
+  view->buf = (uint8_t*)self->map + offsetof(PixbufData, first_pixel);
+  view->len = PixbufData::pixbuf_size(self->width, self->height);
+  view->readonly = 1;
+  view->itemsize = 1;
+  view->format = (flags & PyBUF_FORMAT) ? (char*)"B" : nullptr;
+  view->ndim = 3;
+  view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) ? self->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+PyBufferProcs FrameView_as_buffer = {
+    (getbufferproc)FrameView_getbuffer,
+    nullptr,
+};
+
+PyMemberDef FrameView_members[] = {
+    {"width", T_INT, offsetof(FrameViewObject, width), READONLY,
+     "Frame width in pixels."},
+    {"height", T_INT, offsetof(FrameViewObject, height), READONLY,
+     "Frame height in pixels."},
+    {"sequence", T_ULONGLONG, offsetof(FrameViewObject, sequence), READONLY,
+     "The writer's sequence number when the view was taken."},
+    {nullptr},
+};
+
+// --- Preprocessor ---
+
+// Parses an optional sequence of 'n' ints into 'out'.
+bool parse_ints(PyObject* obj, const char* name, int n, int32_t* out) {
+  if (obj == Py_None) {
+    return true;
+  }
+  PyObject* seq = PySequence_Fast(obj, name);
+  if (!seq) {
+    return false;
+  }
+  bool ok = PySequence_Fast_GET_SIZE(seq) == n;
+  for (int i = 0; ok && i < n; ++i) {
+    long v = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+    ok = !(v == -1 && PyErr_Occurred());
+    out[i] = v;
+  }
+  Py_DECREF(seq);
+  if (!ok && !PyErr_Occurred()) {
+    PyErr_Format(PyExc_ValueError, "%s must have %d values", name, n);
+  }
+  return ok;
+}
+
+// Parses an optional float or sequence of 'n' floats into 'out'.
+bool parse_floats(PyObject* obj, const char* name, int n, float* out) {
+  if (obj == Py_None) {
+    return true;
+  }
+  if (PyNumber_Check(obj)) {
+    double v = PyFloat_AsDouble(obj);
+    for (int i = 0; i < n; ++i) {
+      out[i] = v;
+    }
+    return !PyErr_Occurred();
+  }
+  PyObject* seq = PySequence_Fast(obj, name);
+  if (!seq) {
+    return false;
+  }
+  bool ok = PySequence_Fast_GET_SIZE(seq) == n;
+  for (int i = 0; ok && i < n; ++i) {
+    out[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+    ok = !PyErr_Occurred();
+  }
+  Py_DECREF(seq);
+  if (!ok && !PyErr_Occurred()) {
+    PyErr_Format(PyExc_ValueError, "%s must have %d values", name, n);
+  }
+  return ok;
+}
+
+// Sets 'out' to the index of 'value' in 'options'.
+bool parse_choice(const char* value, const char* name,
+                  std::initializer_list<const char*> options, int* out) {
+  if (!value) {
+    return true;
+  }
+  int i = 0;
+  for (const char* option : options) {
+    if (strcmp(value, option) == 0) {
+      *out = i;
+      return true;
+    }
+    ++i;
+  }
+  PyErr_Format(PyExc_ValueError, "Unknown %s '%s'", name, value);
+  return false;
+}
+
+int Preprocessor_init(PreprocessorObject* self, PyObject* args,
+                      PyObject* kwds) {
+  static const char* kwlist[] = {"size",   "crop",   "channels", "dtype",
+                                 "layout", "filter", "mean",     "std",
+                                 nullptr};
+  PyObject* size = Py_None;
+  PyObject* crop = Py_None;
+  const char* channels = nullptr;
+  const char* dtype = nullptr;
+  const char* layout = nullptr;
+  const char* filter = nullptr;
+  PyObject* mean = Py_None;
+  PyObject* std = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOzzzzOO", (char**)kwlist,
+                                   &size, &crop, &channels, &dtype, &layout,
+                                   &filter, &mean, &std)) {
+    return -1;
+  }
+
+  PreprocessSpec spec;
+  int32_t out_size[2] = {0, 0};
+  int32_t crop_rect[4] = {0, 0, 0, 0};
+  int channels_choice = (int)spec.channels;
+  int dtype_choice = (int)spec.dtype;
+  int layout_choice = (int)spec.layout;
+  int filter_choice = (int)spec.filter;
+  if (!parse_ints(size, "size", 2, out_size) ||
+      !parse_ints(crop, "crop", 4, crop_rect) ||
+      !parse_choice(channels, "channels", {"rgb", "gray"}, &channels_choice) ||
+      !parse_choice(dtype, "dtype", {"uint8", "float32"}, &dtype_choice) ||
+      !parse_choice(layout, "layout", {"hwc", "chw"}, &layout_choice) ||
+      !parse_choice(filter, "filter", {"nearest", "bilinear"},
+                    &filter_choice) ||
+      !parse_floats(mean, "mean", 3, spec.mean) ||
+      !parse_floats(std, "std", 3, spec.std)) {
+    return -1;
+  }
+  spec.out_width = out_size[0];
+  spec.out_height = out_size[1];
+  spec.crop_x = crop_rect[0];
+  spec.crop_y = crop_rect[1];
+  spec.crop_width = crop_rect[2];
+  spec.crop_height = crop_rect[3];
+  spec.channels = (PreprocessSpec::Channels)channels_choice;
+  spec.dtype = (PreprocessSpec::DataType)dtype_choice;
+  spec.layout = (PreprocessSpec::Layout)layout_choice;
+  spec.filter = (PreprocessSpec::Filter)filter_choice;
+
+  StatusOr<Preprocessor> preprocessor = Preprocessor::Create(spec);
+  if (!preprocessor.ok()) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Sizes must be non-negative and std must be non-zero");
+    return -1;
+  }
+  delete self->preprocessor;
+  self->preprocessor = new Preprocessor(std::move(preprocessor.value()));
+  if (!self->mu) {
+    self->mu = new std::mutex();
+  }
+  return 0;
+}
+
+void Preprocessor_dealloc(PreprocessorObject* self) {
+  delete self->preprocessor;
+  delete self->mu;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyObject* Preprocessor_output_shape(PreprocessorObject* self, PyObject* args) {
+  int src_width, src_height;
+  if (!PyArg_ParseTuple(args, "ii", &src_width, &src_height)) {
+    return nullptr;
+  }
+  if (!self->preprocessor) {
+    PyErr_SetString(PyExc_ValueError, "Preprocessor isn't initialized");
+    return nullptr;
+  }
+  int32_t width, height, channels;
+  if (!self->preprocessor->output_shape(src_width, src_height, &width, &height,
+                                        &channels)) {
+    PyErr_SetString(PyExc_ValueError, "The crop doesn't overlap the frame");
+    return nullptr;
+  }
+  if (self->preprocessor->spec().layout == PreprocessSpec::Layout::CHW) {
+    return Py_BuildValue("(iii)", channels, height, width);
+  }
+  return Py_BuildValue("(iii)", height, width, channels);
+}
+
+PyMethodDef Preprocessor_methods[] = {
+    {"output_shape", (PyCFunction)Preprocessor_output_shape, METH_VARARGS,
+     "output_shape(width, height) -> tuple\n\n"
+     "Returns the output array's shape for a width x height frame."},
+    {nullptr},
+};
+
+// --- Reader ---
+
+int Reader_init(ReaderObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"path", "pid", "name", nullptr};
+  const char* path = nullptr;
+  int pid = 0;
+  const char* name = nullptr;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z$iz", (char**)kwlist, &path,
+                                   &pid, &name)) {
+    return -1;
+  }
+  if ((path != nullptr) + (pid != 0) + (name != nullptr) != 1) {
+    PyErr_SetString(PyExc_TypeError,
+                    "Reader() takes exactly one of path, pid or name");
+    return -1;
+  }
+  StatusOr<PixbufReader> reader =
+      path  ? PixbufReader::Create(path)
+      : pid ? PixbufReader::Open((int32_t)pid)
+            : PixbufReader::Open(std::string(name));
+  if (!reader.ok()) {
+    if (path) {
+      PyErr_Format(PyExc_FileNotFoundError, "No vkvfb pixbuf at '%s'", path);
+    } else if (pid) {
+      PyErr_Format(PyExc_FileNotFoundError,
+                   "No registered vkvfb window in process %d", pid);
+    } else {
+      PyErr_Format(PyExc_FileNotFoundError,
+                   "No registered vkvfb window named '%s'", name);
+    }
+    return -1;
+  }
+  delete self->reader;
+  self->reader = new PixbufReader(std::move(reader.value()));
+  if (!self->mu) {
+    self->mu = new std::mutex();
+  }
+  return 0;
+}
+
+void Reader_dealloc(ReaderObject* self) {
+  delete self->reader;
+  delete self->mu;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+bool check_open(ReaderObject* self) {
+  if (!self->reader) {
+    PyErr_SetString(PyExc_ValueError, "Reader isn't initialized");
+    return false;
+  }
+  return true;
+}
+
+PyObject* Reader_read_into(ReaderObject* self, PyObject* args,
+                           PyObject* kwds) {
+  if (!check_open(self)) {
+    return nullptr;
+  }
+  static const char* kwlist[] = {"buffer", "stride", nullptr};
+  Py_buffer dst;
+  Py_ssize_t stride = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "w*|n", (char**)kwlist, &dst,
+                                   &stride)) {
+    return nullptr;
+  }
+  if (stride < 0) {
+    PyBuffer_Release(&dst);
+    PyErr_SetString(PyExc_ValueError, "stride must be non-negative");
+    return nullptr;
+  }
+  if (!PyBuffer_IsContiguous(&dst, 'C')) {
+    PyBuffer_Release(&dst);
+    PyErr_SetString(PyExc_ValueError, "Buffer must be C-contiguous");
+    return nullptr;
+  }
+
+  FrameInfo info;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->read_into((uint8_t*)dst.buf, stride, dst.len);
+  }
+  Py_END_ALLOW_THREADS;
+  Py_ssize_t capacity = dst.len;
+  PyBuffer_Release(&dst);
+
+  if (info.code != ErrorCode::OK) {
+    if (info.sequence == 0) {
+      PyErr_SetString(PyExc_TimeoutError, "Timed out locking the pixbuf");
+    } else {
+      PyErr_Format(PyExc_ValueError,
+                   "A %dx%d frame with a stride of %zu bytes doesn't fit in "
+                   "a %zd byte buffer",
+                   info.width, info.height, info.stride, capacity);
+    }
+    return nullptr;
+  }
+  return frame_info_tuple(info);
+}
+
+PyObject* Reader_read_preprocessed(ReaderObject* self, PyObject* args,
+                                   PyObject* kwds) {
+  if (!check_open(self)) {
+    return nullptr;
+  }
+  static const char* kwlist[] = {"buffer", "preprocessor", nullptr};
+  Py_buffer dst;
+  PreprocessorObject* preprocessor;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "w*O!", (char**)kwlist, &dst,
+                                   &PreprocessorType, &preprocessor)) {
+    return nullptr;
+  }
+  if (!preprocessor->preprocessor) {
+    PyBuffer_Release(&dst);
+    PyErr_SetString(PyExc_ValueError, "Preprocessor isn't initialized");
+    return nullptr;
+  }
+  if (!PyBuffer_IsContiguous(&dst, 'C')) {
+    PyBuffer_Release(&dst);
+    PyErr_SetString(PyExc_ValueError, "Buffer must be C-contiguous");
+    return nullptr;
+  }
+
+  FrameInfo info;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    // Always reader then preprocessor, so calls can't deadlock.
+    std::lock_guard<std::mutex> lock(*self->mu);
+    std::lock_guard<std::mutex> preprocessor_lock(*preprocessor->mu);
+    info = self->reader->read_preprocessed(*preprocessor->preprocessor,
+                                           dst.buf, dst.len);
+  }
+  Py_END_ALLOW_THREADS;
+  Py_ssize_t capacity = dst.len;
+  PyBuffer_Release(&dst);
+
+  if (info.code != ErrorCode::OK) {
+    if (info.sequence == 0) {
+      PyErr_SetString(PyExc_TimeoutError, "Timed out locking the pixbuf");
+    } else {
+      PyErr_Format(PyExc_ValueError,
+                   "The preprocessed %dx%d frame doesn't fit in a %zd byte "
+                   "buffer, or the crop doesn't overlap it",
+                   info.width, info.height, capacity);
+    }
+    return nullptr;
+  }
+  return frame_info_tuple(info);
+}
+
+PyObject* Reader_info(ReaderObject* self, PyObject*) {
+  if (!check_open(self)) {
+    return nullptr;
+  }
+  FrameInfo info;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->peek();
+  }
+  Py_END_ALLOW_THREADS;
+  if (info.code != ErrorCode::OK) {
+    PyErr_SetString(PyExc_TimeoutError, "Timed out locking the pixbuf");
+    return nullptr;
+  }
+  return frame_info_tuple(info);
+}
+
+// Converts an optional timeout in seconds to nanoseconds, where None waits
+// forever.
+bool parse_timeout(PyObject* timeout_obj, uint64_t* timeout_nanos) {
+  *timeout_nanos = UINT64_MAX;
+  if (timeout_obj != Py_None) {
+    double timeout = PyFloat_AsDouble(timeout_obj);
+    if (timeout == -1 && PyErr_Occurred()) {
+      return false;
+    }
+    *timeout_nanos = timeout > 0 ? (uint64_t)std::llround(timeout * 1e9) : 0;
+  }
+  return true;
+}
+
+// How long waits block with the GIL released before checking for signals, so
+// that Ctrl-C interrupts waits without a timeout.
+const uint64_t kWaitSliceNanos = 100'000'000;
+
+// Calls 'wait', which waits up to the nanoseconds it's given, in slices until
+// it returns true or 'timeout_nanos' pass. Each slice holds 'mu' and releases
+// the GIL. Returns a bool, or nullptr if a signal handler raised.
+template <typename Wait>
+PyObject* wait_in_slices(std::mutex& mu, uint64_t timeout_nanos, Wait wait) {
+  const uint64_t start = now_nanos();
+  while (true) {
+    uint64_t elapsed = now_nanos() - start;
+    uint64_t remaining = elapsed < timeout_nanos ? timeout_nanos - elapsed : 0;
+    uint64_t slice = std::min(remaining, kWaitSliceNanos);
+    bool arrived;
+    Py_BEGIN_ALLOW_THREADS;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      arrived = wait(slice);
+    }
+    Py_END_ALLOW_THREADS;
+    if (arrived || remaining == slice) {
+      return PyBool_FromLong(arrived);
+    }
+    if (PyErr_CheckSignals() != 0) {
+      return nullptr;
+    }
+  }
+}
+
+PyObject* Reader_wait(ReaderObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"after_sequence", "timeout", nullptr};
+  unsigned long long after_sequence;
+  PyObject* timeout_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|O", (char**)kwlist,
+                                   &after_sequence, &timeout_obj)) {
+    return nullptr;
+  }
+  if (!check_open(self)) {
+    return nullptr;
+  }
+  uint64_t timeout_nanos;
+  if (!parse_timeout(timeout_obj, &timeout_nanos)) {
+    return nullptr;
+  }
+
+  return wait_in_slices(*self->mu, timeout_nanos, [&](uint64_t slice_nanos) {
+    return self->reader->wait_for_frame(after_sequence, slice_nanos);
+  });
+}
+
+PyObject* Reader_view(ReaderObject* self, PyObject*) {
+  if (!check_open(self)) {
+    return nullptr;
+  }
+  FrameInfo info;
+  int fd;
+  size_t page_size;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->peek();
+    fd = self->reader->get_shm().fd();
+    page_size = self->reader->get_shm().page_size();
+  }
+  Py_END_ALLOW_THREADS;
+  if (info.code != ErrorCode::OK) {
+    PyErr_SetString(PyExc_TimeoutError, "Timed out locking the pixbuf");
+    return nullptr;
+  }
+
+  // hugetlbfs mappings must cover whole huge pages.
+  size_t map_size = round_to_page(
+      PixbufData::pixbuf_struct_size(info.width, info.height), page_size);
+  void* map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+  FrameViewObject* view =
+      (FrameViewObject*)FrameViewType.tp_alloc(&FrameViewType, 0);
+  if (!view) {
+    munmap(map, map_size);
+    return nullptr;
+  }
+  view->map = map;
+  view->map_size = map_size;
+  view->width = info.width;
+  view->height = info.height;
+  view->sequence = info.sequence;
+  view->shape[0] = info.height;
+  view->shape[1] = info.width;
+  view->shape[2] = 4;
+  view->strides[0] = (Py_ssize_t)info.width * 4;
+  view->strides[1] = 4;
+  view->strides[2] = 1;
+  return (PyObject*)view;
+}
+
+PyMethodDef Reader_methods[] = {
+    {"read_into", (PyCFunction)Reader_read_into, METH_VARARGS | METH_KEYWORDS,
+     "read_into(buffer, stride=0) -> (width, height, sequence)\n\n"
+     "Copies the latest frame into a writable, C-contiguous buffer, such as a\n"
+     "NumPy array, as RGBA rows that start every stride bytes, or tightly\n"
+     "packed if stride is 0. Raises ValueError if the frame doesn't fit."},
+    {"read_preprocessed", (PyCFunction)Reader_read_preprocessed,
+     METH_VARARGS | METH_KEYWORDS,
+     "read_preprocessed(buffer, preprocessor) -> (width, height, sequence)\n\n"
+     "Crops, resizes, converts and normalizes the latest frame into buffer in\n"
+     "one pass. The returned size is the source frame's. Raises ValueError\n"
+     "if the output doesn't fit."},
+    {"info", (PyCFunction)Reader_info, METH_NOARGS,
+     "info() -> (width, height, sequence)\n\n"
+     "Returns the latest frame's size and sequence number."},
+    {"wait", (PyCFunction)Reader_wait, METH_VARARGS | METH_KEYWORDS,
+     "wait(after_sequence, timeout=None) -> bool\n\n"
+     "Waits for a frame with a sequence number other than after_sequence.\n"
+     "Returns False if timeout seconds pass first."},
+    {"view", (PyCFunction)Reader_view, METH_NOARGS,
+     "view() -> FrameView\n\n"
+     "Returns a zero-copy, read-only view of the window's shm, exported as a\n"
+     "(height, width, 4) buffer. The view is live, so it can change or tear\n"
+     "as the writer publishes. Take a new view after the window resizes."},
+    {nullptr},
+};
+
+// --- Ring ---
+
+int Ring_init(RingObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"path", "drain", nullptr};
+  const char* path;
+  int drain = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|p", (char**)kwlist, &path,
+                                   &drain)) {
+    return -1;
+  }
+  StatusOr<FrameRingReader> reader = FrameRingReader::Create(path, drain);
+  if (reader.status().code() == ErrorCode::NOT_FOUND) {
+    PyErr_Format(PyExc_FileNotFoundError, "No vkvfb frame ring at '%s'", path);
+    return -1;
+  } else if (!reader.ok()) {
+    PyErr_Format(PyExc_RuntimeError, "Couldn't join the frame ring at '%s'",
+                 path);
+    return -1;
+  }
+  delete self->reader;
+  self->reader = new FrameRingReader(std::move(reader.value()));
+  if (!self->mu) {
+    self->mu = new std::mutex();
+  }
+  return 0;
+}
+
+void Ring_dealloc(RingObject* self) {
+  delete self->reader;
+  delete self->mu;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+bool check_ring_open(RingObject* self) {
+  if (!self->reader) {
+    PyErr_SetString(PyExc_ValueError, "Ring isn't initialized");
+    return false;
+  }
+  return true;
+}
+
+// Gets a writable, C-contiguous buffer from 'obj'.
+bool get_frame_buffer(PyObject* obj, Py_buffer* dst) {
+  if (PyObject_GetBuffer(obj, dst, PyBUF_WRITABLE | PyBUF_ND) < 0) {
+    return false;
+  }
+  if (!PyBuffer_IsContiguous(dst, 'C')) {
+    PyBuffer_Release(dst);
+    PyErr_SetString(PyExc_ValueError, "Buffer must be C-contiguous");
+    return false;
+  }
+  return true;
+}
+
+PyObject* Ring_read_next(RingObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"buffer", nullptr};
+  PyObject* buffer;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", (char**)kwlist,
+                                   &buffer)) {
+    return nullptr;
+  }
+  Py_buffer dst;
+  if (!check_ring_open(self) || !get_frame_buffer(buffer, &dst)) {
+    return nullptr;
+  }
+
+  FrameInfo info;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->read_next((uint8_t*)dst.buf, dst.len);
+  }
+  Py_END_ALLOW_THREADS;
+  Py_ssize_t capacity = dst.len;
+  PyBuffer_Release(&dst);
+
+  if (info.code == ErrorCode::NOT_FOUND) {
+    Py_RETURN_NONE;
+  } else if (info.code != ErrorCode::OK) {
+    if (info.width == 0) {
+      PyErr_SetString(PyExc_TimeoutError, "Timed out locking the ring");
+    } else {
+      PyErr_Format(PyExc_ValueError,
+                   "A %dx%d frame doesn't fit in a %zd byte buffer",
+                   info.width, info.height, capacity);
+    }
+    return nullptr;
+  }
+  return frame_info_tuple(info);
+}
+
+PyObject* Ring_read_latest(RingObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"buffer", "count", nullptr};
+  PyObject* buffer;
+  int count;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi", (char**)kwlist, &buffer,
+                                   &count)) {
+    return nullptr;
+  }
+  Py_buffer dst;
+  if (!check_ring_open(self) || !get_frame_buffer(buffer, &dst)) {
+    return nullptr;
+  }
+
+  FrameInfo info;
+  int32_t copied;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->read_latest(count, (uint8_t*)dst.buf, dst.len,
+                                     &copied);
+  }
+  Py_END_ALLOW_THREADS;
+  Py_ssize_t capacity = dst.len;
+  PyBuffer_Release(&dst);
+
+  if (info.code != ErrorCode::OK) {
+    if (info.width == 0) {
+      PyErr_SetString(PyExc_TimeoutError, "Timed out locking the ring");
+    } else {
+      PyErr_Format(PyExc_ValueError,
+                   "%d %dx%d frames don't fit in a %zd byte buffer", count,
+                   info.width, info.height, capacity);
+    }
+    return nullptr;
+  }
+  return Py_BuildValue("(iiKi)", info.width, info.height,
+                       (unsigned long long)info.sequence, copied);
+}
+
+PyObject* Ring_wait(RingObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"timeout", nullptr};
+  PyObject* timeout_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char**)kwlist,
+                                   &timeout_obj)) {
+    return nullptr;
+  }
+  uint64_t timeout_nanos;
+  if (!check_ring_open(self) || !parse_timeout(timeout_obj, &timeout_nanos)) {
+    return nullptr;
+  }
+
+  return wait_in_slices(*self->mu, timeout_nanos, [&](uint64_t slice_nanos) {
+    return self->reader->wait_for_frame(slice_nanos);
+  });
+}
+
+PyObject* Ring_get_missed(RingObject* self, void*) {
+  if (!check_ring_open(self)) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(*self->mu);
+  return PyLong_FromUnsignedLongLong(self->reader->missed());
+}
+
+PyMethodDef Ring_methods[] = {
+    {"read_next", (PyCFunction)Ring_read_next, METH_VARARGS | METH_KEYWORDS,
+     "read_next(buffer) -> (width, height, frame_number) or None\n\n"
+     "Copies the oldest frame this reader hasn't read into a writable,\n"
+     "C-contiguous buffer as packed RGBA rows, or returns None if it's read\n"
+     "them all. Raises ValueError if the frame doesn't fit."},
+    {"read_latest", (PyCFunction)Ring_read_latest,
+     METH_VARARGS | METH_KEYWORDS,
+     "read_latest(buffer, count) -> (width, height, frame_number, copied)\n\n"
+     "Copies up to count of the newest frames into buffer, oldest first, for\n"
+     "frame stacking. Returns the newest frame's number and how many frames\n"
+     "were copied, which is less than count while the ring fills up."},
+    {"wait", (PyCFunction)Ring_wait, METH_VARARGS | METH_KEYWORDS,
+     "wait(timeout=None) -> bool\n\n"
+     "Waits for a frame this reader hasn't read. Returns False if timeout\n"
+     "seconds pass first."},
+    {nullptr},
+};
+
+PyGetSetDef Ring_getset[] = {
+    {"missed", (getter)Ring_get_missed, nullptr,
+     "The number of frames dropped before this reader read them.", nullptr},
+    {nullptr},
+};
+
+// --- JpegStream ---
+
+int JpegStream_init(JpegStreamObject* self, PyObject* args, PyObject* kwds) {
+  static const char* kwlist[] = {"path", nullptr};
+  const char* path;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", (char**)kwlist, &path)) {
+    return -1;
+  }
+  StatusOr<JpegStreamReader> reader = JpegStreamReader::Create(path);
+  if (reader.status().code() == ErrorCode::NOT_FOUND) {
+    PyErr_Format(PyExc_FileNotFoundError, "No vkvfb JPEG stream at '%s'",
+                 path);
+    return -1;
+  } else if (!reader.ok()) {
+    PyErr_Format(PyExc_RuntimeError, "Couldn't open the JPEG stream at '%s'",
+                 path);
+    return -1;
+  }
+  delete self->reader;
+  self->reader = new JpegStreamReader(std::move(reader.value()));
+  if (!self->mu) {
+    self->mu = new std::mutex();
+  }
+  return 0;
+}
+
+void JpegStream_dealloc(JpegStreamObject* self) {
+  delete self->reader;
+  delete self->mu;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+bool check_stream_open(JpegStreamObject* self) {
+  if (!self->reader) {
+    PyErr_SetString(PyExc_ValueError, "JpegStream isn't initialized");
+    return false;
+  }
+  return true;
+}
+
+PyObject* JpegStream_read(JpegStreamObject* self, PyObject*) {
+  if (!check_stream_open(self)) {
+    return nullptr;
+  }
+  std::vector<uint8_t> jpeg;
+  FrameInfo info;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    std::lock_guard<std::mutex> lock(*self->mu);
+    info = self->reader->read(&jpeg);
+  }
+  Py_END_ALLOW_THREADS;
+
+  if (info.code == ErrorCode::NOT_FOUND) {
+    Py_RETURN_NONE;
+  } else if (info.code != ErrorCode::OK) {
+    PyErr_SetString(PyExc_TimeoutError, "Timed out locking the JPEG stream");
+    return nullptr;
+  }
+  return Py_BuildValue("(y#iiK)", (const char*)jpeg.data(),
+                       (Py_ssize_t)jpeg.size(), info.width, info.height,
+                       (unsigned long long)info.sequence);
+}
+
+PyObject* JpegStream_wait(JpegStreamObject* self, PyObject* args,
+                          PyObject* kwds) {
+  static const char* kwlist[] = {"after_sequence", "timeout", nullptr};
+  unsigned long long after_sequence;
+  PyObject* timeout_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|O", (char**)kwlist,
+                                   &after_sequence, &timeout_obj)) {
+    return nullptr;
+  }
+  uint64_t timeout_nanos;
+  if (!check_stream_open(self) ||
+      !parse_timeout(timeout_obj, &timeout_nanos)) {
+    return nullptr;
+  }
+
+  return wait_in_slices(*self->mu, timeout_nanos, [&](uint64_t slice_nanos) {
+    return self->reader->wait_for_frame(after_sequence, slice_nanos);
+  });
+}
+
+PyMethodDef JpegStream_methods[] = {
+    {"read", (PyCFunction)JpegStream_read, METH_NOARGS,
+     "read() -> (jpeg, width, height, sequence) or None\n\n"
+     "Returns the latest JPEG as bytes, or None if the app hasn't published\n"
+     "one yet. The sequence counts JPEGs, not the app's frames."},
+    {"wait", (PyCFunction)JpegStream_wait, METH_VARARGS | METH_KEYWORDS,
+     "wait(after_sequence, timeout=None) -> bool\n\n"
+     "Waits for a JPEG newer than after_sequence. Returns False if timeout\n"
+     "seconds pass first."},
+    {nullptr},
+};
+
+// --- Module functions ---
+
+PyObject* list_windows(PyObject*, PyObject*) {
+  StatusOr<std::vector<WindowRecord>> records = StatusVal(ErrorCode::UNKNOWN);
+  Py_BEGIN_ALLOW_THREADS;
+  records = list_registered_windows();
+  Py_END_ALLOW_THREADS;
+  PyObject* list = PyList_New(0);
+  if (!list || !records.ok()) {
+    // No registry means no vkvfb process has run yet.
+    return list;
+  }
+  for (const WindowRecord& record : *records) {
+    PyObject* window = Py_BuildValue(
+        "{s:i,s:s,s:s,s:k,s:s,s:s,s:s,s:i,s:i,s:K}", "pid", record.pid,
+        "process_name", record.process_name.c_str(), "display",
+        record.display.c_str(), "window_id", (unsigned long)record.window_id,
+        "title", record.title.c_str(), "path", record.pixbuf_name.c_str(),
+        "format", record.format.c_str(), "width", record.width, "height",
+        record.height, "last_frame_nanos",
+        (unsigned long long)record.last_frame_nanos);
+    if (!window || PyList_Append(list, window) < 0) {
+      Py_XDECREF(window);
+      Py_DECREF(list);
+      return nullptr;
+    }
+    Py_DECREF(window);
+  }
+  return list;
+}
+
+PyMethodDef module_methods[] = {
+    {"list_windows", (PyCFunction)list_windows, METH_NOARGS,
+     "list_windows() -> list of dicts\n\n"
+     "Returns the live windows in the vkvfb registry, with their pid,\n"
+     "process_name, display, window_id, title, path, format, width, height\n"
+     "and last_frame_nanos (CLOCK_MONOTONIC). Pass a window's path to\n"
+     "Reader() or Ring()."},
+    {nullptr},
+};
+
+PyModuleDef vkvfb_module = {
+    PyModuleDef_HEAD_INIT,
+    "vkvfb",
+    "Readers for frames published by the vkvfb Vulkan layer.",
+    -1,
+    module_methods,
+};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_vkvfb() {
+  FrameViewType.tp_name = "vkvfb.FrameView";
+  FrameViewType.tp_basicsize = sizeof(FrameViewObject);
+  FrameViewType.tp_flags = Py_TPFLAGS_DEFAULT;
+  FrameViewType.tp_doc = "A read-only view of a window's frame.";
+  FrameViewType.tp_dealloc = (destructor)FrameView_dealloc;
+  FrameViewType.tp_as_buffer = &FrameView_as_buffer;
+  FrameViewType.tp_members = FrameView_members;
+  if (PyType_Ready(&FrameViewType) < 0) {
+    return nullptr;
+  }
+
+  ReaderType.tp_name = "vkvfb.Reader";
+  ReaderType.tp_basicsize = sizeof(ReaderObject);
+  ReaderType.tp_flags = Py_TPFLAGS_DEFAULT;
+  ReaderType.tp_doc =
+      "Reader(path=None, *, pid=None, name=None)\n\n"
+      "Reads frames from the pixbuf of the window named 'path', e.g.\n"
+      "'0x00400001', or finds the window in the registry by its process's\n"
+      "pid, or by its title or process name. When several windows match,\n"
+      "the one that most recently published a frame wins.";
+  ReaderType.tp_new = PyType_GenericNew;
+  ReaderType.tp_init = (initproc)Reader_init;
+  ReaderType.tp_dealloc = (destructor)Reader_dealloc;
+  ReaderType.tp_methods = Reader_methods;
+  if (PyType_Ready(&ReaderType) < 0) {
+    return nullptr;
+  }
+
+  PreprocessorType.tp_name = "vkvfb.Preprocessor";
+  PreprocessorType.tp_basicsize = sizeof(PreprocessorObject);
+  PreprocessorType.tp_flags = Py_TPFLAGS_DEFAULT;
+  PreprocessorType.tp_doc =
+      "Preprocessor(size=None, crop=None, channels='rgb', dtype='float32',\n"
+      "             layout='hwc', filter='bilinear', mean=None, std=None)\n\n"
+      "Describes how Reader.read_preprocessed() turns frames into\n"
+      "observations. size is (width, height) and crop is (x, y, width,\n"
+      "height), where zeros extend to the frame's edge. channels is 'rgb' or\n"
+      "'gray', dtype is 'uint8' or 'float32', layout is 'hwc' or 'chw' and\n"
+      "filter is 'nearest' or 'bilinear'. float32 outputs are\n"
+      "(value / 255 - mean) / std, per channel.";
+  PreprocessorType.tp_new = PyType_GenericNew;
+  PreprocessorType.tp_init = (initproc)Preprocessor_init;
+  PreprocessorType.tp_dealloc = (destructor)Preprocessor_dealloc;
+  PreprocessorType.tp_methods = Preprocessor_methods;
+  if (PyType_Ready(&PreprocessorType) < 0) {
+    return nullptr;
+  }
+
+  RingType.tp_name = "vkvfb.Ring";
+  RingType.tp_basicsize = sizeof(RingObject);
+  RingType.tp_flags = Py_TPFLAGS_DEFAULT;
+  RingType.tp_doc =
+      "Ring(path, drain=True)\n\n"
+      "Reads every frame of the window named 'path' in order, from the frame\n"
+      "ring the layer publishes when the app runs with VKVFB_RING_FRAMES.\n"
+      "A draining ring reader has its own cursor, and a blocking ring waits\n"
+      "for it. Pass drain=False to only use read_latest().";
+  RingType.tp_new = PyType_GenericNew;
+  RingType.tp_init = (initproc)Ring_init;
+  RingType.tp_dealloc = (destructor)Ring_dealloc;
+  RingType.tp_methods = Ring_methods;
+  RingType.tp_getset = Ring_getset;
+  if (PyType_Ready(&RingType) < 0) {
+    return nullptr;
+  }
+
+  JpegStreamType.tp_name = "vkvfb.JpegStream";
+  JpegStreamType.tp_basicsize = sizeof(JpegStreamObject);
+  JpegStreamType.tp_flags = Py_TPFLAGS_DEFAULT;
+  JpegStreamType.tp_doc =
+      "JpegStream(path)\n\n"
+      "Reads the JPEG stream of the window named 'path', which the layer\n"
+      "publishes when the app runs with VKVFB_JPEG_QUALITY. It only holds\n"
+      "the latest JPEG, encoded at up to VKVFB_JPEG_FPS frames a second.";
+  JpegStreamType.tp_new = PyType_GenericNew;
+  JpegStreamType.tp_init = (initproc)JpegStream_init;
+  JpegStreamType.tp_dealloc = (destructor)JpegStream_dealloc;
+  JpegStreamType.tp_methods = JpegStream_methods;
+  if (PyType_Ready(&JpegStreamType) < 0) {
+    return nullptr;
+  }
+
+  PyObject* module = PyModule_Create(&vkvfb_module);
+  if (!module) {
+    return nullptr;
+  }
+  Py_INCREF(&FrameViewType);
+  PyModule_AddObject(module, "FrameView", (PyObject*)&FrameViewType);
+  Py_INCREF(&ReaderType);
+  PyModule_AddObject(module, "Reader", (PyObject*)&ReaderType);
+  Py_INCREF(&PreprocessorType);
+  PyModule_AddObject(module, "Preprocessor", (PyObject*)&PreprocessorType);
+  Py_INCREF(&RingType);
+  PyModule_AddObject(module, "Ring", (PyObject*)&RingType);
+  Py_INCREF(&JpegStreamType);
+  PyModule_AddObject(module, "JpegStream", (PyObject*)&JpegStreamType);
+  return module;
+}
@@ -0,0 +1,629 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "recording.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+#include "trace/trace.h"
+#include "utility.h"
+
+namespace {
+
+// A buffer aligned for O_DIRECT writes.
+struct AlignedBuffer {
+  uint8_t* data = nullptr;
+  size_t capacity = 0;
+};
+
+AlignedBuffer allocate_buffer(size_t capacity) {
+  AlignedBuffer buffer;
+  void* data = nullptr;
+  if (posix_memalign(&data, kRecordingAlignment, capacity) != 0) {
+    ERROR("Failed to allocate a %zu byte frame buffer", capacity);
+    exit(1);
+  }
+  buffer.data = (uint8_t*)data;
+  buffer.capacity = capacity;
+  return buffer;
+}
+
+// The bytes a width x height frame takes up in the frame file.
+size_t padded_frame_size(int32_t width, int32_t height) {
+  return round_to_page((size_t)width * height * 4, kRecordingAlignment);
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      ERROR("Failed to write recording index: %s",
+            errno_to_string(errno).c_str());
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Writes all of 'iov' at 'offset', continuing after short writes. If an
+// O_DIRECT write is refused, turns O_DIRECT off and retries.
+bool pwritev_all(int fd, iovec* iov, int count, off_t offset) {
+  while (count > 0) {
+    ssize_t written = pwritev(fd, iov, count, offset);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0 && errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+      LOG(kLogSync, "O_DIRECT write refused, writing through the page cache");
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      continue;
+    }
+    if (written <= 0) {
+      ERROR("Failed to write recording frames: %s",
+            errno_to_string(errno).c_str());
+      return false;
+    }
+    offset += written;
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+int open_frame_file(const std::string& path, bool direct_io) {
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  if (direct_io) {
+    int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    // File systems without O_DIRECT support, like tmpfs, refuse it.
+    if (fd >= 0 || errno != EINVAL) {
+      return fd;
+    }
+    LOG(kLogSync, "%s doesn't support O_DIRECT", path.c_str());
+  }
+  return open(path.c_str(), flags, 0644);
+}
+
+}  // namespace
+
+struct RecordingWriter::Queue {
+  struct PendingFrame {
+    AlignedBuffer buffer;
+    // The padded size of the raw frame.
+    size_t size;
+    RecordingIndexEntry entry;
+  };
+
+  RecordOptions options;
+  int data_fd = -1;
+  int index_fd = -1;
+
+  // Only touched by the recording thread.
+  AlignedBuffer current;
+  int32_t current_width = 0;
+  int32_t current_height = 0;
+  uint64_t committed = 0;
+
+  // Only touched by the writer thread.
+  std::unique_ptr<TileCodec> codec;
+  // Compressed frames, one per frame of the batch being written.
+  std::vector<AlignedBuffer> encode_buffers;
+  uint64_t next_offset = kRecordingAlignment;
+
+  // Protects everything below.
+  std::mutex mu;
+  // Notified when frames are queued, written, or the queue is stopping.
+  std::condition_variable cv;
+  std::deque<PendingFrame> pending;
+  // The bytes of frames queued or being written.
+  size_t pending_bytes = 0;
+  std::vector<AlignedBuffer> free_buffers;
+  bool stopping = false;
+  bool failed = false;
+
+  std::thread thread;
+
+  ~Queue() {
+    free(current.data);
+    for (AlignedBuffer& buffer : free_buffers) {
+      free(buffer.data);
+    }
+    for (AlignedBuffer& buffer : encode_buffers) {
+      free(buffer.data);
+    }
+  }
+
+  // Encodes the batch's frame 'i' with the recording's codec, if it has one,
+  // fills in where it'll be written, and returns what to write.
+  iovec prepare_frame(PendingFrame& frame, size_t i) {
+    RecordingIndexEntry& entry = frame.entry;
+    iovec iov = {frame.buffer.data, frame.size};
+    if (options.codec == FrameCodec::QOI_TILES) {
+      if (encode_buffers.size() <= i) {
+        encode_buffers.resize(i + 1);
+      }
+      AlignedBuffer& encoded = encode_buffers[i];
+      size_t capacity = round_to_page(
+          TileCodec::max_encoded_size(entry.width, entry.height),
+          kRecordingAlignment);
+      if (encoded.capacity < capacity) {
+        free(encoded.data);
+        encoded = allocate_buffer(capacity);
+      }
+      size_t size = codec->encode(frame.buffer.data, entry.width,
+                                  entry.height, encoded.data,
+                                  encoded.capacity);
+      // Noise can encode to more than it started as, so keep such frames raw.
+      if (size < entry.size) {
+        entry.size = size;
+        entry.codec = FrameCodec::QOI_TILES;
+        iov.iov_base = encoded.data;
+        iov.iov_len = round_to_page(size, kRecordingAlignment);
+        memset(encoded.data + size, 0, iov.iov_len - size);
+      }
+    }
+    entry.offset = next_offset;
+    next_offset += iov.iov_len;
+    return iov;
+  }
+
+  // Writes queued frames in batches until stopped.
+  void run() {
+    std::vector<PendingFrame> batch;
+    std::vector<iovec> iov;
+    std::vector<RecordingIndexEntry> entries;
+    std::unique_lock<std::mutex> lock(mu);
+    while (true) {
+      cv.wait(lock, [this] { return !pending.empty() || stopping; });
+      if (pending.empty()) {
+        return;
+      }
+
+      // Frames are laid out back to back, so a batch is one contiguous write.
+      size_t batch_bytes = 0;
+      while (!pending.empty() && batch.size() < IOV_MAX &&
+             (batch.empty() ||
+              batch_bytes + pending.front().size <= options.batch_bytes)) {
+        batch_bytes += pending.front().size;
+        batch.push_back(pending.front());
+        pending.pop_front();
+      }
+      bool write = !failed;
+      lock.unlock();
+
+      if (write) {
+        TRACE_SCOPE("record_batch");
+        iov.clear();
+        entries.clear();
+        for (size_t i = 0; i < batch.size(); i++) {
+          iov.push_back(prepare_frame(batch[i], i));
+          entries.push_back(batch[i].entry);
+        }
+        write = pwritev_all(data_fd, iov.data(), iov.size(),
+                            batch.front().entry.offset) &&
+                write_all(index_fd, entries.data(),
+                          entries.size() * sizeof(RecordingIndexEntry));
+      }
+
+      lock.lock();
+      failed |= !write;
+      pending_bytes -= batch_bytes;
+      for (PendingFrame& frame : batch) {
+        free_buffers.push_back(frame.buffer);
+      }
+      batch.clear();
+      cv.notify_all();
+    }
+  }
+};
+
+StatusOr<RecordingWriter> RecordingWriter::Create(
+    const std::string& path, const std::string& source,
+    const RecordOptions& options) {
+  auto queue = std::make_unique<Queue>();
+  queue->options = options;
+  if (options.codec != FrameCodec::RAW) {
+    queue->codec = std::make_unique<TileCodec>(options.encode_threads);
+  }
+
+  queue->data_fd = open_frame_file(path, options.direct_io);
+  if (queue->data_fd < 0) {
+    ERROR("Failed to create recording %s: %s", path.c_str(),
+          errno_to_string(errno).c_str());
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  const std::string index_path = recording_index_path(path);
+  queue->index_fd = open(index_path.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                         0644);
+  if (queue->index_fd < 0) {
+    ERROR("Failed to create recording index %s: %s", index_path.c_str(),
+          errno_to_string(errno).c_str());
+    close(queue->data_fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
+  // The header is padded to a whole block, so it's written like a frame.
+  AlignedBuffer header_buffer = allocate_buffer(kRecordingAlignment);
+  memset(header_buffer.data, 0, kRecordingAlignment);
+  RecordingHeader* header = (RecordingHeader*)header_buffer.data;
+  header->magic = RecordingHeader::kMagic;
+  header->version = RecordingHeader::kVersion;
+  snprintf(header->format, sizeof(header->format), "RGBA8");
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  header->created_nanos = (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+  snprintf(header->source, sizeof(header->source), "%s", source.c_str());
+  iovec header_iov = {header_buffer.data, kRecordingAlignment};
+  bool header_written = pwritev_all(queue->data_fd, &header_iov, 1, 0);
+  queue->free_buffers.push_back(header_buffer);
+
+  RecordingIndexHeader index_header = {};
+  index_header.magic = RecordingIndexHeader::kMagic;
+  index_header.version = RecordingIndexHeader::kVersion;
+  index_header.entry_size = sizeof(RecordingIndexEntry);
+  if (!header_written ||
+      !write_all(queue->index_fd, &index_header, sizeof(index_header))) {
+    close(queue->data_fd);
+    close(queue->index_fd);
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
+  Queue* q = queue.get();
+  queue->thread = std::thread([q] { q->run(); });
+  return RecordingWriter(std::move(queue));
+}
+
+RecordingWriter::RecordingWriter(std::unique_ptr<Queue> queue)
+    : queue_(std::move(queue)) {}
+
+RecordingWriter::~RecordingWriter() {
+  if (queue_) {
+    finish();
+  }
+}
+
+RecordingWriter::RecordingWriter(RecordingWriter&& other) noexcept
+    : queue_(std::move(other.queue_)) {}
+
+RecordingWriter& RecordingWriter::operator=(RecordingWriter&& other) noexcept {
+  if (this != &other) {
+    if (queue_) {
+      finish();
+    }
+    queue_ = std::move(other.queue_);
+  }
+  return *this;
+}
+
+uint8_t* RecordingWriter::next_frame(int32_t width, int32_t height) {
+  Queue& q = *queue_;
+  const size_t size = padded_frame_size(width, height);
+  q.current_width = width;
+  q.current_height = height;
+  if (q.current.capacity >= size) {
+    return q.current.data;
+  }
+
+  std::unique_lock<std::mutex> lock(q.mu);
+  if (q.current.data) {
+    q.free_buffers.push_back(q.current);
+    q.current = AlignedBuffer();
+  }
+  // Bound the queue, but always let one frame through, however large.
+  q.cv.wait(lock, [&q, size] {
+    return q.pending_bytes + size <= q.options.queue_bytes ||
+           q.pending_bytes == 0;
+  });
+  for (size_t i = 0; i < q.free_buffers.size(); i++) {
+    if (q.free_buffers[i].capacity >= size) {
+      q.current = q.free_buffers[i];
+      q.free_buffers.erase(q.free_buffers.begin() + i);
+      return q.current.data;
+    }
+  }
+  // Frames grew, so the smaller buffers won't be used again.
+  for (AlignedBuffer& buffer : q.free_buffers) {
+    free(buffer.data);
+  }
+  q.free_buffers.clear();
+  lock.unlock();
+
+  q.current = allocate_buffer(size);
+  return q.current.data;
+}
+
+void RecordingWriter::commit_frame(uint64_t sequence,
+                                   uint64_t timestamp_nanos) {
+  Queue& q = *queue_;
+  const size_t frame_bytes = (size_t)q.current_width * q.current_height * 4;
+  const size_t size = padded_frame_size(q.current_width, q.current_height);
+  // Zero the padding, rather than writing out whatever the buffer last held.
+  memset(q.current.data + frame_bytes, 0, size - frame_bytes);
+
+  Queue::PendingFrame frame;
+  frame.buffer = q.current;
+  frame.size = size;
+  frame.entry = {};
+  frame.entry.size = frame_bytes;
+  frame.entry.sequence = sequence;
+  frame.entry.timestamp_nanos = timestamp_nanos;
+  frame.entry.width = q.current_width;
+  frame.entry.height = q.current_height;
+  frame.entry.codec = FrameCodec::RAW;
+  q.committed++;
+  q.current = AlignedBuffer();
+
+  std::lock_guard<std::mutex> lock(q.mu);
+  q.pending.push_back(frame);
+  q.pending_bytes += size;
+  q.cv.notify_all();
+}
+
+void RecordingWriter::append(const uint8_t* pixels, int32_t width,
+                             int32_t height, uint64_t sequence,
+                             uint64_t timestamp_nanos) {
+  memcpy(next_frame(width, height), pixels, (size_t)width * height * 4);
+  commit_frame(sequence, timestamp_nanos);
+}
+
+StatusVal RecordingWriter::finish() {
+  Queue& q = *queue_;
+  if (q.thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(q.mu);
+      q.stopping = true;
+      q.cv.notify_all();
+    }
+    q.thread.join();
+    fdatasync(q.data_fd);
+    fdatasync(q.index_fd);
+    close(q.data_fd);
+    close(q.index_fd);
+  }
+  return StatusVal(q.failed ? ErrorCode::GENERAL : ErrorCode::OK);
+}
+
+uint64_t RecordingWriter::frame_count() const { return queue_->committed; }
+
+StatusOr<RecordingReader> RecordingReader::Open(const std::string& path) {
+  int data_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (data_fd < 0) {
+    return StatusVal(errno == ENOENT ? ErrorCode::NOT_FOUND
+                                     : ErrorCode::GENERAL);
+  }
+  int index_fd =
+      open(recording_index_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (index_fd < 0) {
+    close(data_fd);
+    return StatusVal(errno == ENOENT ? ErrorCode::NOT_FOUND
+                                     : ErrorCode::GENERAL);
+  }
+
+  RecordingReader reader(data_fd, index_fd);
+  if (!reader.map_files()) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  const RecordingHeader& header = reader.header();
+  const RecordingIndexHeader* index_header =
+      (const RecordingIndexHeader*)reader.index_map_;
+  if (header.magic != RecordingHeader::kMagic ||
+      header.version != RecordingHeader::kVersion ||
+      index_header->magic != RecordingIndexHeader::kMagic ||
+      index_header->version != RecordingIndexHeader::kVersion ||
+      index_header->entry_size != sizeof(RecordingIndexEntry)) {
+    ERROR("%s isn't a recording this version can read", path.c_str());
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  return reader;
+}
+
+RecordingReader::RecordingReader(int data_fd, int index_fd)
+    : data_fd_(data_fd), index_fd_(index_fd) {}
+
+RecordingReader::~RecordingReader() { close_files(); }
+
+void RecordingReader::close_files() {
+  unmap_files();
+  if (data_fd_ >= 0) {
+    close(data_fd_);
+    data_fd_ = -1;
+  }
+  if (index_fd_ >= 0) {
+    close(index_fd_);
+    index_fd_ = -1;
+  }
+}
+
+RecordingReader::RecordingReader(RecordingReader&& other) noexcept
+    : data_fd_(other.data_fd_),
+      index_fd_(other.index_fd_),
+      data_map_(other.data_map_),
+      data_size_(other.data_size_),
+      index_map_(other.index_map_),
+      index_size_(other.index_size_),
+      frame_count_(other.frame_count_),
+      codec_(std::move(other.codec_)) {
+  other.data_fd_ = -1;
+  other.index_fd_ = -1;
+  other.data_map_ = nullptr;
+  other.index_map_ = nullptr;
+}
+
+RecordingReader& RecordingReader::operator=(RecordingReader&& other) noexcept {
+  if (this != &other) {
+    close_files();
+    data_fd_ = other.data_fd_;
+    index_fd_ = other.index_fd_;
+    data_map_ = other.data_map_;
+    data_size_ = other.data_size_;
+    index_map_ = other.index_map_;
+    index_size_ = other.index_size_;
+    frame_count_ = other.frame_count_;
+    codec_ = std::move(other.codec_);
+    other.data_fd_ = -1;
+    other.index_fd_ = -1;
+    other.data_map_ = nullptr;
+    other.index_map_ = nullptr;
+  }
+  return *this;
+}
+
+RecordedFrame RecordingReader::frame(size_t index) const {
+  RecordedFrame frame;
+  if (index >= frame_count_) {
+    frame.code = ErrorCode::GENERAL;
+    return frame;
+  }
+  const RecordingIndexEntry& entry =
+      ((const RecordingIndexEntry*)(index_map_ +
+                                    sizeof(RecordingIndexHeader)))[index];
+  frame.data = data_map_ + entry.offset;
+  frame.size = entry.size;
+  frame.codec = entry.codec;
+  frame.width = entry.width;
+  frame.height = entry.height;
+  frame.sequence = entry.sequence;
+  frame.timestamp_nanos = entry.timestamp_nanos;
+  return frame;
+}
+
+RecordedFrame RecordingReader::read_frame(size_t index, uint8_t* dst,
+                                          size_t capacity) {
+  TRACE_SCOPE("read_recorded_frame");
+  RecordedFrame frame = this->frame(index);
+  if (frame.code != ErrorCode::OK) {
+    return frame;
+  }
+  bool ok = false;
+  if (frame.codec == FrameCodec::RAW) {
+    ok = capacity >= frame.size;
+    if (ok) {
+      memcpy(dst, frame.data, frame.size);
+    }
+  } else {
+    if (!codec_) {
+      codec_ = std::make_unique<TileCodec>();
+    }
+    int32_t width = 0;
+    int32_t height = 0;
+    ok = TileCodec::peek_size(frame.data, frame.size, &width, &height) &&
+         width == frame.width && height == frame.height &&
+         codec_->decode(frame.data, frame.size, dst, capacity);
+  }
+  if (!ok) {
+    frame.code = ErrorCode::GENERAL;
+  }
+  return frame;
+}
+
+bool RecordingReader::refresh() {
+  size_t old_count = frame_count_;
+  unmap_files();
+  if (!map_files()) {
+    frame_count_ = 0;
+  }
+  return frame_count_ > old_count;
+}
+
+bool RecordingReader::map_files() {
+  struct stat data_stat, index_stat;
+  if (fstat(data_fd_, &data_stat) != 0 || fstat(index_fd_, &index_stat) != 0 ||
+      (size_t)data_stat.st_size < sizeof(RecordingHeader) ||
+      (size_t)index_stat.st_size < sizeof(RecordingIndexHeader)) {
+    ERROR("Recording is missing its headers");
+    return false;
+  }
+
+  void* data_map =
+      mmap(nullptr, data_stat.st_size, PROT_READ, MAP_SHARED, data_fd_, 0);
+  if (data_map == MAP_FAILED) {
+    ERROR("Failed to map recording: %s", errno_to_string(errno).c_str());
+    return false;
+  }
+  void* index_map =
+      mmap(nullptr, index_stat.st_size, PROT_READ, MAP_SHARED, index_fd_, 0);
+  if (index_map == MAP_FAILED) {
+    ERROR("Failed to map recording index: %s", errno_to_string(errno).c_str());
+    munmap(data_map, data_stat.st_size);
+    return false;
+  }
+  data_map_ = (uint8_t*)data_map;
+  data_size_ = data_stat.st_size;
+  index_map_ = (uint8_t*)index_map;
+  index_size_ = index_stat.st_size;
+
+  // Skip a torn trailing entry, and any frames a crashed writer indexed
+  // without writing.
+  const RecordingIndexEntry* entries =
+      (const RecordingIndexEntry*)(index_map_ + sizeof(RecordingIndexHeader));
+  size_t count = (index_size_ - sizeof(RecordingIndexHeader)) /
+                 sizeof(RecordingIndexEntry);
+  frame_count_ = 0;
+  while (frame_count_ < count) {
+    const RecordingIndexEntry& entry = entries[frame_count_];
+    const uint64_t raw_size = (uint64_t)entry.width * entry.height * 4;
+    if (entry.width <= 0 || entry.height <= 0 ||
+        entry.offset + entry.size > data_size_ ||
+        (entry.codec == FrameCodec::RAW && entry.size != raw_size) ||
+        (entry.codec != FrameCodec::RAW &&
+         entry.codec != FrameCodec::QOI_TILES)) {
+      break;
+    }
+    frame_count_++;
+  }
+  return true;
+}
+
+void RecordingReader::unmap_files() {
+  if (data_map_) {
+    munmap(data_map_, data_size_);
+    data_map_ = nullptr;
+  }
+  if (index_map_) {
+    munmap(index_map_, index_size_);
+    index_map_ = nullptr;
+  }
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECORD_RECORDING_H_
+#define RECORD_RECORDING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "codec/tile_codec.h"
+#include "status_or.h"
+
+// A recording is an append-only file of frames at '<path>', and an index of
+// them at '<path>.idx'. The frame file starts with a RecordingHeader padded to
+// kRecordingAlignment bytes, followed by frames, each starting on a
+// kRecordingAlignment boundary so they can be written with O_DIRECT. Frames
+// are stored with the recording's codec: as tightly packed RGBA rows, or
+// compressed with a TileCodec. The index is a RecordingIndexHeader followed by
+// one RecordingIndexEntry per frame. A frame's entry is only appended once the
+// frame is written, so a recording cut short by a crash is still readable up
+// to its last indexed frame.
+
+inline const size_t kRecordingAlignment = 4096;
+
+struct RecordingHeader {
+  static const uint32_t kMagic = 0x76666263;
+  static const uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  char format[8];
+  // CLOCK_REALTIME nanoseconds when recording started.
+  uint64_t created_nanos;
+  // What was recorded, e.g. the pixbuf's name.
+  char source[64];
+};
+static_assert(sizeof(RecordingHeader) <= kRecordingAlignment,
+              "RecordingHeader must fit before the first frame");
+
+struct RecordingIndexHeader {
+  static const uint32_t kMagic = 0x76666269;
+  static const uint32_t kVersion = 2;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t reserved;
+};
+
+struct RecordingIndexEntry {
+  // Where the frame starts in the frame file, and its stored size.
+  uint64_t offset;
+  uint64_t size;
+  // The writer's sequence number for the frame.
+  uint64_t sequence;
+  // CLOCK_MONOTONIC nanoseconds when the frame was read.
+  uint64_t timestamp_nanos;
+  int32_t width;
+  int32_t height;
+  FrameCodec codec;
+  uint32_t reserved;
+};
+
+// The path of the index of the recording at 'path'.
+inline std::string recording_index_path(const std::string& path) {
+  return path + ".idx";
+}
+
+struct RecordOptions {
+  // Writes frames with O_DIRECT, bypassing the page cache, where the file
+  // system supports it.
+  bool direct_io = true;
+  // The most bytes of frames written by one pwritev().
+  size_t batch_bytes = 32 << 20;
+  // The most bytes of frames queued for writing. Once this many are queued,
+  // next_frame() waits for the writer thread to catch up.
+  size_t queue_bytes = 512 << 20;
+  // How frames are stored. Compressed frames are encoded on the writer
+  // thread, in parallel over 'encode_threads' threads, which defaults to one
+  // per core. Frames that don't compress are stored raw.
+  FrameCodec codec = FrameCodec::RAW;
+  int encode_threads = 0;
+};
+
+// Appends frames to a recording. Frames are encoded and written by a
+// background thread, which writes as many queued frames as fit in a batch
+// with one pwritev(), so the caller only pays for copying each frame once.
+class RecordingWriter {
+ public:
+  // Creates the recording at 'path', replacing any recording already there.
+  // 'source' is stored in the header. Returns GENERAL if the files can't be
+  // created.
+  static StatusOr<RecordingWriter> Create(
+      const std::string& path, const std::string& source,
+      const RecordOptions& options = RecordOptions());
+
+  // Finishes the recording.
+  ~RecordingWriter();
+
+  // RecordingWriter is moveable, but not copyable.
+  RecordingWriter(const RecordingWriter&) = delete;
+  RecordingWriter& operator=(const RecordingWriter&) = delete;
+  RecordingWriter(RecordingWriter&& other) noexcept;
+  RecordingWriter& operator=(RecordingWriter&& other) noexcept;
+
+  // Returns a buffer for a width x height frame of tightly packed RGBA rows,
+  // so frames can be read straight into it, waiting if the queue is full.
+  // Queue it with commit_frame(). Calling next_frame() again without
+  // committing discards the buffer.
+  uint8_t* next_frame(int32_t width, int32_t height);
+
+  // Queues the frame filled in since the last next_frame().
+  void commit_frame(uint64_t sequence, uint64_t timestamp_nanos);
+
+  // Copies and queues a frame of tightly packed RGBA rows.
+  void append(const uint8_t* pixels, int32_t width, int32_t height,
+              uint64_t sequence, uint64_t timestamp_nanos);
+
+  // Writes every queued frame and closes the recording. Returns GENERAL if
+  // any write failed, after which the recording ends at the last frame
+  // written.
+  StatusVal finish();
+
+  // The number of frames committed so far.
+  uint64_t frame_count() const;
+
+ private:
+  struct Queue;
+
+  // Private constructor, use Create() instead.
+  explicit RecordingWriter(std::unique_ptr<Queue> queue);
+
+  // Shared with the writer thread.
+  std::unique_ptr<Queue> queue_;
+};
+
+// A frame in a recording. 'data' points to the stored frame in the reader's
+// mapping, and stays valid until the reader is refreshed or destroyed. It's
+// 'size' bytes encoded with 'codec'; RAW frames are tightly packed RGBA rows.
+struct RecordedFrame {
+  ErrorCode code = ErrorCode::OK;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  FrameCodec codec = FrameCodec::RAW;
+  int32_t width = 0;
+  int32_t height = 0;
+  uint64_t sequence = 0;
+  uint64_t timestamp_nanos = 0;
+};
+
+// Maps a recording for random access to its frames by number.
+class RecordingReader {
+ public:
+  // Opens the recording at 'path', which may still be being written. Returns
+  // NOT_FOUND if it doesn't exist, and GENERAL if it isn't a recording.
+  static StatusOr<RecordingReader> Open(const std::string& path);
+
+  ~RecordingReader();
+
+  // RecordingReader is moveable, but not copyable.
+  RecordingReader(const RecordingReader&) = delete;
+  RecordingReader& operator=(const RecordingReader&) = delete;
+  RecordingReader(RecordingReader&& other) noexcept;
+  RecordingReader& operator=(RecordingReader&& other) noexcept;
+
+  // The number of frames in the recording when it was opened or refreshed.
+  size_t frame_count() const { return frame_count_; }
+
+  // Returns frame 'index', counting from 0. Returns GENERAL if there's no
+  // such frame.
+  RecordedFrame frame(size_t index) const;
+
+  // Decodes frame 'index' into 'dst' as tightly packed RGBA rows. Returns
+  // GENERAL if there's no such frame, it's corrupt, or it doesn't fit in
+  // 'capacity' bytes, in which case its size is still filled in.
+  RecordedFrame read_frame(size_t index, uint8_t* dst, size_t capacity);
+
+  // Maps frames appended since the recording was opened or last refreshed.
+  // Pointers to earlier frames may move. Returns whether there are new frames.
+  bool refresh();
+
+  const RecordingHeader& header() const {
+    return *(const RecordingHeader*)data_map_;
+  }
+
+ private:
+  // Private constructor, use Open() instead.
+  RecordingReader(int data_fd, int index_fd);
+
+  // Maps the whole of both files, and counts the frames that are wholly
+  // written. Returns false if either file can't be mapped.
+  bool map_files();
+  void unmap_files();
+  // Unmaps and closes both files.
+  void close_files();
+
+  int data_fd_ = -1;
+  int index_fd_ = -1;
+  uint8_t* data_map_ = nullptr;
+  size_t data_size_ = 0;
+  uint8_t* index_map_ = nullptr;
+  size_t index_size_ = 0;
+  size_t frame_count_ = 0;
+  // Created on the first compressed frame read.
+  std::unique_ptr<TileCodec> codec_;
+};
+
+#endif  // RECORD_RECORDING_H_
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "recording.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string test_path(const char* name) {
+  return "/tmp/test_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+void remove_recording(const std::string& path) {
+  unlink(path.c_str());
+  unlink(recording_index_path(path).c_str());
+}
+
+std::vector<uint8_t> make_frame(int32_t width, int32_t height, uint8_t seed) {
+  std::vector<uint8_t> pixels((size_t)width * height * 4);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    pixels[i] = (uint8_t)(i * 7 + seed);
+  }
+  return pixels;
+}
+
+}  // namespace
+
+TEST(Recording, FramesReadBackByNumber) {
+  const std::string path = test_path("recording");
+  // A small batch size makes several frames per batch, and several batches.
+  RecordOptions options;
+  options.batch_bytes = 64 << 10;
+  options.queue_bytes = 256 << 10;
+  {
+    StatusOr<RecordingWriter> writer =
+        RecordingWriter::Create(path, "test_source", options);
+    ASSERT_TRUE(writer.ok());
+    for (int i = 0; i < 40; i++) {
+      // Frames change size partway through.
+      int32_t width = i < 20 ? 33 : 64;
+      std::vector<uint8_t> pixels = make_frame(width, 17, i);
+      if (i % 2) {
+        writer->append(pixels.data(), width, 17, 100 + i, 1000 * i);
+      } else {
+        memcpy(writer->next_frame(width, 17), pixels.data(), pixels.size());
+        writer->commit_frame(100 + i, 1000 * i);
+      }
+    }
+    EXPECT_EQ(writer->frame_count(), 40u);
+    EXPECT_TRUE(writer->finish().ok());
+  }
+
+  StatusOr<RecordingReader> reader = RecordingReader::Open(path);
+  ASSERT_TRUE(reader.ok());
+  EXPECT_STREQ(reader->header().source, "test_source");
+  EXPECT_STREQ(reader->header().format, "RGBA8");
+  ASSERT_EQ(reader->frame_count(), 40u);
+  for (int i : {39, 0, 20, 19, 7}) {
+    RecordedFrame frame = reader->frame(i);
+    ASSERT_EQ(frame.code, ErrorCode::OK);
+    int32_t width = i < 20 ? 33 : 64;
+    EXPECT_EQ(frame.width, width);
+    EXPECT_EQ(frame.height, 17);
+    EXPECT_EQ(frame.sequence, 100u + i);
+    EXPECT_EQ(frame.timestamp_nanos, 1000u * i);
+    EXPECT_EQ((uintptr_t)frame.data % kRecordingAlignment, 0u);
+    EXPECT_EQ(frame.codec, FrameCodec::RAW);
+    std::vector<uint8_t> pixels = make_frame(width, 17, i);
+    EXPECT_EQ(memcmp(frame.data, pixels.data(), pixels.size()), 0);
+  }
+  EXPECT_EQ(reader->frame(40).code, ErrorCode::GENERAL);
+  remove_recording(path);
+}
+
+TEST(Recording, CompressedFramesDecodeLosslessly) {
+  const std::string path = test_path("qoi_recording");
+  RecordOptions options;
+  options.codec = FrameCodec::QOI_TILES;
+  options.encode_threads = 2;
+  options.batch_bytes = 64 << 10;
+  // Flat frames compress well, and noisy ones not at all, so they're stored
+  // raw.
+  std::vector<uint8_t> flat(96 * 70 * 4, 9);
+  std::vector<uint8_t> noisy = make_frame(96, 70, 4);
+  {
+    StatusOr<RecordingWriter> writer =
+        RecordingWriter::Create(path, "qoi", options);
+    ASSERT_TRUE(writer.ok());
+    for (int i = 0; i < 10; i++) {
+      writer->append(i % 2 ? noisy.data() : flat.data(), 96, 70, i, i);
+    }
+    EXPECT_TRUE(writer->finish().ok());
+  }
+
+  StatusOr<RecordingReader> reader = RecordingReader::Open(path);
+  ASSERT_TRUE(reader.ok());
+  ASSERT_EQ(reader->frame_count(), 10u);
+  std::vector<uint8_t> decoded(flat.size());
+  for (size_t i : {9, 0, 4, 5}) {
+    RecordedFrame frame =
+        reader->read_frame(i, decoded.data(), decoded.size());
+    ASSERT_EQ(frame.code, ErrorCode::OK);
+    EXPECT_EQ(frame.codec, i % 2 ? FrameCodec::RAW : FrameCodec::QOI_TILES);
+    EXPECT_EQ(frame.sequence, i);
+    EXPECT_EQ(decoded, i % 2 ? noisy : flat);
+  }
+  EXPECT_LT(reader->frame(0).size * 20, flat.size());
+  EXPECT_EQ(reader->read_frame(0, decoded.data(), decoded.size() - 1).code,
+            ErrorCode::GENERAL);
+  remove_recording(path);
+}
+
+TEST(Recording, MovedReadersReadTheirNewRecording) {
+  const std::string paths[] = {test_path("move_a"), test_path("move_b")};
+  for (int i = 0; i < 2; i++) {
+    StatusOr<RecordingWriter> writer =
+        RecordingWriter::Create(paths[i], "move", RecordOptions());
+    ASSERT_TRUE(writer.ok());
+    std::vector<uint8_t> pixels = make_frame(8 + i, 4, i);
+    writer->append(pixels.data(), 8 + i, 4, i, i);
+    EXPECT_TRUE(writer->finish().ok());
+  }
+
+  StatusOr<RecordingReader> a = RecordingReader::Open(paths[0]);
+  StatusOr<RecordingReader> b = RecordingReader::Open(paths[1]);
+  ASSERT_TRUE(a.ok());
+  ASSERT_TRUE(b.ok());
+  *a = std::move(*b);
+  RecordedFrame frame = a->frame(0);
+  ASSERT_EQ(frame.code, ErrorCode::OK);
+  EXPECT_EQ(frame.width, 9);
+  std::vector<uint8_t> pixels = make_frame(9, 4, 1);
+  EXPECT_EQ(memcmp(frame.data, pixels.data(), pixels.size()), 0);
+  for (const std::string& path : paths) {
+    remove_recording(path);
+  }
+}
+
+TEST(Recording, ReadersFollowLiveRecordings) {
+  const std::string path = test_path("live_recording");
+  StatusOr<RecordingWriter> writer = RecordingWriter::Create(path, "live");
+  ASSERT_TRUE(writer.ok());
+  std::vector<uint8_t> pixels = make_frame(16, 16, 1);
+  writer->append(pixels.data(), 16, 16, 1, 1);
+
+  // Frames show up once the writer thread has written them.
+  StatusOr<RecordingReader> reader = RecordingReader::Open(path);
+  ASSERT_TRUE(reader.ok());
+  while (reader->frame_count() < 1) {
+    reader->refresh();
+  }
+  writer->append(pixels.data(), 16, 16, 2, 2);
+  EXPECT_TRUE(writer->finish().ok());
+  EXPECT_TRUE(reader->refresh());
+  ASSERT_EQ(reader->frame_count(), 2u);
+  EXPECT_EQ(reader->frame(1).sequence, 2u);
+  EXPECT_EQ(memcmp(reader->frame(1).data, pixels.data(), pixels.size()), 0);
+  remove_recording(path);
+}
+
+TEST(Recording, TruncatedRecordingsEndAtTheLastWholeFrame) {
+  const std::string path = test_path("truncated_recording");
+  {
+    StatusOr<RecordingWriter> writer = RecordingWriter::Create(path, "cut");
+    ASSERT_TRUE(writer.ok());
+    std::vector<uint8_t> pixels = make_frame(64, 64, 3);
+    for (int i = 0; i < 3; i++) {
+      writer->append(pixels.data(), 64, 64, i, i);
+    }
+  }
+
+  // Frames whose pixels were cut off are skipped.
+  ASSERT_EQ(truncate(path.c_str(), kRecordingAlignment + 2 * 64 * 64 * 4 + 8),
+            0);
+  StatusOr<RecordingReader> reader = RecordingReader::Open(path);
+  ASSERT_TRUE(reader.ok());
+  EXPECT_EQ(reader->frame_count(), 2u);
+
+  // So are torn index entries.
+  const std::string index_path = recording_index_path(path);
+  const size_t index_size =
+      sizeof(RecordingIndexHeader) + sizeof(RecordingIndexEntry) * 3 / 2;
+  ASSERT_EQ(truncate(index_path.c_str(), index_size), 0);
+  EXPECT_FALSE(reader->refresh());
+  EXPECT_EQ(reader->frame_count(), 1u);
+
+  EXPECT_EQ(RecordingReader::Open(test_path("missing_recording"))
+                .status()
+                .code(),
+            ErrorCode::NOT_FOUND);
+  remove_recording(path);
+}
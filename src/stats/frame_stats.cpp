@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_stats.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "logger.h"
+
+StatusOr<FrameStats> FrameStats::Create(const std::string& window_name) {
+  const std::string path = kFrameStatsPrefix + window_name;
+  StatusOr<Shm> shm_result = Shm::Create(path, 'w', sizeof(FrameStatsData));
+  RETURN_IF_ERROR(shm_result);
+
+  // The segment may be left over from an earlier process with the same
+  // window, so clear it before publishing the header.
+  FrameStatsData* data = (FrameStatsData*)shm_result->map();
+  memset((void*)data, 0, sizeof(FrameStatsData));
+  data->version = FrameStatsData::kVersion;
+  data->pid = getpid();
+  strncpy(data->window_name, window_name.c_str(),
+          sizeof(data->window_name) - 1);
+  std::atomic_thread_fence(std::memory_order_release);
+  data->magic = FrameStatsData::kMagic;
+
+  return FrameStats(std::move(*shm_result), path);
+}
+
+StatusOr<FrameStats> FrameStats::Open(const std::string& shm_name) {
+  StatusOr<Shm> shm_result = Shm::Create(shm_name, 'r', sizeof(FrameStatsData));
+  RETURN_IF_ERROR(shm_result);
+
+  // A segment its writer hasn't sized yet, or that something else truncated,
+  // would fault on the first read past its end.
+  struct stat st;
+  if (fstat(shm_result->fd(), &st) != 0 ||
+      (size_t)st.st_size < sizeof(FrameStatsData)) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+
+  const FrameStatsData* data = (const FrameStatsData*)shm_result->map();
+  if (data->magic != FrameStatsData::kMagic ||
+      data->version != FrameStatsData::kVersion) {
+    return StatusVal(ErrorCode::GENERAL);
+  }
+  return FrameStats(std::move(*shm_result), "");
+}
+
+bool FrameStats::enabled_by_env() {
+  const char* stats_env = std::getenv("VKVFB_STATS");
+  return !stats_env || strcmp(stats_env, "0") != 0;
+}
+
+FrameStats::FrameStats(Shm&& shm, std::string unlink_path)
+    : shm_(std::move(shm)),
+      data_((FrameStatsData*)shm_.map()),
+      unlink_path_(std::move(unlink_path)) {}
+
+FrameStats::~FrameStats() {
+  if (data_ && !unlink_path_.empty()) {
+    shm_unlink(unlink_path_.c_str());
+  }
+}
+
+FrameStats::FrameStats(FrameStats&& other) noexcept
+    : shm_(std::move(other.shm_)),
+      data_(other.data_),
+      unlink_path_(std::move(other.unlink_path_)) {
+  other.data_ = nullptr;
+}
+
+FrameStats& FrameStats::operator=(FrameStats&& other) noexcept {
+  if (this != &other) {
+    if (data_ && !unlink_path_.empty()) {
+      shm_unlink(unlink_path_.c_str());
+    }
+    shm_ = std::move(other.shm_);
+    data_ = other.data_;
+    unlink_path_ = std::move(other.unlink_path_);
+    other.data_ = nullptr;
+  }
+  return *this;
+}
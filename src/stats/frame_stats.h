@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATS_FRAME_STATS_H_
+#define STATS_FRAME_STATS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ipc/shm.h"
+#include "status_or.h"
+
+// Stats segments are named kFrameStatsPrefix + <window name>, so that tools can
+// find them all by listing /dev/shm.
+inline const char kFrameStatsPrefix[] = "vkvfb_stats_";
+
+enum class FrameCounter {
+  // Frames passed to vkQueuePresentKHR.
+  PRESENTED = 0,
+  // Presented frames whose copy back to the host failed to submit to the
+  // queue. Frames that are copied but not published count as SKIPPED.
+  SUBMIT_FAILED,
+  // Frames copied back to the host.
+  COPIED,
+  // Copied frames that weren't published, because their swapchain was retired
+  // or the frame was empty.
+  SKIPPED,
+  // Frames written to the pixbuf.
+  PUBLISHED,
+  // Copied frames that weren't published because the pixbuf lock timed out.
+  LOCK_TIMEOUTS,
+  // Copied frames that weren't published because the pixbuf lock's previous
+  // owner died.
+  OWNER_DEAD,
+  // Frames that didn't make it into the window's frame ring, because a
+  // blocking ring stayed full or its lock failed.
+  RING_DROPS,
+  COUNT,
+};
+
+enum class FrameLatency {
+  // From vkQueuePresentKHR to the copied frame being readable on the host.
+  PRESENT_TO_COPY = 0,
+  // From the copied frame being readable to it being published to the pixbuf.
+  COPY_TO_PUBLISH,
+  COUNT,
+};
+
+inline const size_t kNumFrameCounters = (size_t)FrameCounter::COUNT;
+inline const size_t kNumFrameLatencies = (size_t)FrameLatency::COUNT;
+
+// Latencies are recorded in log2 microsecond buckets. Bucket 0 holds
+// latencies under 1us and bucket i holds latencies in [2^(i-1), 2^i) us. The
+// last bucket also holds everything longer.
+inline const size_t kLatencyBuckets = 24;
+
+// The layout of a stats segment. Every field after the header is only ever
+// updated with relaxed atomic adds, so readers may see a snapshot that's
+// slightly torn across fields, but never a torn value.
+struct FrameStatsData {
+  static const uint32_t kMagic = 0x76666273;
+  static const uint32_t kVersion = 2;
+
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;
+  char window_name[52];
+
+  // Counters are written from both the present thread and the copy thread, so
+  // each gets its own cache line.
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> value;
+  };
+  Counter counters[kNumFrameCounters];
+  std::atomic<uint64_t> latency_us[kNumFrameLatencies][kLatencyBuckets];
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "FrameStatsData's atomics must be lock free to live in shm");
+
+// A handle to a window's stats segment. A default constructed FrameStats is
+// disabled and all of its updates are no-ops, so callers don't need to check
+// whether stats are enabled.
+class FrameStats {
+ public:
+  FrameStats() = default;
+
+  // Creates and zeroes the stats segment for the given window. The segment is
+  // unlinked when the FrameStats is destroyed.
+  static StatusOr<FrameStats> Create(const std::string& window_name);
+
+  // Opens an existing stats segment by its shm name (including the prefix)
+  // for reading.
+  static StatusOr<FrameStats> Open(const std::string& shm_name);
+
+  // Returns false if stats were disabled with VKVFB_STATS=0.
+  static bool enabled_by_env();
+
+  ~FrameStats();
+  FrameStats(FrameStats&& other) noexcept;
+  FrameStats& operator=(FrameStats&& other) noexcept;
+
+  void count(FrameCounter counter) {
+    if (data_) {
+      data_->counters[(size_t)counter].value.fetch_add(
+          1, std::memory_order_relaxed);
+    }
+  }
+
+  void record_latency(FrameLatency latency, uint64_t nanos) {
+    if (data_) {
+      data_->latency_us[(size_t)latency][latency_bucket(nanos)].fetch_add(
+          1, std::memory_order_relaxed);
+    }
+  }
+
+  bool enabled() const { return data_ != nullptr; }
+  const FrameStatsData* data() const { return data_; }
+
+  static size_t latency_bucket(uint64_t nanos) {
+    uint64_t us = nanos / 1000;
+    size_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    return bucket < kLatencyBuckets ? bucket : kLatencyBuckets - 1;
+  }
+
+ private:
+  FrameStats(Shm&& shm, std::string unlink_path);
+
+  Shm shm_;
+  FrameStatsData* data_ = nullptr;
+  // Set on the creating side, so the segment goes away with its window.
+  std::string unlink_path_;
+};
+
+#endif  // STATS_FRAME_STATS_H_
@@ -137,7 +137,7 @@ class StatusOr {
 
 #define RETURN_IF_ERROR(expr)    \
   do {                           \
-    auto status_or = (expr);     \
+    auto&& status_or = (expr);   \
     if (!status_or.ok()) {       \
       return status_or.status(); \
     }                            \
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "logger.h"
+#include "trace/trace.h"
+#include "utility.h"
+
+namespace {
+
+// Each buffer starts with a page that ends in the frame's header, so the
+// header and rows are one contiguous run, and the rows are page aligned.
+const size_t kHeaderRoom = 4096;
+
+enum class ClientKind {
+  // vmspliced into directly.
+  PIPE,
+  // Fed from a staging pipe with splice().
+  SOCKET,
+  // Terminals and files, which are written to, copying each frame.
+  // Terminals are made non-blocking like sockets, but regular files ignore
+  // O_NONBLOCK, so a file on slow storage can still hold up the server.
+  OTHER,
+};
+
+// Makes 'fd' non-blocking. Returns its flags from before, or -1 if they
+// didn't change.
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || (flags & O_NONBLOCK) ||
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return -1;
+  }
+  return flags;
+}
+
+bool would_block(ssize_t result) {
+  return result < 0 && (errno == EAGAIN || errno == EINTR);
+}
+
+}  // namespace
+
+struct FrameServer::Buffer {
+  ~Buffer() { free(data); }
+
+  FrameStreamHeader* header() {
+    return (FrameStreamHeader*)(data + kHeaderRoom -
+                                sizeof(FrameStreamHeader));
+  }
+  uint8_t* pixels() { return data + kHeaderRoom; }
+
+  uint8_t* data = nullptr;
+  size_t capacity = 0;
+  int32_t width = 0;
+  int32_t height = 0;
+  // Consumers that may still be reading the buffer's pages.
+  int holds = 0;
+};
+
+struct FrameServer::Client {
+  struct Hold {
+    int buffer;
+    // Where the buffer's frame ends in the consumer's stream.
+    uint64_t end;
+  };
+
+  bool idle() const { return remaining == 0 && staged == 0; }
+
+  int fd;
+  bool owned;
+  ClientKind kind;
+  // The flags 'fd' had before it was made non-blocking, or -1. A borrowed
+  // fd, like a terminal on stdout, may share its flags with other processes,
+  // so they're restored when the consumer is dropped.
+  int restore_flags = -1;
+  int stage[2] = {-1, -1};
+  // The part of the current frame not yet handed to the kernel.
+  const uint8_t* data = nullptr;
+  size_t remaining = 0;
+  // Bytes in the staging pipe, not yet spliced to the socket.
+  size_t staged = 0;
+  // Bytes handed to 'fd', and bytes of frames started, since it connected.
+  uint64_t sent = 0;
+  uint64_t queued = 0;
+  std::vector<Hold> holds;
+  // Set once the consumer shuts down its side, after which there's nothing
+  // left to read from it.
+  bool read_closed = false;
+  // The frame size of a stream without headers.
+  int32_t width = 0;
+  int32_t height = 0;
+};
+
+StatusOr<std::unique_ptr<FrameServer>> FrameServer::Create(
+    const std::string& socket_path, const FrameServerOptions& options) {
+  int listen_fd = -1;
+  if (!socket_path.empty()) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+      ERROR("Socket path is too long: %s", socket_path.c_str());
+      return StatusVal(ErrorCode::GENERAL);
+    }
+    memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+    listen_fd =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // Only replace sockets, in case the path is a typo for something else.
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(socket_path.c_str());
+    }
+    if (listen_fd == -1 ||
+        bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1 ||
+        chmod(socket_path.c_str(), 0600) == -1 ||
+        listen(listen_fd, 16) == -1) {
+      ERROR("Failed to listen on %s: %s", socket_path.c_str(),
+            errno_to_string(errno).c_str());
+      if (listen_fd != -1) {
+        close(listen_fd);
+      }
+      return StatusVal(ErrorCode::GENERAL);
+    }
+  }
+  return std::unique_ptr<FrameServer>(
+      new FrameServer(listen_fd, socket_path, options));
+}
+
+FrameServer::FrameServer(int listen_fd, const std::string& socket_path,
+                         const FrameServerOptions& options)
+    : listen_fd_(listen_fd), socket_path_(socket_path), options_(options) {}
+
+FrameServer::~FrameServer() {
+  while (!clients_.empty()) {
+    drop_client(clients_.size() - 1);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+}
+
+void FrameServer::add_client(int fd, bool owned) {
+  auto client = std::make_unique<Client>();
+  client->fd = fd;
+  client->owned = owned;
+  struct stat st = {};
+  fstat(fd, &st);
+  if (S_ISFIFO(st.st_mode)) {
+    client->kind = ClientKind::PIPE;
+    fcntl(fd, F_SETPIPE_SZ, (int)options_.pipe_size);
+  } else if (S_ISSOCK(st.st_mode) &&
+             pipe2(client->stage, O_NONBLOCK | O_CLOEXEC) == 0) {
+    client->kind = ClientKind::SOCKET;
+    client->restore_flags = set_nonblocking(fd);
+    fcntl(client->stage[1], F_SETPIPE_SZ, (int)options_.pipe_size);
+  } else {
+    client->kind = ClientKind::OTHER;
+    client->restore_flags = set_nonblocking(fd);
+  }
+  LOG(kLogSync, "Frame stream consumer connected on fd %d", fd);
+  clients_.push_back(std::move(client));
+}
+
+void FrameServer::drop_client(size_t index) {
+  Client& client = *clients_[index];
+  LOG(kLogSync, "Frame stream consumer on fd %d disconnected", client.fd);
+  // The consumer's gone, so nothing can read the buffers it held.
+  for (const Client::Hold& hold : client.holds) {
+    buffers_[hold.buffer]->holds--;
+  }
+  if (client.stage[0] != -1) {
+    close(client.stage[0]);
+    close(client.stage[1]);
+  }
+  if (client.owned) {
+    close(client.fd);
+  } else if (client.restore_flags != -1) {
+    fcntl(client.fd, F_SETFL, client.restore_flags);
+  }
+  clients_.erase(clients_.begin() + index);
+}
+
+void FrameServer::accept_clients() {
+  if (listen_fd_ == -1) {
+    return;
+  }
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    add_client(fd, /*owned=*/true);
+  }
+}
+
+bool FrameServer::wants_frame() const {
+  for (const std::unique_ptr<Client>& client : clients_) {
+    if (client->idle()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FrameServer::sending() const {
+  for (const std::unique_ptr<Client>& client : clients_) {
+    if (!client->idle()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t* FrameServer::next_frame(int32_t width, int32_t height) {
+  pending_ = -1;
+  if (width <= 0 || height <= 0) {
+    return nullptr;
+  }
+  for (std::unique_ptr<Client>& client : clients_) {
+    reclaim(*client);
+  }
+
+  // Prefer a free buffer that already fits, then a new buffer, then growing
+  // a free one.
+  const size_t size = kHeaderRoom + round_to_page((size_t)width * height * 4);
+  int free_buffer = -1;
+  for (size_t i = 0; i < buffers_.size(); i++) {
+    if (buffers_[i]->holds > 0) {
+      continue;
+    }
+    free_buffer = i;
+    if (buffers_[i]->capacity >= size) {
+      break;
+    }
+  }
+  if ((free_buffer == -1 || buffers_[free_buffer]->capacity < size) &&
+      buffers_.size() < options_.buffers) {
+    buffers_.push_back(std::make_unique<Buffer>());
+    free_buffer = buffers_.size() - 1;
+  }
+  if (free_buffer == -1) {
+    frames_skipped_ += clients_.size();
+    return nullptr;
+  }
+
+  Buffer& buffer = *buffers_[free_buffer];
+  if (buffer.capacity < size) {
+    free(buffer.data);
+    buffer.data = nullptr;
+    buffer.capacity = 0;
+    void* data;
+    if (posix_memalign(&data, kHeaderRoom, size) != 0) {
+      ERROR("Failed to allocate a %zu byte frame buffer", size);
+      return nullptr;
+    }
+    buffer.data = (uint8_t*)data;
+    buffer.capacity = size;
+  }
+  buffer.width = width;
+  buffer.height = height;
+  pending_ = free_buffer;
+  return buffer.pixels();
+}
+
+void FrameServer::commit_frame(uint64_t sequence, uint64_t timestamp_nanos) {
+  if (pending_ == -1) {
+    return;
+  }
+  TRACE_SCOPE("stream_commit");
+  Buffer& buffer = *buffers_[pending_];
+  FrameStreamHeader* header = buffer.header();
+  memset(header, 0, sizeof(*header));
+  header->magic = FrameStreamHeader::kMagic;
+  header->version = FrameStreamHeader::kVersion;
+  header->header_size = sizeof(FrameStreamHeader);
+  header->width = buffer.width;
+  header->height = buffer.height;
+  header->size = (uint64_t)buffer.width * buffer.height * 4;
+  header->sequence = sequence;
+  header->timestamp_nanos = timestamp_nanos;
+  frames_committed_++;
+
+  for (size_t i = clients_.size(); i-- > 0;) {
+    Client& client = *clients_[i];
+    if (!client.idle()) {
+      frames_skipped_++;
+      continue;
+    }
+    if (!options_.headers) {
+      if (client.width == 0) {
+        client.width = buffer.width;
+        client.height = buffer.height;
+      } else if (client.width != buffer.width ||
+                 client.height != buffer.height) {
+        frames_skipped_++;
+        continue;
+      }
+    }
+    client.data = options_.headers ? (const uint8_t*)header : buffer.pixels();
+    client.remaining =
+        header->size + (options_.headers ? sizeof(FrameStreamHeader) : 0);
+    client.queued += client.remaining;
+    client.holds.push_back({pending_, client.queued});
+    buffer.holds++;
+    if (!send(client)) {
+      drop_client(i);
+    }
+  }
+  pending_ = -1;
+}
+
+bool FrameServer::send(Client& client) {
+  TRACE_SCOPE("stream_send");
+  while (!client.idle()) {
+    iovec iov = {(void*)client.data, client.remaining};
+    ssize_t n = 0;
+    switch (client.kind) {
+      case ClientKind::PIPE:
+        n = vmsplice(client.fd, &iov, 1, SPLICE_F_NONBLOCK);
+        if (would_block(n)) {
+          return true;
+        } else if (n <= 0) {
+          return false;
+        }
+        client.sent += n;
+        break;
+      case ClientKind::SOCKET: {
+        n = 0;
+        if (client.remaining > 0) {
+          n = vmsplice(client.stage[1], &iov, 1, SPLICE_F_NONBLOCK);
+          if (n < 0 && !would_block(n)) {
+            return false;
+          }
+          n = std::max<ssize_t>(n, 0);
+          client.staged += n;
+        }
+        ssize_t spliced = 0;
+        if (client.staged > 0) {
+          spliced = splice(client.stage[0], nullptr, client.fd, nullptr,
+                           client.staged, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+          if (would_block(spliced)) {
+            spliced = 0;
+          } else if (spliced <= 0) {
+            return false;
+          }
+          client.staged -= spliced;
+          client.sent += spliced;
+        }
+        if (n == 0 && spliced == 0) {
+          return true;
+        }
+        break;
+      }
+      case ClientKind::OTHER:
+        n = write(client.fd, client.data, client.remaining);
+        if (would_block(n)) {
+          return true;
+        } else if (n <= 0) {
+          return false;
+        }
+        client.sent += n;
+        break;
+    }
+    client.data += n;
+    client.remaining -= n;
+  }
+  return true;
+}
+
+void FrameServer::reclaim(Client& client) {
+  if (client.holds.empty()) {
+    return;
+  }
+  // Bytes the kernel still holds for the consumer may still point at our
+  // pages. A socket's queue is counted in allocated bytes, which overstates
+  // it, so buffers are released late rather than early.
+  int unread = 0;
+  if (client.kind == ClientKind::PIPE) {
+    if (ioctl(client.fd, FIONREAD, &unread) == -1) {
+      return;
+    }
+  } else if (client.kind == ClientKind::SOCKET) {
+    if (ioctl(client.fd, SIOCOUTQ, &unread) == -1) {
+      return;
+    }
+  }
+  const uint64_t read =
+      client.sent > (uint64_t)unread ? client.sent - unread : 0;
+  size_t kept = 0;
+  for (const Client::Hold& hold : client.holds) {
+    if (hold.end <= read) {
+      buffers_[hold.buffer]->holds--;
+    } else {
+      client.holds[kept++] = hold;
+    }
+  }
+  client.holds.resize(kept);
+}
+
+void FrameServer::pump(uint64_t timeout_nanos) {
+  accept_clients();
+  std::vector<pollfd> fds;
+  for (const std::unique_ptr<Client>& client : clients_) {
+    short events = client->idle() ? 0 : POLLOUT;
+    if (client->kind == ClientKind::SOCKET && !client->read_closed) {
+      events |= POLLIN;
+    }
+    fds.push_back({client->fd, events, 0});
+  }
+  if (listen_fd_ != -1) {
+    fds.push_back({listen_fd_, POLLIN, 0});
+  }
+  timespec timeout = {(time_t)(timeout_nanos / 1'000'000'000),
+                      (long)(timeout_nanos % 1'000'000'000)};
+  if (ppoll(fds.data(), fds.size(), &timeout, nullptr) <= 0) {
+    return;
+  }
+
+  for (size_t i = clients_.size(); i-- > 0;) {
+    Client& client = *clients_[i];
+    const short revents = fds[i].revents;
+    // Pipes report POLLERR once their reader closes, and sockets POLLHUP.
+    bool gone = revents & (POLLERR | POLLHUP | POLLNVAL);
+    if (!gone && (revents & POLLIN)) {
+      // Consumers have nothing to say, so drain whatever they send.
+      char discard[256];
+      client.read_closed = read(client.fd, discard, sizeof(discard)) == 0;
+    }
+    if (!gone && (revents & POLLOUT)) {
+      gone = !send(client);
+    }
+    if (gone) {
+      drop_client(i);
+    } else {
+      reclaim(client);
+    }
+  }
+  accept_clients();
+}
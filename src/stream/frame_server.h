@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STREAM_FRAME_SERVER_H_
+#define STREAM_FRAME_SERVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "status_or.h"
+
+// A frame stream is a byte stream of frames for consumers that can't map
+// shm, like an ffmpeg rawvideo pipeline or a sandboxed reader. Each frame is
+// a FrameStreamHeader followed by 'size' bytes of tightly packed RGBA rows,
+// or, for raw streams, just the rows.
+//
+// FrameServer hands its frame buffers to the kernel with vmsplice(), so
+// sending a frame to a pipe or socket copies nothing: pipes reference the
+// buffer's pages until the consumer reads them, and sockets are fed from a
+// staging pipe with splice(). Other consumers, like files and terminals, are
+// written to, which copies the frame. A buffer is only reused once every
+// consumer has read it, and a consumer that's still reading the last frame
+// skips new ones, so a slow consumer doesn't hold up the server or the other
+// consumers. Regular files are the exception: they can't be made
+// non-blocking, so a file on slow storage stalls every write. Pipe consumers
+// should read() their pipe: splicing from it hands the pages on, past where
+// the server can tell whether they're still in use.
+
+struct FrameStreamHeader {
+  static const uint32_t kMagic = 0x76666273;
+  static const uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  // The bytes from the start of this header to the frame's first row.
+  uint32_t header_size;
+  uint32_t reserved;
+  int32_t width;
+  int32_t height;
+  // The bytes of rows that follow the header.
+  uint64_t size;
+  // The writer's sequence number for the frame. Gaps are frames this
+  // consumer skipped.
+  uint64_t sequence;
+  // CLOCK_MONOTONIC nanoseconds when the frame was read.
+  uint64_t timestamp_nanos;
+  uint64_t reserved2[2];
+};
+static_assert(sizeof(FrameStreamHeader) == 64,
+              "FrameStreamHeader's layout is part of the stream format");
+
+struct FrameServerOptions {
+  // Prefixes every frame with a FrameStreamHeader. Without headers, each
+  // consumer only gets frames the size of its first one, so the stream stays
+  // parseable as rawvideo.
+  bool headers = true;
+  // The most frames held for consumers at once. A frame that arrives while
+  // every buffer is still being read is skipped.
+  uint32_t buffers = 4;
+  // The pipe size to ask for, so each vmsplice() hands over more of a frame.
+  size_t pipe_size = 1 << 20;
+};
+
+// Streams frames to consumers connected to a unix socket, or given as fds.
+// FrameServer is single threaded: the caller fills frames and calls pump() to
+// accept consumers and keep sending.
+//
+// Consumers closing their end raise SIGPIPE, so callers should ignore it.
+class FrameServer {
+ public:
+  // Creates a server. If 'socket_path' isn't empty, it listens for consumers
+  // on a unix socket at that path, only accessible to this user, replacing
+  // any socket left there. Returns GENERAL if it can't listen.
+  static StatusOr<std::unique_ptr<FrameServer>> Create(
+      const std::string& socket_path,
+      const FrameServerOptions& options = FrameServerOptions());
+
+  // Disconnects every consumer and removes the socket.
+  ~FrameServer();
+
+  // Consumers hold pointers into the server's buffers, so it can't move.
+  FrameServer(const FrameServer&) = delete;
+  FrameServer& operator=(const FrameServer&) = delete;
+
+  // Adds a consumer at 'fd', e.g. stdout. Pipes are vmspliced into directly,
+  // sockets through a staging pipe, and anything else is written to. Sockets
+  // and terminals are made non-blocking, but regular files can't be, so
+  // writing to a file on slow storage blocks the server. Closes 'fd' when
+  // the consumer is dropped if 'owned', and otherwise restores its flags.
+  void add_client(int fd, bool owned);
+
+  // Whether any consumer is ready for a new frame. When none is, reading the
+  // next frame is wasted.
+  bool wants_frame() const;
+
+  // Returns a buffer for a width x height frame of tightly packed RGBA rows,
+  // so frames can be read straight into it, or nullptr if every buffer is
+  // still being read and the frame has to be skipped. Send it with
+  // commit_frame().
+  uint8_t* next_frame(int32_t width, int32_t height);
+
+  // Starts sending the frame filled in since the last next_frame() to every
+  // consumer that's ready for it.
+  void commit_frame(uint64_t sequence, uint64_t timestamp_nanos);
+
+  // Accepts new consumers and sends as much of their frames as they take,
+  // waiting up to 'timeout_nanos' for any of them to become ready. Drops
+  // consumers that disconnected.
+  void pump(uint64_t timeout_nanos);
+
+  // Whether any consumer is part way through a frame.
+  bool sending() const;
+
+  size_t client_count() const { return clients_.size(); }
+  // Frames committed, and frames consumers missed, counted once per consumer:
+  // because they were busy, because every buffer was, or, without headers,
+  // because the frame was another size.
+  uint64_t frames_committed() const { return frames_committed_; }
+  uint64_t frames_skipped() const { return frames_skipped_; }
+
+ private:
+  struct Buffer;
+  struct Client;
+
+  // Private constructor, use Create() instead.
+  FrameServer(int listen_fd, const std::string& socket_path,
+              const FrameServerOptions& options);
+
+  void accept_clients();
+  // Sends as much of 'client's frame as it takes without blocking. Returns
+  // false if the consumer is gone.
+  bool send(Client& client);
+  // Releases the buffers 'client' has finished reading.
+  void reclaim(Client& client);
+  void drop_client(size_t index);
+
+  int listen_fd_;
+  std::string socket_path_;
+  const FrameServerOptions options_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  std::vector<std::unique_ptr<Client>> clients_;
+  // The buffer filled since the last next_frame(), or -1.
+  int pending_ = -1;
+  uint64_t frames_committed_ = 0;
+  uint64_t frames_skipped_ = 0;
+};
+
+#endif  // STREAM_FRAME_SERVER_H_
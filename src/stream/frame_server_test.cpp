@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_server.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char* kSocketPath = "/tmp/test_frame_server.sock";
+
+class FrameServerTest : public ::testing::Test {
+ protected:
+  // Consumers closing their end would otherwise kill the test.
+  void SetUp() override { signal(SIGPIPE, SIG_IGN); }
+};
+
+std::unique_ptr<FrameServer> make_server(
+    const std::string& socket_path = "",
+    const FrameServerOptions& options = FrameServerOptions()) {
+  StatusOr<std::unique_ptr<FrameServer>> server =
+      FrameServer::Create(socket_path, options);
+  EXPECT_TRUE(server.ok());
+  return std::move(server.value());
+}
+
+// Commits a width x height frame filled with 'value'. Returns false if the
+// server had no buffer for it.
+bool commit(FrameServer& server, int32_t width, int32_t height,
+            uint8_t value) {
+  uint8_t* pixels = server.next_frame(width, height);
+  if (!pixels) {
+    return false;
+  }
+  memset(pixels, value, (size_t)width * height * 4);
+  server.commit_frame(value, 1000 + value);
+  return true;
+}
+
+// Reads exactly 'size' bytes from the non-blocking 'fd', pumping 'server'
+// whenever the fd runs dry.
+std::vector<uint8_t> read_exactly(int fd, size_t size, FrameServer& server) {
+  std::vector<uint8_t> data(size);
+  size_t done = 0;
+  for (int tries = 0; done < size && tries < 10000; tries++) {
+    ssize_t n = read(fd, data.data() + done, size - done);
+    if (n > 0) {
+      done += n;
+    } else {
+      server.pump(1'000'000);
+    }
+  }
+  EXPECT_EQ(done, size);
+  return data;
+}
+
+FrameStreamHeader read_header(int fd, FrameServer& server) {
+  std::vector<uint8_t> data =
+      read_exactly(fd, sizeof(FrameStreamHeader), server);
+  FrameStreamHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  return header;
+}
+
+// Reads a frame and checks its header and that every byte is 'value'.
+void expect_frame(int fd, FrameServer& server, int32_t width, int32_t height,
+                  uint8_t value) {
+  FrameStreamHeader header = read_header(fd, server);
+  EXPECT_EQ(header.magic, (uint32_t)FrameStreamHeader::kMagic);
+  EXPECT_EQ(header.header_size, sizeof(FrameStreamHeader));
+  EXPECT_EQ(header.width, width);
+  EXPECT_EQ(header.height, height);
+  EXPECT_EQ(header.sequence, value);
+  EXPECT_EQ(header.timestamp_nanos, 1000u + value);
+  ASSERT_EQ(header.size, (uint64_t)width * height * 4);
+  std::vector<uint8_t> pixels = read_exactly(fd, header.size, server);
+  EXPECT_EQ(std::vector<uint8_t>(header.size, value), pixels);
+}
+
+}  // namespace
+
+TEST_F(FrameServerTest, StreamsFramesIntoPipes) {
+  std::unique_ptr<FrameServer> server = make_server();
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  server->add_client(fds[1], /*owned=*/true);
+
+  EXPECT_TRUE(server->wants_frame());
+  ASSERT_TRUE(commit(*server, 16, 8, 1));
+  expect_frame(fds[0], *server, 16, 8, 1);
+  ASSERT_TRUE(commit(*server, 32, 4, 2));
+  expect_frame(fds[0], *server, 32, 4, 2);
+  EXPECT_EQ(server->frames_committed(), 2u);
+  EXPECT_EQ(server->frames_skipped(), 0u);
+
+  // Consumers that close their end are dropped.
+  close(fds[0]);
+  commit(*server, 16, 8, 3);
+  server->pump(0);
+  EXPECT_EQ(server->client_count(), 0u);
+}
+
+TEST_F(FrameServerTest, StreamsFramesToSocketConsumers) {
+  std::unique_ptr<FrameServer> server = make_server(kSocketPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, kSocketPath);
+  ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+  server->pump(0);
+  ASSERT_EQ(server->client_count(), 1u);
+
+  // Frames larger than the pipes take several rounds of splicing.
+  const int32_t kWidth = 1024;
+  const int32_t kHeight = 512;
+  for (uint8_t i = 1; i <= 3; i++) {
+    ASSERT_TRUE(commit(*server, kWidth, kHeight, i));
+    expect_frame(fd, *server, kWidth, kHeight, i);
+  }
+
+  close(fd);
+  for (int i = 0; i < 10 && server->client_count() > 0; i++) {
+    server->pump(1'000'000);
+  }
+  EXPECT_EQ(server->client_count(), 0u);
+  server.reset();
+  EXPECT_NE(access(kSocketPath, F_OK), 0);
+}
+
+TEST_F(FrameServerTest, SlowConsumersSkipFramesWithoutCorruptingThem) {
+  std::unique_ptr<FrameServer> server = make_server();
+  int slow[2];
+  int fast[2];
+  ASSERT_EQ(pipe2(slow, O_NONBLOCK), 0);
+  ASSERT_EQ(pipe2(fast, O_NONBLOCK), 0);
+  server->add_client(slow[1], /*owned=*/true);
+  server->add_client(fast[1], /*owned=*/true);
+
+  // Frames are larger than a pipe holds, so the slow consumer is stuck part
+  // way through its first frame while the fast one keeps up.
+  const int32_t kWidth = 1024;
+  const int32_t kHeight = 1024;
+  ASSERT_TRUE(commit(*server, kWidth, kHeight, 1));
+  expect_frame(fast[0], *server, kWidth, kHeight, 1);
+  for (uint8_t i = 2; i <= 20; i++) {
+    ASSERT_TRUE(commit(*server, kWidth, kHeight, i));
+    expect_frame(fast[0], *server, kWidth, kHeight, i);
+  }
+  EXPECT_GT(server->frames_skipped(), 0u);
+
+  // The slow consumer's frame wasn't overwritten while it was stuck, and it
+  // gets new frames once it catches up.
+  expect_frame(slow[0], *server, kWidth, kHeight, 1);
+  EXPECT_TRUE(server->wants_frame());
+  ASSERT_TRUE(commit(*server, kWidth, kHeight, 21));
+  expect_frame(slow[0], *server, kWidth, kHeight, 21);
+  close(slow[0]);
+  close(fast[0]);
+}
+
+TEST_F(FrameServerTest, SkipsFramesWithoutFreeBuffers) {
+  FrameServerOptions options;
+  options.buffers = 1;
+  std::unique_ptr<FrameServer> server = make_server("", options);
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  server->add_client(fds[1], /*owned=*/true);
+
+  ASSERT_TRUE(commit(*server, 16, 8, 1));
+  // The only buffer is still in the pipe.
+  EXPECT_EQ(server->next_frame(16, 8), nullptr);
+  expect_frame(fds[0], *server, 16, 8, 1);
+  ASSERT_TRUE(commit(*server, 16, 8, 2));
+  expect_frame(fds[0], *server, 16, 8, 2);
+  close(fds[0]);
+}
+
+TEST_F(FrameServerTest, RawStreamsKeepTheirFirstFrameSize) {
+  FrameServerOptions options;
+  options.headers = false;
+  std::unique_ptr<FrameServer> server = make_server("", options);
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  server->add_client(fds[1], /*owned=*/true);
+
+  ASSERT_TRUE(commit(*server, 16, 8, 1));
+  ASSERT_TRUE(commit(*server, 8, 8, 2));
+  ASSERT_TRUE(commit(*server, 16, 8, 3));
+  EXPECT_EQ(server->frames_skipped(), 1u);
+  EXPECT_EQ(read_exactly(fds[0], 16 * 8 * 4, *server),
+            std::vector<uint8_t>(16 * 8 * 4, 1));
+  EXPECT_EQ(read_exactly(fds[0], 16 * 8 * 4, *server),
+            std::vector<uint8_t>(16 * 8 * 4, 3));
+  char extra;
+  EXPECT_EQ(read(fds[0], &extra, 1), -1);
+  close(fds[0]);
+}
+
+TEST_F(FrameServerTest, WritesFramesToFiles) {
+  std::unique_ptr<FrameServer> server = make_server();
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  const int fd = fileno(file);
+  const int flags = fcntl(fd, F_GETFL);
+  server->add_client(fd, /*owned=*/false);
+
+  ASSERT_TRUE(commit(*server, 16, 8, 1));
+  server->pump(1'000'000);
+  ASSERT_TRUE(commit(*server, 16, 8, 2));
+
+  // A borrowed fd gets its flags back once the consumer's dropped.
+  server.reset();
+  EXPECT_EQ(fcntl(fd, F_GETFL), flags);
+  const size_t frame_size = sizeof(FrameStreamHeader) + 16 * 8 * 4;
+  EXPECT_EQ(lseek(fd, 0, SEEK_END), (off_t)(2 * frame_size));
+  std::vector<uint8_t> data(frame_size);
+  ASSERT_EQ(pread(fd, data.data(), frame_size, frame_size),
+            (ssize_t)frame_size);
+  FrameStreamHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  EXPECT_EQ(header.sequence, 2u);
+  EXPECT_EQ(data.back(), 2);
+  fclose(file);
+}
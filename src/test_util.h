@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+// Helpers shared by the unit tests of shm segments.
+
+#include <sys/mman.h>
+
+#include <string>
+#include <utility>
+
+#include "status_or.h"
+
+// Drops the segment 'name' and its '<name>_mu' mutex, if an earlier run left
+// them, so a test's writer starts afresh rather than taking them over.
+inline void remove_shared_segment(const std::string& name) {
+  shm_unlink(name.c_str());
+  shm_unlink((name + "_mu").c_str());
+}
+
+// Returns the value of a Create() that the test can't go on without.
+template <typename T>
+T created_or_die(StatusOr<T>&& result) {
+  return std::move(result.value_or_die());
+}
+
+#endif  // TEST_UTIL_H_
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+
+namespace trace {
+namespace {
+
+// Must be a power of two. At 40 bytes per event, a ring is 320KiB.
+const size_t kRingEvents = 8192;
+
+struct Event {
+  const char* name;
+  const char* arg_name;
+  uint64_t begin_nanos;
+  uint32_t duration_nanos;
+  uint64_t arg;
+};
+
+// Written only by its owning thread. Once the ring is full, new events
+// overwrite the oldest ones.
+struct Ring {
+  pid_t tid;
+  std::atomic<const char*> thread_name{nullptr};
+  std::atomic<uint64_t> head{0};
+  Event events[kRingEvents];
+};
+
+struct State {
+  std::string path;
+  // Protects rings. Rings outlive their threads, so that their events still
+  // make it into the dump.
+  std::mutex rings_mu;
+  std::vector<Ring*> rings;
+  // Serializes dumps.
+  std::mutex dump_mu;
+  int signal_pipe[2] = {-1, -1};
+};
+
+// Never freed, since events can be recorded during static destruction.
+State* state = nullptr;
+
+thread_local Ring* thread_ring = nullptr;
+
+Ring& get_thread_ring() {
+  if (!thread_ring) {
+    Ring* ring = new Ring();
+    ring->tid = gettid();
+    std::lock_guard<std::mutex> lock(state->rings_mu);
+    state->rings.push_back(ring);
+    thread_ring = ring;
+  }
+  return *thread_ring;
+}
+
+void write_json_string(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+    }
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void dump_ring(FILE* f, pid_t pid, Ring& ring, bool& first) {
+  const char* thread_name = ring.thread_name.load(std::memory_order_acquire);
+  if (thread_name) {
+    fprintf(f,
+            "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":",
+            first ? "" : ",", pid, ring.tid);
+    write_json_string(f, thread_name);
+    fputs("}}", f);
+    first = false;
+  }
+
+  uint64_t head = ring.head.load(std::memory_order_acquire);
+  uint64_t begin = head > kRingEvents ? head - kRingEvents : 0;
+  std::vector<Event> events(head - begin);
+  for (uint64_t i = begin; i < head; ++i) {
+    events[i - begin] = ring.events[i & (kRingEvents - 1)];
+  }
+  // The owning thread may have lapped us while we copied. Drop any events
+  // that could have been overwritten mid-copy.
+  uint64_t head_after = ring.head.load(std::memory_order_acquire);
+  uint64_t valid_begin =
+      head_after > kRingEvents ? head_after - kRingEvents + 1 : 0;
+
+  for (uint64_t i = std::max(begin, valid_begin); i < head; ++i) {
+    const Event& e = events[i - begin];
+    fprintf(f,
+            "%s\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%lu.%03lu,\"dur\":%u.%03u",
+            first ? "" : ",", e.name, pid, ring.tid,
+            (unsigned long)(e.begin_nanos / 1000),
+            (unsigned long)(e.begin_nanos % 1000), e.duration_nanos / 1000,
+            e.duration_nanos % 1000);
+    if (e.arg_name) {
+      fprintf(f, ",\"args\":{\"%s\":%lu}", e.arg_name, (unsigned long)e.arg);
+    }
+    fputc('}', f);
+    first = false;
+  }
+}
+
+void dump_signal_handler(int) {
+  char c = 0;
+  (void)!write(state->signal_pipe[1], &c, 1);
+}
+
+// Dumps are written from this thread rather than the signal handler, since
+// they allocate and do stdio.
+void dump_thread_func() {
+  while (true) {
+    char c;
+    ssize_t r = read(state->signal_pipe[0], &c, 1);
+    if (r == 1) {
+      dump();
+    } else if (r == -1 && errno != EINTR) {
+      return;
+    }
+  }
+}
+
+bool init_from_env() {
+  const char* prefix = std::getenv("VKVFB_TRACE");
+  if (!prefix || !*prefix) {
+    return false;
+  }
+
+  state = new State();
+  state->path = std::string(prefix) + "." + std::to_string(getpid()) + ".json";
+  if (pipe2(state->signal_pipe, O_CLOEXEC) == 0) {
+    struct sigaction action = {};
+    action.sa_handler = dump_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, nullptr);
+    std::thread(dump_thread_func).detach();
+  } else {
+    ERROR("Failed to create trace signal pipe, SIGUSR2 dumps are disabled");
+  }
+  atexit(dump);
+  return true;
+}
+
+}  // namespace
+
+extern const bool g_enabled = init_from_env();
+
+void record(const char* name, uint64_t begin_nanos, uint64_t end_nanos,
+            const char* arg_name, uint64_t arg) {
+  if (!enabled()) {
+    return;
+  }
+  Ring& ring = get_thread_ring();
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  Event& e = ring.events[head & (kRingEvents - 1)];
+  e.name = name;
+  e.arg_name = arg_name;
+  e.begin_nanos = begin_nanos;
+  uint64_t duration = end_nanos - begin_nanos;
+  e.duration_nanos = duration > UINT32_MAX ? UINT32_MAX : duration;
+  e.arg = arg;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void set_thread_name(const char* name) {
+  if (!enabled()) {
+    return;
+  }
+  get_thread_ring().thread_name.store(name, std::memory_order_release);
+}
+
+void dump() {
+  if (!enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> dump_lock(state->dump_mu);
+  std::vector<Ring*> rings;
+  {
+    std::lock_guard<std::mutex> lock(state->rings_mu);
+    rings = state->rings;
+  }
+
+  // Write to a temporary file and rename it, so that readers never see a
+  // partial trace.
+  std::string tmp_path = state->path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    ERROR("Failed to open trace file: %s", tmp_path.c_str());
+    return;
+  }
+  pid_t pid = getpid();
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+  bool first = true;
+  for (Ring* ring : rings) {
+    dump_ring(f, pid, *ring, first);
+  }
+  fputs("\n]}\n", f);
+  fclose(f);
+  if (rename(tmp_path.c_str(), state->path.c_str()) != 0) {
+    ERROR("Failed to write trace file: %s", state->path.c_str());
+    return;
+  }
+  LOG(kLogLayer, "Wrote trace to %s", state->path.c_str());
+}
+
+}  // namespace trace
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACE_TRACE_H_
+#define TRACE_TRACE_H_
+
+#include <cstdint>
+
+#include "utility.h"
+
+// An in-process recorder for frame lifecycle traces.
+//
+// Tracing is off unless VKVFB_TRACE is set to an output path prefix. When on,
+// each thread records its events into a fixed size ring buffer, keeping the
+// most recent events, and the rings are dumped as Chrome trace JSON to
+// <prefix>.<pid>.json at exit and whenever the process gets SIGUSR2. The
+// files can be opened in Perfetto or chrome://tracing. Timestamps come from
+// CLOCK_MONOTONIC, so traces from the layer and from a reader process on the
+// same machine line up.
+//
+// When tracing is off, a trace point costs a predictable branch.
+namespace trace {
+
+// Set once at load from VKVFB_TRACE.
+extern const bool g_enabled;
+
+inline bool enabled() { return __builtin_expect(g_enabled, 0); }
+
+// Records a complete event on the calling thread. 'name' and 'arg_name' must
+// be string literals, since they're stored by pointer. 'arg_name' may be null.
+void record(const char* name, uint64_t begin_nanos, uint64_t end_nanos,
+            const char* arg_name, uint64_t arg);
+
+// Names the calling thread in the trace.
+void set_thread_name(const char* name);
+
+// Writes out the trace now. Safe to call when tracing is off.
+void dump();
+
+// Records the lifetime of a scope as a complete event.
+class Scope {
+ public:
+  explicit Scope(const char* name, const char* arg_name = nullptr,
+                 uint64_t arg = 0)
+      : name_(name), arg_name_(arg_name), arg_(arg) {
+    if (enabled()) {
+      begin_nanos_ = now_nanos();
+    }
+  }
+  ~Scope() { end(); }
+
+  // Ends the event early, for events that don't line up with a C++ scope.
+  void end() {
+    if (begin_nanos_) {
+      record(name_, begin_nanos_, now_nanos(), arg_name_, arg_);
+      begin_nanos_ = 0;
+    }
+  }
+
+  // Sets the event's argument, for values that aren't known until the scope
+  // ends.
+  void set_arg(const char* arg_name, uint64_t arg) {
+    arg_name_ = arg_name;
+    arg_ = arg;
+  }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* name_;
+  const char* arg_name_;
+  uint64_t arg_;
+  uint64_t begin_nanos_ = 0;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Traces the enclosing scope. Takes a name and optionally an argument name and
+// value, e.g. TRACE_SCOPE("fence_wait", "frame", frame_id).
+#define TRACE_SCOPE(...) \
+  ::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif  // TRACE_TRACE_H_
@@ -17,8 +17,12 @@
 #ifndef UTILITY_H_
 #define UTILITY_H_
 
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -57,8 +61,10 @@
   } \
 }
 
-inline size_t round_to_page(size_t size) {
-  size_t ps = getpagesize();
+// Rounds 'size' up to a whole number of pages of 'page_size' bytes, which
+// defaults to the system page size.
+inline size_t round_to_page(size_t size, size_t page_size = 0) {
+  size_t ps = page_size ? page_size : getpagesize();
   return ps * ((size + ps - 1) / ps);
 }
 
@@ -69,4 +75,23 @@ inline std::string errno_to_string(int error_num) {
   return std::string(error_str);
 }
 
+// Returns CLOCK_MONOTONIC time in nanoseconds, for timeouts and latencies.
+inline uint64_t now_nanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+inline void sleep_nanos(uint64_t nanos) {
+  timespec ts = {(time_t)(nanos / 1'000'000'000),
+                 (long)(nanos % 1'000'000'000)};
+  nanosleep(&ts, nullptr);
+}
+
+// Whether process 'pid' exists, including other users' processes, which we
+// can't signal.
+inline bool pid_alive(int32_t pid) {
+  return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
 #endif  // UTILITY_H_
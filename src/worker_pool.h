@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace/trace.h"
+
+// Runs a job over indices [0, n) on a fixed set of threads. Threads claim
+// indices from a shared counter, so a slow index doesn't hold up the indices
+// behind it. The calling thread works too, so a pool of one thread is just a
+// loop. Only one thread may run jobs on a pool at a time.
+class WorkerPool {
+ public:
+  // Starts num_threads - 1 threads, named 'thread_name' in traces.
+  WorkerPool(int num_threads, const char* thread_name)
+      : thread_name_(thread_name) {
+    for (int i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  // The number of threads that run jobs, including the calling thread.
+  int num_threads() const { return threads_.size() + 1; }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void run(size_t n, const std::function<void(size_t)>& job) {
+    if (threads_.empty()) {
+      for (size_t i = 0; i < n; ++i) {
+        job(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      job_ = &job;
+      n_ = n;
+      next_.store(0, std::memory_order_relaxed);
+      busy_workers_ = threads_.size();
+      generation_++;
+    }
+    start_cv_.notify_all();
+    work();
+
+    std::unique_lock<std::mutex> lock(mu_);
+    done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+    job_ = nullptr;
+  }
+
+ private:
+  void worker_loop() {
+    trace::set_thread_name(thread_name_);
+    uint64_t seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        start_cv_.wait(lock, [&] {
+          return stopping_ || generation_ != seen_generation;
+        });
+        if (stopping_) {
+          return;
+        }
+        seen_generation = generation_;
+      }
+      work();
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        busy_workers_--;
+      }
+      done_cv_.notify_one();
+    }
+  }
+
+  void work() {
+    for (size_t i = next_.fetch_add(1, std::memory_order_relaxed); i < n_;
+         i = next_.fetch_add(1, std::memory_order_relaxed)) {
+      (*job_)(i);
+    }
+  }
+
+  const char* thread_name_;
+  std::vector<std::thread> threads_;
+
+  // job_ and n_ are written under mu_ before a generation starts, and are only
+  // read by workers during it.
+  const std::function<void(size_t)>* job_ = nullptr;
+  size_t n_ = 0;
+  std::atomic<size_t> next_{0};
+
+  std::mutex mu_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_ = 0;
+  size_t busy_workers_ = 0;
+  bool stopping_ = false;
+};
+
+#endif  // WORKER_POOL_H_
@@ -0,0 +1,375 @@
+# Multi-environment density benchmark for vkvfb.
+#
+# Runs N environments side by side on one machine, each a writer publishing
+# frames to its own pixbuf plus a latency_reader attached to it, and sweeps N.
+# Writers are either synthetic_writer processes, which publish through
+# PixbufWriter without Vulkan or X, or present_app instances running through
+# the layer on lavapipe under a shared Xvfb.
+#
+# For each N it reports:
+#   - aggregate frames/s seen by all readers
+#   - per-env frame rate and write-to-reader latency percentiles
+#   - total CPU use of the writers and readers, in cores
+#   - estimated memory bandwidth of the pixbuf copies
+#   - shm footprint, from the growth of /dev/shm during the run
+#
+# Memory bandwidth is estimated from the frames written and read, counting a
+# read and a write of the frame per copy. It doesn't include the layer's GPU
+# readback for present_app environments.
+#
+# Usage:
+# $ python tests/density_benchmark.py --out tests/out/density.json
+# $ python tests/density_benchmark.py --kinds synthetic vulkan --counts 1 4 \
+#     --resolution 640x480 --seconds 3
+
+import argparse
+import json
+import os
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+from latency_benchmark import (
+    find_available_display,
+    find_lavapipe_icd,
+    parse_resolution,
+    percentile,
+    read_log,
+)
+
+
+def shm_bytes():
+    """Returns the bytes allocated to files in /dev/shm."""
+    total = 0
+    for entry in os.scandir("/dev/shm"):
+        try:
+            total += entry.stat(follow_symlinks=False).st_blocks * 512
+        except FileNotFoundError:
+            pass
+    return total
+
+
+def remove_pixbuf(name):
+    """Removes every segment a window may leave behind, since synthetic
+    writers aren't cleaned up by the layer: the pixbuf, its frame ring, JPEG
+    stream and stats segments, and each one's lock."""
+    segments = [name, f"{name}_ring", f"{name}_jpeg"]
+    paths = [f"/dev/shm/vkvfb_stats_{name}"]
+    for segment in segments:
+        paths += [
+            f"/dev/shm/{segment}",
+            f"/dev/shm/{segment}_mu",
+            f"/tmp/{segment}_mu",
+        ]
+    for path in paths:
+        try:
+            os.remove(path)
+        except FileNotFoundError:
+            pass
+
+
+def children_cpu_seconds():
+    usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return usage.ru_utime + usage.ru_stime
+
+
+def read_header_log(path):
+    """Reads a '<frame id> <seen nanos> <write nanos>' log into tuples."""
+    entries = []
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 3:
+                entries.append(tuple(int(part) for part in parts))
+    return entries
+
+
+def parse_counts(output, keys):
+    """Parses 'key value' pairs, like 'reads 10 frames 5', from a tool's
+    output."""
+    counts = {}
+    for line in output.splitlines():
+        words = line.split()
+        for i in range(0, len(words) - 1, 2):
+            if words[i] in keys and words[i + 1].isdigit():
+                counts[words[i]] = int(words[i + 1])
+    return counts
+
+
+def summarize_env(latencies_ms, frames_written, measure_sec):
+    latencies_ms.sort()
+    return {
+        "frames_written": frames_written,
+        "frames_seen": len(latencies_ms),
+        "seen_fps": len(latencies_ms) / measure_sec,
+        "latency_ms": {
+            "p50": percentile(latencies_ms, 0.50),
+            "p99": percentile(latencies_ms, 0.99),
+            "max": latencies_ms[-1] if latencies_ms else None,
+        },
+    }
+
+
+def synthetic_env_result(seen_log, start_nanos, measure_sec):
+    latencies_ms = [
+        (seen - written) / 1e6
+        for _, seen, written in read_header_log(seen_log)
+        if written >= start_nanos
+    ]
+    return summarize_env(latencies_ms, None, measure_sec)
+
+
+def vulkan_env_result(present_log, seen_log, start_nanos, measure_sec):
+    # Frame ids are 24 bits in the pixels.
+    present_times = {
+        frame_id & 0xFFFFFF: nanos
+        for frame_id, nanos in read_log(present_log)
+        if nanos >= start_nanos
+    }
+    latencies_ms = []
+    for frame_id, seen_nanos in read_log(seen_log):
+        present_nanos = present_times.get(frame_id)
+        if present_nanos is not None and seen_nanos >= present_nanos:
+            latencies_ms.append((seen_nanos - present_nanos) / 1e6)
+    return summarize_env(latencies_ms, len(present_times), measure_sec)
+
+
+def start_writer(kind, build_dir, env, index, args, width, height, tmp):
+    """Starts one environment's writer. Returns (process, pixbuf name)."""
+    if kind == "synthetic":
+        name = f"vkvfb_density_{os.getpid()}_{index}"
+        command = [
+            os.path.join(build_dir, "synthetic_writer"),
+            name,
+            "--width", str(width),
+            "--height", str(height),
+            "--fps", str(args.fps),
+            "--seconds", str(args.seconds + args.warmup + 1),
+        ]
+        ready_word = "ready"
+    else:
+        name = None
+        command = [
+            os.path.join(build_dir, "present_app"),
+            "--width", str(width),
+            "--height", str(height),
+            "--seconds", str(args.seconds + args.warmup + 1),
+            "--log", os.path.join(tmp, f"present_{index}.log"),
+        ]
+        ready_word = "window"
+    process = subprocess.Popen(
+        command,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        env=env,
+        text=True,
+    )
+    # The layer's logs share present_app's stdout, so skip to the pixbuf name.
+    for line in process.stdout:
+        words = line.split()
+        if len(words) == 2 and words[0] == ready_word:
+            return process, words[1]
+    process.wait()
+    return process, None
+
+
+def run_config(kind, count, build_dir, env, args, width, height):
+    frame_bytes = width * height * 4
+    with tempfile.TemporaryDirectory() as tmp:
+        shm_before = shm_bytes()
+        cpu_before = children_cpu_seconds()
+
+        writers = []
+        names = []
+        try:
+            for i in range(count):
+                process, name = start_writer(
+                    kind, build_dir, env, i, args, width, height, tmp
+                )
+                writers.append(process)
+                if name is None:
+                    return {"error": f"writer {i} failed to start"}
+                names.append(name)
+
+            readers = []
+            for i, name in enumerate(names):
+                command = [
+                    os.path.join(build_dir, "latency_reader"),
+                    name,
+                    "--log", os.path.join(tmp, f"seen_{i}.log"),
+                    "--seconds", str(args.seconds + args.warmup),
+                    "--poll", args.poll,
+                ]
+                if kind == "synthetic":
+                    command += ["--decode", "header"]
+                readers.append(
+                    subprocess.Popen(
+                        command,
+                        stdout=subprocess.PIPE,
+                        stderr=subprocess.PIPE,
+                        env=env,
+                        text=True,
+                    )
+                )
+
+            # Only measure once every environment is up and past warmup.
+            time.sleep(args.warmup)
+            start_nanos = time.clock_gettime_ns(time.CLOCK_MONOTONIC)
+            time.sleep(args.seconds / 2)
+            shm_during = shm_bytes()
+
+            reader_outputs = [reader.communicate() for reader in readers]
+            writer_outputs = [writer.communicate()[0] for writer in writers]
+        finally:
+            for process in writers:
+                if process.poll() is None:
+                    process.kill()
+                    process.wait()
+            if kind == "synthetic":
+                for name in names:
+                    remove_pixbuf(name)
+        wall_sec = args.seconds + args.warmup
+        cpu_sec = children_cpu_seconds() - cpu_before
+
+        for i, reader in enumerate(readers):
+            if reader.returncode != 0:
+                return {
+                    "error": f"latency_reader {i} failed: "
+                    f"{reader_outputs[i][1].strip()}"
+                }
+
+        envs = []
+        reads = 0
+        written = 0
+        for i in range(count):
+            seen_log = os.path.join(tmp, f"seen_{i}.log")
+            if kind == "synthetic":
+                result = synthetic_env_result(seen_log, start_nanos, args.seconds)
+                counts = parse_counts(writer_outputs[i], {"published"})
+                result["frames_written"] = counts.get("published")
+            else:
+                present_log = os.path.join(tmp, f"present_{i}.log")
+                result = vulkan_env_result(
+                    present_log, seen_log, start_nanos, args.seconds
+                )
+            envs.append(result)
+            reads += parse_counts(reader_outputs[i][0], {"reads"}).get("reads", 0)
+            written += result["frames_written"] or 0
+
+    p99s = sorted(
+        env["latency_ms"]["p99"]
+        for env in envs
+        if env["latency_ms"]["p99"] is not None
+    )
+    # Writer counts cover the whole run, and reader counts cover warmup too.
+    copies_per_sec = written / (wall_sec + 1) + reads / wall_sec
+    return {
+        "aggregate_seen_fps": sum(env["seen_fps"] for env in envs),
+        "p99_ms": {
+            "median_env": percentile(p99s, 0.5),
+            "worst_env": p99s[-1] if p99s else None,
+        },
+        "cpu_cores": cpu_sec / wall_sec,
+        "copy_bandwidth_gbps_est": copies_per_sec * frame_bytes * 2 / 1e9,
+        "shm_footprint_mb": (shm_during - shm_before) / 2**20,
+        "envs": envs,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--counts", nargs="+", type=int, default=[1, 2, 4, 8])
+    parser.add_argument(
+        "--kinds",
+        nargs="+",
+        choices=["synthetic", "vulkan"],
+        default=["synthetic", "vulkan"],
+    )
+    parser.add_argument("--resolution", default="1280x720")
+    parser.add_argument(
+        "--fps",
+        type=float,
+        default=60,
+        help="Frame rate of synthetic writers, or 0 for unlimited.",
+    )
+    parser.add_argument(
+        "--poll",
+        default="1000",
+        help="Reader poll mode: 'spin' or a sleep in microseconds.",
+    )
+    parser.add_argument("--seconds", type=float, default=5)
+    parser.add_argument("--warmup", type=float, default=1)
+    parser.add_argument("--out", default="tests/out/density_benchmark.json")
+    parser.add_argument("--build-dir", default=None)
+    args = parser.parse_args()
+
+    project_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    build_dir = args.build_dir or os.path.join(project_root, "build")
+    width, height = parse_resolution(args.resolution)
+
+    kinds = args.kinds
+    if "vulkan" in kinds and not os.path.exists(
+        os.path.join(build_dir, "present_app")
+    ):
+        print("present_app wasn't built, skipping Vulkan environments")
+        kinds = [kind for kind in kinds if kind != "vulkan"]
+
+    env = os.environ.copy()
+    env["LD_LIBRARY_PATH"] = build_dir
+    env["VK_LAYER_PATH"] = build_dir
+    env["VK_LOADER_LAYERS_ENABLE"] = "VK_LAYER_VKVFB_vkvfb"
+    icd = find_lavapipe_icd()
+    if icd:
+        env["VK_DRIVER_FILES"] = icd
+        env["VK_ICD_FILENAMES"] = icd
+
+    xvfb_process = None
+    if "vulkan" in kinds:
+        display_str = f":{find_available_display()}"
+        print(f"Starting Xvfb on display {display_str}")
+        xvfb_process = subprocess.Popen(
+            ["Xvfb", display_str, "-screen", "0", "1920x1080x24"],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        time.sleep(2)
+        env["DISPLAY"] = display_str
+
+    results = []
+    try:
+        for kind in kinds:
+            for count in args.counts:
+                config = {"kind": kind, "count": count}
+                print(f"Running {config}", flush=True)
+                result = run_config(kind, count, build_dir, env, args, width, height)
+                summary = {k: v for k, v in result.items() if k != "envs"}
+                print(f"  {summary}", flush=True)
+                results.append({"config": config, "result": result})
+    finally:
+        if xvfb_process:
+            xvfb_process.terminate()
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    with open(args.out, "w") as f:
+        json.dump(
+            {
+                "driver": icd or "default",
+                "resolution": args.resolution,
+                "fps": args.fps,
+                "poll": args.poll,
+                "seconds": args.seconds,
+                "runs": results,
+            },
+            f,
+            indent=2,
+        )
+    print(f"Wrote {args.out}")
+
+    if any("error" in run["result"] for run in results):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,256 @@
+# End-to-end latency benchmark for vkvfb.
+#
+# Runs present_app through the layer on lavapipe under Xvfb, with
+# latency_reader attached to its pixbuf. present_app encodes a frame id in
+# every frame's pixels and logs its present times, and latency_reader logs
+# when it first saw each frame, so joining the two logs gives the
+# vkQueuePresentKHR-to-reader latency of every frame the reader saw.
+#
+# The benchmark sweeps resolution, swapchain image count and reader polling
+# mode, and writes one JSON record per configuration with the frame rate, the
+# fraction of presented frames the reader never saw, and latency percentiles.
+#
+# Usage:
+# $ python tests/latency_benchmark.py --out tests/out/latency.json
+# $ python tests/latency_benchmark.py --resolutions 640x480 --images 2 3 \
+#     --polls spin 1000 --seconds 3
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def find_available_display():
+    """Find an available X display number by checking /tmp/.X*-lock files"""
+    existing_displays = []
+
+    lock_files = glob.glob("/tmp/.X*-lock")
+    for lock_file in lock_files:
+        display_num = lock_file.split(".X")[1].split("-")[0]
+        if display_num.isdigit():
+            existing_displays.append(int(display_num))
+
+    display_num = 0
+    while display_num in existing_displays:
+        display_num += 1
+
+    return display_num
+
+
+def find_lavapipe_icd():
+    """Returns the path of lavapipe's ICD manifest, or None if not installed."""
+    for pattern in [
+        "/usr/share/vulkan/icd.d/lvp_icd*.json",
+        "/usr/local/share/vulkan/icd.d/lvp_icd*.json",
+        "/etc/vulkan/icd.d/lvp_icd*.json",
+    ]:
+        matches = glob.glob(pattern)
+        if matches:
+            return matches[0]
+    return None
+
+
+def read_log(path):
+    """Reads a '<frame id> <nanos>' log into a list of (id, nanos) tuples."""
+    entries = []
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 2:
+                entries.append((int(parts[0]), int(parts[1])))
+    return entries
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return None
+    index = min(len(sorted_values) - 1, int(p * len(sorted_values)))
+    return sorted_values[index]
+
+
+def summarize(presents, seen, warmup_sec):
+    """Joins present and reader logs into a result record."""
+    if not presents:
+        return {"error": "present_app logged no frames"}
+
+    # Ignore frames presented during warmup, while the reader is attaching.
+    start_nanos = presents[0][1] + int(warmup_sec * 1e9)
+    # Frame ids are 24 bits in the pixels.
+    present_times = {
+        frame_id & 0xFFFFFF: nanos
+        for frame_id, nanos in presents
+        if nanos >= start_nanos
+    }
+    if not present_times:
+        return {"error": "run was shorter than warmup"}
+
+    latencies_ms = []
+    for frame_id, seen_nanos in seen:
+        present_nanos = present_times.get(frame_id)
+        if present_nanos is not None and seen_nanos >= present_nanos:
+            latencies_ms.append((seen_nanos - present_nanos) / 1e6)
+    latencies_ms.sort()
+
+    measured = [nanos for nanos in present_times.values()]
+    duration_sec = (max(measured) - min(measured)) / 1e9
+    frames_seen = len(latencies_ms)
+    return {
+        "frames_presented": len(present_times),
+        "frames_seen": frames_seen,
+        "present_fps": (len(present_times) - 1) / duration_sec if duration_sec else None,
+        "seen_fps": frames_seen / duration_sec if duration_sec else None,
+        "drop_rate": 1 - frames_seen / len(present_times),
+        "latency_ms": {
+            "min": latencies_ms[0] if latencies_ms else None,
+            "p50": percentile(latencies_ms, 0.50),
+            "p90": percentile(latencies_ms, 0.90),
+            "p99": percentile(latencies_ms, 0.99),
+            "max": latencies_ms[-1] if latencies_ms else None,
+        },
+    }
+
+
+def run_config(build_dir, env, width, height, images, poll, seconds, warmup_sec):
+    with tempfile.TemporaryDirectory() as tmp:
+        present_log = os.path.join(tmp, "present.log")
+        seen_log = os.path.join(tmp, "seen.log")
+        app = subprocess.Popen(
+            [
+                os.path.join(build_dir, "present_app"),
+                "--width", str(width),
+                "--height", str(height),
+                "--images", str(images),
+                "--seconds", str(seconds),
+                "--log", present_log,
+            ],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            env=env,
+            text=True,
+        )
+        # The layer's logs share present_app's stdout, so skip to the window id.
+        window = None
+        startup_output = []
+        for line in app.stdout:
+            words = line.split()
+            if len(words) == 2 and words[0] == "window":
+                window = words[1]
+                break
+            startup_output.append(line)
+        if window is None:
+            app.kill()
+            app.wait()
+            out = "".join(startup_output)
+            return {"error": f"present_app failed to start: {out.strip()}"}
+
+        reader = subprocess.run(
+            [
+                os.path.join(build_dir, "latency_reader"),
+                window,
+                "--log", seen_log,
+                "--seconds", str(seconds),
+                "--poll", poll,
+            ],
+            capture_output=True,
+            text=True,
+            env=env,
+        )
+        app.communicate()
+        if reader.returncode != 0:
+            return {"error": f"latency_reader failed: {reader.stderr.strip()}"}
+        if app.returncode != 0:
+            return {"error": f"present_app exited with {app.returncode}"}
+
+        return summarize(read_log(present_log), read_log(seen_log), warmup_sec)
+
+
+def parse_resolution(s):
+    width, height = s.lower().split("x")
+    return int(width), int(height)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        "--resolutions", nargs="+", default=["640x480", "1280x720", "1920x1080"]
+    )
+    parser.add_argument("--images", nargs="+", type=int, default=[2, 3])
+    parser.add_argument(
+        "--polls",
+        nargs="+",
+        default=["spin", "1000"],
+        help="Reader poll modes: 'spin' or a sleep in microseconds.",
+    )
+    parser.add_argument("--seconds", type=float, default=5)
+    parser.add_argument("--warmup", type=float, default=1)
+    parser.add_argument("--out", default="tests/out/latency_benchmark.json")
+    parser.add_argument("--build-dir", default=None)
+    args = parser.parse_args()
+
+    project_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    build_dir = args.build_dir or os.path.join(project_root, "build")
+
+    env = os.environ.copy()
+    env["LD_LIBRARY_PATH"] = build_dir
+    env["VK_LAYER_PATH"] = build_dir
+    env["VK_LOADER_LAYERS_ENABLE"] = "VK_LAYER_VKVFB_vkvfb"
+    icd = find_lavapipe_icd()
+    if icd:
+        env["VK_DRIVER_FILES"] = icd
+        env["VK_ICD_FILENAMES"] = icd
+    else:
+        print("lavapipe not found, using the default Vulkan driver")
+
+    display_num = find_available_display()
+    display_str = f":{display_num}"
+    print(f"Starting Xvfb on display {display_str}")
+    xvfb_process = subprocess.Popen(
+        ["Xvfb", display_str, "-screen", "0", "1920x1080x24"],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    time.sleep(2)
+    env["DISPLAY"] = display_str
+
+    results = []
+    try:
+        for resolution in args.resolutions:
+            width, height = parse_resolution(resolution)
+            for images in args.images:
+                for poll in args.polls:
+                    config = {
+                        "width": width,
+                        "height": height,
+                        "images": images,
+                        "poll": poll,
+                    }
+                    print(f"Running {config}", flush=True)
+                    result = run_config(
+                        build_dir, env, width, height, images, poll,
+                        args.seconds, args.warmup,
+                    )
+                    print(f"  {result}", flush=True)
+                    results.append({"config": config, "result": result})
+    finally:
+        xvfb_process.terminate()
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    with open(args.out, "w") as f:
+        json.dump(
+            {"driver": icd or "default", "seconds": args.seconds, "runs": results},
+            f,
+            indent=2,
+        )
+    print(f"Wrote {args.out}")
+
+    if any("error" in run["result"] for run in results):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
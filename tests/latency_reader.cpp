@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The reader half of the latency benchmarks. Polls a window's pixbuf, decodes
+// the frame id that the writer encoded in the pixels and logs when each frame
+// was first seen, as "<frame id> <seen time>" lines in CLOCK_MONOTONIC
+// nanoseconds.
+//
+// By default, frames are decoded as present_app draws them, with the id in
+// every pixel's color. With --decode header, frames are decoded as
+// synthetic_writer writes them, with the write time and frame id in the first
+// 12 bytes, and lines get a third "<write time>" column.
+
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "pixbuf/pixbuf_reader.h"
+#include "utility.h"
+
+namespace {
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s <window> --log <path> [--seconds <s>] [--poll spin|<us>] "
+      "[--decode color|header]\n",
+      program_name);
+  printf("  --poll: Busy poll for new frames with 'spin', or sleep the given\n");
+  printf("          number of microseconds between polls. Defaults to spin.\n");
+  printf("          Frames are only copied once they're new.\n");
+  printf("  --decode: How frame ids are encoded. Defaults to color.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::string window = argv[1];
+  const char* log_path = nullptr;
+  double seconds = 5;
+  uint64_t poll_nanos = 0;
+  bool decode_header = false;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--log") == 0) {
+      log_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--seconds") == 0) {
+      seconds = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--poll") == 0) {
+      poll_nanos = strcmp(argv[i + 1], "spin") == 0
+                       ? 0
+                       : (uint64_t)(atof(argv[i + 1]) * 1000);
+    } else if (strcmp(argv[i], "--decode") == 0) {
+      decode_header = strcmp(argv[i + 1], "header") == 0;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!log_path || argc % 2 != 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // The app may not have created its swapchain yet.
+  const uint64_t open_deadline = now_nanos() + 10 * kOneSecNanos;
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create(window);
+  while (!reader_result.ok() && now_nanos() < open_deadline) {
+    sleep_nanos(10'000'000);
+    reader_result = PixbufReader::Create(window);
+  }
+  if (!reader_result.ok()) {
+    fprintf(stderr, "Failed to open pixbuf for window %s\n", window.c_str());
+    return 1;
+  }
+  PixbufReader reader = std::move(reader_result.value());
+
+  FILE* log = fopen(log_path, "w");
+  if (!log) {
+    fprintf(stderr, "Failed to open %s\n", log_path);
+    return 1;
+  }
+
+  const uint64_t end_nanos = now_nanos() + (uint64_t)(seconds * 1e9);
+  uint64_t last_sequence = 0;
+  uint64_t reads = 0;
+  uint64_t frames = 0;
+  while (now_nanos() < end_nanos) {
+    // Polls the sequence number without taking the lock, so spinning doesn't
+    // contend with the writer or copy the same frame over and over.
+    if (!reader.wait_for_frame(last_sequence, 0)) {
+      if (poll_nanos) {
+        sleep_nanos(poll_nanos);
+      }
+      continue;
+    }
+    const ReadPixbuf& read = reader.read_pixels();
+    uint64_t seen_nanos = now_nanos();
+    reads++;
+    if (read.code == ErrorCode::OK && read.width > 0 &&
+        read.sequence != last_sequence) {
+      last_sequence = read.sequence;
+      if (decode_header) {
+        uint64_t write_nanos;
+        uint32_t frame_id;
+        memcpy(&write_nanos, read.pixels, sizeof(write_nanos));
+        memcpy(&frame_id, read.pixels + sizeof(write_nanos), sizeof(frame_id));
+        fprintf(log, "%u %lu %lu\n", frame_id, (unsigned long)seen_nanos,
+                (unsigned long)write_nanos);
+      } else {
+        // Sample the center pixel, in case the edges get clipped.
+        size_t center =
+            ((size_t)(read.height / 2) * read.width + read.width / 2) * 4;
+        const uint8_t* pixel = read.pixels + center;
+        uint32_t frame_id = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+        fprintf(log, "%u %lu\n", frame_id, (unsigned long)seen_nanos);
+      }
+      frames++;
+    }
+  }
+  fclose(log);
+  printf("reads %lu frames %lu\n", (unsigned long)reads,
+         (unsigned long)frames);
+  return 0;
+}
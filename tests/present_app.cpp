@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A minimal Vulkan app for latency benchmarks. It clears every frame to a
+// color that encodes the frame's id and logs when each frame was presented.
+//
+// Frame ids are encoded in the R, G and B channels of every pixel, low byte
+// first. The present log is a text file with one "<frame id> <present time>"
+// line per frame, where present time is CLOCK_MONOTONIC nanoseconds taken just
+// before vkQueuePresentKHR.
+
+#include <time.h>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_xcb.h>
+#include <xcb/xcb.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+#define CHECK_VK(expr)                                                  \
+  do {                                                                  \
+    VkResult r__ = (expr);                                              \
+    if (r__ != VK_SUCCESS) {                                            \
+      fprintf(stderr, "%s failed with VkResult %d\n", #expr, (int)r__); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+uint64_t now_nanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+struct Options {
+  uint32_t width = 640;
+  uint32_t height = 480;
+  uint32_t images = 3;
+  double seconds = 5;
+  const char* log_path = nullptr;
+};
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s --log <path> [--width <w>] [--height <h>] [--images <n>] "
+      "[--seconds <s>]\n",
+      program_name);
+  printf("\n");
+  printf("Presents frames whose color encodes their frame id, and logs each\n");
+  printf("frame's present time. Prints the window id on startup.\n");
+}
+
+bool parse_options(int argc, char* argv[], Options& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--width") == 0) {
+      options.width = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--height") == 0) {
+      options.height = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--images") == 0) {
+      options.images = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seconds") == 0) {
+      options.seconds = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--log") == 0) {
+      options.log_path = argv[i + 1];
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1 && options.log_path && options.width > 0 &&
+         options.height > 0 && options.images > 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  FILE* log = fopen(options.log_path, "w");
+  if (!log) {
+    fprintf(stderr, "Failed to open %s\n", options.log_path);
+    return 1;
+  }
+
+  // Window.
+  xcb_connection_t* connection = xcb_connect(nullptr, nullptr);
+  if (xcb_connection_has_error(connection)) {
+    fprintf(stderr, "Failed to connect to X server\n");
+    return 1;
+  }
+  xcb_screen_t* screen =
+      xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+  xcb_window_t window = xcb_generate_id(connection);
+  xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root, 0,
+                    0, options.width, options.height, 0,
+                    XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0,
+                    nullptr);
+  xcb_map_window(connection, window);
+  xcb_flush(connection);
+
+  // Instance and device.
+  const char* instance_extensions[] = {VK_KHR_SURFACE_EXTENSION_NAME,
+                                       VK_KHR_XCB_SURFACE_EXTENSION_NAME};
+  VkApplicationInfo app_info{VK_STRUCTURE_TYPE_APPLICATION_INFO};
+  app_info.pApplicationName = "vkvfb_present_app";
+  app_info.apiVersion = VK_API_VERSION_1_1;
+  VkInstanceCreateInfo instance_info{VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+  instance_info.pApplicationInfo = &app_info;
+  instance_info.enabledExtensionCount = 2;
+  instance_info.ppEnabledExtensionNames = instance_extensions;
+  VkInstance instance;
+  CHECK_VK(vkCreateInstance(&instance_info, nullptr, &instance));
+
+  VkXcbSurfaceCreateInfoKHR surface_info{
+      VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR};
+  surface_info.connection = connection;
+  surface_info.window = window;
+  VkSurfaceKHR surface;
+  CHECK_VK(vkCreateXcbSurfaceKHR(instance, &surface_info, nullptr, &surface));
+
+  uint32_t device_count = 1;
+  VkPhysicalDevice physical_device;
+  VkResult enumerate_result =
+      vkEnumeratePhysicalDevices(instance, &device_count, &physical_device);
+  if ((enumerate_result != VK_SUCCESS && enumerate_result != VK_INCOMPLETE) ||
+      device_count == 0) {
+    fprintf(stderr, "No Vulkan devices found\n");
+    return 1;
+  }
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           families.data());
+  uint32_t queue_family = UINT32_MAX;
+  for (uint32_t i = 0; i < family_count; ++i) {
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface,
+                                         &supported);
+    if ((families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && supported) {
+      queue_family = i;
+      break;
+    }
+  }
+  if (queue_family == UINT32_MAX) {
+    fprintf(stderr, "No graphics queue can present to the window\n");
+    return 1;
+  }
+
+  float priority = 1.0f;
+  VkDeviceQueueCreateInfo queue_info{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+  queue_info.queueFamilyIndex = queue_family;
+  queue_info.queueCount = 1;
+  queue_info.pQueuePriorities = &priority;
+  const char* device_extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+  VkDeviceCreateInfo device_info{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+  device_info.queueCreateInfoCount = 1;
+  device_info.pQueueCreateInfos = &queue_info;
+  device_info.enabledExtensionCount = 1;
+  device_info.ppEnabledExtensionNames = device_extensions;
+  VkDevice device;
+  CHECK_VK(vkCreateDevice(physical_device, &device_info, nullptr, &device));
+  VkQueue queue;
+  vkGetDeviceQueue(device, queue_family, 0, &queue);
+
+  // Swapchain.
+  const VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+  VkSwapchainCreateInfoKHR swapchain_info{
+      VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR};
+  swapchain_info.surface = surface;
+  swapchain_info.minImageCount = options.images;
+  swapchain_info.imageFormat = format;
+  swapchain_info.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+  swapchain_info.imageExtent = {options.width, options.height};
+  swapchain_info.imageArrayLayers = 1;
+  swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  swapchain_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+  swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+  swapchain_info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  swapchain_info.clipped = VK_TRUE;
+  VkSwapchainKHR swapchain;
+  CHECK_VK(vkCreateSwapchainKHR(device, &swapchain_info, nullptr, &swapchain));
+
+  uint32_t image_count = 0;
+  vkGetSwapchainImagesKHR(device, swapchain, &image_count, nullptr);
+  std::vector<VkImage> images(image_count);
+  vkGetSwapchainImagesKHR(device, swapchain, &image_count, images.data());
+
+  // A render pass that only clears, so each frame is a single clear color.
+  VkAttachmentDescription attachment{};
+  attachment.format = format;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  VkAttachmentReference color_ref{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_ref;
+  VkRenderPassCreateInfo render_pass_info{
+      VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+  render_pass_info.attachmentCount = 1;
+  render_pass_info.pAttachments = &attachment;
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  VkRenderPass render_pass;
+  CHECK_VK(vkCreateRenderPass(device, &render_pass_info, nullptr, &render_pass));
+
+  std::vector<VkImageView> views(image_count);
+  std::vector<VkFramebuffer> framebuffers(image_count);
+  for (uint32_t i = 0; i < image_count; ++i) {
+    VkImageViewCreateInfo view_info{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    view_info.image = images[i];
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    CHECK_VK(vkCreateImageView(device, &view_info, nullptr, &views[i]));
+
+    VkFramebufferCreateInfo framebuffer_info{
+        VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    framebuffer_info.renderPass = render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &views[i];
+    framebuffer_info.width = options.width;
+    framebuffer_info.height = options.height;
+    framebuffer_info.layers = 1;
+    CHECK_VK(vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                                 &framebuffers[i]));
+  }
+
+  VkCommandPoolCreateInfo pool_info{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = queue_family;
+  VkCommandPool pool;
+  CHECK_VK(vkCreateCommandPool(device, &pool_info, nullptr, &pool));
+
+  // One command buffer, semaphore pair and fence per swapchain image, so that
+  // up to image_count frames can be in flight.
+  std::vector<VkCommandBuffer> command_buffers(image_count);
+  VkCommandBufferAllocateInfo alloc_info{
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+  alloc_info.commandPool = pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = image_count;
+  CHECK_VK(vkAllocateCommandBuffers(device, &alloc_info,
+                                    command_buffers.data()));
+  std::vector<VkSemaphore> acquired(image_count);
+  std::vector<VkSemaphore> rendered(image_count);
+  std::vector<VkFence> in_flight(image_count);
+  for (uint32_t i = 0; i < image_count; ++i) {
+    VkSemaphoreCreateInfo semaphore_info{
+        VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    CHECK_VK(vkCreateSemaphore(device, &semaphore_info, nullptr, &acquired[i]));
+    CHECK_VK(vkCreateSemaphore(device, &semaphore_info, nullptr, &rendered[i]));
+    VkFenceCreateInfo fence_info{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    CHECK_VK(vkCreateFence(device, &fence_info, nullptr, &in_flight[i]));
+  }
+
+  printf("window 0x%08x\n", window);
+  fflush(stdout);
+
+  const uint64_t end_nanos = now_nanos() + (uint64_t)(options.seconds * 1e9);
+  uint64_t frame_id = 0;
+  while (now_nanos() < end_nanos) {
+    uint32_t slot = frame_id % image_count;
+    vkWaitForFences(device, 1, &in_flight[slot], VK_TRUE, UINT64_MAX);
+    vkResetFences(device, 1, &in_flight[slot]);
+
+    uint32_t image_index;
+    CHECK_VK(vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
+                                   acquired[slot], VK_NULL_HANDLE,
+                                   &image_index));
+
+    VkCommandBuffer cmd = command_buffers[slot];
+    vkResetCommandBuffer(cmd, 0);
+    VkCommandBufferBeginInfo begin_info{
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &begin_info);
+    VkClearValue clear;
+    clear.color.float32[0] = (frame_id & 0xff) / 255.0f;
+    clear.color.float32[1] = ((frame_id >> 8) & 0xff) / 255.0f;
+    clear.color.float32[2] = ((frame_id >> 16) & 0xff) / 255.0f;
+    clear.color.float32[3] = 1.0f;
+    VkRenderPassBeginInfo pass_begin{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    pass_begin.renderPass = render_pass;
+    pass_begin.framebuffer = framebuffers[image_index];
+    pass_begin.renderArea = {{0, 0}, {options.width, options.height}};
+    pass_begin.clearValueCount = 1;
+    pass_begin.pClearValues = &clear;
+    vkCmdBeginRenderPass(cmd, &pass_begin, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdEndRenderPass(cmd);
+    vkEndCommandBuffer(cmd);
+
+    VkPipelineStageFlags wait_stage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submit{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &acquired[slot];
+    submit.pWaitDstStageMask = &wait_stage;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &cmd;
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &rendered[slot];
+    CHECK_VK(vkQueueSubmit(queue, 1, &submit, in_flight[slot]));
+
+    VkPresentInfoKHR present{VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
+    present.waitSemaphoreCount = 1;
+    present.pWaitSemaphores = &rendered[slot];
+    present.swapchainCount = 1;
+    present.pSwapchains = &swapchain;
+    present.pImageIndices = &image_index;
+    uint64_t present_nanos = now_nanos();
+    CHECK_VK(vkQueuePresentKHR(queue, &present));
+    fprintf(log, "%lu %lu\n", (unsigned long)frame_id,
+            (unsigned long)present_nanos);
+    frame_id++;
+  }
+
+  vkDeviceWaitIdle(device);
+  fclose(log);
+
+  for (uint32_t i = 0; i < image_count; ++i) {
+    vkDestroyFence(device, in_flight[i], nullptr);
+    vkDestroySemaphore(device, rendered[i], nullptr);
+    vkDestroySemaphore(device, acquired[i], nullptr);
+    vkDestroyFramebuffer(device, framebuffers[i], nullptr);
+    vkDestroyImageView(device, views[i], nullptr);
+  }
+  vkDestroyCommandPool(device, pool, nullptr);
+  vkDestroyRenderPass(device, render_pass, nullptr);
+  vkDestroySwapchainKHR(device, swapchain, nullptr);
+  vkDestroyDevice(device, nullptr);
+  vkDestroySurfaceKHR(instance, surface, nullptr);
+  vkDestroyInstance(instance, nullptr);
+  xcb_destroy_window(connection, window);
+  xcb_disconnect(connection);
+  return 0;
+}
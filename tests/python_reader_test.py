@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+
+# Tests the vkvfb Python module against a synthetic_writer process.
+#
+# Usage:
+# $ python tests/python_reader_test.py [build dir]
+
+import os
+import signal
+import struct
+import subprocess
+import sys
+import threading
+
+project_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+build_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(project_root, "build")
+sys.path.insert(0, build_dir)
+
+import vkvfb  # noqa: E402
+
+WIDTH = 320
+HEIGHT = 240
+name = f"vkvfb_python_test_{os.getpid()}"
+
+writer = subprocess.Popen(
+    [
+        os.path.join(build_dir, "synthetic_writer"),
+        name,
+        "--width", str(WIDTH),
+        "--height", str(HEIGHT),
+        "--fps", "200",
+        "--seconds", "5",
+    ],
+    stdout=subprocess.PIPE,
+    text=True,
+    env=dict(os.environ, VKVFB_RING_FRAMES="64", VKVFB_JPEG_QUALITY="80"),
+)
+try:
+    assert writer.stdout.readline().split() == ["ready", name]
+    reader = vkvfb.Reader(name)
+
+    # Wait for the first frame, then copy it into a caller-provided buffer.
+    assert reader.wait(0, timeout=2.0)
+    frame = bytearray(WIDTH * HEIGHT * 4)
+    width, height, sequence = reader.read_into(frame)
+    assert (width, height) == (WIDTH, HEIGHT)
+    assert sequence > 0
+    # synthetic_writer fills pixels past its 12 byte header with i % 256.
+    assert frame[100] == 100
+
+    # While one thread waits, other threads can use the module.
+    waited = []
+    waiter = threading.Thread(
+        target=lambda: waited.append(reader.wait(sequence, timeout=2.0))
+    )
+    waiter.start()
+    other_reader = vkvfb.Reader(name)
+    assert other_reader.info()[:2] == (WIDTH, HEIGHT)
+    waiter.join()
+    assert waited == [True]
+
+    # Later frames have later ids.
+    _, _, later_sequence = reader.read_into(frame)
+    assert later_sequence > sequence
+    assert struct.unpack_from("<I", frame, 8)[0] > 0
+
+    # Rows can be padded out to a stride.
+    stride = WIDTH * 4 + 64
+    padded = bytearray(b"\xab" * stride * HEIGHT)
+    reader.read_into(padded, stride=stride)
+    assert padded[stride + 100] == frame[WIDTH * 4 + 100]
+    assert padded[WIDTH * 4] == 0xAB
+
+    # Buffers that are too small are rejected.
+    try:
+        reader.read_into(bytearray(16))
+        raise AssertionError("expected ValueError")
+    except ValueError:
+        pass
+
+    # Preprocessing crops and converts in one pass. Green is i % 256 too.
+    preprocessor = vkvfb.Preprocessor(
+        crop=(25, 0, 4, 2), dtype="uint8", layout="chw"
+    )
+    assert preprocessor.output_shape(WIDTH, HEIGHT) == (3, 2, 4)
+    obs = bytearray(3 * 2 * 4)
+    assert reader.read_preprocessed(obs, preprocessor)[:2] == (WIDTH, HEIGHT)
+    assert obs[0] == 100 and obs[8] == 101
+    try:
+        vkvfb.Preprocessor(std=0)
+        raise AssertionError("expected ValueError")
+    except ValueError:
+        pass
+
+    # Views are zero-copy, read-only and shaped (height, width, 4).
+    view = memoryview(reader.view())
+    assert view.shape == (HEIGHT, WIDTH, 4)
+    assert view.readonly
+    assert view[0, 25, 0] == 100
+    assert reader.info()[:2] == (WIDTH, HEIGHT)
+
+    # Rings hand out every frame in order, starting at the oldest they hold.
+    ring = vkvfb.Ring(name)
+    assert ring.wait(timeout=2.0)
+    _, _, first = ring.read_next(frame)
+    _, _, second = ring.read_next(frame)
+    assert second == first + 1 + ring.missed
+    assert ring.wait(timeout=2.0)
+    stack = bytearray(2 * WIDTH * HEIGHT * 4)
+    _, _, newest, copied = vkvfb.Ring(name, drain=False).read_latest(stack, 2)
+    assert copied == 2 and newest > second
+
+    # JPEG streams hold the latest frame, encoded at a few frames a second.
+    try:
+        stream = vkvfb.JpegStream(name)
+    except FileNotFoundError:
+        stream = None  # vkvfb was built without libjpeg.
+    if stream:
+        assert stream.wait(0, timeout=2.0)
+        jpeg, width, height, jpeg_sequence = stream.read()
+        assert (width, height) == (WIDTH, HEIGHT)
+        assert jpeg[:2] == b"\xff\xd8" and jpeg_sequence > 0
+        assert len(jpeg) < WIDTH * HEIGHT * 4
+
+    # Writers register their windows, so readers can find them by pid.
+    windows = [w for w in vkvfb.list_windows() if w["path"] == name]
+    assert len(windows) == 1
+    assert windows[0]["pid"] == writer.pid
+    assert (windows[0]["width"], windows[0]["height"]) == (WIDTH, HEIGHT)
+    assert vkvfb.Reader(pid=writer.pid).info()[:2] == (WIDTH, HEIGHT)
+
+    # Missing windows raise FileNotFoundError.
+    try:
+        vkvfb.Reader(name + "_missing")
+        raise AssertionError("expected FileNotFoundError")
+    except FileNotFoundError:
+        pass
+
+    # Waits without a timeout still run signal handlers, so Ctrl-C works.
+    class Interrupted(Exception):
+        pass
+
+    def interrupt(signum, stack):
+        raise Interrupted()
+
+    writer.kill()
+    writer.wait()
+    _, _, last_sequence = reader.read_into(frame)
+    signal.signal(signal.SIGALRM, interrupt)
+    signal.setitimer(signal.ITIMER_REAL, 0.2)
+    try:
+        reader.wait(last_sequence)
+        raise AssertionError("expected Interrupted")
+    except Interrupted:
+        pass
+finally:
+    writer.kill()
+    writer.wait()
+    for path in [
+        f"/dev/shm/{name}",
+        f"/dev/shm/{name}_mu",
+        f"/tmp/{name}_mu",
+        f"/dev/shm/{name}_ring",
+        f"/dev/shm/{name}_ring_mu",
+        f"/tmp/{name}_ring_mu",
+        f"/dev/shm/{name}_jpeg",
+        f"/dev/shm/{name}_jpeg_mu",
+        f"/tmp/{name}_jpeg_mu",
+    ]:
+        if os.path.exists(path):
+            os.remove(path)
+
+print("python_reader_test passed")
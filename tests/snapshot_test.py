@@ -2,7 +2,6 @@
 
 import glob
 import os
-import re
 import subprocess
 import time
 
@@ -68,53 +67,42 @@ except subprocess.TimeoutExpired:
     pass
 
 
-def find_pixbuf_path():
-    """Find a pixbuf shared memory path that matches our pixbuf pattern."""
-    pixbuf_pattern = r"0x\d+"
-    shm_dir = "/dev/shm"
-    if not os.path.exists(shm_dir):
-        return None
-    for filename in os.listdir(shm_dir):
-        if re.match(pixbuf_pattern, filename):
-            return filename
-    return None
-
-
-pixbuf_path = find_pixbuf_path()
-if not pixbuf_path:
-    print("No matching pixbuf path found in /dev/shm")
-    vkcube_process.terminate()
-    xvfb_process.terminate()
-    exit(1)
-
-print(f"Found pixbuf path: {pixbuf_path}")
-
+# The layer registers vkcube's window, so it can be found by pid instead of by
+# guessing at /dev/shm names. snapshot_vfb encodes the PNG itself.
 snapshot_exe = os.path.join(build_dir, "snapshot_vfb")
-result = subprocess.run([snapshot_exe, pixbuf_path], capture_output=True, text=True)
+result = subprocess.run(
+    [snapshot_exe, "--pid", str(vkcube_process.pid), "--output",
+     "tests/out/snapshot.png"],
+    capture_output=True,
+    text=True,
+)
 
 if result.returncode == 0:
     print("Snapshot captured successfully:")
     print(result.stdout.strip())
 
-    # Convert raw data to PNG
     try:
-        with open("tests/out/snapshot_dim.txt", "r") as f:
-            width, height = map(int, f.read().strip().split())
-
-        with open("tests/out/snapshot.raw", "rb") as f:
-            raw_data = f.read()
-
-        img = Image.frombytes("RGBA", (width, height), raw_data)
-        img.save("tests/out/snapshot.png")
-        print("Converted to PNG: tests/out/snapshot.png")
-
+        with Image.open("tests/out/snapshot.png") as img:
+            img.load()
+            print(f"Decoded PNG: {img.size[0]}x{img.size[1]} {img.mode}")
     except Exception as e:
-        print(f"Failed to convert to PNG: {e}")
+        print(f"Failed to decode PNG: {e}")
 
 else:
     print(f"Snapshot failed with return code {result.returncode}")
     if result.stderr:
         print("Error:", result.stderr.strip())
 
+# A burst saves consecutive frames, numbered from tests/out/burst_000.png.
+result = subprocess.run(
+    [snapshot_exe, "--pid", str(vkcube_process.pid), "--output",
+     "tests/out/burst.png", "--burst", "3"],
+    capture_output=True,
+    text=True,
+)
+print(result.stdout.strip())
+if result.returncode != 0:
+    print(f"Burst failed with return code {result.returncode}")
+
 vkcube_process.terminate()
 xvfb_process.terminate()
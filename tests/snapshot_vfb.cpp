@@ -14,55 +14,203 @@
  * limitations under the License.
  */
 
+// Saves a window's latest frame, or a burst of its next frames, as PNG, QOI
+// or raw RGBA files.
+//
+// A burst copies every frame out as soon as the writer publishes it, into
+// buffers allocated up front, and only encodes them once the burst is over, so
+// encoding doesn't make it miss frames. Frames are numbered by the writer, so
+// any it does miss are counted.
+
+#include <time.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <vector>
 
+#include "codec/image_encoder.h"
 #include "pixbuf/pixbuf_reader.h"
+#include "utility.h"
+
+namespace {
+
+const char* kDefaultOutput = "tests/out/snapshot";
+const uint64_t kWaitNanos = 2'000'000'000;
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s <pixbuf_path> | --pid <pid> | --name <name> "
+      "[--output <path>] [--format png|qoi|raw] [--burst <n>] "
+      "[--threads <n>] [--png-level <0-9>]\n",
+      program_name);
+  printf("  --output: Where to save the frame. Defaults to %s.<format>.\n",
+         kDefaultOutput);
+  printf("  --format: Defaults to the output's extension, or png.\n");
+  printf("  --burst: Save the next n frames, to <output>_000.<format> on.\n");
+  printf("  --threads: Threads encoding. Defaults to one per core.\n");
+  printf("  --png-level: zlib's compression level. Defaults to 1.\n");
+}
+
+// Splits 'path' into its extension, without the dot, and the rest.
+void split_extension(const std::string& path, std::string* stem,
+                     std::string* extension) {
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    *stem = path;
+    extension->clear();
+    return;
+  }
+  *stem = path.substr(0, dot);
+  *extension = path.substr(dot + 1);
+}
+
+bool write_file(const std::string& path, const std::vector<uint8_t>& data) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  size_t written = fwrite(data.data(), 1, data.size(), file);
+  return fclose(file) == 0 && written == data.size();
+}
+
+}  // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <pixbuf_path>\n", argv[0]);
-        return 1;
-    }
+  // Windows are found by path, or through the registry by pid or name.
+  StatusOr<PixbufReader> reader_result = StatusVal(ErrorCode::GENERAL);
+  int first_option = 2;
+  if (argc >= 2 && argv[1][0] != '-') {
+    reader_result = PixbufReader::Create(argv[1]);
+  } else if (argc >= 3 && strcmp(argv[1], "--pid") == 0) {
+    reader_result = PixbufReader::Open((int32_t)atoi(argv[2]));
+    first_option = 3;
+  } else if (argc >= 3 && strcmp(argv[1], "--name") == 0) {
+    reader_result = PixbufReader::Open(std::string(argv[2]));
+    first_option = 3;
+  } else {
+    print_usage(argv[0]);
+    return 1;
+  }
 
-    std::string pixbuf_path = argv[1];
+  std::string output;
+  std::string format_name;
+  int burst = 1;
+  int threads = 0;
+  int png_level = 1;
+  for (int i = first_option; i < argc; i++) {
+    if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      format_name = argv[++i];
+    } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+      burst = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--png-level") == 0 && i + 1 < argc) {
+      png_level = atoi(argv[++i]);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
 
-    StatusOr<PixbufReader> reader_result = PixbufReader::Create(pixbuf_path);
-    if (!reader_result.ok()) {
-      printf("Failed to create PixbufReader\n");
+  // The format comes from --format, then the output's extension.
+  std::string stem;
+  std::string extension;
+  split_extension(output.empty() ? kDefaultOutput : output, &stem, &extension);
+  ImageFormat format = ImageFormat::PNG;
+  if (!format_name.empty()) {
+    if (!parse_image_format(format_name, &format)) {
+      printf("Unknown format %s\n", format_name.c_str());
       return 1;
     }
-    PixbufReader reader = std::move(reader_result.value());
+  } else if (!extension.empty() && !parse_image_format(extension, &format)) {
+    printf("Unknown format %s, pass --format\n", extension.c_str());
+    return 1;
+  }
+  if (extension.empty()) {
+    extension = image_format_name(format);
+  }
+  if (burst < 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
 
-    const ReadPixbuf& result = reader.read_pixels();
-    if (result.code != ErrorCode::OK) {
+  if (!reader_result.ok()) {
+    printf("Failed to create PixbufReader\n");
+    return 1;
+  }
+  PixbufReader reader = std::move(reader_result.value());
+
+  // Buffers are allocated and faulted in before the burst starts, so copying
+  // frames out keeps up with the app. A frame that outgrows them is read
+  // again once its buffer has grown.
+  FrameInfo latest = reader.peek();
+  size_t frame_size = (size_t)std::max(latest.width, 1) *
+                      std::max(latest.height, 1) * 4;
+  std::vector<std::vector<uint8_t>> frames(burst);
+  for (std::vector<uint8_t>& frame : frames) {
+    frame.resize(frame_size);
+  }
+  std::vector<FrameInfo> infos;
+  uint64_t missed = 0;
+  for (int i = 0; i < burst; i++) {
+    if (i > 0 && !reader.wait_for_frame(infos.back().sequence, kWaitNanos)) {
+      printf("Timed out waiting for frame %d of the burst\n", i);
+      break;
+    }
+    std::vector<uint8_t>& frame = frames[i];
+    FrameInfo info = reader.read_into(frame.data(), frame.size());
+    if (info.code != ErrorCode::OK && info.width > 0 && info.height > 0) {
+      frame.resize((size_t)info.width * info.height * 4);
+      info = reader.read_into(frame.data(), frame.size());
+    }
+    if (info.code != ErrorCode::OK || info.width <= 0 || info.height <= 0) {
       printf("Failed to read pixels\n");
       return 1;
     }
+    // Only count gaps, since consecutive reads can see the same sequence.
+    const uint64_t last_sequence = infos.empty() ? 0 : infos.back().sequence;
+    if (!infos.empty() && info.sequence > last_sequence + 1) {
+      missed += info.sequence - last_sequence - 1;
+    }
+    infos.push_back(info);
+  }
 
-    int32_t width = result.width;
-    int32_t height = result.height;
-    int32_t pixels_size = width * height * 4; // Assume RGBA format
-    uint8_t* pixels = result.pixels;
-    
-    FILE* dim_file = fopen("tests/out/snapshot_dim.txt", "w");
-    if (!dim_file) {
-        printf("Failed to open tests/out/snapshot_dim.txt for writing\n");
-        return 1;
+  ImageEncoder encoder(threads, png_level);
+  std::vector<uint8_t> file;
+  const uint64_t start_nanos = now_nanos();
+  for (size_t i = 0; i < infos.size(); i++) {
+    const FrameInfo& info = infos[i];
+    std::string path = stem + "." + extension;
+    if (burst > 1) {
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), "_%03zu.", i);
+      path = stem + suffix + extension;
     }
-    fprintf(dim_file, "%d %d\n", width, height);
-    fclose(dim_file);
-    
-    FILE* raw_file = fopen("tests/out/snapshot.raw", "wb");
-    if (!raw_file) {
-        printf("Failed to open tests/out/snapshot.raw for writing\n");
-        return 1;
+    if (!encoder.encode(format, frames[i].data(), info.width, info.height,
+                        &file)) {
+      printf("Failed to encode frame %llu\n",
+             (unsigned long long)info.sequence);
+      return 1;
+    }
+    if (!write_file(path, file)) {
+      printf("Failed to write %s\n", path.c_str());
+      return 1;
     }
-    fwrite(pixels, 1, pixels_size, raw_file);
-    fclose(raw_file);
-    
-    printf("Snapshot saved: %dx%d (%d bytes)\n", width, height, pixels_size);
-    
-    return 0;
+    printf("Snapshot saved: %s %dx%d frame %llu (%zu bytes)\n", path.c_str(),
+           info.width, info.height, (unsigned long long)info.sequence,
+           file.size());
+  }
+  printf("Saved %zu frames as %s in %.1fms", infos.size(),
+         image_format_name(format), (now_nanos() - start_nanos) / 1e6);
+  if (missed) {
+    printf(", missed %llu", (unsigned long long)missed);
+  }
+  printf("\n");
+  return infos.size() == (size_t)burst ? 0 : 1;
 }
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A stand-in for an app running through the layer, for the density benchmark.
+// Publishes frames to a pixbuf with PixbufWriter at a fixed rate, with no
+// Vulkan or X server involved. Each frame starts with its write time in
+// CLOCK_MONOTONIC nanoseconds and its frame id, which latency_reader decodes
+// with --decode header. Like the layer, it also publishes a frame ring if
+// VKVFB_RING_FRAMES is set, a JPEG stream if VKVFB_JPEG_QUALITY is set, and
+// honors VKVFB_TRANSPORT and VKVFB_HUGE_PAGES.
+
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pixbuf/frame_ring.h"
+#include "pixbuf/jpeg_stream.h"
+#include "pixbuf/pixbuf_writer.h"
+#include "utility.h"
+
+namespace {
+
+void sleep_until_nanos(uint64_t nanos) {
+  timespec ts = {(time_t)(nanos / 1'000'000'000),
+                 (long)(nanos % 1'000'000'000)};
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s <name> [--width <w>] [--height <h>] [--fps <f>] "
+      "[--seconds <s>]\n",
+      program_name);
+  printf("  --fps: Frames per second to publish, or 0 to publish as fast as\n");
+  printf("         possible. Defaults to 60.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::string name = argv[1];
+  int32_t width = 1280;
+  int32_t height = 720;
+  double fps = 60;
+  double seconds = 5;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--width") == 0) {
+      width = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--height") == 0) {
+      height = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--fps") == 0) {
+      fps = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seconds") == 0) {
+      seconds = atof(argv[i + 1]);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc % 2 != 0 || width <= 0 || height <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  StatusOr<PixbufWriter> writer_result =
+      PixbufWriter::Create(name, WindowInfo(), PixbufOptions::from_env());
+  if (!writer_result.ok()) {
+    fprintf(stderr, "Failed to create pixbuf %s\n", name.c_str());
+    return 1;
+  }
+  PixbufWriter writer = std::move(writer_result.value());
+
+  std::unique_ptr<FrameRingWriter> ring;
+  RingOptions ring_options = RingOptions::from_env();
+  if (ring_options.frames > 0) {
+    StatusOr<FrameRingWriter> ring_result =
+        FrameRingWriter::Create(name, ring_options);
+    if (!ring_result.ok()) {
+      fprintf(stderr, "Failed to create frame ring %s\n", name.c_str());
+      return 1;
+    }
+    ring = std::make_unique<FrameRingWriter>(std::move(*ring_result));
+  }
+
+  // Builds without libjpeg have no stream, so carry on without one.
+  std::unique_ptr<JpegStreamWriter> jpeg;
+  JpegOptions jpeg_options = JpegOptions::from_env();
+  if (jpeg_options.quality > 0) {
+    StatusOr<JpegStreamWriter> jpeg_result =
+        JpegStreamWriter::Create(name, jpeg_options);
+    if (jpeg_result.ok()) {
+      jpeg = std::make_unique<JpegStreamWriter>(std::move(*jpeg_result));
+    } else {
+      fprintf(stderr, "Failed to create JPEG stream %s\n", name.c_str());
+    }
+  }
+
+  std::vector<uint8_t> pixels(PixbufData::pixbuf_size(width, height));
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (uint8_t)i;
+  }
+
+  // Tell the harness we're ready for readers.
+  printf("ready %s\n", name.c_str());
+  fflush(stdout);
+
+  const uint64_t frame_nanos = fps > 0 ? (uint64_t)(1e9 / fps) : 0;
+  const uint64_t start_nanos = now_nanos();
+  const uint64_t end_nanos = start_nanos + (uint64_t)(seconds * 1e9);
+  uint64_t next_nanos = start_nanos;
+  uint32_t frame_id = 0;
+  uint64_t published = 0;
+  uint64_t unpublished = 0;
+  while (now_nanos() < end_nanos) {
+    if (frame_nanos) {
+      sleep_until_nanos(next_nanos);
+      next_nanos += frame_nanos;
+    }
+    uint64_t write_nanos = now_nanos();
+    memcpy(pixels.data(), &write_nanos, sizeof(write_nanos));
+    memcpy(pixels.data() + sizeof(write_nanos), &frame_id, sizeof(frame_id));
+    if (writer.write_pixels(pixels.data(), width, height) ==
+        WriteResult::PUBLISHED) {
+      published++;
+    } else {
+      unpublished++;
+    }
+    if (ring) {
+      ring->write_pixels(pixels.data(), width, height);
+    }
+    if (jpeg) {
+      jpeg->submit(pixels.data(), width, height);
+    }
+    frame_id++;
+  }
+  printf("published %lu unpublished %lu\n", (unsigned long)published,
+         (unsigned long)unpublished);
+  return 0;
+}
@@ -16,33 +16,49 @@
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
 
 #include "pixbuf/pixbuf_reader.h"
 
-// Return epoch time in seconds.
+// How long to sleep without X events or frames before checking the title.
+const int kIdleWaitMillis = 100;
+// How long the frame thread waits for a frame before waiting again.
+const uint64_t kFrameWaitNanos = 1'000'000'000;
+
+// Return monotonic time in seconds.
 double time_sec() {
   struct timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
   return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-// Sleep for the given amount of time.
-void sleep_sec(double seconds) {
-  if (seconds > 0) {
-    struct timespec ts = {
-      (time_t)seconds,
-      (long)((seconds - (time_t)seconds) * 1e9)
-    };
-    nanosleep(&ts, nullptr);
-  }
+// Set by shm_attach_error_handler() if the X server can't attach our shm
+// segment, e.g. because it's on another host.
+bool shm_attach_failed = false;
+
+int shm_attach_error_handler(Display*, XErrorEvent*) {
+  shm_attach_failed = true;
+  return 0;
 }
 
+// Displays a pixbuf in an X11 window. Frames are copied straight from the
+// pixbuf into an MIT-SHM image, which the X server reads without the pixels
+// crossing its socket, and the window is only redrawn when the writer
+// publishes a frame or the window is exposed. A thread waits on the pixbuf's
+// futex and signals an eventfd, so the main loop sleeps on X events and
+// frames at once.
 class VfbMonitor {
  public:
   VfbMonitor(const std::string& window_id)
@@ -53,46 +69,96 @@ class VfbMonitor {
       printf("Failed to open X11 display\n");
       exit(1);
     }
-    
+
     screen_ = DefaultScreen(display_);
     root_window_ = RootWindow(display_, screen_);
-    
-    width_ = 0;
-    height_ = 0;
-    window_ = None;
-    image_ = nullptr;
-    pixels_ = nullptr;
+
+    use_shm_ = XShmQueryExtension(display_);
+    if (use_shm_) {
+      shm_completion_type_ = XShmGetEventBase(display_) + ShmCompletion;
+    } else {
+      printf("MIT-SHM unavailable, falling back to XPutImage\n");
+    }
+
+    frame_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (frame_event_fd_ < 0) {
+      printf("Failed to create eventfd\n");
+      exit(1);
+    }
   }
 
   void run() {
     printf("Starting VFB monitor for window ID: %s\n", window_id_.c_str());
-    const double frame_duration = 1.0 / 60.0; // 60 FPS in seconds
-    
+    stats_start_ = time_sec();
+
+    // The thread gets its own reader, since the main loop's may remap the
+    // pixbuf under it.
+    PixbufReader waiter =
+        std::move(PixbufReader::Create(window_id_).value_or_die());
+    std::thread([this, waiter = std::move(waiter)]() mutable {
+      wait_for_frames(waiter);
+    }).detach();
+
     while (true) {
-      double frame_start = time_sec();
-      update_frame();
+      // Xlib may have queued events while we drew, which poll() can't see.
+      const int timeout_millis = QLength(display_) ? 0 : kIdleWaitMillis;
+      pollfd fds[2] = {{ConnectionNumber(display_), POLLIN, 0},
+                       {frame_event_fd_, POLLIN, 0}};
+      poll(fds, 2, timeout_millis);
+      if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        if (read(frame_event_fd_, &count, sizeof(count)) == sizeof(count)) {
+          frame_ready_ = true;
+        }
+      }
 
-      // Keep the event queue processed.
       while (XPending(display_)) {
         XEvent event;
         XNextEvent(display_, &event);
+        if (event.type == Expose && event.xexpose.count == 0) {
+          exposed_ = true;
+        } else if (event.type == shm_completion_type_) {
+          put_pending_ = false;
+        }
+      }
+
+      // While the server is still reading the image, it can't be
+      // overwritten, so frames and exposures wait for its completion event.
+      if (!put_pending_) {
+        if (frame_ready_) {
+          frame_ready_ = false;
+          update_frame();
+        }
+        if (exposed_) {
+          put_image();
+        }
       }
-      
-      // Sleep till next read.
-      double frame_end = time_sec();
-      sleep_sec(frame_duration - (frame_end - frame_start));
+
+      update_title();
     }
   }
 
  private:
-  void create_window(int width, int height) {
-    if (window_ != None) {
-      XDestroyWindow(display_, window_);
+  // Signals frame_event_fd_ whenever 'waiter' sees a new frame.
+  void wait_for_frames(PixbufReader& waiter) {
+    uint64_t sequence = 0;
+    while (true) {
+      if (!waiter.wait_for_frame(sequence, kFrameWaitNanos)) {
+        continue;
+      }
+      sequence = waiter.peek().sequence;
+      const uint64_t one = 1;
+      if (write(frame_event_fd_, &one, sizeof(one)) != sizeof(one)) {
+        // The counter only overflows if the main loop is long gone.
+        return;
+      }
     }
-    
+  }
+
+  void create_window(int width, int height) {
     XSetWindowAttributes attrs;
     attrs.background_pixel = BlackPixel(display_, screen_);
-    attrs.event_mask = 0;
+    attrs.event_mask = ExposureMask;
 
     window_ = XCreateWindow(display_, root_window_,
                            100, 100, width, height, 0,
@@ -101,93 +167,198 @@ class VfbMonitor {
                            DefaultVisual(display_, screen_),
                            CWBackPixel | CWEventMask,
                            &attrs);
-    
+
     char title[256];
     snprintf(title, sizeof(title), "VFB Monitor - %s", window_id_.c_str());
     XStoreName(display_, window_, title);
     XMapWindow(display_, window_);
     XFlush(display_);
     gc_ = XCreateGC(display_, window_, 0, nullptr);
-    
+
     printf("Created X11 window %dx%d\n", width, height);
   }
-  
+
   void resize_window(int width, int height) {
-    if (window_ != None) {
-      XResizeWindow(display_, window_, width, height);
-      XFlush(display_);
-      printf("Resized X11 window to %dx%d\n", width, height);
+    XResizeWindow(display_, window_, width, height);
+    XFlush(display_);
+    printf("Resized X11 window to %dx%d\n", width, height);
+  }
+
+  // Creates image_ in a SysV shm segment the X server attaches to. Returns
+  // false if the segment can't be created or attached.
+  bool create_shm_image(int32_t width, int32_t height) {
+    image_ = XShmCreateImage(display_, DefaultVisual(display_, screen_),
+                             DefaultDepth(display_, screen_), ZPixmap,
+                             nullptr, &shm_info_, width, height);
+    if (!image_) {
+      return false;
+    }
+    shm_info_.shmid = shmget(IPC_PRIVATE, image_->bytes_per_line * height,
+                             IPC_CREAT | 0600);
+    if (shm_info_.shmid < 0) {
+      XDestroyImage(image_);
+      image_ = nullptr;
+      return false;
     }
+    shm_info_.shmaddr = image_->data = (char*)shmat(shm_info_.shmid, 0, 0);
+    shm_info_.readOnly = False;
+
+    shm_attach_failed = false;
+    XErrorHandler old_handler = XSetErrorHandler(shm_attach_error_handler);
+    XShmAttach(display_, &shm_info_);
+    XSync(display_, False);
+    XSetErrorHandler(old_handler);
+    // The segment is freed once both we and the server detach.
+    shmctl(shm_info_.shmid, IPC_RMID, nullptr);
+
+    if (shm_attach_failed) {
+      XDestroyImage(image_);
+      image_ = nullptr;
+      shmdt(shm_info_.shmaddr);
+      return false;
+    }
+    return true;
   }
 
-  void resize_window_and_image(int32_t width, int32_t height, uint8_t* data) {
-      if (image_) {
-        free(image_);
-      }
-      
-      if (window_ == None) {
-        create_window(width, height);
-      } else {
-        resize_window(width, height);
-      }
-      
+  void destroy_image() {
+    if (!image_) {
+      return;
+    }
+    if (use_shm_) {
+      XShmDetach(display_, &shm_info_);
+      XDestroyImage(image_);
+      shmdt(shm_info_.shmaddr);
+    } else {
+      // Frees the pixels too.
+      XDestroyImage(image_);
+    }
+    image_ = nullptr;
+  }
+
+  void resize_window_and_image(int32_t width, int32_t height) {
+    destroy_image();
+
+    if (window_ == None) {
+      create_window(width, height);
+    } else {
+      resize_window(width, height);
+    }
+
+    if (use_shm_ && !create_shm_image(width, height)) {
+      printf("Failed to attach MIT-SHM image, falling back to XPutImage\n");
+      use_shm_ = false;
+    }
+    if (!use_shm_) {
+      char* pixels = (char*)malloc((size_t)width * height * 4);
       image_ = XCreateImage(display_,
-                           DefaultVisual(display_, screen_),
-                           DefaultDepth(display_, screen_),
-                           ZPixmap, 0,
-                           reinterpret_cast<char*>(data),
-                           width, height, 32, width * 4);
-      if (!image_) {
-        printf("Failed to create XImage\n");
-        exit(1);
-      }
-      image_->byte_order = LSBFirst;
-      image_->bitmap_bit_order = LSBFirst;
+                            DefaultVisual(display_, screen_),
+                            DefaultDepth(display_, screen_),
+                            ZPixmap, 0, pixels,
+                            width, height, 32, width * 4);
+    }
+    if (!image_) {
+      printf("Failed to create XImage\n");
+      exit(1);
+    }
+    image_->byte_order = LSBFirst;
+    image_->bitmap_bit_order = LSBFirst;
+    width_ = width;
+    height_ = height;
   }
-  
-  bool update_frame() {
-    const ReadPixbuf& read = reader_.read_pixels();
-    if (read.code != ErrorCode::OK) {
-      return false;
+
+  // Copies the latest frame into image_, first resizing the window and image
+  // if the frame's size changed, and draws it.
+  void update_frame() {
+    FrameInfo info = read_into_image();
+    if (info.width <= 0 || info.height <= 0) {
+      return;
+    }
+    if (info.width != width_ || info.height != height_) {
+      resize_window_and_image(info.width, info.height);
+      info = read_into_image();
+    }
+    if (info.code != ErrorCode::OK || info.width != width_ ||
+        info.height != height_) {
+      return;
     }
 
-    int32_t width = read.width;
-    int32_t height = read.height;
-    
-    if (width <= 0 || height <= 0) {
-      return false;
+    last_sequence_ = info.sequence;
+    put_image();
+    stats_frames_++;
+  }
+
+  FrameInfo read_into_image() {
+    if (!image_) {
+      return reader_.read_into(nullptr, 0);
     }
-    if (width != width_ || height != height_) {
-      width_ = width;
-      height_ = height;
-      resize_window_and_image(width, height, read.pixels);
+    return reader_.read_into((uint8_t*)image_->data, image_->bytes_per_line,
+                             (size_t)image_->bytes_per_line * image_->height);
+  }
+
+  void put_image() {
+    if (window_ == None || !image_) {
+      return;
     }
-    if (window_ != None && image_) {
-      XPutImage(display_, window_, gc_, image_, 0, 0, 0, 0, width, height);
-      XFlush(display_);
+    exposed_ = false;
+    if (use_shm_) {
+      // Ask for a completion event, so the image isn't overwritten while the
+      // server is still reading it.
+      XShmPutImage(display_, window_, gc_, image_, 0, 0, 0, 0, width_,
+                   height_, True);
+      put_pending_ = true;
+    } else {
+      XPutImage(display_, window_, gc_, image_, 0, 0, 0, 0, width_, height_);
     }
-    
-    return true;
+    XFlush(display_);
   }
-  
-  void convert_bgra_to_rgba(uint8_t* pixels, int pixel_count) {
-    for (int i = 0; i < pixel_count; ++i) {
-      uint8_t* pixel = &pixels[i * 4];
-      std::swap(pixel[0], pixel[2]);
+
+  // Shows the frame rate and average frame time in the title, once a second.
+  void update_title() {
+    double now = time_sec();
+    double elapsed = now - stats_start_;
+    if (elapsed < 1.0 || window_ == None) {
+      return;
     }
+    double fps = stats_frames_ / elapsed;
+    double frame_ms = stats_frames_ ? elapsed * 1000.0 / stats_frames_ : 0.0;
+
+    char title[256];
+    snprintf(title, sizeof(title), "VFB Monitor - %s - %dx%d - %.1f fps "
+             "(%.2f ms)", window_id_.c_str(), width_, height_, fps, frame_ms);
+    XStoreName(display_, window_, title);
+    XFlush(display_);
+
+    stats_start_ = now;
+    stats_frames_ = 0;
   }
-  
+
   std::string window_id_;
   PixbufReader reader_;
   Display* display_;
   int screen_;
   Window root_window_;
-  Window window_;
+  Window window_ = None;
   GC gc_;
-  XImage* image_;
-  uint8_t* pixels_;
-  int32_t width_;
-  int32_t height_;
+  XImage* image_ = nullptr;
+  int32_t width_ = 0;
+  int32_t height_ = 0;
+  // The sequence number of the frame in image_.
+  uint64_t last_sequence_ = 0;
+
+  bool use_shm_ = false;
+  XShmSegmentInfo shm_info_ = {};
+  int shm_completion_type_ = -1;
+  // Whether the server hasn't finished reading image_ yet.
+  bool put_pending_ = false;
+  // Written by the frame thread whenever the writer publishes a frame.
+  int frame_event_fd_ = -1;
+  // Whether a frame or an exposure is waiting to be drawn.
+  bool frame_ready_ = false;
+  bool exposed_ = false;
+
+  // The frames drawn since stats_start_.
+  double stats_start_ = 0;
+  int stats_frames_ = 0;
 };
 
 void print_usage(const char* program_name) {
@@ -195,7 +366,9 @@ void print_usage(const char* program_name) {
   printf("  window_id: VFB window identifier (hex or decimal)\n");
   printf("\n");
   printf("This program monitors a virtual framebuffer and displays it in an X11 window.\n");
-  printf("The display updates at 60 FPS and automatically resizes when the VFB changes size.\n");
+  printf("The display is redrawn whenever the app publishes a frame, through MIT-SHM when\n");
+  printf("the X server supports it, and automatically resizes when the VFB changes size.\n");
+  printf("The window title shows the frame rate and frame time.\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -203,10 +376,10 @@ int main(int argc, char* argv[]) {
     print_usage(argv[0]);
     return 1;
   }
-  
+
   std::string window_id = argv[1];
   VfbMonitor monitor(window_id);
   monitor.run();
-  
+
   return 0;
 }
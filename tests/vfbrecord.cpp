@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Records a window's frames into a recording (see record/recording.h), which
+// RecordingReader maps for random access by frame number.
+//
+// If the window has a frame ring (VKVFB_RING_FRAMES), every frame is recorded
+// through a draining cursor. Otherwise, the latest frame is recorded every
+// time the writer publishes one, and frames published while a copy is in
+// progress are skipped.
+
+#include <signal.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include "pixbuf/frame_ring.h"
+#include "pixbuf/pixbuf_reader.h"
+#include "record/recording.h"
+#include "utility.h"
+
+namespace {
+
+const uint64_t kWaitNanos = 100'000'000;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s <window> <output> [--frames <n>] [--seconds <s>] "
+      "[--codec raw|qoi] [--buffered] [--no-ring]\n",
+      program_name);
+  printf("  Records until either limit is hit, or until interrupted.\n");
+  printf("  Frames go to <output>, and their index to <output>.idx.\n");
+  printf("  --codec: How frames are stored. qoi compresses them losslessly,\n");
+  printf("           on a thread per core. Defaults to raw.\n");
+  printf("  --buffered: Write through the page cache instead of O_DIRECT.\n");
+  printf("  --no-ring: Record the latest frame even if the window has a\n");
+  printf("             frame ring.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::string window = argv[1];
+  std::string output = argv[2];
+  uint64_t max_frames = 0;
+  double seconds = 0;
+  bool use_ring = true;
+  RecordOptions options;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      max_frames = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc &&
+               parse_codec(argv[i + 1], &options.codec)) {
+      i++;
+    } else if (strcmp(argv[i], "--buffered") == 0) {
+      options.direct_io = false;
+    } else if (strcmp(argv[i], "--no-ring") == 0) {
+      use_ring = false;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::optional<FrameRingReader> ring;
+  std::optional<PixbufReader> reader;
+  if (use_ring) {
+    StatusOr<FrameRingReader> ring_result = FrameRingReader::Create(window);
+    if (ring_result.ok()) {
+      ring.emplace(std::move(*ring_result));
+    }
+  }
+  if (!ring) {
+    StatusOr<PixbufReader> reader_result = PixbufReader::Create(window);
+    if (!reader_result.ok()) {
+      printf("Failed to open %s\n", window.c_str());
+      return 1;
+    }
+    reader.emplace(std::move(*reader_result));
+  }
+
+  StatusOr<RecordingWriter> writer_result =
+      RecordingWriter::Create(output, window, options);
+  if (!writer_result.ok()) {
+    printf("Failed to create %s\n", output.c_str());
+    return 1;
+  }
+  RecordingWriter writer = std::move(*writer_result);
+
+  signal(SIGINT, request_stop);
+  signal(SIGTERM, request_stop);
+  printf("Recording %s to %s%s\n", window.c_str(), output.c_str(),
+         ring ? " from its frame ring" : "");
+  fflush(stdout);
+
+  const uint64_t start_nanos = now_nanos();
+  const uint64_t end_nanos =
+      seconds > 0 ? start_nanos + (uint64_t)(seconds * 1e9) : UINT64_MAX;
+  int32_t width = 1;
+  int32_t height = 1;
+  uint64_t last_sequence = 0;
+  while (!stop_requested && now_nanos() < end_nanos &&
+         (max_frames == 0 || writer.frame_count() < max_frames)) {
+    if (ring ? !ring->wait_for_frame(kWaitNanos)
+             : !reader->wait_for_frame(last_sequence, kWaitNanos)) {
+      continue;
+    }
+
+    // Frames are read straight into the recording's buffers. If the frame
+    // outgrew the buffer, its size is filled in, so retry at that size.
+    FrameInfo info;
+    for (int attempt = 0; attempt < 2; attempt++) {
+      uint8_t* dst = writer.next_frame(width, height);
+      size_t capacity = (size_t)width * height * 4;
+      info = ring ? ring->read_next(dst, capacity)
+                  : reader->read_into(dst, capacity);
+      if (info.code == ErrorCode::OK || info.width <= 0 || info.height <= 0) {
+        break;
+      }
+      width = info.width;
+      height = info.height;
+    }
+    if (info.code != ErrorCode::OK || info.width <= 0 || info.height <= 0) {
+      continue;
+    }
+    // Smaller frames fit too, so the buffer is sized to this frame's size.
+    if (info.width != width || info.height != height) {
+      width = info.width;
+      height = info.height;
+      writer.next_frame(width, height);
+    }
+    last_sequence = info.sequence;
+    writer.commit_frame(info.sequence, now_nanos());
+  }
+
+  uint64_t frames = writer.frame_count();
+  StatusVal status = writer.finish();
+  double elapsed = (now_nanos() - start_nanos) / 1e9;
+  printf("Recorded %llu frames in %.2fs", (unsigned long long)frames,
+         elapsed);
+  if (ring && ring->missed()) {
+    printf(", missed %llu", (unsigned long long)ring->missed());
+  }
+  printf("\n");
+  if (!status.ok()) {
+    printf("Failed to write %s\n", output.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Streams a window's frames to consumers that can't map its shm, over a unix
+// socket or stdout (see stream/frame_server.h). For example:
+//
+//   vfbserve 0x00400001 --stdout --raw |
+//       ffmpeg -f rawvideo -pixel_format rgba -video_size 1280x720 -i - out.mp4
+//
+// Each frame is read straight into one of the server's buffers, which are
+// vmspliced to consumers. Frames are only read while some consumer is ready
+// for one, and consumers still reading a frame skip new ones.
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "pixbuf/pixbuf_reader.h"
+#include "stream/frame_server.h"
+#include "utility.h"
+
+namespace {
+
+const uint64_t kWaitNanos = 100'000'000;
+// How long to wait for busy consumers before checking for a new frame.
+const uint64_t kPumpNanos = 1'000'000;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+void print_usage(const char* program_name) {
+  printf(
+      "Usage: %s <window> --socket <path> | --stdout [--raw] [--frames <n>] "
+      "[--seconds <s>]\n",
+      program_name);
+  printf("  Streams until either limit is hit, or until interrupted.\n");
+  printf("  --socket: Serve every consumer that connects to this path.\n");
+  printf("  --stdout: Serve one consumer on stdout, until it exits.\n");
+  printf("  --raw: Send only pixels, as rgba rawvideo, with no headers.\n");
+  printf("         Frames of another size than the first are skipped.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::string window = argv[1];
+  std::string socket_path;
+  bool use_stdout = false;
+  uint64_t max_frames = 0;
+  double seconds = 0;
+  FrameServerOptions options;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (strcmp(argv[i], "--stdout") == 0) {
+      use_stdout = true;
+    } else if (strcmp(argv[i], "--raw") == 0) {
+      options.headers = false;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      max_frames = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (use_stdout == !socket_path.empty()) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Logs go to stdout, so when frames do, move the stream to its own fd and
+  // send everything else to stderr.
+  int stream_fd = -1;
+  if (use_stdout) {
+    stream_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+
+  StatusOr<PixbufReader> reader_result = PixbufReader::Create(window);
+  if (!reader_result.ok()) {
+    printf("Failed to open %s\n", window.c_str());
+    return 1;
+  }
+  PixbufReader reader = std::move(*reader_result);
+
+  StatusOr<std::unique_ptr<FrameServer>> server_result =
+      FrameServer::Create(socket_path, options);
+  if (!server_result.ok()) {
+    printf("Failed to listen on %s\n", socket_path.c_str());
+    return 1;
+  }
+  std::unique_ptr<FrameServer> server = std::move(*server_result);
+  if (use_stdout) {
+    server->add_client(stream_fd, /*owned=*/true);
+  }
+
+  // Consumers that leave are noticed by their writes failing.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, request_stop);
+  signal(SIGTERM, request_stop);
+  printf("Streaming %s to %s\n", window.c_str(),
+         use_stdout ? "stdout" : socket_path.c_str());
+  fflush(stdout);
+
+  const uint64_t start_nanos = now_nanos();
+  const uint64_t end_nanos =
+      seconds > 0 ? start_nanos + (uint64_t)(seconds * 1e9) : UINT64_MAX;
+  uint64_t last_sequence = 0;
+  // Frames published while every consumer was busy.
+  uint64_t unread = 0;
+  while (!stop_requested && now_nanos() < end_nanos &&
+         (max_frames == 0 || server->frames_committed() < max_frames)) {
+    if (use_stdout && server->client_count() == 0) {
+      break;
+    }
+    if (!server->wants_frame()) {
+      server->pump(server->sending() ? kPumpNanos : kWaitNanos);
+      continue;
+    }
+    const bool sending = server->sending();
+    if (reader.wait_for_frame(last_sequence, sending ? 0 : kWaitNanos)) {
+      FrameInfo info = reader.peek();
+      uint8_t* dst = server->next_frame(info.width, info.height);
+      if (dst) {
+        FrameInfo read = reader.read_into(
+            dst, (size_t)info.width * info.height * 4);
+        // Frames that resized since peek() are read again at their new size.
+        if (read.code == ErrorCode::OK && read.width == info.width &&
+            read.height == info.height) {
+          if (last_sequence > 0 && read.sequence > last_sequence + 1) {
+            unread += read.sequence - last_sequence - 1;
+          }
+          last_sequence = read.sequence;
+          server->commit_frame(read.sequence, now_nanos());
+        }
+      } else {
+        last_sequence = info.sequence;
+      }
+    }
+    server->pump(sending ? kPumpNanos : 0);
+  }
+
+  // Finish the frames consumers are part way through.
+  while (!stop_requested && server->sending()) {
+    server->pump(kWaitNanos);
+  }
+
+  double elapsed = (now_nanos() - start_nanos) / 1e9;
+  printf("Served %llu frames in %.2fs, consumers skipped %llu",
+         (unsigned long long)server->frames_committed(), elapsed,
+         (unsigned long long)server->frames_skipped());
+  if (unread) {
+    printf(", %llu published while all were busy",
+           (unsigned long long)unread);
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2025 William Henning
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// vkvfb-stat shows frame stats for every live vkvfb window, top style.
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "stats/frame_stats.h"
+#include "utility.h"
+
+namespace {
+
+struct Sample {
+  uint64_t counters[kNumFrameCounters] = {};
+  uint64_t latency_us[kNumFrameLatencies][kLatencyBuckets] = {};
+
+  void add(const Sample& other) {
+    for (size_t i = 0; i < kNumFrameCounters; ++i) {
+      counters[i] += other.counters[i];
+    }
+    for (size_t l = 0; l < kNumFrameLatencies; ++l) {
+      for (size_t b = 0; b < kLatencyBuckets; ++b) {
+        latency_us[l][b] += other.latency_us[l][b];
+      }
+    }
+  }
+
+  // Returns whether any counter is lower than in the given earlier sample,
+  // which happens when a window's segment is recreated and zeroed in place.
+  bool reset_since(const Sample& other) const {
+    for (size_t i = 0; i < kNumFrameCounters; ++i) {
+      if (counters[i] < other.counters[i]) {
+        return true;
+      }
+    }
+    for (size_t l = 0; l < kNumFrameLatencies; ++l) {
+      for (size_t b = 0; b < kLatencyBuckets; ++b) {
+        if (latency_us[l][b] < other.latency_us[l][b]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Returns this - other. Counters are monotonic within a segment's lifetime,
+  // so other must not be from before a reset.
+  Sample since(const Sample& other) const {
+    Sample delta;
+    for (size_t i = 0; i < kNumFrameCounters; ++i) {
+      delta.counters[i] = counters[i] - other.counters[i];
+    }
+    for (size_t l = 0; l < kNumFrameLatencies; ++l) {
+      for (size_t b = 0; b < kLatencyBuckets; ++b) {
+        delta.latency_us[l][b] = latency_us[l][b] - other.latency_us[l][b];
+      }
+    }
+    return delta;
+  }
+
+  uint64_t count(FrameCounter counter) const {
+    return counters[(size_t)counter];
+  }
+
+  // Returns the upper bound in microseconds of the bucket holding the given
+  // percentile, or 0 if there are no samples.
+  uint64_t percentile_us(FrameLatency latency, double percentile) const {
+    const uint64_t* buckets = latency_us[(size_t)latency];
+    uint64_t total = 0;
+    for (size_t b = 0; b < kLatencyBuckets; ++b) {
+      total += buckets[b];
+    }
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t target = (uint64_t)(percentile * total);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kLatencyBuckets; ++b) {
+      seen += buckets[b];
+      if (seen > target) {
+        return 1ull << b;
+      }
+    }
+    return 1ull << (kLatencyBuckets - 1);
+  }
+};
+
+struct Window {
+  std::string shm_name;
+  FrameStats stats;
+  Sample last;
+};
+
+Sample read_sample(const FrameStatsData& data) {
+  Sample sample;
+  for (size_t i = 0; i < kNumFrameCounters; ++i) {
+    sample.counters[i] =
+        data.counters[i].value.load(std::memory_order_relaxed);
+  }
+  for (size_t l = 0; l < kNumFrameLatencies; ++l) {
+    for (size_t b = 0; b < kLatencyBuckets; ++b) {
+      sample.latency_us[l][b] =
+          data.latency_us[l][b].load(std::memory_order_relaxed);
+    }
+  }
+  return sample;
+}
+
+std::vector<std::string> list_stats_segments() {
+  std::vector<std::string> names;
+  DIR* dir = opendir("/dev/shm");
+  if (!dir) {
+    return names;
+  }
+  size_t prefix_len = strlen(kFrameStatsPrefix);
+  while (dirent* entry = readdir(dir)) {
+    if (strncmp(entry->d_name, kFrameStatsPrefix, prefix_len) == 0) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  return names;
+}
+
+// Opens newly created segments and closes ones whose process exited. If gc is
+// set, also unlinks segments left behind by processes that died.
+void refresh_windows(std::map<std::string, Window>& windows, bool gc) {
+  std::map<std::string, Window> live;
+  for (const std::string& name : list_stats_segments()) {
+    auto it = windows.find(name);
+    if (it != windows.end()) {
+      if (pid_alive(it->second.stats.data()->pid)) {
+        live.emplace(name, std::move(it->second));
+      }
+      continue;
+    }
+
+    StatusOr<FrameStats> stats = FrameStats::Open(name);
+    if (!stats.ok()) {
+      continue;
+    }
+    if (!pid_alive(stats->data()->pid)) {
+      if (gc) {
+        shm_unlink(name.c_str());
+      }
+      continue;
+    }
+    Window window{name, std::move(*stats), Sample()};
+    window.last = read_sample(*window.stats.data());
+    live.emplace(name, std::move(window));
+  }
+  windows = std::move(live);
+}
+
+std::string format_us(uint64_t us) {
+  char s[16];
+  if (us == 0) {
+    snprintf(s, sizeof(s), "-");
+  } else if (us < 1000) {
+    snprintf(s, sizeof(s), "%luus", (unsigned long)us);
+  } else {
+    snprintf(s, sizeof(s), "%.1fms", us / 1000.0);
+  }
+  return s;
+}
+
+void print_row(const char* pid, const char* window, const Sample& delta,
+               double interval_sec) {
+  printf("%7s %-20.20s %7.1f %7.1f %6lu %6lu %6lu %6lu %6lu %8s %8s %8s "
+         "%8s\n",
+         pid, window, delta.count(FrameCounter::PRESENTED) / interval_sec,
+         delta.count(FrameCounter::PUBLISHED) / interval_sec,
+         (unsigned long)delta.count(FrameCounter::SUBMIT_FAILED),
+         (unsigned long)delta.count(FrameCounter::SKIPPED),
+         (unsigned long)delta.count(FrameCounter::LOCK_TIMEOUTS),
+         (unsigned long)delta.count(FrameCounter::OWNER_DEAD),
+         (unsigned long)delta.count(FrameCounter::RING_DROPS),
+         format_us(delta.percentile_us(FrameLatency::PRESENT_TO_COPY, 0.5))
+             .c_str(),
+         format_us(delta.percentile_us(FrameLatency::PRESENT_TO_COPY, 0.99))
+             .c_str(),
+         format_us(delta.percentile_us(FrameLatency::COPY_TO_PUBLISH, 0.5))
+             .c_str(),
+         format_us(delta.percentile_us(FrameLatency::COPY_TO_PUBLISH, 0.99))
+             .c_str());
+}
+
+void print_usage(const char* program_name) {
+  printf("Usage: %s [-n <seconds>] [--once] [--gc]\n", program_name);
+  printf("  -n <seconds>: Refresh interval. Defaults to 1.\n");
+  printf("  --once: Print a single sample and exit.\n");
+  printf("  --gc: Unlink stats segments left behind by dead processes.\n");
+  printf("\n");
+  printf("Shows per-window frame rates, drops and latency percentiles for\n");
+  printf("every running vkvfb process. Latencies are bucketed by powers of\n");
+  printf("two, so percentiles are upper bounds.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  double interval_sec = 1.0;
+  bool once = false;
+  bool gc = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      interval_sec = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--once") == 0) {
+      once = true;
+    } else if (strcmp(argv[i], "--gc") == 0) {
+      gc = true;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (interval_sec <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  bool clear_screen = !once && isatty(STDOUT_FILENO);
+  std::map<std::string, Window> windows;
+  refresh_windows(windows, gc);
+  while (true) {
+    timespec interval = {(time_t)interval_sec,
+                         (long)((interval_sec - (time_t)interval_sec) * 1e9)};
+    nanosleep(&interval, nullptr);
+
+    Sample total;
+    std::vector<std::pair<const Window*, Sample>> rows;
+    for (auto& [name, window] : windows) {
+      Sample now = read_sample(*window.stats.data());
+      // A reset segment counts up from zero again, so its whole sample is
+      // new.
+      Sample delta =
+          now.reset_since(window.last) ? now : now.since(window.last);
+      window.last = now;
+      total.add(delta);
+      rows.push_back({&window, delta});
+    }
+
+    if (clear_screen) {
+      printf("\033[H\033[2J");
+    }
+    printf("%7s %-20s %7s %7s %6s %6s %6s %6s %6s %8s %8s %8s %8s\n", "PID",
+           "WINDOW", "PRES/s", "PUB/s", "SUBERR", "SKIP", "LOCKTO", "ODEAD",
+           "RINGDR", "P2C p50", "P2C p99", "C2P p50", "C2P p99");
+    for (const auto& [window, delta] : rows) {
+      char pid[16];
+      snprintf(pid, sizeof(pid), "%d", window->stats.data()->pid);
+      print_row(pid, window->stats.data()->window_name, delta, interval_sec);
+    }
+    char count[32];
+    snprintf(count, sizeof(count), "%zu windows", rows.size());
+    print_row("TOTAL", count, total, interval_sec);
+    fflush(stdout);
+
+    if (once) {
+      return 0;
+    }
+    refresh_windows(windows, gc);
+  }
+}